@@ -23,12 +23,43 @@
 
 #include <assert.h>
 #include <fcntl.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <sys/ioctl.h>
 #include <sys/mman.h>
+#include <sys/syscall.h>
 #include <unistd.h>
 
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <map>
+#include <thread>
+
 #include "key_string.h"
 #include "utils.h"
 
+#if defined(__has_include)
+#if __has_include(<linux/dma-buf.h>)
+#include <linux/dma-buf.h>
+#endif
+#if __has_include(<linux/udmabuf.h>)
+#include <linux/udmabuf.h>
+#endif
+#endif
+
+// Copy from linux uapi while the toolchain headers are too old.
+#ifndef DMA_BUF_IOCTL_SYNC
+struct dma_buf_sync {
+  __u64 flags;
+};
+#define DMA_BUF_SYNC_READ (1 << 0)
+#define DMA_BUF_SYNC_WRITE (2 << 0)
+#define DMA_BUF_SYNC_START (0 << 2)
+#define DMA_BUF_SYNC_END (1 << 2)
+#define DMA_BUF_IOCTL_SYNC _IOW('b', 0, struct dma_buf_sync)
+#endif
+
 namespace easymedia {
 
 MediaBuffer::MemType StringToMemType(const char *s) {
@@ -40,6 +71,10 @@ MediaBuffer::MemType StringToMemType(const char *s) {
 #ifdef LIBDRM
     if (!strcmp(s, KEY_MEM_DRM) || !strcmp(s, KEY_MEM_HARDWARE))
       return MediaBuffer::MemType::MEM_HARD_WARE;
+#endif
+#if !defined(LIBION) && !defined(LIBDRM)
+    if (!strcmp(s, KEY_MEM_HARDWARE))
+      return MediaBuffer::MemType::MEM_HARD_WARE;
 #endif
     LOG("warning: %s is not supported or not integrated, fallback to common\n",
         s);
@@ -100,7 +135,7 @@ static int free_ion_memory(void *buffer) {
   return 0;
 }
 
-static MediaBuffer alloc_ion_memory(size_t size) {
+static MediaBuffer alloc_ion_memory(size_t size, bool cacheable) {
   ion_user_handle_t handle;
   int ret;
   int fd;
@@ -111,7 +146,8 @@ static MediaBuffer alloc_ion_memory(size_t size) {
     LOG("ion_open() failed: %m\n");
     goto err;
   }
-  ret = ion_alloc(client, size, 0, ION_HEAP_TYPE_DMA_MASK, 0, &handle);
+  ret = ion_alloc(client, size, 0, ION_HEAP_TYPE_DMA_MASK,
+                  cacheable ? ION_FLAG_CACHED : 0, &handle);
   if (ret) {
     LOG("ion_alloc() failed: %m\n");
     ion_close(client);
@@ -331,13 +367,18 @@ static int free_drm_memory(void *buffer) {
   return 0;
 }
 
-static MediaBuffer alloc_drm_memory(size_t size, bool map = true) {
+#ifndef ROCKCHIP_BO_CACHABLE
+#define ROCKCHIP_BO_CACHABLE (1 << 1)
+#endif
+
+static MediaBuffer alloc_drm_memory(size_t size, bool cacheable,
+                                    bool map = true) {
   static auto drm_dev = std::make_shared<DrmDevice>();
   DrmBuffer *db = nullptr;
   do {
     if (!drm_dev || !drm_dev->Valid())
       break;
-    db = new DrmBuffer(drm_dev, size);
+    db = new DrmBuffer(drm_dev, size, cacheable ? ROCKCHIP_BO_CACHABLE : 0);
     if (!db || !db->Valid())
       break;
     if (map && !db->MapToVirtual())
@@ -350,24 +391,483 @@ static MediaBuffer alloc_drm_memory(size_t size, bool map = true) {
 }
 #endif
 
-std::shared_ptr<MediaBuffer> MediaBuffer::Alloc(size_t size, MemType type) {
-  MediaBuffer &&mb = Alloc2(size, type);
+#if !defined(LIBION) && !defined(LIBDRM)
+// Without ion and drm, hardware memory is stood in by memfd, which is
+// exported as a dma-buf through /dev/udmabuf if the kernel supports.
+#ifndef MFD_CLOEXEC
+#define MFD_CLOEXEC 0x0001U
+#define MFD_ALLOW_SEALING 0x0002U
+#endif
+#ifndef F_ADD_SEALS
+#define F_ADD_SEALS (1024 + 9)
+#define F_SEAL_SHRINK 0x0002
+#endif
+#ifndef UDMABUF_CREATE
+struct udmabuf_create {
+  __u32 memfd;
+  __u32 flags;
+  __u64 offset;
+  __u64 size;
+};
+#define UDMABUF_FLAGS_CLOEXEC 0x01
+#define UDMABUF_CREATE _IOW('u', 0x42, struct udmabuf_create)
+#endif
+
+class MemfdBuffer {
+public:
+  MemfdBuffer() : memfd(-1), fd(-1), map_ptr(nullptr), len(0) {}
+  ~MemfdBuffer() {
+    if (map_ptr)
+      munmap(map_ptr, len);
+    if (fd >= 0 && fd != memfd)
+      close(fd);
+    if (memfd >= 0)
+      close(memfd);
+  }
+
+  int memfd;
+  int fd; // dma-buf fd, or memfd if udmabuf is not supported
+  void *map_ptr;
+  size_t len;
+};
+
+static int free_memfd_memory(void *buffer) {
+  assert(buffer);
+  delete static_cast<MemfdBuffer *>(buffer);
+  return 0;
+}
+
+static int udmabuf_device_open() {
+  static int dev_fd = open("/dev/udmabuf", O_RDWR | O_CLOEXEC);
+  return dev_fd;
+}
+
+// memfd memory is always cached
+static MediaBuffer alloc_memfd_memory(size_t size) {
+  MemfdBuffer *mb = new MemfdBuffer();
+  if (!mb)
+    return MediaBuffer();
+  do {
+    mb->len = UPALIGNTO(size, (size_t)PAGE_SIZE);
+    mb->memfd = syscall(SYS_memfd_create, "easymedia",
+                        MFD_CLOEXEC | MFD_ALLOW_SEALING);
+    if (mb->memfd < 0) {
+      LOG("memfd_create failed: %m\n");
+      break;
+    }
+    if (ftruncate(mb->memfd, mb->len) < 0) {
+      LOG("ftruncate memfd to %zu failed: %m\n", mb->len);
+      break;
+    }
+    // udmabuf requires the size of memfd never shrinks
+    if (fcntl(mb->memfd, F_ADD_SEALS, F_SEAL_SHRINK) < 0) {
+      LOG("seal memfd failed: %m\n");
+      break;
+    }
+    mb->fd = mb->memfd;
+    int dev_fd = udmabuf_device_open();
+    if (dev_fd >= 0) {
+      struct udmabuf_create create;
+      memset(&create, 0, sizeof(create));
+      create.memfd = mb->memfd;
+      create.flags = UDMABUF_FLAGS_CLOEXEC;
+      create.size = mb->len;
+      int fd = ioctl(dev_fd, UDMABUF_CREATE, &create);
+      if (fd >= 0)
+        mb->fd = fd;
+      else
+        LOG("UDMABUF_CREATE failed: %m, fallback to memfd\n");
+    }
+    void *ptr = mmap(NULL, mb->len, PROT_READ | PROT_WRITE, MAP_SHARED,
+                     mb->fd, 0);
+    if (ptr == MAP_FAILED) {
+      LOG("memfd mmap failed: %m\n");
+      break;
+    }
+    mb->map_ptr = ptr;
+    return MediaBuffer(mb->map_ptr, mb->len, mb->fd, mb, free_memfd_memory);
+  } while (false);
+  delete mb;
+  return MediaBuffer();
+}
+#endif
+
+struct MemoryOwner {
+  MemoryOwner(const std::string &n) : name(n), current(0), peak(0), count(0) {}
+  std::string name;
+  size_t current;
+  size_t peak;
+  size_t count;
+};
+
+class MemoryAccount {
+public:
+  static const int kTypeNum =
+      static_cast<int>(MediaBuffer::MemType::MEM_HARD_WARE) + 1;
+  MemoryAccount() : waiters(0) {
+    memset(stats, 0, sizeof(stats));
+    memset(timeouts, 0, sizeof(timeouts));
+  }
+  bool Reserve(MediaBuffer::MemType type, size_t size, MemoryOwner *owner);
+  void Release(MediaBuffer::MemType type, size_t size, MemoryOwner *owner);
+  void SetLimit(MediaBuffer::MemType type, size_t bytes, int timeout_ms);
+  void GetStats(MediaBuffer::MemType type, MemoryStats &s);
+  MemoryOwner *GetOwner(const std::string &name);
+  void Dump();
+
+private:
+  std::mutex mtx;
+  std::condition_variable cond;
+  int waiters;
+  MemoryStats stats[kTypeNum];
+  int timeouts[kTypeNum];
+  std::map<std::string, std::unique_ptr<MemoryOwner>> owners;
+};
+
+static MemoryAccount &GetMemoryAccount() {
+  // never destructed, buffers may be freed in static destructors
+  static MemoryAccount *account = new MemoryAccount();
+  return *account;
+}
+
+static thread_local MemoryOwner *current_owner = nullptr;
+
+bool MemoryAccount::Reserve(MediaBuffer::MemType type, size_t size,
+                            MemoryOwner *owner) {
+  int i = static_cast<int>(type);
+  std::unique_lock<std::mutex> lk(mtx);
+  MemoryStats &s = stats[i];
+  if (s.limit > 0 && size > s.limit) {
+    // never fits, do not wait
+    s.fail_times++;
+    LOG("memory type %d request %zu exceeds limit %zu (owner %s)\n", i, size,
+        s.limit, owner ? owner->name.c_str() : "null");
+    return false;
+  }
+  if (s.limit > 0 && s.current + size > s.limit) {
+    // 0 is no limit, the limit may be removed while waiting
+    auto pred = [&s, size] {
+      return s.limit == 0 || s.current + size <= s.limit;
+    };
+    bool ret = false;
+    waiters++;
+    if (timeouts[i] < 0) {
+      cond.wait(lk, pred);
+      ret = true;
+    } else if (timeouts[i] > 0) {
+      ret = cond.wait_for(lk, std::chrono::milliseconds(timeouts[i]), pred);
+    }
+    waiters--;
+    if (!ret) {
+      s.fail_times++;
+      LOG("memory type %d exceeds limit %zu (current %zu, request %zu, "
+          "owner %s)\n",
+          i, s.limit, s.current, size, owner ? owner->name.c_str() : "null");
+      return false;
+    }
+  }
+  s.current += size;
+  s.count++;
+  if (s.current > s.peak)
+    s.peak = s.current;
+  if (owner) {
+    owner->current += size;
+    owner->count++;
+    if (owner->current > owner->peak)
+      owner->peak = owner->current;
+  }
+  return true;
+}
+
+void MemoryAccount::Release(MediaBuffer::MemType type, size_t size,
+                            MemoryOwner *owner) {
+  std::lock_guard<std::mutex> lk(mtx);
+  MemoryStats &s = stats[static_cast<int>(type)];
+  s.current -= size;
+  s.count--;
+  if (owner) {
+    owner->current -= size;
+    owner->count--;
+  }
+  if (waiters > 0)
+    cond.notify_all();
+}
+
+void MemoryAccount::SetLimit(MediaBuffer::MemType type, size_t bytes,
+                             int timeout_ms) {
+  std::lock_guard<std::mutex> lk(mtx);
+  int i = static_cast<int>(type);
+  stats[i].limit = bytes;
+  timeouts[i] = timeout_ms;
+  cond.notify_all();
+}
+
+void MemoryAccount::GetStats(MediaBuffer::MemType type, MemoryStats &s) {
+  std::lock_guard<std::mutex> lk(mtx);
+  s = stats[static_cast<int>(type)];
+}
+
+MemoryOwner *MemoryAccount::GetOwner(const std::string &name) {
+  std::lock_guard<std::mutex> lk(mtx);
+  auto &owner = owners[name];
+  if (!owner)
+    owner.reset(new MemoryOwner(name));
+  return owner.get();
+}
+
+void MemoryAccount::Dump() {
+  static const char *type_names[kTypeNum] = {"common", "hardware"};
+  std::lock_guard<std::mutex> lk(mtx);
+  for (int i = 0; i < kTypeNum; i++) {
+    MemoryStats &s = stats[i];
+    LOG("memory %s: current %zu, peak %zu, count %zu, limit %zu, fail %llu\n",
+        type_names[i], s.current, s.peak, s.count, s.limit,
+        (unsigned long long)s.fail_times);
+  }
+  for (auto &p : owners) {
+    MemoryOwner *o = p.second.get();
+    LOG("  owner %s: current %zu, peak %zu, count %zu\n", o->name.c_str(),
+        o->current, o->peak, o->count);
+  }
+}
+
+void SetMemoryLimit(MediaBuffer::MemType type, size_t bytes, int timeout_ms) {
+  GetMemoryAccount().SetLimit(type, bytes, timeout_ms);
+}
+
+void GetMemoryStats(MediaBuffer::MemType type, MemoryStats &stats) {
+  GetMemoryAccount().GetStats(type, stats);
+}
+
+void DumpMemoryStats() { GetMemoryAccount().Dump(); }
+
+MemoryOwner *GetMemoryOwner(const std::string &name) {
+  return GetMemoryAccount().GetOwner(name);
+}
+
+AutoMemoryOwner::AutoMemoryOwner(MemoryOwner *owner)
+    : saved_owner(current_owner) {
+  current_owner = owner;
+}
+
+AutoMemoryOwner::~AutoMemoryOwner() { current_owner = saved_owner; }
+
+// Holds the memory, gives it back to account after freed.
+class MemoryRecord {
+public:
+  static const int kHopNum = 4;
+  MemoryRecord(std::shared_ptr<void> &mem, MediaBuffer::MemType t, size_t s,
+               MemoryOwner *o);
+  ~MemoryRecord();
+  void StartTrace(const std::shared_ptr<MemoryRecord> &sptr);
+  void TraceHolder(MemoryOwner *holder, int slot);
+  void Dump(int64_t now, int64_t min_age_ms);
+
+  // traced records list
+  MemoryRecord *prev, *next;
+  // the buffers share the record, never locked
+  std::weak_ptr<MemoryRecord> self;
+
+private:
+  std::shared_ptr<void> memory;
+  MediaBuffer::MemType type;
+  size_t size;
+  MemoryOwner *owner;
+  bool traced;
+  int64_t alloc_time; // ms
+  struct Hop {
+    std::atomic<MemoryOwner *> holder;
+    std::atomic_int slot;
+    std::atomic<int64_t> time;
+  } hops[kHopNum];
+  std::atomic_uint hop_count;
+};
+
+class BufferTrace {
+public:
+  BufferTrace() : head(nullptr), signal_pipe{-1, -1} {
+    const char *env = getenv("EASYMEDIA_BUFFER_TRACE");
+    enabled = env && atoi(env) > 0;
+  }
+  void Add(MemoryRecord *r) {
+    std::lock_guard<std::mutex> _lg(mtx);
+    r->prev = nullptr;
+    r->next = head;
+    if (head)
+      head->prev = r;
+    head = r;
+  }
+  void Remove(MemoryRecord *r) {
+    std::lock_guard<std::mutex> _lg(mtx);
+    if (r->prev)
+      r->prev->next = r->next;
+    else
+      head = r->next;
+    if (r->next)
+      r->next->prev = r->prev;
+  }
+  void Dump(int64_t min_age_ms);
+  bool InstallSignal(int signo);
+
+  std::atomic_bool enabled;
+
+private:
+  static void SignalHandler(int signo);
+  void SignalThread();
+
+  std::mutex mtx;
+  MemoryRecord *head;
+  int signal_pipe[2];
+};
+
+static BufferTrace &GetBufferTrace() {
+  // never destructed, records may be released in static destructors
+  static BufferTrace *trace = new BufferTrace();
+  return *trace;
+}
+
+MemoryRecord::MemoryRecord(std::shared_ptr<void> &mem, MediaBuffer::MemType t,
+                           size_t s, MemoryOwner *o)
+    : prev(nullptr), next(nullptr), memory(mem), type(t), size(s), owner(o),
+      traced(false), alloc_time(0), hop_count(0) {}
+
+void MemoryRecord::StartTrace(const std::shared_ptr<MemoryRecord> &sptr) {
+  BufferTrace &trace = GetBufferTrace();
+  if (!trace.enabled)
+    return;
+  self = sptr;
+  for (auto &hop : hops) {
+    hop.holder = nullptr;
+    hop.slot = -1;
+    hop.time = 0;
+  }
+  alloc_time = easymedia::gettimeofday() / 1000;
+  traced = true;
+  trace.Add(this);
+}
+
+MemoryRecord::~MemoryRecord() {
+  if (traced)
+    GetBufferTrace().Remove(this);
+  memory.reset();
+  GetMemoryAccount().Release(type, size, owner);
+}
+
+void MemoryRecord::TraceHolder(MemoryOwner *holder, int slot) {
+  if (!traced)
+    return;
+  Hop &hop = hops[hop_count++ % kHopNum];
+  hop.holder = holder;
+  hop.slot = slot;
+  hop.time = easymedia::gettimeofday() / 1000;
+}
+
+void MemoryRecord::Dump(int64_t now, int64_t min_age_ms) {
+  int64_t age = now - alloc_time;
+  if (age < min_age_ms)
+    return;
+  LOG("buffer %p: %zu bytes, type %d, owner %s, age %lld ms, holders %ld\n",
+      memory.get(), size, static_cast<int>(type),
+      owner ? owner->name.c_str() : "unknown", (long long)age,
+      self.use_count());
+  unsigned count = hop_count;
+  unsigned first = count > kHopNum ? count - kHopNum : 0;
+  for (unsigned i = first; i < count; i++) {
+    Hop &hop = hops[i % kHopNum];
+    MemoryOwner *holder = hop.holder;
+    LOG("    -> %s slot %d, %lld ms ago\n",
+        holder ? holder->name.c_str() : "unknown", (int)hop.slot,
+        (long long)(now - hop.time));
+  }
+}
+
+void BufferTrace::Dump(int64_t min_age_ms) {
+  int64_t now = easymedia::gettimeofday() / 1000;
+  int num = 0;
+  std::lock_guard<std::mutex> _lg(mtx);
+  for (MemoryRecord *r = head; r; r = r->next, num++)
+    r->Dump(now, min_age_ms);
+  LOG("%d traced buffers alive\n", num);
+}
+
+static int trace_signal_fd = -1;
+
+void BufferTrace::SignalHandler(int signo _UNUSED) {
+  char c = 0;
+  if (write(trace_signal_fd, &c, 1) < 0) {
+    // nothing can be done in signal handler
+  }
+}
+
+void BufferTrace::SignalThread() {
+  char c;
+  while (read(signal_pipe[0], &c, 1) > 0 || errno == EINTR)
+    Dump(0);
+}
+
+bool BufferTrace::InstallSignal(int signo) {
+  std::lock_guard<std::mutex> _lg(mtx);
+  if (signal_pipe[0] < 0) {
+    if (pipe2(signal_pipe, O_CLOEXEC)) {
+      LOG("pipe2 failed: %m\n");
+      return false;
+    }
+    trace_signal_fd = signal_pipe[1];
+    std::thread th(&BufferTrace::SignalThread, this);
+    th.detach();
+  }
+  struct sigaction sa;
+  memset(&sa, 0, sizeof(sa));
+  sa.sa_handler = &BufferTrace::SignalHandler;
+  sa.sa_flags = SA_RESTART;
+  sigemptyset(&sa.sa_mask);
+  if (sigaction(signo, &sa, nullptr)) {
+    LOG("sigaction %d failed: %m\n", signo);
+    return false;
+  }
+  return true;
+}
+
+void EnableBufferTrace(bool enable) { GetBufferTrace().enabled = enable; }
+
+void DumpBufferTrace(int64_t min_age_ms) {
+  GetBufferTrace().Dump(min_age_ms);
+}
+
+bool InstallBufferTraceSignal(int signo) {
+  return GetBufferTrace().InstallSignal(signo);
+}
+
+void MediaBuffer::TraceHolder(MemoryOwner *holder, int slot) {
+  if (mem_record)
+    mem_record->TraceHolder(holder, slot);
+}
+
+std::shared_ptr<MediaBuffer> MediaBuffer::Alloc(size_t size, MemType type,
+                                                uint32_t flags) {
+  MediaBuffer &&mb = Alloc2(size, type, flags);
   if (mb.GetSize() == 0)
     return nullptr;
   return std::make_shared<MediaBuffer>(mb);
 }
 
-MediaBuffer MediaBuffer::Alloc2(size_t size, MemType type) {
+static MediaBuffer alloc_memory(size_t size, MediaBuffer::MemType type,
+                                uint32_t flags) {
+  bool cacheable _UNUSED = !!(flags & MediaBuffer::kMemCacheable);
   switch (type) {
-  case MemType::MEM_COMMON:
+  case MediaBuffer::MemType::MEM_COMMON:
     return alloc_common_memory(size);
 #ifdef LIBION
-  case MemType::MEM_HARD_WARE:
-    return alloc_ion_memory(size);
+  case MediaBuffer::MemType::MEM_HARD_WARE:
+    return alloc_ion_memory(size, cacheable);
 #endif
 #ifdef LIBDRM
-  case MemType::MEM_HARD_WARE:
-    return alloc_drm_memory(size);
+  case MediaBuffer::MemType::MEM_HARD_WARE:
+    return alloc_drm_memory(size, cacheable);
+#endif
+#if !defined(LIBION) && !defined(LIBDRM)
+  case MediaBuffer::MemType::MEM_HARD_WARE:
+    return alloc_memfd_memory(size);
 #endif
   default:
     LOG("unknown memtype\n");
@@ -375,6 +875,29 @@ MediaBuffer MediaBuffer::Alloc2(size_t size, MemType type) {
   }
 }
 
+MediaBuffer MediaBuffer::Alloc2(size_t size, MemType type, uint32_t flags) {
+  MemoryAccount &account = GetMemoryAccount();
+  MemoryOwner *owner = current_owner;
+  if (!account.Reserve(type, size, owner))
+    return MediaBuffer();
+  MediaBuffer mb = alloc_memory(size, type, flags);
+  if (mb.GetSize() == 0 || !mb.userdata) {
+    account.Release(type, size, owner);
+    return mb;
+  }
+  auto record = std::make_shared<MemoryRecord>(mb.userdata, type, size, owner);
+  if (!record) {
+    account.Release(type, size, owner);
+    LOG_NO_MEMORY();
+    return MediaBuffer();
+  }
+  // userdata still points to the memory, but the record owns it
+  mb.userdata = std::shared_ptr<void>(record, mb.userdata.get());
+  mb.mem_record = record.get();
+  record->StartTrace(record);
+  return mb;
+}
+
 std::shared_ptr<MediaBuffer> MediaBuffer::Clone(MediaBuffer &src,
                                                 MemType dst_type) {
   size_t size = src.GetValidSize();
@@ -387,17 +910,414 @@ std::shared_ptr<MediaBuffer> MediaBuffer::Clone(MediaBuffer &src,
   }
   if (src.IsHwBuffer() && new_buffer->IsHwBuffer())
     LOG_TODO(); // TODO: fd -> fd by RGA
+  AutoCPUAccess src_access(&src, kCPURead);
+  AutoCPUAccess dst_access(new_buffer.get(), kCPUWrite);
   memcpy(new_buffer->GetPtr(), src.GetPtr(), size);
   new_buffer->SetValidSize(size);
   new_buffer->CopyAttribute(src);
   return new_buffer;
 }
 
+std::shared_ptr<MediaBuffer>
+MediaBuffer::Slice(const std::shared_ptr<MediaBuffer> &parent, size_t offset,
+                   size_t length) {
+  if (!parent || offset > parent->GetSize() ||
+      length > parent->GetSize() - offset) {
+    LOG("slice [%zu, +%zu) out of buffer range\n", offset, length);
+    return nullptr;
+  }
+  auto slice = std::make_shared<MediaBuffer>();
+  if (!slice) {
+    LOG_NO_MEMORY();
+    return nullptr;
+  }
+  slice->ptr = static_cast<uint8_t *>(parent->GetPtr()) + offset;
+  slice->size = length;
+  slice->fd = parent->GetFD();
+  slice->fd_offset = parent->GetFDOffset() + offset;
+  slice->valid_size = length;
+  slice->CopyAttribute(*parent);
+  // the layout of image/audio is lost after slicing, the view is raw bytes
+  if (slice->type == Type::Image || slice->type == Type::Audio)
+    slice->type = Type::None;
+  slice->userdata = parent->userdata;
+  slice->mem_record = parent->mem_record;
+  slice->slice_parent = parent;
+  return slice;
+}
+
+// new object of the final class of src, which type implies
+static std::shared_ptr<MediaBuffer>
+new_buffer_like(const std::shared_ptr<MediaBuffer> &src,
+                const MediaBuffer &mb) {
+  std::shared_ptr<MediaBuffer> ret;
+  switch (src->GetType()) {
+  case Type::Image:
+    ret = std::make_shared<ImageBuffer>(
+        mb, std::static_pointer_cast<ImageBuffer>(src)->GetImageInfo());
+    break;
+  case Type::Audio:
+    ret = std::make_shared<SampleBuffer>(
+        mb, std::static_pointer_cast<SampleBuffer>(src)->GetSampleInfo());
+    break;
+  default:
+    ret = std::make_shared<MediaBuffer>(mb);
+  }
+  if (!ret) {
+    LOG_NO_MEMORY();
+    return nullptr;
+  }
+  ret->SetValidSize(mb.GetValidSize());
+  return ret;
+}
+
+bool MediaBuffer::IsWritable(const std::shared_ptr<MediaBuffer> &buffer) {
+  if (!buffer || buffer->read_only || buffer->slice_parent)
+    return false;
+  if (buffer.use_count() > 1)
+    return false;
+  return !buffer->userdata || buffer->userdata.use_count() == 1;
+}
+
+std::shared_ptr<MediaBuffer>
+MediaBuffer::DeepCopy(const std::shared_ptr<MediaBuffer> &src,
+                      MemType dst_type) {
+  size_t size = src->GetValidSize();
+  MediaBuffer mb;
+  if (size == 0) {
+    mb.CopyAttribute(*src);
+    return new_buffer_like(src, mb);
+  }
+  if (dst_type == MemType::MEM_HARD_WARE)
+    mb = Alloc2(size, MemType::MEM_HARD_WARE);
+  if (mb.GetSize() == 0)
+    mb = Alloc2(size, MemType::MEM_COMMON);
+  if (mb.GetSize() == 0) {
+    LOG_NO_MEMORY();
+    return nullptr;
+  }
+  {
+    AutoCPUAccess src_access(src.get(), kCPURead);
+    AutoCPUAccess dst_access(&mb, kCPUWrite);
+    memcpy(mb.GetPtr(), src->GetPtr(), size);
+  }
+  mb.SetValidSize(size);
+  mb.CopyAttribute(*src);
+  return new_buffer_like(src, mb);
+}
+
+bool MediaBuffer::MakeWritable(std::shared_ptr<MediaBuffer> &buffer) {
+  if (!buffer)
+    return false;
+  if (IsWritable(buffer))
+    return true;
+  auto new_buffer = DeepCopy(buffer, buffer->IsHwBuffer()
+                                         ? MemType::MEM_HARD_WARE
+                                         : MemType::MEM_COMMON);
+  if (!new_buffer)
+    return false;
+  buffer = new_buffer;
+  return true;
+}
+
+std::shared_ptr<MediaBuffer>
+MediaBuffer::ShallowCopy(const std::shared_ptr<MediaBuffer> &src) {
+  if (!src)
+    return nullptr;
+  MediaBuffer mb(*src);
+  mb.ptr = src->GetPtr();
+  mb.slice_parent = src;
+  mb.read_only = true;
+  return new_buffer_like(src, mb);
+}
+
+bool MediaBuffer::Materialize(std::shared_ptr<MediaBuffer> &buffer) {
+  if (!buffer || !buffer->slice_parent)
+    return true;
+  auto new_buffer = DeepCopy(buffer, MemType::MEM_COMMON);
+  if (!new_buffer)
+    return false;
+  buffer = new_buffer;
+  return true;
+}
+
+size_t MediaBuffer::GetIOVec(std::vector<struct iovec> &iov) {
+  if (valid_size == 0)
+    return 0;
+  struct iovec v = {GetPtr(), valid_size};
+  iov.push_back(v);
+  return valid_size;
+}
+
+static bool dma_buf_sync(int fd, uint32_t access, __u64 flags) {
+  if (access & MediaBuffer::kCPURead)
+    flags |= DMA_BUF_SYNC_READ;
+  if (access & MediaBuffer::kCPUWrite)
+    flags |= DMA_BUF_SYNC_WRITE;
+  struct dma_buf_sync sync;
+  sync.flags = flags;
+  int ret;
+  do {
+    ret = ioctl(fd, DMA_BUF_IOCTL_SYNC, &sync);
+  } while (ret < 0 && (errno == EINTR || errno == EAGAIN));
+  if (ret < 0) {
+    // not a dma-buf, such as memfd, which is coherent
+    if (errno == ENOTTY)
+      return true;
+    LOG("DMA_BUF_IOCTL_SYNC <fd: %d> failed: %m\n", fd);
+    return false;
+  }
+  return true;
+}
+
+bool MediaBuffer::BeginCPUAccess(uint32_t access) {
+  if (fd < 0 || !access)
+    return true;
+  return dma_buf_sync(fd, access, DMA_BUF_SYNC_START);
+}
+
+bool MediaBuffer::EndCPUAccess(uint32_t access) {
+  if (fd < 0 || !access)
+    return true;
+  return dma_buf_sync(fd, access, DMA_BUF_SYNC_END);
+}
+
 void MediaBuffer::CopyAttribute(MediaBuffer &src_attr) {
   type = src_attr.GetType();
   user_flag = src_attr.GetUserFlag();
   ustimestamp = src_attr.GetUSTimeStamp();
   eof = src_attr.IsEOF();
+  side_data = src_attr.GetSideData();
+}
+
+// Pool of extension records, power-of-2 sizes from 64 bytes to 4k bytes.
+class SideDataPool {
+public:
+  static const int kClassNum = 7;
+  static const size_t kMinSize = 64;
+  static const size_t kMaxCached = 16; // per class
+  ~SideDataPool() {
+    for (auto &l : free_lists)
+      for (void *p : l)
+        free(p);
+  }
+  std::shared_ptr<void> Get(size_t size);
+
+private:
+  void Put(int index, void *p) {
+    {
+      std::lock_guard<std::mutex> _lg(mtx);
+      if (free_lists[index].size() < kMaxCached) {
+        free_lists[index].push_back(p);
+        return;
+      }
+    }
+    free(p);
+  }
+  std::mutex mtx;
+  std::vector<void *> free_lists[kClassNum];
+};
+
+std::shared_ptr<void> SideDataPool::Get(size_t size) {
+  int index = 0;
+  size_t class_size = kMinSize;
+  while (class_size < size && index < kClassNum) {
+    class_size <<= 1;
+    index++;
+  }
+  if (index >= kClassNum) {
+    void *p = malloc(size);
+    return p ? std::shared_ptr<void>(p, free) : nullptr;
+  }
+  void *p = nullptr;
+  {
+    std::lock_guard<std::mutex> _lg(mtx);
+    if (!free_lists[index].empty()) {
+      p = free_lists[index].back();
+      free_lists[index].pop_back();
+    }
+  }
+  if (!p)
+    p = malloc(class_size);
+  if (!p)
+    return nullptr;
+  return std::shared_ptr<void>(p,
+                               [this, index](void *ptr) { Put(index, ptr); });
+}
+
+static SideDataPool &GetSideDataPool() {
+  // never destructed, records may be released in static destructors
+  static SideDataPool *pool = new SideDataPool();
+  return *pool;
+}
+
+SideData::InlineEntry *SideData::FindInline(uint32_t key) {
+  for (int i = 0; i < inline_num; i++)
+    if (inlines[i].key == key)
+      return &inlines[i];
+  return nullptr;
+}
+
+SideData::Record *SideData::FindRecord(uint32_t key) {
+  for (auto &r : records)
+    if (r.key == key)
+      return &r;
+  return nullptr;
+}
+
+bool SideData::Set(uint32_t key, const void *data, size_t size) {
+  if (!data || size == 0)
+    return false;
+  if (size <= kInlineSize) {
+    InlineEntry *e = FindInline(key);
+    if (!e) {
+      if (inline_num < kInlineNum) {
+        Remove(key);
+        e = &inlines[inline_num++];
+        e->key = key;
+      }
+    }
+    if (e) {
+      e->size = size;
+      memcpy(e->data, data, size);
+      return true;
+    }
+  }
+  auto record = GetSideDataPool().Get(size);
+  if (!record) {
+    LOG_NO_MEMORY();
+    return false;
+  }
+  memcpy(record.get(), data, size);
+  return SetRecord(key, record, size);
+}
+
+bool SideData::SetRecord(uint32_t key, const std::shared_ptr<void> &record,
+                         size_t size) {
+  if (!record)
+    return false;
+  Record *r = FindRecord(key);
+  if (!r) {
+    Remove(key);
+    records.push_back(Record{key, size, record});
+    return true;
+  }
+  r->size = size;
+  r->data = record;
+  return true;
+}
+
+const void *SideData::Get(uint32_t key, size_t *size) const {
+  for (int i = 0; i < inline_num; i++) {
+    if (inlines[i].key == key) {
+      if (size)
+        *size = inlines[i].size;
+      return inlines[i].data;
+    }
+  }
+  for (auto &r : records) {
+    if (r.key == key) {
+      if (size)
+        *size = r.size;
+      return r.data.get();
+    }
+  }
+  return nullptr;
+}
+
+std::shared_ptr<void> SideData::GetRecord(uint32_t key) const {
+  for (auto &r : records)
+    if (r.key == key)
+      return r.data;
+  return nullptr;
+}
+
+void SideData::Remove(uint32_t key) {
+  for (int i = 0; i < inline_num; i++) {
+    if (inlines[i].key == key) {
+      inlines[i] = inlines[--inline_num];
+      return;
+    }
+  }
+  for (auto it = records.begin(); it != records.end(); ++it) {
+    if (it->key == key) {
+      records.erase(it);
+      return;
+    }
+  }
+}
+
+void SideData::Merge(const SideData &other, bool overwrite) {
+  for (int i = 0; i < other.inline_num; i++) {
+    const InlineEntry &e = other.inlines[i];
+    if (overwrite || !Has(e.key))
+      Set(e.key, e.data, e.size);
+  }
+  for (auto &r : other.records) {
+    if (overwrite || !Has(r.key))
+      SetRecord(r.key, r.data, r.size);
+  }
+}
+
+bool ChainBuffer::Append(const std::shared_ptr<MediaBuffer> &segment) {
+  if (!segment)
+    return false;
+  std::lock_guard<std::mutex> _lg(flat_mtx);
+  segments.push_back(segment);
+  SetSize(GetSize() + segment->GetValidSize());
+  SetValidSize(GetValidSize() + segment->GetValidSize());
+  flat.reset();
+  return true;
+}
+
+void *ChainBuffer::GetPtr() const {
+  std::lock_guard<std::mutex> _lg(flat_mtx);
+  if (segments.size() == 1)
+    return segments.front()->GetPtr();
+  if (flat)
+    return flat->GetPtr();
+  size_t total = GetValidSize();
+  if (total == 0)
+    return nullptr;
+  auto buffer = MediaBuffer::Alloc(total);
+  if (!buffer) {
+    LOG_NO_MEMORY();
+    return nullptr;
+  }
+  uint8_t *p = static_cast<uint8_t *>(buffer->GetPtr());
+  for (auto &seg : segments) {
+    AutoCPUAccess seg_access(seg.get(), kCPURead);
+    memcpy(p, seg->GetPtr(), seg->GetValidSize());
+    p += seg->GetValidSize();
+  }
+  buffer->SetValidSize(total);
+  flat = buffer;
+  return flat->GetPtr();
+}
+
+size_t ChainBuffer::GetIOVec(std::vector<struct iovec> &iov) {
+  size_t len = 0;
+  for (auto &seg : segments)
+    len += seg->GetIOVec(iov);
+  return len;
+}
+
+bool ChainBuffer::BeginCPUAccess(uint32_t access) {
+  for (size_t i = 0; i < segments.size(); i++) {
+    if (segments[i]->BeginCPUAccess(access))
+      continue;
+    while (i-- > 0)
+      segments[i]->EndCPUAccess(access);
+    return false;
+  }
+  return true;
+}
+
+bool ChainBuffer::EndCPUAccess(uint32_t access) {
+  bool ret = true;
+  for (auto &seg : segments)
+    ret &= seg->EndCPUAccess(access);
+  return ret;
 }
 
 } // namespace easymedia
@@ -25,8 +25,13 @@
 #include <stdint.h>
 #include <string.h>
 #include <sys/time.h>
+#include <sys/uio.h>
 
 #include <memory>
+#include <mutex>
+#include <string>
+#include <type_traits>
+#include <vector>
 
 #include "image.h"
 #include "media_type.h"
@@ -36,6 +41,77 @@ typedef int (*DeleteFun)(void *arg);
 
 namespace easymedia {
 
+class MemoryRecord;
+struct MemoryOwner;
+
+// Typed metadata attached to a buffer, such as roi, motion vectors,
+// nn results or osd regions. Small payloads are copied into a fixed inline
+// area, large payloads are kept in keyed extension records which are shared
+// rather than copied when the side data is copied.
+class _API SideData {
+public:
+  // well-known keys, user keys start from kUser
+  static const uint32_t kROI = 1;
+  static const uint32_t kMotionVector = 2;
+  static const uint32_t kNNResult = 3;
+  static const uint32_t kOSD = 4;
+  static const uint32_t kUser = 0x10000;
+
+  static const int kInlineNum = 4;
+  static const size_t kInlineSize = 32;
+
+  SideData() : inline_num(0) {}
+  bool Empty() const { return inline_num == 0 && records.empty(); }
+  // copy data, the extension record of large data comes from a pool
+  bool Set(uint32_t key, const void *data, size_t size);
+  // Share the record without copy. The pointer must address the size bytes
+  // of data, not the owner of them. To keep a MediaBuffer alive with its
+  // data, use the aliasing constructor:
+  //   std::shared_ptr<void>(buffer, buffer->GetPtr())
+  bool SetRecord(uint32_t key, const std::shared_ptr<void> &record,
+                 size_t size);
+  const void *Get(uint32_t key, size_t *size = nullptr) const;
+  std::shared_ptr<void> GetRecord(uint32_t key) const;
+  bool Has(uint32_t key) const { return Get(key) != nullptr; }
+  void Remove(uint32_t key);
+  void Clear() {
+    inline_num = 0;
+    records.clear();
+  }
+  // merge the entries of other, keep the existing entries if !overwrite
+  void Merge(const SideData &other, bool overwrite = false);
+
+  template <typename T> bool Set(uint32_t key, const T &value) {
+    static_assert(std::is_trivially_copyable<T>::value,
+                  "side data must be trivially copyable");
+    return Set(key, &value, sizeof(T));
+  }
+  // return nullptr if not exist or size mismatch
+  template <typename T> const T *Get(uint32_t key) const {
+    size_t size = 0;
+    const void *data = Get(key, &size);
+    return size == sizeof(T) ? static_cast<const T *>(data) : nullptr;
+  }
+
+private:
+  struct InlineEntry {
+    uint32_t key;
+    uint32_t size;
+    uint64_t data[kInlineSize / sizeof(uint64_t)];
+  };
+  struct Record {
+    uint32_t key;
+    size_t size;
+    std::shared_ptr<void> data;
+  };
+  InlineEntry *FindInline(uint32_t key);
+  Record *FindRecord(uint32_t key);
+
+  InlineEntry inlines[kInlineNum];
+  int inline_num;
+  std::vector<Record> records;
+};
+
 // wrapping existing buffer
 class _API MediaBuffer {
 public:
@@ -51,13 +127,15 @@ public:
   static const uint32_t kBuildinLibvorbisenc = (1 << 16);
 
   MediaBuffer()
-      : ptr(nullptr), size(0), fd(-1), valid_size(0), type(Type::None),
-        user_flag(0), ustimestamp(0), eof(false) {}
+      : ptr(nullptr), size(0), fd(-1), fd_offset(0), valid_size(0),
+        type(Type::None), user_flag(0), ustimestamp(0), eof(false),
+        read_only(false), mem_record(nullptr) {}
   // Set userdata and delete function if you want free resource when destrut.
   MediaBuffer(void *buffer_ptr, size_t buffer_size, int buffer_fd = -1,
               void *user_data = nullptr, DeleteFun df = nullptr)
-      : ptr(buffer_ptr), size(buffer_size), fd(buffer_fd), valid_size(0),
-        type(Type::None), user_flag(0), ustimestamp(0), eof(false) {
+      : ptr(buffer_ptr), size(buffer_size), fd(buffer_fd), fd_offset(0),
+        valid_size(0), type(Type::None), user_flag(0), ustimestamp(0),
+        eof(false), read_only(false), mem_record(nullptr) {
     SetUserData(user_data, df);
   }
   virtual ~MediaBuffer() = default;
@@ -65,7 +143,10 @@ public:
   virtual SampleFormat GetSampleFormat() const { return SAMPLE_FMT_NONE; }
   int GetFD() const { return fd; }
   void SetFD(int new_fd) { fd = new_fd; }
-  void *GetPtr() const { return ptr; }
+  // offset of ptr from the start of fd memory, non-zero for slices
+  size_t GetFDOffset() const { return fd_offset; }
+  void SetFDOffset(size_t offset) { fd_offset = offset; }
+  virtual void *GetPtr() const { return ptr; }
   void SetPtr(void *addr) { ptr = addr; }
   size_t GetSize() const { return size; }
   void SetSize(size_t s) { size = s; }
@@ -89,10 +170,15 @@ public:
   void SetTimeVal(const struct timeval &val) {
     ustimestamp = val.tv_sec * 1000000LL + val.tv_usec;
   }
+  // Append the valid data as scatter-gather segments for vectored io,
+  // return the appended length.
+  virtual size_t GetIOVec(std::vector<struct iovec> &iov);
+  SideData &GetSideData() { return side_data; }
   bool IsEOF() const { return eof; }
   void SetEOF(bool val) { eof = val; }
 
   void SetUserData(void *user_data, DeleteFun df) {
+    mem_record = nullptr;
     if (user_data) {
       if (df)
         userdata.reset(user_data, df);
@@ -102,7 +188,10 @@ public:
       userdata.reset();
     }
   }
-  void SetUserData(std::shared_ptr<void> user_data) { userdata = user_data; }
+  void SetUserData(std::shared_ptr<void> user_data) {
+    mem_record = nullptr;
+    userdata = user_data;
+  }
   std::shared_ptr<void> GetUserData() { return userdata; }
 
   void SetRelatedSPtr(const std::shared_ptr<void> &rdata, int index = -1) {
@@ -120,36 +209,131 @@ public:
 
   bool IsValid() { return valid_size > 0; }
   bool IsHwBuffer() { return fd >= 0; }
+  // Read-only buffers must never be written, such as reference frames.
+  bool IsReadOnly() const { return read_only; }
+  void SetReadOnly(bool val) { read_only = val; }
 
   enum class MemType {
     MEM_COMMON,
     MEM_HARD_WARE,
   };
-  static std::shared_ptr<MediaBuffer> Alloc(size_t size,
-                                            MemType type = MemType::MEM_COMMON);
-  static MediaBuffer Alloc2(size_t size, MemType type = MemType::MEM_COMMON);
+  // alloc flags
+  // CPU mapping of hardware memory is cached, faster for CPU readers but
+  // CPU access must be bracketed by BeginCPUAccess/EndCPUAccess.
+  static const uint32_t kMemCacheable = (1 << 0);
+  static std::shared_ptr<MediaBuffer>
+  Alloc(size_t size, MemType type = MemType::MEM_COMMON, uint32_t flags = 0);
+  static MediaBuffer Alloc2(size_t size, MemType type = MemType::MEM_COMMON,
+                            uint32_t flags = 0);
   static std::shared_ptr<MediaBuffer>
   Clone(MediaBuffer &src, MemType dst_type = MemType::MEM_COMMON);
+  // Zero-copy view of [offset, offset + length) of parent.
+  // The view shares parent's memory and fd, and holds parent alive until
+  // the view is released. The byte offset into fd is recorded in fd_offset.
+  static std::shared_ptr<MediaBuffer>
+  Slice(const std::shared_ptr<MediaBuffer> &parent, size_t offset,
+        size_t length);
+
+  // Copy-on-write helpers.
+  // A buffer is writable only if it is not read-only, not a view of another
+  // buffer and nobody else references the buffer or its memory.
+  static bool IsWritable(const std::shared_ptr<MediaBuffer> &buffer);
+  // Replace buffer with a private copy if it is not writable.
+  static bool MakeWritable(std::shared_ptr<MediaBuffer> &buffer);
+  // New buffer object of the same class sharing the memory of src and
+  // holding src alive. Its attributes and image/sample info can be modified
+  // without affecting src, but its memory is read-only.
+  static std::shared_ptr<MediaBuffer>
+  ShallowCopy(const std::shared_ptr<MediaBuffer> &src);
+  // Clone which delays copying until Materialize() is called, for example
+  // when the original hardware buffer has to be returned to its pool.
+  static std::shared_ptr<MediaBuffer>
+  LazyClone(const std::shared_ptr<MediaBuffer> &src) {
+    return ShallowCopy(src);
+  }
+  // Copy the memory of a view into private common memory and release the
+  // parent.
+  static bool Materialize(std::shared_ptr<MediaBuffer> &buffer);
+  bool IsView() const { return slice_parent != nullptr; }
+
+  // CPU access directions
+  static const uint32_t kCPURead = (1 << 0);
+  static const uint32_t kCPUWrite = (1 << 1);
+  // Synchronize the cpu caches of a dma-buf before and after the CPU touches
+  // its memory. No-ops for common memory.
+  virtual bool BeginCPUAccess(uint32_t access);
+  virtual bool EndCPUAccess(uint32_t access);
+  // Record that the buffer reaches slot of holder, for buffer trace.
+  void TraceHolder(MemoryOwner *holder, int slot);
 
 private:
   // copy attributs except buffer
   void CopyAttribute(MediaBuffer &src_attr);
+  static std::shared_ptr<MediaBuffer>
+  DeepCopy(const std::shared_ptr<MediaBuffer> &src, MemType dst_type);
 
   void *ptr; // buffer virtual address
   size_t size;
   int fd;            // buffer fd
+  size_t fd_offset;  // offset of ptr in fd
   size_t valid_size; // valid data size, less than above size
   Type type;
   uint32_t user_flag;
   int64_t ustimestamp;
   bool eof;
+  bool read_only;
+  SideData side_data;
 
   std::shared_ptr<void> userdata;
+  MemoryRecord *mem_record; // owned by userdata, if allocated by Alloc2
   std::vector<std::shared_ptr<void>> related_sptrs;
+  std::shared_ptr<MediaBuffer> slice_parent; // the buffer sliced from
 };
 
 MediaBuffer::MemType StringToMemType(const char *s);
 
+// Accounting of the memory allocated by MediaBuffer::Alloc/Alloc2.
+typedef struct {
+  size_t current; // bytes in use
+  size_t peak;    // high-water mark of current
+  size_t count;   // buffers in use
+  size_t limit;   // 0 means no limit
+  uint64_t fail_times;
+} MemoryStats;
+
+// Limit the total bytes of type. When the limit is reached, allocation
+// fails immediately if timeout_ms is 0, or waits for released memory at most
+// timeout_ms (forever if negative). A request larger than the limit fails
+// immediately.
+_API void SetMemoryLimit(MediaBuffer::MemType type, size_t bytes,
+                         int timeout_ms = 0);
+_API void GetMemoryStats(MediaBuffer::MemType type, MemoryStats &stats);
+// print the stats of each memory type and each owner
+_API void DumpMemoryStats();
+
+// Buffer trace, for finding buffers which are held too long.
+// When enabled, the memory allocated by Alloc/Alloc2 is traced with the
+// allocation owner, age, holder count and the last flows it passed.
+// The initial state comes from env EASYMEDIA_BUFFER_TRACE=1.
+_API void EnableBufferTrace(bool enable);
+// print the traced buffers older than min_age_ms
+_API void DumpBufferTrace(int64_t min_age_ms = 0);
+// dump the traced buffers when signo is received
+_API bool InstallBufferTraceSignal(int signo);
+
+// The owner which allocations are accounted to, such as a flow.
+// Owners of the same name are the same object and never freed.
+_API MemoryOwner *GetMemoryOwner(const std::string &name);
+// Account the allocations in current thread to owner during the lifetime.
+class _API AutoMemoryOwner {
+public:
+  AutoMemoryOwner(MemoryOwner *owner);
+  ~AutoMemoryOwner();
+
+private:
+  MemoryOwner *saved_owner;
+};
+
 // Audio sample buffer
 class _API SampleBuffer : public MediaBuffer {
 public:
@@ -209,6 +393,10 @@ public:
   int GetVirWidth() const { return image_info.vir_width; }
   int GetVirHeight() const { return image_info.vir_height; }
   ImageInfo &GetImageInfo() { return image_info; }
+  // the layout of planes, return the plane number
+  int GetPlaneLayout(ImagePlane planes[IMAGE_MAX_PLANES]) const {
+    return GetImagePlaneLayout(image_info, planes);
+  }
 
 private:
   void ResetValues() {
@@ -219,6 +407,46 @@ private:
   ImageInfo image_info;
 };
 
+// Scatter-gather buffer, an ordered chain of segments which are usually
+// slices of other buffers. The segments are gathered into contiguous memory
+// only when GetPtr() is called.
+class _API ChainBuffer : public MediaBuffer {
+public:
+  ChainBuffer() = default;
+  virtual ~ChainBuffer() = default;
+  bool Append(const std::shared_ptr<MediaBuffer> &segment);
+  const std::vector<std::shared_ptr<MediaBuffer>> &GetSegments() const {
+    return segments;
+  }
+  virtual void *GetPtr() const override;
+  virtual size_t GetIOVec(std::vector<struct iovec> &iov) override;
+  virtual bool BeginCPUAccess(uint32_t access) override;
+  virtual bool EndCPUAccess(uint32_t access) override;
+
+private:
+  std::vector<std::shared_ptr<MediaBuffer>> segments;
+  mutable std::mutex flat_mtx;
+  mutable std::shared_ptr<MediaBuffer> flat; // lazily gathered data
+};
+
+// Bracket the CPU access of buffer during the lifetime.
+class _API AutoCPUAccess {
+public:
+  AutoCPUAccess(MediaBuffer *buffer, uint32_t access)
+      : mb(buffer), flags(access) {
+    if (mb && !mb->BeginCPUAccess(flags))
+      mb = nullptr;
+  }
+  ~AutoCPUAccess() {
+    if (mb)
+      mb->EndCPUAccess(flags);
+  }
+
+private:
+  MediaBuffer *mb;
+  uint32_t flags;
+};
+
 } // namespace easymedia
 
 #endif // EASYMEDIA_BUFFER_H_
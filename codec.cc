@@ -115,9 +115,24 @@ const uint8_t *find_h264_startcode(const uint8_t *p, const uint8_t *end) {
   return out;
 }
 
-std::list<std::shared_ptr<MediaBuffer>>
-split_h264_separate(const uint8_t *buffer, size_t length, int64_t timestamp) {
-  std::list<std::shared_ptr<MediaBuffer>> l;
+static uint32_t h264_nal_user_flag(uint8_t nal_type) {
+  switch (nal_type) {
+  case 7:
+  case 8:
+    return MediaBuffer::kExtraIntra;
+  case 5:
+    return MediaBuffer::kIntra;
+  case 1:
+    return MediaBuffer::kPredicted;
+  default:
+    return 0;
+  }
+}
+
+// call func(offset, size, flag) for each nal unit, offset includes start code
+template <typename Func>
+static bool for_each_h264_nal(const uint8_t *buffer, size_t length,
+                              Func func) {
   const uint8_t *p = buffer;
   const uint8_t *end = p + length;
   const uint8_t *nal_start = nullptr, *nal_end = nullptr;
@@ -130,37 +145,58 @@ split_h264_separate(const uint8_t *buffer, size_t length, int64_t timestamp) {
     nal_start += start_len;
     nal_end = find_h264_startcode(nal_start, end);
     size_t size = nal_end - nal_start + start_len;
-    uint8_t nal_type = (*nal_start) & 0x1F;
-    uint32_t flag;
-    switch (nal_type) {
-    case 7:
-    case 8:
-      flag = MediaBuffer::kExtraIntra;
-      break;
-    case 5:
-      flag = MediaBuffer::kIntra;
-      break;
-    case 1:
-      flag = MediaBuffer::kPredicted;
-      break;
-    default:
-      flag = 0;
-    }
-    auto sub_buffer = MediaBuffer::Alloc(size);
-    if (!sub_buffer) {
-      LOG_NO_MEMORY(); // fatal error
-      l.clear();
-      return l;
-    }
-    memcpy(sub_buffer->GetPtr(), nal_start - start_len, size);
-    sub_buffer->SetValidSize(size);
-    sub_buffer->SetUserFlag(flag);
-    sub_buffer->SetUSTimeStamp(timestamp);
-    l.push_back(sub_buffer);
-
+    uint32_t flag = h264_nal_user_flag((*nal_start) & 0x1F);
+    if (!func(nal_start - start_len - buffer, size, flag))
+      return false;
     nal_start = nal_end;
   }
-  return std::move(l);
+  return true;
+}
+
+std::list<std::shared_ptr<MediaBuffer>>
+split_h264_separate(const uint8_t *buffer, size_t length, int64_t timestamp) {
+  std::list<std::shared_ptr<MediaBuffer>> l;
+  bool ret = for_each_h264_nal(
+      buffer, length, [&](size_t offset, size_t size, uint32_t flag) {
+        auto sub_buffer = MediaBuffer::Alloc(size);
+        if (!sub_buffer) {
+          LOG_NO_MEMORY(); // fatal error
+          return false;
+        }
+        memcpy(sub_buffer->GetPtr(), buffer + offset, size);
+        sub_buffer->SetValidSize(size);
+        sub_buffer->SetUserFlag(flag);
+        sub_buffer->SetUSTimeStamp(timestamp);
+        l.push_back(sub_buffer);
+        return true;
+      });
+  if (!ret)
+    l.clear();
+  return l;
+}
+
+std::list<std::shared_ptr<MediaBuffer>>
+split_h264_separate(const std::shared_ptr<MediaBuffer> &buffer,
+                    int64_t timestamp) {
+  std::list<std::shared_ptr<MediaBuffer>> l;
+  if (!buffer || buffer->GetValidSize() == 0)
+    return l;
+  bool ret =
+      for_each_h264_nal((const uint8_t *)buffer->GetPtr(),
+                        buffer->GetValidSize(),
+                        [&](size_t offset, size_t size, uint32_t flag) {
+                          auto sub_buffer =
+                              MediaBuffer::Slice(buffer, offset, size);
+                          if (!sub_buffer)
+                            return false;
+                          sub_buffer->SetUserFlag(flag);
+                          sub_buffer->SetUSTimeStamp(timestamp);
+                          l.push_back(sub_buffer);
+                          return true;
+                        });
+  if (!ret)
+    l.clear();
+  return l;
 }
 
 } // namespace easymedia
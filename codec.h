@@ -64,6 +64,10 @@ _API const uint8_t *find_h264_startcode(const uint8_t *p, const uint8_t *end);
 // must be h264 data
 _API std::list<std::shared_ptr<MediaBuffer>>
 split_h264_separate(const uint8_t *buffer, size_t length, int64_t timestamp);
+// zero-copy version, the separated buffers are slices of the input buffer
+_API std::list<std::shared_ptr<MediaBuffer>>
+split_h264_separate(const std::shared_ptr<MediaBuffer> &buffer,
+                    int64_t timestamp);
 
 } // namespace easymedia
 
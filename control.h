@@ -22,6 +22,7 @@
 #ifndef EASYMEDIA_CONTROL_H_
 #define EASYMEDIA_CONTROL_H_
 
+#include <stddef.h>
 #include <stdint.h>
 
 namespace easymedia {
@@ -31,6 +32,39 @@ typedef struct {
   uint64_t value;
 } DRMPropertyArg;
 
+typedef struct {
+  uint64_t written_bytes;
+  uint64_t dropped_bytes;
+  uint64_t dropped_times;
+  size_t inflight_bytes;
+  size_t peak_inflight_bytes;
+  int64_t max_write_us;      // the longest time of a Write() call
+  int error;                 // the first errno of the background writes
+  uint64_t bytes_per_second; // written bytes over the open time
+  uint64_t flush_times;      // background flushes to the storage
+  int64_t max_flush_us;
+  int64_t avg_flush_us;
+} StreamWriteStats;
+
+typedef struct {
+  int connected;
+  uint64_t sent_frames;
+  uint64_t dropped_frames; // no room in the ring or too many in flight
+  int inflight_frames;     // sent but not released by the consumer
+  size_t ring_used_bytes;
+} IpcSinkStats;
+
+typedef struct {
+  uint64_t frames;
+  uint64_t bytes;
+  uint64_t bytes_per_second; // read bytes over the running time
+  int64_t max_read_us;       // the longest read of a frame
+  int64_t avg_jitter_us;     // output time against the frame rate
+  int64_t max_jitter_us;
+  uint64_t late_frames; // later than a frame interval
+  uint64_t underruns;   // no frame read ahead when it is due
+} FileReadStats;
+
 typedef struct {
   unsigned long int sub_request;
   void *arg;
@@ -52,6 +86,16 @@ enum {
   S_CONNECTOR_PROPERTY,
   // any type
   S_STREAM_OFF,
+  // StreamWriteStats
+  G_STREAM_WRITE_STATS,
+  // IpcSinkStats
+  G_IPC_SINK_STATS,
+  // FileReadStats
+  G_FILE_READ_STATS,
+  // int64_t timestamp
+  S_CAPTURE_SEEK_TIME,
+  // uint64_t
+  G_CAPTURE_FRAME_NUM,
 };
 
 } // namespace easymedia
@@ -27,13 +27,15 @@
 
 #include "buffer.h"
 #include "key_string.h"
+#include "negotiation.h"
 #include "utils.h"
 
 namespace easymedia {
 
 class FlowCoroutine {
 public:
-  FlowCoroutine(Flow *f, Model sync_model, FunctionProcess func, float inter);
+  FlowCoroutine(Flow *f, Model sync_model, FunctionProcess func, float inter,
+                LockType in_lock, LockType out_lock);
   ~FlowCoroutine();
 
   void Bind(std::vector<int> &in, std::vector<int> &out);
@@ -44,15 +46,18 @@ private:
   void WhileRun();
   void WhileRunSleep();
   void SyncFetchInput(MediaBufferVector &in);
-  void ASyncFetchInputCommon(MediaBufferVector &in);
+  // Lock is the final type of the input queue lock
+  template <class Lock> void ASyncFetchInputCommon(MediaBufferVector &in);
   void ASyncFetchInputAtomic(MediaBufferVector &in);
+  // Lock is the policy of the down flow lists
+  template <class Lock> void SendOutputs(bool process_ret);
 
   void SendNullBufferDown(Flow::FlowMap &fm, const MediaBufferVector &in,
-                          std::list<Flow::FlowInputMap> &flows);
+                          const Flow::FlowMap::FlowList &flows);
   void SendBufferDown(Flow::FlowMap &fm, const MediaBufferVector &in,
-                      std::list<Flow::FlowInputMap> &flows, bool process_ret);
+                      const Flow::FlowMap::FlowList &flows, bool process_ret);
   void SendBufferDownFromDeque(Flow::FlowMap &fm, const MediaBufferVector &in,
-                               std::list<Flow::FlowInputMap> &flows,
+                               const Flow::FlowMap::FlowList &flows,
                                bool process_ret);
   size_t OutputHoldRelated(Flow::FlowMap &fm,
                            std::shared_ptr<MediaBuffer> &out_buffer,
@@ -61,6 +66,9 @@ private:
   Flow *flow;
   Model model;
   float interval;
+  LockType input_lock;
+  LockType output_lock;
+  MemoryOwner *mem_owner;
   std::vector<int> in_slots;
   std::vector<int> out_slots;
   std::thread *th;
@@ -69,8 +77,10 @@ private:
   MediaBufferVector in_vector;
   decltype(&FlowCoroutine::SyncFetchInput) fetch_input_func;
   decltype(&FlowCoroutine::SendBufferDown) send_down_func;
-#ifndef NDEBUG
+  decltype(&FlowCoroutine::SendOutputs<NoLock>) send_outputs_func;
 public:
+  void SetMemoryOwner(MemoryOwner *owner) { mem_owner = owner; }
+#ifndef NDEBUG
   void SetMarkName(std::string s) { name = s; }
   void SetExpectProcessTime(int time) { expect_process_time = time; }
 
@@ -79,9 +89,23 @@ public:
 #endif
 };
 
+template <>
+std::shared_ptr<const Flow::FlowMap::FlowList>
+Flow::FlowMap::GetFlows<SpinLockMutex>() {
+  AutoLock<SpinLockMutex> _al(list_mtx);
+  return flows;
+}
+
+template <>
+std::shared_ptr<const Flow::FlowMap::FlowList>
+Flow::FlowMap::GetFlows<NoLock>() {
+  return flows;
+}
+
 FlowCoroutine::FlowCoroutine(Flow *f, Model sync_model, FunctionProcess func,
-                             float inter)
-    : flow(f), model(sync_model), interval(inter), th(nullptr), th_run(func)
+                             float inter, LockType in_lock, LockType out_lock)
+    : flow(f), model(sync_model), interval(inter), input_lock(in_lock),
+      output_lock(out_lock), mem_owner(nullptr), th(nullptr), th_run(func)
 #ifndef NDEBUG
       ,
       expect_process_time(0)
@@ -110,7 +134,12 @@ bool FlowCoroutine::Start() {
   switch (model) {
   case Model::ASYNCCOMMON:
     need_thread = true;
-    fetch_input_func = &FlowCoroutine::ASyncFetchInputCommon;
+    if (input_lock == LockType::ADAPTIVE)
+      fetch_input_func =
+          &FlowCoroutine::ASyncFetchInputCommon<AdaptiveLockMutex>;
+    else
+      fetch_input_func =
+          &FlowCoroutine::ASyncFetchInputCommon<ConditionLockMutex>;
     send_down_func = &FlowCoroutine::SendBufferDownFromDeque;
     break;
   case Model::ASYNCATOMIC:
@@ -127,6 +156,10 @@ bool FlowCoroutine::Start() {
     LOG("invalid model %d\n", (int)model);
     return false;
   }
+  if (output_lock == LockType::NONE)
+    send_outputs_func = &FlowCoroutine::SendOutputs<NoLock>;
+  else
+    send_outputs_func = &FlowCoroutine::SendOutputs<SpinLockMutex>;
   in_vector.resize(in_slots.size());
   if (need_thread) {
     th = new std::thread(func, this);
@@ -153,23 +186,27 @@ void FlowCoroutine::RunOnce() {
   {
     AutoDuration ad;
 #endif
-    ret = (*th_run)(flow, in_vector);
+    {
+      AutoMemoryOwner _amo(mem_owner);
+      ret = (*th_run)(flow, in_vector);
+    }
 #ifndef NDEBUG
     if (expect_process_time > 0)
       check_consume_time(name.c_str(), expect_process_time,
                          (int)(ad.Get() / 1000));
   }
 #endif // DEBUG
+  (this->*send_outputs_func)(ret);
+  for (auto &buffer : in_vector)
+    buffer.reset();
+}
+
+template <class Lock> void FlowCoroutine::SendOutputs(bool process_ret) {
   for (int idx : out_slots) {
     auto &fm = flow->downflowmap[idx];
-    std::list<Flow::FlowInputMap> flows;
-    fm.list_mtx.read_lock();
-    flows = fm.flows;
-    fm.list_mtx.unlock();
-    (this->*send_down_func)(fm, in_vector, flows, ret);
+    auto flows = fm.GetFlows<Lock>();
+    (this->*send_down_func)(fm, in_vector, *flows, process_ret);
   }
-  for (auto &buffer : in_vector)
-    buffer.reset();
 }
 
 void FlowCoroutine::WhileRun() {
@@ -203,18 +240,22 @@ void FlowCoroutine::SyncFetchInput(MediaBufferVector &in) {
   }
 }
 
+template <class Lock>
 void FlowCoroutine::ASyncFetchInputCommon(MediaBufferVector &in) {
   for (size_t i = 0; i < in_slots.size(); i++) {
     int idx = in_slots[i];
     auto &input = flow->v_input[idx];
-    AutoLockMutex _am(input.cond_mtx);
+    Lock &lock = input.InputLock<Lock>();
+    AutoLock<Lock> _al(lock);
     auto &v = input.cached_buffers;
     if (v.empty()) {
       if (!input.fetch_block) {
         in[i] = nullptr;
         continue;
       }
-      input.cond_mtx.wait();
+      // futex based locks may wake up spuriously
+      while (v.empty() && flow->enable)
+        lock.wait();
     }
     if (!flow->enable) {
       in.assign(in_slots.size(), nullptr);
@@ -231,16 +272,17 @@ void FlowCoroutine::ASyncFetchInputAtomic(MediaBufferVector &in) {
   for (int idx : in_slots) {
     std::shared_ptr<MediaBuffer> buffer;
     auto &input = flow->v_input[idx];
-    input.spin_mtx.lock();
-    buffer = input.cached_buffer;
-    input.spin_mtx.unlock();
+    {
+      AutoLock<SpinLockMutex> _al(input.spin_mtx);
+      buffer = input.cached_buffer;
+    }
     in[i++] = buffer;
   }
 }
 
 void FlowCoroutine::SendNullBufferDown(Flow::FlowMap &fm,
                                        const MediaBufferVector &in,
-                                       std::list<Flow::FlowInputMap> &flows) {
+                                       const Flow::FlowMap::FlowList &flows) {
   std::shared_ptr<MediaBuffer> nullbuffer;
   if (fm.hold_input != HoldInputMode::NONE) {
     auto empty_result = std::make_shared<easymedia::MediaBuffer>();
@@ -253,7 +295,7 @@ void FlowCoroutine::SendNullBufferDown(Flow::FlowMap &fm,
 
 void FlowCoroutine::SendBufferDown(Flow::FlowMap &fm,
                                    const MediaBufferVector &in,
-                                   std::list<Flow::FlowInputMap> &flows,
+                                   const Flow::FlowMap::FlowList &flows,
                                    bool process_ret) {
   if (!process_ret) {
     SendNullBufferDown(fm, in, flows);
@@ -267,7 +309,7 @@ void FlowCoroutine::SendBufferDown(Flow::FlowMap &fm,
 
 void FlowCoroutine::SendBufferDownFromDeque(
     Flow::FlowMap &fm, const MediaBufferVector &in,
-    std::list<Flow::FlowInputMap> &flows, bool process_ret) {
+    const Flow::FlowMap::FlowList &flows, bool process_ret) {
   if (!process_ret) {
     SendNullBufferDown(fm, in, flows);
     return;
@@ -307,10 +349,10 @@ Flow::~Flow() { StopAllThread(); }
 
 void Flow::StopAllThread() {
   for (auto &in : v_input) {
-    AutoLockMutex _alm(in.cond_mtx);
+    AutoLockMutex _alm(*in.cond_mtx);
     enable = false;
     quit = true;
-    in.cond_mtx.notify();
+    in.cond_mtx->notify();
   }
   for (auto &coroutine : coroutines)
     coroutine.reset();
@@ -333,7 +375,7 @@ static bool check_slots(std::vector<int> &slots, const char *debugstr) {
   return true;
 }
 
-Flow::FlowMap::FlowMap(FlowMap &&fm) {
+Flow::FlowMap::FlowMap(FlowMap &&fm) : FlowMap() {
   if (fm.valid) {
     LOG("Flow::FlowMap is not copyable and moveable after inited\n");
     assert(0);
@@ -359,7 +401,7 @@ void Flow::FlowMap::SetOutputToQueueBehavior(
   cached_buffers.push_back(output);
 }
 
-Flow::Input::Input(Input &&in) {
+Flow::Input::Input(Input &&in) : Input() {
   if (in.valid) {
     LOG("Flow::Input is not copyable and moveable after inited\n");
     assert(0);
@@ -367,9 +409,14 @@ Flow::Input::Input(Input &&in) {
 }
 
 void Flow::Input::Init(Flow *f, Model m, int mcn, InputMode im, bool f_block,
-                       std::shared_ptr<FlowCoroutine> fc) {
+                       std::shared_ptr<FlowCoroutine> fc, LockType lt) {
   assert(!valid);
   valid = true;
+  // cond_mtx is a ConditionLockMutex unless the adaptive lock is selected,
+  // the queue behaviors are instantiated on the matching type
+  bool adaptive = (lt == LockType::ADAPTIVE);
+  if (adaptive)
+    cond_mtx.reset(NewWaitableLockMutex(lt));
   flow = f;
   thread_model = m;
   fetch_block = f_block;
@@ -377,7 +424,9 @@ void Flow::Input::Init(Flow *f, Model m, int mcn, InputMode im, bool f_block,
   mode_when_full = im;
   switch (m) {
   case Model::ASYNCCOMMON:
-    send_input_behavior = &Input::ASyncSendInputCommonBehavior;
+    send_input_behavior =
+        adaptive ? &Input::ASyncSendInputCommonBehavior<AdaptiveLockMutex>
+                 : &Input::ASyncSendInputCommonBehavior<ConditionLockMutex>;
     break;
   case Model::ASYNCATOMIC:
     send_input_behavior = &Input::ASyncSendInputAtomicBehavior;
@@ -391,7 +440,9 @@ void Flow::Input::Init(Flow *f, Model m, int mcn, InputMode im, bool f_block,
   }
   switch (im) {
   case InputMode::BLOCKING:
-    async_full_behavior = &Input::ASyncFullBlockingBehavior;
+    async_full_behavior =
+        adaptive ? &Input::ASyncFullBlockingBehavior<AdaptiveLockMutex>
+                 : &Input::ASyncFullBlockingBehavior<ConditionLockMutex>;
     break;
   case InputMode::DROPFRONT:
     async_full_behavior = &Input::ASyncFullDropFrontBehavior;
@@ -462,12 +513,15 @@ bool Flow::InstallSlotMap(SlotMap &map, const std::string &mark,
     return false;
 
   auto c = std::make_shared<FlowCoroutine>(this, map.thread_model, map.process,
-                                           map.interval);
+                                           map.interval, map.input_lock,
+                                           map.output_lock);
   if (!c) {
     errno = ENOMEM;
     return false;
   }
   c->Bind(in_slots, out_slots);
+  MemoryOwner *owner = GetMemoryOwner(mark);
+  c->SetMemoryOwner(owner);
   coroutines.push_back(c);
   if (!in_slots.empty()) {
     int max_idx = in_slots[in_slots.size() - 1];
@@ -482,7 +536,11 @@ bool Flow::InstallSlotMap(SlotMap &map, const std::string &mark,
           (map.thread_model == Model::ASYNCCOMMON && map.fetch_block.size() > i)
               ? map.fetch_block[i]
               : true,
-          c);
+          c, map.input_lock);
+      v_input[in_slots[i]].mem_owner = owner;
+      std::string lock_name = mark + ".input" + std::to_string(in_slots[i]);
+      v_input[in_slots[i]].cond_mtx->SetName(lock_name);
+      v_input[in_slots[i]].spin_mtx.SetName(lock_name + ".atomic");
       input_slot_num++;
     }
   }
@@ -494,6 +552,8 @@ bool Flow::InstallSlotMap(SlotMap &map, const std::string &mark,
       downflowmap[out_slots[i]].Init(
           map.thread_model,
           map.hold_input.size() > i ? map.hold_input[i] : HoldInputMode::NONE);
+      downflowmap[out_slots[i]].list_mtx.SetName(
+          mark + ".output" + std::to_string(out_slots[i]));
       out_slot_num++;
     }
   }
@@ -509,20 +569,30 @@ bool Flow::InstallSlotMap(SlotMap &map, const std::string &mark,
 }
 
 void Flow::FlowMap::AddFlow(std::shared_ptr<Flow> flow, int index) {
-  AutoLockMutex _lg(list_mtx);
-  auto i = std::find(flows.begin(), flows.end(), flow);
-  if (i != flows.end()) {
+  std::lock_guard<std::mutex> _lg(update_mtx);
+  auto new_flows = std::make_shared<FlowList>(*flows);
+  auto i = std::find(new_flows->begin(), new_flows->end(), flow);
+  if (i != new_flows->end()) {
     LOG("repeatedly add, update index\n");
     i->index_of_in = index;
-    return;
+  } else {
+    // TODO: sort by sync type in downflow
+    new_flows->emplace_back(flow, index);
   }
-  // TODO: sort by sync type in downflow
-  flows.emplace_back(flow, index);
+  AutoLock<SpinLockMutex> _al(list_mtx);
+  flows = new_flows;
 }
 
 void Flow::FlowMap::RemoveFlow(std::shared_ptr<Flow> flow) {
-  AutoLockMutex _lg(list_mtx);
-  flows.remove_if([&flow](FlowInputMap &fm) { return fm == flow; });
+  std::lock_guard<std::mutex> _lg(update_mtx);
+  auto new_flows = std::make_shared<FlowList>(*flows);
+  new_flows->erase(std::remove_if(new_flows->begin(), new_flows->end(),
+                                  [&flow](FlowInputMap &fm) {
+                                    return fm == flow;
+                                  }),
+                   new_flows->end());
+  AutoLock<SpinLockMutex> _al(list_mtx);
+  flows = new_flows;
 }
 
 bool Flow::AddDownFlow(std::shared_ptr<Flow> down, int out_slot_index,
@@ -539,7 +609,41 @@ bool Flow::AddDownFlow(std::shared_ptr<Flow> down, int out_slot_index,
     LOG("can not set self loop flow\n");
     return false;
   }
-  downflowmap[out_slot_index].AddFlow(down, in_slot_index_of_down);
+  if (!down) {
+    LOG("null down flow\n");
+    return false;
+  }
+  auto report = std::make_shared<LinkReport>();
+  if (!report) {
+    LOG_NO_MEMORY();
+    return false;
+  }
+  report->up = this;
+  report->down = down.get();
+  report->out_slot = out_slot_index;
+  report->in_slot = in_slot_index_of_down;
+  if (!NegotiateLink(output_caps, down->input_caps, *report)) {
+    LOG("incompatible down flow, output caps [%s] vs input caps [%s]\n",
+        output_caps.ToString().c_str(), down->input_caps.ToString().c_str());
+    return false;
+  }
+  std::shared_ptr<Flow> next = down;
+  int next_in_slot = in_slot_index_of_down;
+  auto &converters = report->converters;
+  for (auto it = converters.rbegin(); it != converters.rend(); ++it) {
+    if (!(*it)->AddDownFlow(next, 0, next_in_slot)) {
+      // unlink the converters linked so far, each from its down flow
+      for (auto done = converters.rbegin(); done != it; ++done)
+        (*done)->RemoveDownFlow(done == converters.rbegin() ? down
+                                                            : *(done - 1));
+      return false;
+    }
+    next = *it;
+    next_in_slot = 0;
+  }
+  LOGD("%s\n", report->ToString().c_str());
+  links.push_back(report);
+  downflowmap[out_slot_index].AddFlow(next, next_in_slot);
   if (source_start_cond_mtx) {
     source_start_cond_mtx->lock();
     down_flow_num++;
@@ -549,15 +653,38 @@ bool Flow::AddDownFlow(std::shared_ptr<Flow> down, int out_slot_index,
   return true;
 }
 
+void Flow::LimitDataTypes(const MediaTypeSet &in, const MediaTypeSet &out) {
+  input_caps.types = input_caps.types.Intersection(in);
+  output_caps.types = output_caps.types.Intersection(out);
+}
+
+void Flow::LimitCaps(const FlowCaps &in, const FlowCaps &out) {
+  input_caps = input_caps.Intersection(in);
+  output_caps = output_caps.Intersection(out);
+}
+
 void Flow::RemoveDownFlow(std::shared_ptr<Flow> down) {
   if (out_slot_num <= 0 || (int)downflowmap.size() != out_slot_num)
     return;
   // if (down->down_flow_num > 0)
   //   LOG("the removing flow has down flows, remove them first\n");
+  // down flow may be linked through inserted converters
+  std::vector<std::shared_ptr<Flow>> heads;
+  for (auto it = links.begin(); it != links.end();) {
+    if ((*it)->down != down.get()) {
+      ++it;
+      continue;
+    }
+    if (!(*it)->converters.empty())
+      heads.push_back((*it)->converters.front());
+    it = links.erase(it);
+  }
   for (auto &dm : downflowmap) {
     if (!dm.valid)
       continue;
     dm.RemoveFlow(down);
+    for (auto &head : heads)
+      dm.RemoveFlow(head);
     if (source_start_cond_mtx) {
       source_start_cond_mtx->lock();
       down_flow_num--;
@@ -576,6 +703,8 @@ void Flow::SendInput(std::shared_ptr<MediaBuffer> &input, int in_slot_index) {
 #endif
   if (enable) {
     auto &in = v_input[in_slot_index];
+    if (input)
+      input->TraceHolder(in.mem_owner, in_slot_index);
     CALL_MEMBER_FN(in, in.send_input_behavior)(input);
   }
 }
@@ -617,33 +746,37 @@ void Flow::Input::SyncSendInputBehavior(std::shared_ptr<MediaBuffer> &input) {
   coroutine->RunOnce();
 }
 
+template <class Lock>
 void Flow::Input::ASyncSendInputCommonBehavior(
     std::shared_ptr<MediaBuffer> &input) {
-  AutoLockMutex _alm(cond_mtx);
+  Lock &lock = InputLock<Lock>();
+  AutoLock<Lock> _al(lock);
   if (max_cache_num > 0 && max_cache_num <= (int)cached_buffers.size()) {
     bool ret = (this->*async_full_behavior)(flow->enable);
     if (!ret)
       return;
   }
   cached_buffers.push_back(input);
-  cond_mtx.notify();
+  lock.notify();
 }
 
 void Flow::Input::ASyncSendInputAtomicBehavior(
     std::shared_ptr<MediaBuffer> &input) {
-  AutoLockMutex _alm(spin_mtx);
+  AutoLock<SpinLockMutex> _al(spin_mtx);
   cached_buffer = input;
 }
 
+template <class Lock>
 bool Flow::Input::ASyncFullBlockingBehavior(volatile bool &pred) {
+  Lock &lock = InputLock<Lock>();
   do {
     msleep(5);
-    cond_mtx.unlock();
+    lock.unlock();
     if (max_cache_num > (int)cached_buffers.size()) {
-      cond_mtx.lock();
+      lock.lock();
       break;
     }
-    cond_mtx.lock();
+    lock.lock();
   } while (pred);
 
   return pred;
@@ -701,6 +834,25 @@ void ParseParamToSlotMap(std::map<std::string, std::string> &params,
   }
   sm.thread_model = GetModelByString(params[KEK_THREAD_SYNC_MODEL]);
   sm.mode_when_full = GetInputModelByString(params[KEK_INPUT_MODEL]);
+  std::string &lock_str = params[KEY_INPUT_LOCK];
+  if (!lock_str.empty()) {
+    sm.input_lock = GetLockTypeByString(lock_str);
+    if (sm.input_lock != LockType::CONDITION &&
+        sm.input_lock != LockType::ADAPTIVE) {
+      LOG("warning, unknown input lock %s\n", lock_str.c_str());
+      sm.input_lock = LockType::CONDITION;
+    }
+  }
+  std::string &out_lock_str = params[KEY_OUTPUT_LOCK];
+  if (!out_lock_str.empty()) {
+    if (out_lock_str == KEY_LOCK_NONE) {
+      sm.output_lock = LockType::NONE;
+    } else if (GetLockTypeByString(out_lock_str) == LockType::SPIN) {
+      sm.output_lock = LockType::SPIN;
+    } else {
+      LOG("warning, unknown output lock %s\n", out_lock_str.c_str());
+    }
+  }
   std::string &cache_num_str = params[KEY_INPUT_CACHE_NUM];
   int cache_num = -1;
   if (!cache_num_str.empty()) {
@@ -715,8 +867,11 @@ size_t FlowOutputHoldInput(std::shared_ptr<MediaBuffer> &out_buffer,
                            const MediaBufferVector &input_vector) {
   assert(out_buffer);
   size_t i = 0;
-  for (; i < input_vector.size(); i++)
+  for (; i < input_vector.size(); i++) {
     out_buffer->SetRelatedSPtr(input_vector[i], i);
+    if (input_vector[i])
+      out_buffer->GetSideData().Merge(input_vector[i]->GetSideData());
+  }
   return i;
 }
 
@@ -729,6 +884,7 @@ size_t FlowOutputInheritFromInput(std::shared_ptr<MediaBuffer> &out_buffer,
     auto &input_vec = input_vector[i]->GetRelatedSPtrs();
     ret += input_vec.size();
     vec.insert(vec.end(), input_vec.begin(), input_vec.end());
+    out_buffer->GetSideData().Merge(input_vector[i]->GetSideData());
   }
   return ret;
 }
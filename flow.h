@@ -23,11 +23,14 @@
 #define EASYMEDIA_FLOW_H_
 
 #include "lock.h"
+#include "media_type.h"
 #include "reflector.h"
 
 #include <stdarg.h>
 
 #include <deque>
+#include <memory>
+#include <mutex>
 #include <thread>
 #include <type_traits>
 #include <vector>
@@ -45,10 +48,43 @@ DECLARE_REFLECTOR(Flow)
   DEFINE_MEDIA_CHILD_FACTORY(REAL_PRODUCT, REAL_PRODUCT::GetFlowName(),        \
                              FINAL_EXPOSE_PRODUCT, Flow)                       \
   DEFINE_MEDIA_CHILD_FACTORY_EXTRA(REAL_PRODUCT)                               \
-  DEFINE_MEDIA_NEW_PRODUCT_BY(REAL_PRODUCT, FINAL_EXPOSE_PRODUCT,              \
-                              GetError() < 0)
+  std::shared_ptr<FINAL_EXPOSE_PRODUCT> FACTORY(REAL_PRODUCT)::NewProduct(     \
+      const char *param) {                                                     \
+    auto ret = std::make_shared<REAL_PRODUCT>(param);                          \
+    if (ret && ret->GetError() < 0)                                            \
+      return nullptr;                                                          \
+    if (ret)                                                                   \
+      ret->LimitDataTypes(InputTypes(), OutputTypes());                        \
+    return ret;                                                                \
+  }
 
 class MediaBuffer;
+struct MemoryOwner;
+struct LinkReport;
+
+// What one side of a flow accepts or produces, used to negotiate links.
+struct _API FlowCaps {
+  FlowCaps()
+      : types(MediaTypeSet::Anything()), width(0), height(0), mem_types(0) {}
+  MediaTypeSet types;
+  int width; // 0 means any size
+  int height;
+  // bits of (1 << MediaBuffer::MemType), 0 means any memory
+  uint32_t mem_types;
+  bool SizeIntersects(const FlowCaps &other) const {
+    return !width || !other.width ||
+           (width == other.width && height == other.height);
+  }
+  bool MemIntersects(const FlowCaps &other) const {
+    return !mem_types || !other.mem_types || (mem_types & other.mem_types);
+  }
+  bool Intersects(const FlowCaps &other) const {
+    return types.Intersects(other.types) && SizeIntersects(other) &&
+           MemIntersects(other);
+  }
+  FlowCaps Intersection(const FlowCaps &other) const;
+  std::string ToString() const;
+};
 enum class Model { NONE, ASYNCCOMMON, ASYNCATOMIC, SYNC };
 // PushMode
 enum class InputMode { NONE, BLOCKING, DROPFRONT, DROPCURRENT };
@@ -64,7 +100,8 @@ class _API SlotMap {
 public:
   SlotMap()
       : thread_model(Model::SYNC), mode_when_full(InputMode::DROPFRONT),
-        process(nullptr), interval(16.66f) {}
+        process(nullptr), interval(16.66f), input_lock(LockType::CONDITION),
+        output_lock(LockType::SPIN) {}
   std::vector<int> input_slots;
   Model thread_model;
   InputMode mode_when_full;
@@ -75,6 +112,10 @@ public:
   std::vector<HoldInputMode> hold_input;
   FunctionProcess process;
   float interval;
+  LockType input_lock; // lock of input queue if ASYNCCOMMON
+  // lock of down flow lists, SPIN or NONE if the down flows never change
+  // while data flows
+  LockType output_lock;
 };
 
 class FlowCoroutine;
@@ -92,6 +133,18 @@ public:
   bool AddDownFlow(std::shared_ptr<Flow> down, int out_slot_index,
                    int in_slot_index_of_down);
   void RemoveDownFlow(std::shared_ptr<Flow> down);
+  // Narrow the caps this flow accepts and produces. Both are anything by
+  // default. AddDownFlow negotiates the output caps of up flow with the input
+  // caps of down flow, inserts registered converters if they do not
+  // intersect, and rejects the link if no converter path is found.
+  void LimitDataTypes(const MediaTypeSet &in, const MediaTypeSet &out);
+  void LimitCaps(const FlowCaps &in, const FlowCaps &out);
+  const FlowCaps &GetInputCaps() const { return input_caps; }
+  const FlowCaps &GetOutputCaps() const { return output_caps; }
+  // the negotiated result of each down link, see negotiation.h
+  std::vector<std::shared_ptr<LinkReport>> GetLinkReports() const {
+    return links;
+  }
 
   void SendInput(std::shared_ptr<MediaBuffer> &input, int in_slot_index);
   void SetDisable() { enable = false; }
@@ -124,9 +177,10 @@ protected:
     void SetOutputToQueueBehavior(const std::shared_ptr<MediaBuffer> &output);
 
   public:
-    FlowMap() : valid(false), hold_input(HoldInputMode::NONE) {
-      assert(list_mtx.valid);
-    }
+    typedef std::vector<FlowInputMap> FlowList;
+    FlowMap()
+        : valid(false), hold_input(HoldInputMode::NONE),
+          flows(std::make_shared<const FlowList>()) {}
     FlowMap(FlowMap &&);
     void Init(Model m, HoldInputMode hold_in);
     bool valid;
@@ -134,8 +188,15 @@ protected:
     // down flow
     void AddFlow(std::shared_ptr<Flow> flow, int index);
     void RemoveFlow(std::shared_ptr<Flow> flow);
-    std::list<FlowInputMap> flows;
-    ReadWriteLockMutex list_mtx;
+    // Snapshot of down flows for each output, not copied per hop.
+    // The list is replaced as a whole when down flows are added or removed,
+    // the new list is built under update_mtx and list_mtx only guards the
+    // swap of the pointer. Lock is the policy of SlotMap::output_lock,
+    // SpinLockMutex takes list_mtx and NoLock reads the list directly.
+    template <class Lock> std::shared_ptr<const FlowList> GetFlows();
+    std::shared_ptr<const FlowList> flows;
+    SpinLockMutex list_mtx;
+    std::mutex update_mtx;
     std::deque<std::shared_ptr<MediaBuffer>> cached_buffers; // never drop
     std::shared_ptr<MediaBuffer> cached_buffer;
     decltype(&FlowMap::SetOutputBehavior) set_output_behavior;
@@ -143,31 +204,42 @@ protected:
   class Input {
   private:
     void SyncSendInputBehavior(std::shared_ptr<MediaBuffer> &input);
+    // Lock is the final type of cond_mtx
+    template <class Lock>
     void ASyncSendInputCommonBehavior(std::shared_ptr<MediaBuffer> &input);
     void ASyncSendInputAtomicBehavior(std::shared_ptr<MediaBuffer> &input);
     // behavior when input list exceed max_cache_num
-    bool ASyncFullBlockingBehavior(volatile bool &pred);
+    template <class Lock> bool ASyncFullBlockingBehavior(volatile bool &pred);
     bool ASyncFullDropFrontBehavior(volatile bool &pred);
     bool ASyncFullDropCurrentBehavior(volatile bool &pred);
 
   public:
-    Input() : valid(false), flow(nullptr), fetch_block(true) {}
+    Input()
+        : valid(false), flow(nullptr), fetch_block(true),
+          cond_mtx(new ConditionLockMutex()), mem_owner(nullptr) {}
     Input(Input &&);
     void Init(Flow *f, Model m, int mcn, InputMode im, bool f_block,
-              std::shared_ptr<FlowCoroutine> fc);
+              std::shared_ptr<FlowCoroutine> fc,
+              LockType lt = LockType::CONDITION);
     bool valid;
     Flow *flow;
     Model thread_model;
     bool fetch_block;
     std::deque<std::shared_ptr<MediaBuffer>> cached_buffers;
-    ConditionLockMutex cond_mtx;
+    // The queue lock selected by input_lock. The hot paths are templated on
+    // its final type, see InputLock().
+    std::unique_ptr<LockMutex> cond_mtx;
+    template <class Lock> Lock &InputLock() {
+      return static_cast<Lock &>(*cond_mtx);
+    }
     int max_cache_num;
     InputMode mode_when_full;
     std::shared_ptr<MediaBuffer> cached_buffer;
     SpinLockMutex spin_mtx;
     decltype(&Input::SyncSendInputBehavior) send_input_behavior;
-    decltype(&Input::ASyncFullBlockingBehavior) async_full_behavior;
+    decltype(&Input::ASyncFullDropFrontBehavior) async_full_behavior;
     std::shared_ptr<FlowCoroutine> coroutine;
+    MemoryOwner *mem_owner; // for buffer trace
   };
 
   // Can not change the following values after initialize,
@@ -205,6 +277,9 @@ protected:
 private:
   volatile bool enable;
   volatile bool quit;
+  FlowCaps input_caps;
+  FlowCaps output_caps;
+  std::vector<std::shared_ptr<LinkReport>> links;
 
   friend class FlowCoroutine;
 
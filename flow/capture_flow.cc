@@ -0,0 +1,250 @@
+/*
+ * Copyright (C) 2017 Hertz Wang 1989wanghang@163.com
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see http://www.gnu.org/licenses
+ *
+ * Any non-GPL usage of this software or parts of this software is strictly
+ * forbidden.
+ *
+ */
+
+#include <stdarg.h>
+
+#include "buffer.h"
+#include "flow.h"
+#include "stream.h"
+#include "utils.h"
+
+namespace easymedia {
+
+// Record the input into a capture file of capture_write_stream, keeping
+// the frame boundaries, timestamps, flags and image or sample info.
+class CaptureRecorderFlow : public Flow {
+public:
+  CaptureRecorderFlow(const char *param);
+  virtual ~CaptureRecorderFlow() { StopAllThread(); }
+  static const char *GetFlowName() { return "capture_recorder"; }
+  virtual int Control(unsigned long int request, ...) final {
+    if (!stream)
+      return -1;
+    va_list vl;
+    va_start(vl, request);
+    void *arg = va_arg(vl, void *);
+    va_end(vl);
+    return stream->IoCtrl(request, arg);
+  }
+
+private:
+  static bool Record(Flow *f, MediaBufferVector &input_vector);
+
+  std::shared_ptr<Stream> stream;
+};
+
+CaptureRecorderFlow::CaptureRecorderFlow(const char *param) {
+  std::map<std::string, std::string> params;
+  if (!parse_media_param_map(param, params)) {
+    SetError(-EINVAL);
+    return;
+  }
+  std::string value;
+  CHECK_EMPTY_SETERRNO(value, params, KEY_PATH, EINVAL)
+  std::string s;
+  PARAM_STRING_APPEND(s, KEY_PATH, value);
+  stream = REFLECTOR(Stream)::Create<Stream>("capture_write_stream", s.c_str());
+  if (!stream) {
+    LOG("Fail to create capture %s\n", value.c_str());
+    SetError(-EINVAL);
+    return;
+  }
+  SlotMap sm;
+  int input_maxcachenum = 16;
+  ParseParamToSlotMap(params, sm, input_maxcachenum);
+  if (sm.thread_model == Model::NONE)
+    sm.thread_model = Model::ASYNCCOMMON;
+  if (sm.mode_when_full == InputMode::NONE)
+    sm.mode_when_full = InputMode::DROPCURRENT;
+  sm.input_slots.push_back(0);
+  sm.input_maxcachenum.push_back(input_maxcachenum);
+  sm.process = Record;
+  if (!InstallSlotMap(sm, value, -1)) {
+    SetError(-EINVAL);
+    return;
+  }
+}
+
+bool CaptureRecorderFlow::Record(Flow *f, MediaBufferVector &input_vector) {
+  CaptureRecorderFlow *flow = static_cast<CaptureRecorderFlow *>(f);
+  auto &buffer = input_vector[0];
+  if (!buffer)
+    return true;
+  return flow->stream->Write(buffer);
+}
+
+DEFINE_FLOW_FACTORY(CaptureRecorderFlow, Flow)
+const char *FACTORY(CaptureRecorderFlow)::ExpectedInputDataType() {
+  return TYPE_ANYTHING;
+}
+const char *FACTORY(CaptureRecorderFlow)::OutPutDataType() { return nullptr; }
+
+// Replay a capture file. The buffers keep their original timestamps.
+// With KEY_REALTIME=1 (default) they are sent at the pace of their
+// timestamps, otherwise as fast as the down flows take them.
+// KEY_START_TIMESTAMP starts from the intra frame of that timestamp.
+class CapturePlayerFlow : public Flow {
+public:
+  CapturePlayerFlow(const char *param);
+  virtual ~CapturePlayerFlow();
+  static const char *GetFlowName() { return "capture_player"; }
+
+private:
+  // a larger gap of timestamps is not waited for
+  static const int64_t kMaxGapUs = 5000000;
+  void ReadThreadRun();
+  // wait until the frame of timestamp ts is due, false if quit
+  bool WaitDue(int64_t ts);
+
+  std::shared_ptr<Stream> stream;
+  std::string path;
+  bool realtime;
+  int loop_time;
+  bool has_start;
+  int64_t start_timestamp;
+  bool loop;
+  std::thread *read_thread;
+  // timestamp and time of the anchor frame, the last timestamp
+  bool anchored;
+  int64_t base_ts;
+  int64_t base_time;
+  int64_t last_ts;
+};
+
+CapturePlayerFlow::CapturePlayerFlow(const char *param)
+    : realtime(true), loop_time(0), has_start(false), start_timestamp(0),
+      loop(false), read_thread(nullptr), anchored(false), base_ts(0),
+      base_time(0), last_ts(0) {
+  std::map<std::string, std::string> params;
+  if (!parse_media_param_map(param, params)) {
+    SetError(-EINVAL);
+    return;
+  }
+  std::string value;
+  CHECK_EMPTY_SETERRNO(value, params, KEY_PATH, EINVAL)
+  path = value;
+  std::string s;
+  PARAM_STRING_APPEND(s, KEY_PATH, path);
+  value = params[KEY_MEM_TYPE];
+  if (!value.empty())
+    PARAM_STRING_APPEND(s, KEY_MEM_TYPE, value);
+  stream = REFLECTOR(Stream)::Create<Stream>("capture_read_stream", s.c_str());
+  if (!stream) {
+    LOG("Fail to open capture %s\n", path.c_str());
+    SetError(-EINVAL);
+    return;
+  }
+  value = params[KEY_REALTIME];
+  if (!value.empty())
+    realtime = !!std::stoi(value);
+  value = params[KEY_LOOP_TIME];
+  if (!value.empty())
+    loop_time = std::stoi(value);
+  value = params[KEY_START_TIMESTAMP];
+  if (!value.empty()) {
+    has_start = true;
+    start_timestamp = std::stoll(value);
+  }
+  if (!SetAsSource(std::vector<int>({0}), std::vector<int>({0}),
+                   void_transaction00, path)) {
+    SetError(-EINVAL);
+    return;
+  }
+  loop = true;
+  read_thread = new std::thread(&CapturePlayerFlow::ReadThreadRun, this);
+  if (!read_thread) {
+    loop = false;
+    SetError(-EINVAL);
+  }
+}
+
+CapturePlayerFlow::~CapturePlayerFlow() {
+  loop = false;
+  StopAllThread();
+  if (read_thread) {
+    source_start_cond_mtx->lock();
+    loop = false;
+    source_start_cond_mtx->notify();
+    source_start_cond_mtx->unlock();
+    read_thread->join();
+    delete read_thread;
+  }
+  stream.reset();
+}
+
+bool CapturePlayerFlow::WaitDue(int64_t ts) {
+  int64_t now = gettimeofday();
+  if (!anchored || ts < last_ts || ts - last_ts > kMaxGapUs) {
+    // the first frame, replayed again or a discontinuity
+    anchored = true;
+    base_ts = ts;
+    base_time = now;
+  }
+  last_ts = ts;
+  int64_t due = base_time + (ts - base_ts);
+  while (loop && due > now) {
+    // wake up in time to quit
+    int64_t remain = std::min<int64_t>(due - now, 100000);
+    if (remain >= 1000)
+      msleep(remain / 1000);
+    else
+      usleep(remain);
+    now = gettimeofday();
+  }
+  return loop;
+}
+
+void CapturePlayerFlow::ReadThreadRun() {
+  source_start_cond_mtx->lock();
+  if (down_flow_num == 0 && IsEnable())
+    source_start_cond_mtx->wait();
+  source_start_cond_mtx->unlock();
+  AutoPrintLine apl(__func__);
+  AutoMemoryOwner _amo(GetMemoryOwner(GetFlowName()));
+  if (has_start && stream->IoCtrl(S_CAPTURE_SEEK_TIME, &start_timestamp))
+    LOG("%s: no frame at timestamp %lld\n", path.c_str(),
+        (long long)start_timestamp);
+  while (loop) {
+    if (stream->Eof()) {
+      if (loop_time-- > 0) {
+        stream->Seek(0, SEEK_SET);
+        continue;
+      }
+      break;
+    }
+    auto buffer = stream->Read();
+    if (!buffer) {
+      SetDisable();
+      break;
+    }
+    if (realtime && !WaitDue(buffer->GetUSTimeStamp()))
+      break;
+    SendInput(buffer, 0);
+  }
+}
+
+DEFINE_FLOW_FACTORY(CapturePlayerFlow, Flow)
+const char *FACTORY(CapturePlayerFlow)::ExpectedInputDataType() {
+  return nullptr;
+}
+const char *FACTORY(CapturePlayerFlow)::OutPutDataType() { return ""; }
+
+} // namespace easymedia
@@ -19,38 +19,100 @@
  *
  */
 
+#include <stdarg.h>
+#include <string.h>
+
+#include <condition_variable>
+#include <deque>
+
 #include "buffer.h"
+#include "control.h"
 #include "flow.h"
 #include "stream.h"
 #include "utils.h"
 
 namespace easymedia {
 
+// Recycled memory of the frames read ahead.
+struct ReadBufferPool {
+  std::mutex mtx;
+  std::vector<std::shared_ptr<MediaBuffer>> free_buffers;
+  size_t max_free;
+};
+
+struct PooledReadBuffer {
+  std::shared_ptr<ReadBufferPool> pool;
+  std::shared_ptr<MediaBuffer> storage;
+};
+
+static int recycle_read_buffer(void *arg) {
+  PooledReadBuffer *pb = static_cast<PooledReadBuffer *>(arg);
+  {
+    std::lock_guard<std::mutex> _lg(pb->pool->mtx);
+    if (pb->pool->free_buffers.size() < pb->pool->max_free)
+      pb->pool->free_buffers.push_back(pb->storage);
+  }
+  delete pb;
+  return 0;
+}
+
 class FileReadFlow : public Flow {
 public:
   FileReadFlow(const char *param);
   virtual ~FileReadFlow();
   static const char *GetFlowName() { return "file_read_flow"; }
+  virtual int Control(unsigned long int request, ...) final;
 
 private:
   void ReadThreadRun();
+  // With KEY_READ_AHEAD, frames are read by this thread into a queue,
+  // so that the latency of storage does not reach the output.
+  void PrefetchRun(size_t alloc_size);
+  // next frame, false at the end of file or if failed to read
+  bool ReadNext(size_t alloc_size, std::shared_ptr<MediaBuffer> &buffer);
+  // read into a new buffer, nullptr and !read_ok if failed to read
+  std::shared_ptr<MediaBuffer> ReadCopy(size_t alloc_size, bool &read_ok);
+  std::shared_ptr<MediaBuffer> AllocBuffer(size_t size);
+  // output at the frame rate
+  void SendFrame(std::shared_ptr<MediaBuffer> &buffer);
 
   std::shared_ptr<Stream> fstream;
   std::string path;
+  bool use_mmap;
+  // the stream returns whole buffers: mmap, y4m and wav
+  bool buffer_read;
   MediaBuffer::MemType mtype;
   size_t read_size;
   ImageInfo info;
   int fps;
   int loop_time;
   bool loop;
+  bool read_error;
   std::thread *read_thread;
+
+  int read_ahead;
+  std::shared_ptr<ReadBufferPool> pool;
+  std::mutex queue_mtx;
+  std::condition_variable queue_cond;
+  std::deque<std::shared_ptr<MediaBuffer>> queue;
+  bool prefetch_done;
+
+  std::mutex stats_mtx;
+  FileReadStats stats;
+  int64_t start_time;
+  int64_t next_time; // when the next frame is due
+  int64_t total_jitter_us;
 };
 
 FileReadFlow::FileReadFlow(const char *param)
-    : mtype(MediaBuffer::MemType::MEM_COMMON), read_size(0), fps(0),
-      loop_time(0), loop(false), read_thread(nullptr) {
+    : use_mmap(false), buffer_read(false),
+      mtype(MediaBuffer::MemType::MEM_COMMON), read_size(0), fps(0),
+      loop_time(0), loop(false), read_error(false), read_thread(nullptr),
+      read_ahead(0), prefetch_done(false), start_time(0), next_time(0),
+      total_jitter_us(0) {
   memset(&info, 0, sizeof(info));
   info.pix_fmt = PIX_FMT_NONE;
+  memset(&stats, 0, sizeof(stats));
   std::map<std::string, std::string> params;
   if (!parse_media_param_map(param, params)) {
     SetError(-EINVAL);
@@ -60,12 +122,44 @@ FileReadFlow::FileReadFlow(const char *param)
   std::string value;
   CHECK_EMPTY_SETERRNO(value, params, KEY_PATH, EINVAL)
   path = value;
-  CHECK_EMPTY_SETERRNO(value, params, KEY_OPEN_MODE, EINVAL)
-  PARAM_STRING_APPEND(s, KEY_PATH, path);
-  PARAM_STRING_APPEND(s, KEY_OPEN_MODE, value);
-  fstream = REFLECTOR(Stream)::Create<Stream>("file_read_stream", s.c_str());
+  value = params[KEY_USE_MMAP];
+  use_mmap = !value.empty() && !!std::stoi(value);
+  value = params[KEY_READ_AHEAD];
+  if (!value.empty())
+    read_ahead = std::stoi(value);
+  const char *stream_name = "file_read_stream";
+  if (use_mmap)
+    stream_name = "mmap_read_stream"; // zero copy into the mapped file
+  else if (string_end_withs(path, ".y4m"))
+    stream_name = "y4m_read_stream";
+  else if (string_end_withs(path, ".wav"))
+    stream_name = "wav_read_stream";
+  buffer_read = strcmp(stream_name, "file_read_stream") != 0;
+  if (buffer_read) {
+    // The flow replays by itself, do not let the stream loop.
+    for (auto &p : params) {
+      if (p.first != KEY_LOOP_TIME)
+        s.append(p.first).append("=").append(p.second).append("\n");
+    }
+  } else {
+    CHECK_EMPTY_SETERRNO(value, params, KEY_OPEN_MODE, EINVAL)
+    PARAM_STRING_APPEND(s, KEY_PATH, path);
+    PARAM_STRING_APPEND(s, KEY_OPEN_MODE, value);
+    // reading ahead is sequential
+    value = params[KEY_FILE_ADVICE];
+    if (value.empty() && read_ahead > 0)
+      value = KEY_ADVICE_SEQUENTIAL;
+    if (!value.empty())
+      PARAM_STRING_APPEND(s, KEY_FILE_ADVICE, value);
+    for (const char *key : {KEY_DROP_BEHIND, KEY_WILLNEED_SIZE}) {
+      auto it = params.find(key);
+      if (it != params.end())
+        s.append(key).append("=").append(it->second).append("\n");
+    }
+  }
+  fstream = REFLECTOR(Stream)::Create<Stream>(stream_name, s.c_str());
   if (!fstream) {
-    fprintf(stderr, "Create stream file_read_stream failed\n");
+    fprintf(stderr, "Create stream %s failed\n", stream_name);
     SetError(-EINVAL);
     return;
   }
@@ -73,13 +167,14 @@ FileReadFlow::FileReadFlow(const char *param)
   if (!value.empty())
     mtype = StringToMemType(value.c_str());
   value = params[KEY_MEM_SIZE_PERTIME];
-  if (value.empty()) {
+  if (!value.empty()) {
+    read_size = std::stoul(value);
+  } else if (use_mmap || !buffer_read) {
+    // y4m and wav get the format from the file header
     if (!ParseImageInfoFromMap(params, info)) {
       SetError(-EINVAL);
       return;
     }
-  } else {
-    read_size = std::stoul(value);
   }
   value = params[KEY_FPS];
   if (!value.empty())
@@ -87,6 +182,15 @@ FileReadFlow::FileReadFlow(const char *param)
   value = params[KEY_LOOP_TIME];
   if (!value.empty())
     loop_time = std::stoi(value);
+  if (read_ahead > 0 && !buffer_read) {
+    pool = std::make_shared<ReadBufferPool>();
+    if (!pool) {
+      SetError(-ENOMEM);
+      return;
+    }
+    // the queue, the frame being sent and the one held downstream
+    pool->max_free = read_ahead + 2;
+  }
   if (!SetAsSource(std::vector<int>({0}), std::vector<int>({0}),
                    void_transaction00, path)) {
     SetError(-EINVAL);
@@ -108,71 +212,239 @@ FileReadFlow::~FileReadFlow() {
     loop = false;
     source_start_cond_mtx->notify();
     source_start_cond_mtx->unlock();
+    {
+      std::lock_guard<std::mutex> _lg(queue_mtx);
+      queue_cond.notify_all();
+    }
     read_thread->join();
     delete read_thread;
   }
   fstream.reset();
 }
 
-void FileReadFlow::ReadThreadRun() {
-  source_start_cond_mtx->lock();
-  if (down_flow_num == 0)
-    source_start_cond_mtx->wait();
-  source_start_cond_mtx->unlock();
-  AutoPrintLine apl(__func__);
-  size_t alloc_size = read_size;
+std::shared_ptr<MediaBuffer> FileReadFlow::AllocBuffer(size_t size) {
+  if (!pool)
+    return MediaBuffer::Alloc(size, mtype);
+  std::shared_ptr<MediaBuffer> storage;
+  {
+    std::lock_guard<std::mutex> _lg(pool->mtx);
+    auto &fb = pool->free_buffers;
+    for (auto it = fb.begin(); it != fb.end(); ++it) {
+      if ((*it)->GetSize() >= size) {
+        storage = *it;
+        fb.erase(it);
+        break;
+      }
+    }
+  }
+  if (!storage) {
+    storage = MediaBuffer::Alloc(size, mtype);
+    if (!storage)
+      return nullptr;
+  }
+  PooledReadBuffer *pb = new PooledReadBuffer();
+  if (!pb) {
+    LOG_NO_MEMORY();
+    return nullptr;
+  }
+  pb->pool = pool;
+  pb->storage = storage;
+  auto buffer =
+      std::make_shared<MediaBuffer>(storage->GetPtr(), storage->GetSize(),
+                                    storage->GetFD(), pb, recycle_read_buffer);
+  if (!buffer) {
+    recycle_read_buffer(pb);
+    LOG_NO_MEMORY();
+  }
+  return buffer;
+}
+
+std::shared_ptr<MediaBuffer> FileReadFlow::ReadCopy(size_t alloc_size,
+                                                   bool &read_ok) {
   bool is_image = (info.pix_fmt != PIX_FMT_NONE);
-  if (alloc_size == 0) {
-    if (is_image) {
-      int num = 0, den = 0;
-      GetPixFmtNumDen(info.pix_fmt, num, den);
-      alloc_size = info.vir_width * info.vir_height * num * den;
+  auto buffer = AllocBuffer(alloc_size);
+  if (!buffer) {
+    LOG_NO_MEMORY();
+    return nullptr;
+  }
+  if (is_image) {
+    auto imagebuffer = std::make_shared<ImageBuffer>(*(buffer.get()), info);
+    if (!imagebuffer) {
+      LOG_NO_MEMORY();
+      return nullptr;
+    }
+    buffer = imagebuffer;
+  }
+  size_t size;
+  buffer->BeginCPUAccess(MediaBuffer::kCPUWrite);
+  if (read_size) {
+    size = fstream->Read(buffer->GetPtr(), 1, read_size);
+    if (size != read_size && !fstream->Eof()) {
+      LOG("read get %d != expect %d\n", (int)size, (int)read_size);
+      read_ok = false;
     }
+    buffer->SetValidSize(size);
   }
+  if (read_ok && is_image) {
+    if (!fstream->ReadImage(buffer->GetPtr(), info) && !fstream->Eof())
+      read_ok = false;
+    buffer->SetValidSize(buffer->GetSize());
+  }
+  buffer->EndCPUAccess(MediaBuffer::kCPUWrite);
+  return read_ok ? buffer : nullptr;
+}
+
+bool FileReadFlow::ReadNext(size_t alloc_size,
+                            std::shared_ptr<MediaBuffer> &buffer) {
   while (loop) {
     if (fstream->Eof()) {
       if (loop_time-- > 0)
         fstream->Seek(0, SEEK_SET);
       else
-        break;
+        return false;
     }
-    auto buffer = MediaBuffer::Alloc(alloc_size, mtype);
-    if (!buffer) {
-      LOG_NO_MEMORY();
-      continue;
-    }
-    if (is_image) {
-      auto imagebuffer = std::make_shared<ImageBuffer>(*(buffer.get()), info);
-      if (!imagebuffer) {
-        LOG_NO_MEMORY();
+    bool read_ok = true;
+    int64_t begin = gettimeofday();
+    if (buffer_read) {
+      buffer = fstream->Read();
+      if (!buffer && fstream->Eof())
+        continue;
+      read_ok = !!buffer;
+    } else {
+      buffer = ReadCopy(alloc_size, read_ok);
+      if (!buffer && read_ok)
         continue;
-      }
-      buffer = imagebuffer;
     }
-    size_t size;
-    if (read_size) {
-      size = fstream->Read(buffer->GetPtr(), 1, read_size);
-      if (size != read_size && !fstream->Eof()) {
-        LOG("read get %d != expect %d\n", (int)size, (int)read_size);
-        SetDisable();
-        break;
-      }
-      buffer->SetValidSize(size);
+    if (!read_ok) {
+      read_error = true;
+      return false;
     }
-    if (is_image) {
-      if (!fstream->ReadImage(buffer->GetPtr(), info) && !fstream->Eof()) {
-        SetDisable();
+    int64_t cost = gettimeofday() - begin;
+    std::lock_guard<std::mutex> _lg(stats_mtx);
+    stats.max_read_us = std::max(stats.max_read_us, cost);
+    stats.bytes += buffer->GetValidSize();
+    return true;
+  }
+  return false;
+}
+
+void FileReadFlow::PrefetchRun(size_t alloc_size) {
+  AutoMemoryOwner _amo(GetMemoryOwner(GetFlowName()));
+  while (true) {
+    {
+      std::unique_lock<std::mutex> lk(queue_mtx);
+      queue_cond.wait(lk, [this] {
+        return !loop || (int)queue.size() < read_ahead;
+      });
+      if (!loop)
         break;
+    }
+    std::shared_ptr<MediaBuffer> buffer;
+    if (!ReadNext(alloc_size, buffer))
+      break;
+    std::lock_guard<std::mutex> _lg(queue_mtx);
+    queue.push_back(buffer);
+    queue_cond.notify_all();
+  }
+  std::lock_guard<std::mutex> _lg(queue_mtx);
+  prefetch_done = true;
+  queue_cond.notify_all();
+}
+
+void FileReadFlow::SendFrame(std::shared_ptr<MediaBuffer> &buffer) {
+  int64_t interval = fps > 0 ? 1000000 / fps : 0;
+  int64_t now = gettimeofday();
+  if (interval > 0 && next_time > now) {
+    msleep((next_time - now) / 1000);
+    // finish the rest below 1ms
+    now = gettimeofday();
+    if (next_time > now)
+      usleep(next_time - now);
+    now = gettimeofday();
+  }
+  buffer->SetUSTimeStamp(now);
+  SendInput(buffer, 0);
+  std::lock_guard<std::mutex> _lg(stats_mtx);
+  if (stats.frames == 0) {
+    start_time = now;
+    next_time = now;
+  }
+  stats.frames++;
+  if (interval > 0) {
+    int64_t jitter = std::abs(now - next_time);
+    total_jitter_us += jitter;
+    stats.avg_jitter_us = total_jitter_us / stats.frames;
+    stats.max_jitter_us = std::max(stats.max_jitter_us, jitter);
+    next_time += interval;
+    if (jitter >= interval) {
+      // do not burst to catch up
+      stats.late_frames++;
+      next_time = now + interval;
+    }
+  }
+}
+
+void FileReadFlow::ReadThreadRun() {
+  source_start_cond_mtx->lock();
+  if (down_flow_num == 0)
+    source_start_cond_mtx->wait();
+  source_start_cond_mtx->unlock();
+  AutoPrintLine apl(__func__);
+  AutoMemoryOwner _amo(GetMemoryOwner(GetFlowName()));
+  size_t alloc_size = read_size;
+  if (alloc_size == 0 && info.pix_fmt != PIX_FMT_NONE)
+    alloc_size = CalPixFmtSize(info);
+  if (read_ahead <= 0) {
+    std::shared_ptr<MediaBuffer> buffer;
+    while (loop && ReadNext(alloc_size, buffer))
+      SendFrame(buffer);
+  } else {
+    std::thread prefetch(&FileReadFlow::PrefetchRun, this, alloc_size);
+    while (loop) {
+      std::shared_ptr<MediaBuffer> buffer;
+      {
+        std::unique_lock<std::mutex> lk(queue_mtx);
+        if (queue.empty() && !prefetch_done && stats.frames > 0) {
+          std::lock_guard<std::mutex> _lg(stats_mtx);
+          stats.underruns++;
+        }
+        queue_cond.wait(lk, [this] {
+          return !loop || !queue.empty() || prefetch_done;
+        });
+        if (queue.empty())
+          break;
+        buffer = queue.front();
+        queue.pop_front();
+        queue_cond.notify_all();
       }
-      buffer->SetValidSize(buffer->GetSize());
+      SendFrame(buffer);
     }
-    buffer->SetUSTimeStamp(gettimeofday());
-    SendInput(buffer, 0);
-    if (fps != 0) {
-      static int interval = 1000 / fps;
-      msleep(interval);
+    {
+      std::lock_guard<std::mutex> _lg(queue_mtx);
+      loop = false;
+      queue.clear();
+      queue_cond.notify_all();
     }
+    prefetch.join();
   }
+  if (read_error)
+    SetDisable();
+}
+
+int FileReadFlow::Control(unsigned long int request, ...) {
+  va_list vl;
+  va_start(vl, request);
+  void *arg = va_arg(vl, void *);
+  va_end(vl);
+  if (request != G_FILE_READ_STATS || !arg)
+    return -1;
+  std::lock_guard<std::mutex> _lg(stats_mtx);
+  FileReadStats *s = static_cast<FileReadStats *>(arg);
+  *s = stats;
+  int64_t duration = gettimeofday() - start_time;
+  if (stats.frames > 0 && duration > 0)
+    s->bytes_per_second = stats.bytes * 1000000 / duration;
+  return 0;
 }
 
 DEFINE_FLOW_FACTORY(FileReadFlow, Flow)
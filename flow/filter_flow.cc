@@ -69,6 +69,8 @@ FilterFlow::FilterFlow(const char *param)
       return;
     }
   }
+  LimitDataTypes(MediaTypeSet::FromString(params[KEY_INPUTDATATYPE].c_str()),
+                 MediaTypeSet::FromString(params[KEY_OUTPUTDATATYPE].c_str()));
   input_pix_fmt = StringToPixFmt(params[KEY_INPUTDATATYPE].c_str());
   SlotMap sm;
   int input_maxcachenum = 2;
@@ -117,6 +119,12 @@ FilterFlow::FilterFlow(const char *param)
     SetError(-EINVAL);
     return;
   }
+  if (out_img_info.pix_fmt != PIX_FMT_NONE && out_img_info.vir_width > 0) {
+    FlowCaps out;
+    out.width = out_img_info.width;
+    out.height = out_img_info.height;
+    LimitCaps(FlowCaps(), out);
+  }
 }
 
 // comparing timestamp as modification?
@@ -161,21 +169,24 @@ bool do_filters(Flow *f, MediaBufferVector &input_vector) {
       continue;
     }
     last_filter = filter;
-    if (flow->input_pix_fmt != PIX_FMT_NONE && in->GetType() == Type::Image) {
-      auto in_img = std::static_pointer_cast<ImageBuffer>(in);
+    if (flow->input_pix_fmt != PIX_FMT_NONE && in->GetType() == Type::Image &&
+        flow->input_pix_fmt != in->GetPixelFormat()) {
       // hack for n4 cif
-      if (flow->input_pix_fmt != in_img->GetPixelFormat()) {
-        ImageInfo &info = in_img->GetImageInfo();
-        int flow_num = 0, flow_den = 0;
-        GetPixFmtNumDen(flow->input_pix_fmt, flow_num, flow_den);
-        int in_num = 0, in_den = 0;
-        GetPixFmtNumDen(info.pix_fmt, in_num, in_den);
-        int num = in_num * flow_den;
-        int den = in_den * flow_num;
-        info.width = info.width * num / den;
-        info.vir_width = info.vir_width * num / den;
-        info.pix_fmt = flow->input_pix_fmt;
-      }
+      // input may be shared by other flows, modify the info of a shallow copy
+      in = MediaBuffer::ShallowCopy(in);
+      if (!in)
+        return false;
+      auto in_img = std::static_pointer_cast<ImageBuffer>(in);
+      ImageInfo &info = in_img->GetImageInfo();
+      int flow_num = 0, flow_den = 0;
+      GetPixFmtNumDen(flow->input_pix_fmt, flow_num, flow_den);
+      int in_num = 0, in_den = 0;
+      GetPixFmtNumDen(info.pix_fmt, in_num, in_den);
+      int num = in_num * flow_den;
+      int den = in_den * flow_num;
+      info.width = info.width * num / den;
+      info.vir_width = info.vir_width * num / den;
+      info.pix_fmt = flow->input_pix_fmt;
     }
     if (flow->support_async) {
       int ret = filter->SendInput(in);
@@ -0,0 +1,849 @@
+/*
+ * Copyright (C) 2017 Hertz Wang 1989wanghang@163.com
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see http://www.gnu.org/licenses
+ *
+ * Any non-GPL usage of this software or parts of this software is strictly
+ * forbidden.
+ *
+ */
+
+// Bridge of flows in different processes over a unix socket.
+//
+// ipc_sink listens on KEY_PATH, ipc_source connects to it and outputs the
+// buffers the sink receives. A path starting with '@' is in the abstract
+// namespace. The sink serves one source at a time, a new connection
+// replaces the old one.
+// Buffers with fd, such as dma-buf, are passed by SCM_RIGHTS without copy.
+// Other buffers are copied once into a memfd ring of KEY_IPC_RING_SIZE
+// bytes, which the source maps read-only. Every connection has a new ring,
+// a replaced source keeps reading its buffers safely. The source sends a release
+// message when its buffer is destructed, then the sink drops its reference
+// or reuses the ring space. Note that the source flow keeps its last output
+// until the next one, so one frame stays in flight.
+// The sink never waits for the source. A frame is dropped if the ring is
+// full, KEY_IPC_MAX_FRAMES frames are in flight, or the socket is full.
+// When the source disconnects or crashes, all the frames in flight are
+// released. The source reconnects every KEY_IPC_RETRY_MS.
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/prctl.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <linux/memfd.h>
+
+#include <deque>
+#include <unordered_map>
+
+#include "buffer.h"
+#include "flow.h"
+#include "stream.h"
+#include "utils.h"
+
+namespace easymedia {
+
+static const uint32_t kIpcMagic = 0x454d4950; // "PIME"
+
+enum IpcMsgType : uint32_t {
+  kIpcHello = 1, // sink to source, with the memfd of ring
+  kIpcFrame,     // sink to source, with the fd of buffer if kPayloadFd
+  kIpcRelease,   // source to sink
+};
+
+enum IpcPayload : uint32_t {
+  kPayloadFd = 1,
+  kPayloadRing,
+};
+
+struct IpcMessage {
+  uint32_t magic;
+  uint32_t type;
+  uint32_t id;
+  uint32_t payload;
+  int32_t buf_type;
+  uint32_t user_flag;
+  int64_t timestamp;
+  uint64_t size;     // valid bytes, ring size in hello
+  uint64_t offset;   // of data in fd or ring
+  uint64_t map_size; // bytes to map from the start of fd
+  uint32_t eof;
+  ImageInfo image_info;
+  SampleInfo sample_info;
+};
+
+static bool ipc_address(const std::string &path, struct sockaddr_un &addr,
+                        socklen_t &len) {
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  if (path.empty() || path.size() >= sizeof(addr.sun_path)) {
+    LOG("invalid ipc path <%s>\n", path.c_str());
+    return false;
+  }
+  memcpy(addr.sun_path, path.c_str(), path.size());
+  if (path[0] == '@')
+    addr.sun_path[0] = 0;
+  len = offsetof(struct sockaddr_un, sun_path) + path.size();
+  return true;
+}
+
+// return the errno, 0 if sent
+static int ipc_send(int sock, const IpcMessage &msg, int fd, int flags) {
+  struct iovec iov = {const_cast<IpcMessage *>(&msg), sizeof(msg)};
+  union {
+    struct cmsghdr align;
+    char buf[CMSG_SPACE(sizeof(int))];
+  } ctrl;
+  struct msghdr mh;
+  memset(&mh, 0, sizeof(mh));
+  mh.msg_iov = &iov;
+  mh.msg_iovlen = 1;
+  if (fd >= 0) {
+    memset(&ctrl, 0, sizeof(ctrl));
+    mh.msg_control = ctrl.buf;
+    mh.msg_controllen = sizeof(ctrl.buf);
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&mh);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+    memcpy(CMSG_DATA(cmsg), &fd, sizeof(int));
+  }
+  while (sendmsg(sock, &mh, flags | MSG_NOSIGNAL) < 0) {
+    if (errno != EINTR)
+      return errno;
+  }
+  return 0;
+}
+
+// return the bytes received, fd is -1 if no fd passed
+static ssize_t ipc_recv(int sock, IpcMessage &msg, int &fd, int flags = 0) {
+  struct iovec iov = {&msg, sizeof(msg)};
+  union {
+    struct cmsghdr align;
+    char buf[CMSG_SPACE(sizeof(int))];
+  } ctrl;
+  struct msghdr mh;
+  memset(&mh, 0, sizeof(mh));
+  mh.msg_iov = &iov;
+  mh.msg_iovlen = 1;
+  mh.msg_control = ctrl.buf;
+  mh.msg_controllen = sizeof(ctrl.buf);
+  fd = -1;
+  ssize_t ret;
+  while ((ret = recvmsg(sock, &mh, flags | MSG_CMSG_CLOEXEC)) < 0 &&
+         errno == EINTR)
+    ;
+  if (ret <= 0)
+    return ret;
+  for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(&mh); cmsg;
+       cmsg = CMSG_NXTHDR(&mh, cmsg)) {
+    if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS)
+      memcpy(&fd, CMSG_DATA(cmsg), sizeof(int));
+  }
+  if (ret != sizeof(msg) || msg.magic != kIpcMagic) {
+    LOG("bad ipc message of %d bytes\n", (int)ret);
+    if (fd >= 0)
+      close(fd);
+    fd = -1;
+    errno = EPROTO;
+    return -1;
+  }
+  return ret;
+}
+
+// Payload ring of the sink, allocated and released in FIFO order.
+class IpcRing {
+public:
+  IpcRing() : fd(-1), addr(nullptr), capacity(0), tail(0), used(0) {}
+  ~IpcRing() {
+    if (addr)
+      munmap(addr, capacity);
+    if (fd >= 0)
+      close(fd);
+  }
+  bool Init(size_t size);
+  // contiguous space of len, false if full
+  bool Alloc(size_t len, size_t &offset);
+  void Release(size_t offset);
+
+  int fd;
+  uint8_t *addr;
+  size_t capacity;
+  size_t tail;
+  size_t used;
+
+private:
+  struct Region {
+    size_t offset;
+    size_t len;
+    bool released;
+  };
+  std::deque<Region> regions;
+};
+
+bool IpcRing::Init(size_t size) {
+  fd = syscall(__NR_memfd_create, "easymedia_ipc", MFD_CLOEXEC);
+  if (fd < 0) {
+    LOG("memfd_create failed, %m\n");
+    return false;
+  }
+  if (ftruncate(fd, size)) {
+    LOG("ftruncate memfd failed, %m\n");
+    return false;
+  }
+  void *ptr = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  if (ptr == MAP_FAILED) {
+    LOG("mmap memfd failed, %m\n");
+    return false;
+  }
+  addr = static_cast<uint8_t *>(ptr);
+  capacity = size;
+  return true;
+}
+
+bool IpcRing::Alloc(size_t len, size_t &offset) {
+  if (len == 0 || len > capacity)
+    return false;
+  if (regions.empty()) {
+    tail = 0;
+    offset = 0;
+  } else {
+    size_t head = regions.front().offset;
+    if (tail > head) {
+      // free space at the end and before head
+      if (capacity - tail >= len)
+        offset = tail;
+      else if (head >= len)
+        offset = 0;
+      else
+        return false;
+    } else {
+      // wrapped, tail == head means full
+      if (head - tail < len)
+        return false;
+      offset = tail;
+    }
+  }
+  regions.push_back({offset, len, false});
+  tail = offset + len;
+  used += len;
+  return true;
+}
+
+void IpcRing::Release(size_t offset) {
+  for (auto &r : regions) {
+    if (r.offset == offset && !r.released) {
+      r.released = true;
+      used -= r.len;
+      break;
+    }
+  }
+  while (!regions.empty() && regions.front().released)
+    regions.pop_front();
+}
+
+class IpcSinkFlow : public Flow {
+public:
+  IpcSinkFlow(const char *param);
+  virtual ~IpcSinkFlow();
+  static const char *GetFlowName() { return "ipc_sink"; }
+  virtual int Control(unsigned long int request, ...) final;
+
+private:
+  struct Inflight {
+    std::shared_ptr<MediaBuffer> buffer; // fd payload
+    bool in_ring;
+    size_t ring_offset;
+  };
+  static bool Process(Flow *f, MediaBufferVector &input_vector);
+  bool Send(const std::shared_ptr<MediaBuffer> &buffer);
+  void ServiceRun();
+  // with mtx locked
+  void Disconnect();
+  void Release(uint32_t id);
+
+  std::string path;
+  size_t ring_size;
+  int max_frames;
+  int listen_fd;
+  int wake_fd[2];
+  std::thread *service;
+
+  std::mutex mtx;
+  int client_fd;
+  // changes at every disconnection, the fd number may be reused
+  uint32_t connection_serial;
+  std::unique_ptr<IpcRing> ring; // of the current connection
+  uint32_t next_id;
+  std::unordered_map<uint32_t, Inflight> inflight;
+  IpcSinkStats stats;
+};
+
+IpcSinkFlow::IpcSinkFlow(const char *param)
+    : ring_size(8 * 1024 * 1024), max_frames(8), listen_fd(-1),
+      wake_fd{-1, -1}, service(nullptr), client_fd(-1), connection_serial(0),
+      next_id(1) {
+  memset(&stats, 0, sizeof(stats));
+  std::map<std::string, std::string> params;
+  if (!parse_media_param_map(param, params)) {
+    SetError(-EINVAL);
+    return;
+  }
+  std::string value;
+  CHECK_EMPTY_SETERRNO(value, params, KEY_PATH, EINVAL)
+  path = value;
+  value = params[KEY_IPC_RING_SIZE];
+  if (!value.empty())
+    ring_size = std::stoul(value);
+  value = params[KEY_IPC_MAX_FRAMES];
+  if (!value.empty())
+    max_frames = std::stoi(value);
+  if (ring_size == 0) {
+    SetError(-EINVAL);
+    return;
+  }
+  struct sockaddr_un addr;
+  socklen_t addr_len;
+  if (!ipc_address(path, addr, addr_len)) {
+    SetError(-EINVAL);
+    return;
+  }
+  listen_fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+  if (path[0] != '@')
+    unlink(path.c_str());
+  if (listen_fd < 0 || bind(listen_fd, (struct sockaddr *)&addr, addr_len) ||
+      listen(listen_fd, 2)) {
+    LOG("listen on %s failed, %m\n", path.c_str());
+    SetError(-errno);
+    return;
+  }
+  if (pipe2(wake_fd, O_CLOEXEC)) {
+    SetError(-errno);
+    return;
+  }
+  SlotMap sm;
+  int input_maxcachenum = 2;
+  ParseParamToSlotMap(params, sm, input_maxcachenum);
+  if (sm.thread_model == Model::NONE)
+    sm.thread_model = Model::SYNC;
+  if (sm.mode_when_full == InputMode::NONE)
+    sm.mode_when_full = InputMode::DROPFRONT;
+  sm.input_slots.push_back(0);
+  sm.input_maxcachenum.push_back(input_maxcachenum);
+  sm.process = Process;
+  if (!InstallSlotMap(sm, path, -1)) {
+    SetError(-EINVAL);
+    return;
+  }
+  service = new std::thread(&IpcSinkFlow::ServiceRun, this);
+  if (!service)
+    SetError(-ENOMEM);
+}
+
+IpcSinkFlow::~IpcSinkFlow() {
+  StopAllThread();
+  if (service) {
+    char c = 0;
+    if (write(wake_fd[1], &c, 1) != 1)
+      LOG("wake ipc service failed, %m\n");
+    service->join();
+    delete service;
+  }
+  {
+    std::lock_guard<std::mutex> _lg(mtx);
+    Disconnect();
+  }
+  if (listen_fd >= 0) {
+    close(listen_fd);
+    if (!path.empty() && path[0] != '@')
+      unlink(path.c_str());
+  }
+  for (int fd : wake_fd) {
+    if (fd >= 0)
+      close(fd);
+  }
+}
+
+// The ring is dropped with the connection. A source which is replaced but
+// still alive keeps its own mapping of the memory.
+void IpcSinkFlow::Disconnect() {
+  if (client_fd >= 0) {
+    LOGD("%s: consumer gone, release %d frames in flight, %llu dropped\n",
+         path.c_str(), (int)inflight.size(),
+         (unsigned long long)stats.dropped_frames);
+    close(client_fd);
+  }
+  client_fd = -1;
+  connection_serial++;
+  inflight.clear();
+  ring.reset();
+  stats.connected = 0;
+}
+
+void IpcSinkFlow::Release(uint32_t id) {
+  auto it = inflight.find(id);
+  if (it == inflight.end())
+    return;
+  if (it->second.in_ring)
+    ring->Release(it->second.ring_offset);
+  inflight.erase(it);
+}
+
+void IpcSinkFlow::ServiceRun() {
+  prctl(PR_SET_NAME, "ipc_sink");
+  while (true) {
+    struct pollfd fds[3];
+    int n = 0;
+    fds[n++] = {wake_fd[0], POLLIN, 0};
+    fds[n++] = {listen_fd, POLLIN, 0};
+    int cfd;
+    uint32_t serial;
+    {
+      std::lock_guard<std::mutex> _lg(mtx);
+      cfd = client_fd;
+      serial = connection_serial;
+    }
+    if (cfd >= 0)
+      fds[n++] = {cfd, POLLIN, 0};
+    if (poll(fds, n, -1) < 0) {
+      if (errno == EINTR)
+        continue;
+      LOG("ipc poll failed, %m\n");
+      break;
+    }
+    if (fds[0].revents)
+      break;
+    if (fds[1].revents & POLLIN) {
+      int fd = accept4(listen_fd, nullptr, nullptr, SOCK_CLOEXEC);
+      std::unique_ptr<IpcRing> new_ring;
+      if (fd >= 0) {
+        new_ring.reset(new IpcRing());
+        if (!new_ring->Init(ring_size)) {
+          close(fd);
+          fd = -1;
+        }
+      }
+      if (fd >= 0) {
+        IpcMessage hello;
+        memset(&hello, 0, sizeof(hello));
+        hello.magic = kIpcMagic;
+        hello.type = kIpcHello;
+        hello.size = new_ring->capacity;
+        std::lock_guard<std::mutex> _lg(mtx);
+        Disconnect();
+        if (ipc_send(fd, hello, new_ring->fd, MSG_DONTWAIT)) {
+          LOG("%s: hello failed, %m\n", path.c_str());
+          close(fd);
+        } else {
+          client_fd = fd;
+          ring = std::move(new_ring);
+          stats.connected = 1;
+          LOGD("%s: consumer connected\n", path.c_str());
+        }
+      }
+    }
+    if (n > 2 && fds[2].revents) {
+      std::lock_guard<std::mutex> _lg(mtx);
+      // replaced or closed by Send meanwhile
+      if (serial != connection_serial)
+        continue;
+      IpcMessage msg;
+      int fd = -1;
+      ssize_t ret = ipc_recv(cfd, msg, fd, MSG_DONTWAIT);
+      if (fd >= 0)
+        close(fd);
+      if (ret < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+        continue;
+      if (ret <= 0)
+        Disconnect();
+      else if (msg.type == kIpcRelease)
+        Release(msg.id);
+    }
+  }
+}
+
+bool IpcSinkFlow::Send(const std::shared_ptr<MediaBuffer> &buffer) {
+  std::lock_guard<std::mutex> _lg(mtx);
+  if (client_fd < 0)
+    return true; // nobody to receive
+  if ((int)inflight.size() >= max_frames) {
+    stats.dropped_frames++;
+    return true;
+  }
+  IpcMessage msg;
+  memset(&msg, 0, sizeof(msg));
+  msg.magic = kIpcMagic;
+  msg.type = kIpcFrame;
+  msg.id = next_id++;
+  msg.buf_type = (int32_t)buffer->GetType();
+  msg.user_flag = buffer->GetUserFlag();
+  msg.timestamp = buffer->GetUSTimeStamp();
+  msg.size = buffer->GetValidSize();
+  msg.eof = buffer->IsEOF();
+  if (buffer->GetType() == Type::Image)
+    msg.image_info = static_cast<ImageBuffer *>(buffer.get())->GetImageInfo();
+  else if (buffer->GetType() == Type::Audio)
+    msg.sample_info =
+        static_cast<SampleBuffer *>(buffer.get())->GetSampleInfo();
+  Inflight hold;
+  hold.in_ring = false;
+  hold.ring_offset = 0;
+  int fd = buffer->GetFD();
+  if (fd >= 0) {
+    msg.payload = kPayloadFd;
+    msg.offset = buffer->GetFDOffset();
+    msg.map_size = buffer->GetFDOffset() + buffer->GetSize();
+    hold.buffer = buffer;
+  } else {
+    msg.payload = kPayloadRing;
+    if (msg.size > 0) {
+      if (!ring->Alloc(msg.size, hold.ring_offset)) {
+        stats.dropped_frames++;
+        return true;
+      }
+      hold.in_ring = true;
+      AutoCPUAccess _aca(buffer.get(), MediaBuffer::kCPURead);
+      memcpy(ring->addr + hold.ring_offset, buffer->GetPtr(), msg.size);
+    }
+    msg.offset = hold.ring_offset;
+  }
+  int err = ipc_send(client_fd, msg, fd, MSG_DONTWAIT);
+  if (err) {
+    if (hold.in_ring)
+      ring->Release(hold.ring_offset);
+    if (err == EAGAIN || err == EWOULDBLOCK) {
+      stats.dropped_frames++;
+      return true;
+    }
+    LOG("%s: send failed, %s\n", path.c_str(), strerror(err));
+    Disconnect();
+    return true;
+  }
+  inflight[msg.id] = hold;
+  stats.sent_frames++;
+  return true;
+}
+
+bool IpcSinkFlow::Process(Flow *f, MediaBufferVector &input_vector) {
+  IpcSinkFlow *flow = static_cast<IpcSinkFlow *>(f);
+  auto &buffer = input_vector[0];
+  if (!buffer)
+    return true;
+  return flow->Send(buffer);
+}
+
+int IpcSinkFlow::Control(unsigned long int request, ...) {
+  va_list vl;
+  va_start(vl, request);
+  void *arg = va_arg(vl, void *);
+  va_end(vl);
+  if (request != G_IPC_SINK_STATS || !arg)
+    return -1;
+  std::lock_guard<std::mutex> _lg(mtx);
+  IpcSinkStats *s = static_cast<IpcSinkStats *>(arg);
+  *s = stats;
+  s->inflight_frames = inflight.size();
+  s->ring_used_bytes = ring ? ring->used : 0;
+  return 0;
+}
+
+DEFINE_FLOW_FACTORY(IpcSinkFlow, Flow)
+const char *FACTORY(IpcSinkFlow)::ExpectedInputDataType() {
+  return TYPE_ANYTHING;
+}
+const char *FACTORY(IpcSinkFlow)::OutPutDataType() { return nullptr; }
+
+// The connection of source, alive while its buffers are.
+class IpcConnection {
+public:
+  IpcConnection(int fd) : sock(fd), ring(nullptr), ring_size(0) {}
+  ~IpcConnection() {
+    Close();
+    if (ring)
+      munmap(ring, ring_size);
+  }
+  void Close() {
+    std::lock_guard<std::mutex> _lg(mtx);
+    if (sock >= 0)
+      close(sock);
+    sock = -1;
+  }
+  void SendRelease(uint32_t id) {
+    IpcMessage msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.magic = kIpcMagic;
+    msg.type = kIpcRelease;
+    msg.id = id;
+    std::lock_guard<std::mutex> _lg(mtx);
+    // lost if the sink is gone, it releases all by itself
+    if (sock >= 0)
+      ipc_send(sock, msg, -1, 0);
+  }
+
+  std::mutex mtx;
+  int sock;
+  uint8_t *ring;
+  size_t ring_size;
+};
+
+struct IpcHold {
+  std::shared_ptr<IpcConnection> conn;
+  uint32_t id;
+  void *map; // mapping of the passed fd
+  size_t map_size;
+  int fd;
+};
+
+static int release_ipc_buffer(void *arg) {
+  IpcHold *hold = static_cast<IpcHold *>(arg);
+  if (hold->map)
+    munmap(hold->map, hold->map_size);
+  if (hold->fd >= 0)
+    close(hold->fd);
+  hold->conn->SendRelease(hold->id);
+  delete hold;
+  return 0;
+}
+
+class IpcSourceFlow : public Flow {
+public:
+  IpcSourceFlow(const char *param);
+  virtual ~IpcSourceFlow();
+  static const char *GetFlowName() { return "ipc_source"; }
+
+private:
+  void ReadThreadRun();
+  std::shared_ptr<IpcConnection> Connect();
+  std::shared_ptr<MediaBuffer>
+  NewBuffer(const std::shared_ptr<IpcConnection> &conn, const IpcMessage &msg,
+            int fd);
+
+  std::string path;
+  int retry_ms;
+  bool loop;
+  std::thread *read_thread;
+  std::mutex conn_mtx;
+  std::shared_ptr<IpcConnection> cur_conn;
+};
+
+IpcSourceFlow::IpcSourceFlow(const char *param)
+    : retry_ms(100), loop(false), read_thread(nullptr) {
+  std::map<std::string, std::string> params;
+  if (!parse_media_param_map(param, params)) {
+    SetError(-EINVAL);
+    return;
+  }
+  std::string value;
+  CHECK_EMPTY_SETERRNO(value, params, KEY_PATH, EINVAL)
+  path = value;
+  value = params[KEY_IPC_RETRY_MS];
+  if (!value.empty())
+    retry_ms = std::stoi(value);
+  if (!SetAsSource(std::vector<int>({0}), std::vector<int>({0}),
+                   void_transaction00, path)) {
+    SetError(-EINVAL);
+    return;
+  }
+  value = params[KEY_OUTPUTDATATYPE];
+  if (!value.empty()) {
+    FlowCaps out;
+    out.types = MediaTypeSet::FromString(value.c_str());
+    LimitCaps(FlowCaps(), out);
+  }
+  loop = true;
+  read_thread = new std::thread(&IpcSourceFlow::ReadThreadRun, this);
+  if (!read_thread) {
+    loop = false;
+    SetError(-EINVAL);
+  }
+}
+
+IpcSourceFlow::~IpcSourceFlow() {
+  loop = false;
+  StopAllThread();
+  {
+    // wake up the blocking recv
+    std::lock_guard<std::mutex> _lg(conn_mtx);
+    if (cur_conn) {
+      std::lock_guard<std::mutex> _lg2(cur_conn->mtx);
+      if (cur_conn->sock >= 0)
+        shutdown(cur_conn->sock, SHUT_RDWR);
+    }
+  }
+  if (read_thread) {
+    source_start_cond_mtx->lock();
+    loop = false;
+    source_start_cond_mtx->notify();
+    source_start_cond_mtx->unlock();
+    read_thread->join();
+    delete read_thread;
+  }
+}
+
+std::shared_ptr<IpcConnection> IpcSourceFlow::Connect() {
+  struct sockaddr_un addr;
+  socklen_t addr_len;
+  if (!ipc_address(path, addr, addr_len))
+    return nullptr;
+  int fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+  if (fd < 0)
+    return nullptr;
+  if (connect(fd, (struct sockaddr *)&addr, addr_len)) {
+    close(fd);
+    return nullptr;
+  }
+  auto conn = std::make_shared<IpcConnection>(fd);
+  IpcMessage hello;
+  int ring_fd = -1;
+  if (ipc_recv(fd, hello, ring_fd) <= 0 || hello.type != kIpcHello ||
+      ring_fd < 0) {
+    LOG("%s: bad hello\n", path.c_str());
+    if (ring_fd >= 0)
+      close(ring_fd);
+    return nullptr;
+  }
+  void *ptr = mmap(nullptr, hello.size, PROT_READ, MAP_SHARED, ring_fd, 0);
+  close(ring_fd);
+  if (ptr == MAP_FAILED) {
+    LOG("%s: mmap ring failed, %m\n", path.c_str());
+    return nullptr;
+  }
+  conn->ring = static_cast<uint8_t *>(ptr);
+  conn->ring_size = hello.size;
+  return conn;
+}
+
+std::shared_ptr<MediaBuffer>
+IpcSourceFlow::NewBuffer(const std::shared_ptr<IpcConnection> &conn,
+                         const IpcMessage &msg, int fd) {
+  IpcHold *hold = new IpcHold();
+  if (!hold) {
+    LOG_NO_MEMORY();
+    return nullptr;
+  }
+  hold->conn = conn;
+  hold->id = msg.id;
+  hold->map = nullptr;
+  hold->map_size = 0;
+  hold->fd = fd;
+  uint8_t *ptr = nullptr;
+  size_t size = msg.size;
+  if (msg.payload == kPayloadFd) {
+    void *map = mmap(nullptr, msg.map_size, PROT_READ, MAP_SHARED, fd, 0);
+    if (map == MAP_FAILED) {
+      LOG("%s: mmap buffer fd failed, %m\n", path.c_str());
+      release_ipc_buffer(hold);
+      return nullptr;
+    }
+    hold->map = map;
+    hold->map_size = msg.map_size;
+    ptr = static_cast<uint8_t *>(map) + msg.offset;
+    size = msg.map_size - msg.offset;
+  } else if (msg.size > 0) {
+    if (msg.offset + msg.size > conn->ring_size) {
+      release_ipc_buffer(hold);
+      return nullptr;
+    }
+    ptr = conn->ring + msg.offset;
+  }
+  MediaBuffer mb(ptr, size, fd, hold, release_ipc_buffer);
+  if (fd >= 0)
+    mb.SetFDOffset(msg.offset);
+  mb.SetValidSize(msg.size);
+  mb.SetUserFlag(msg.user_flag);
+  mb.SetUSTimeStamp(msg.timestamp);
+  mb.SetEOF(!!msg.eof);
+  // the memory belongs to the producer
+  mb.SetReadOnly(true);
+  std::shared_ptr<MediaBuffer> ret;
+  Type type = (Type)msg.buf_type;
+  if (type == Type::Image) {
+    ret = std::make_shared<ImageBuffer>(mb, msg.image_info);
+  } else if (type == Type::Audio) {
+    ret = std::make_shared<SampleBuffer>(mb, msg.sample_info);
+  } else {
+    ret = std::make_shared<MediaBuffer>(mb);
+    if (ret)
+      ret->SetType(type);
+  }
+  if (!ret) {
+    LOG_NO_MEMORY();
+    return nullptr;
+  }
+  ret->SetValidSize(msg.size);
+  return ret;
+}
+
+void IpcSourceFlow::ReadThreadRun() {
+  source_start_cond_mtx->lock();
+  if (down_flow_num == 0 && IsEnable())
+    source_start_cond_mtx->wait();
+  source_start_cond_mtx->unlock();
+  prctl(PR_SET_NAME, "ipc_source");
+  AutoPrintLine apl(__func__);
+  while (loop) {
+    auto conn = Connect();
+    if (!conn) {
+      msleep(retry_ms);
+      continue;
+    }
+    LOGD("%s: connected\n", path.c_str());
+    {
+      std::lock_guard<std::mutex> _lg(conn_mtx);
+      cur_conn = conn;
+    }
+    while (loop) {
+      IpcMessage msg;
+      int fd = -1;
+      if (ipc_recv(conn->sock, msg, fd) <= 0)
+        break;
+      if (msg.type != kIpcFrame) {
+        if (fd >= 0)
+          close(fd);
+        continue;
+      }
+      if ((msg.payload == kPayloadFd) != (fd >= 0)) {
+        LOG("%s: frame %u without fd\n", path.c_str(), msg.id);
+        if (fd >= 0)
+          close(fd);
+        conn->SendRelease(msg.id);
+        continue;
+      }
+      auto buffer = NewBuffer(conn, msg, fd);
+      if (buffer)
+        SendInput(buffer, 0);
+    }
+    {
+      std::lock_guard<std::mutex> _lg(conn_mtx);
+      cur_conn.reset();
+    }
+    // the buffers still alive keep the ring mapped
+    conn->Close();
+    LOGD("%s: disconnected\n", path.c_str());
+  }
+}
+
+DEFINE_FLOW_FACTORY(IpcSourceFlow, Flow)
+const char *FACTORY(IpcSourceFlow)::ExpectedInputDataType() {
+  return nullptr;
+}
+const char *FACTORY(IpcSourceFlow)::OutPutDataType() { return TYPE_ANYTHING; }
+
+} // namespace easymedia
@@ -46,10 +46,11 @@ private:
   bool loop;
   std::thread *read_thread;
   std::shared_ptr<Stream> stream;
+  MemoryOwner *mem_owner;
 };
 
 SourceStreamFlow::SourceStreamFlow(const char *param)
-    : loop(false), read_thread(nullptr) {
+    : loop(false), read_thread(nullptr), mem_owner(nullptr) {
   std::list<std::string> separate_list;
   std::map<std::string, std::string> params;
   if (!ParseWrapFlowParams(param, params, separate_list)) {
@@ -70,6 +71,21 @@ SourceStreamFlow::SourceStreamFlow(const char *param)
     SetError(-EINVAL);
     return;
   }
+  // what the stream is configured to output, if it tells
+  std::map<std::string, std::string> stream_params;
+  if (parse_media_param_map(stream_param.c_str(), stream_params)) {
+    FlowCaps out;
+    out.types = MediaTypeSet::FromString(
+        stream_params[KEY_OUTPUTDATATYPE].c_str());
+    const std::string &width = stream_params[KEY_BUFFER_WIDTH];
+    const std::string &height = stream_params[KEY_BUFFER_HEIGHT];
+    if (!width.empty() && !height.empty()) {
+      out.width = std::stoi(width);
+      out.height = std::stoi(height);
+    }
+    LimitCaps(FlowCaps(), out);
+  }
+  mem_owner = GetMemoryOwner(name);
   loop = true;
   read_thread = new std::thread(&SourceStreamFlow::ReadThreadRun, this);
   if (!read_thread) {
@@ -101,6 +117,7 @@ void SourceStreamFlow::ReadThreadRun() {
   if (down_flow_num == 0 && IsEnable())
     source_start_cond_mtx->wait();
   source_start_cond_mtx->unlock();
+  AutoMemoryOwner _amo(mem_owner);
   while (loop) {
     if (stream->Eof()) {
       // TODO: tell that I reach eof
@@ -69,6 +69,13 @@ bool encode(Flow *f, MediaBufferVector &input_vector) {
     LOG("encoder failed\n");
     return false;
   }
+  // keep the side data of source frame, such as roi
+  dst->GetSideData().Merge(src->GetSideData());
+  if (extra_dst && extra_dst->GetValidSize() > 0)
+    dst->GetSideData().SetRecord(
+        SideData::kMotionVector,
+        std::shared_ptr<void>(extra_dst, extra_dst->GetPtr()),
+        extra_dst->GetValidSize());
   bool ret = vf->SetOutput(dst, 0);
   if (vf->extra_output)
     ret &= vf->SetOutput(extra_dst, 1);
@@ -101,6 +108,8 @@ VideoEncoderFlow::VideoEncoderFlow(const char *param) : extra_output(false) {
     SetError(-EINVAL);
     return;
   }
+  LimitDataTypes(MediaTypeSet::FromString(params[KEY_INPUTDATATYPE].c_str()),
+                 MediaTypeSet::FromString(params[KEY_OUTPUTDATATYPE].c_str()));
 
   const std::string &enc_param_str = separate_list.back();
   std::map<std::string, std::string> enc_params;
@@ -129,15 +138,12 @@ VideoEncoderFlow::VideoEncoderFlow(const char *param) : extra_output(false) {
     return;
   }
 
-  void *extra_data = nullptr;
-  size_t extra_data_size = 0;
-  encoder->GetExtraData(&extra_data, &extra_data_size);
+  auto extra_data = encoder->GetExtraData();
   // TODO: if not h264
   const std::string &output_dt = enc_params[KEY_OUTPUTDATATYPE];
-  if (extra_data && extra_data_size > 0 &&
+  if (extra_data && extra_data->GetValidSize() > 0 &&
       (output_dt == VIDEO_H264 || output_dt == VIDEO_H265))
-    extra_buffer_list = split_h264_separate((const uint8_t *)extra_data,
-                                            extra_data_size, gettimeofday());
+    extra_buffer_list = split_h264_separate(extra_data, gettimeofday());
 
   enc = encoder;
 
@@ -24,6 +24,8 @@
 #include <assert.h>
 #include <string.h>
 
+#include <algorithm>
+
 #include "key_string.h"
 #include "media_type.h"
 #include "utils.h"
@@ -71,6 +73,112 @@ int CalPixFmtSize(const PixelFormat &fmt, const int width, const int height) {
   return UPALIGNTO16(width) * UPALIGNTO16(height) * num / den;
 }
 
+int GetPixFmtPlaneNum(PixelFormat fmt) {
+  switch (fmt) {
+  case PIX_FMT_YUV420P:
+  case PIX_FMT_YUV422P:
+    return 3;
+  case PIX_FMT_NV12:
+  case PIX_FMT_NV21:
+  case PIX_FMT_NV16:
+  case PIX_FMT_NV61:
+    return 2;
+  case PIX_FMT_YUYV422:
+  case PIX_FMT_UYVY422:
+  case PIX_FMT_RGB332:
+  case PIX_FMT_RGB565:
+  case PIX_FMT_BGR565:
+  case PIX_FMT_RGB888:
+  case PIX_FMT_BGR888:
+  case PIX_FMT_ARGB8888:
+  case PIX_FMT_ABGR8888:
+    return 1;
+  default:
+    return 0;
+  }
+}
+
+bool GetPixFmtPlaneSize(PixelFormat fmt, int plane, int width, int height,
+                        int &row_bytes, int &rows) {
+  if (plane < 0 || plane >= GetPixFmtPlaneNum(fmt))
+    return false;
+  row_bytes = width;
+  rows = height;
+  switch (fmt) {
+  case PIX_FMT_YUV420P:
+    if (plane > 0) {
+      row_bytes = width / 2;
+      rows = height / 2;
+    }
+    break;
+  case PIX_FMT_NV12:
+  case PIX_FMT_NV21:
+    if (plane > 0)
+      rows = height / 2;
+    break;
+  case PIX_FMT_YUV422P:
+    if (plane > 0)
+      row_bytes = width / 2;
+    break;
+  case PIX_FMT_NV16:
+  case PIX_FMT_NV61:
+  case PIX_FMT_RGB332:
+    break;
+  case PIX_FMT_YUYV422:
+  case PIX_FMT_UYVY422:
+  case PIX_FMT_RGB565:
+  case PIX_FMT_BGR565:
+    row_bytes = width * 2;
+    break;
+  case PIX_FMT_RGB888:
+  case PIX_FMT_BGR888:
+    row_bytes = width * 3;
+    break;
+  case PIX_FMT_ARGB8888:
+  case PIX_FMT_ABGR8888:
+    row_bytes = width * 4;
+    break;
+  default:
+    return false;
+  }
+  return true;
+}
+
+int GetImagePlaneLayout(const ImageInfo &ii,
+                        ImagePlane planes[IMAGE_MAX_PLANES]) {
+  if (ii.plane_num > 0) {
+    int num = std::min(ii.plane_num, IMAGE_MAX_PLANES);
+    memcpy(planes, ii.planes, num * sizeof(ImagePlane));
+    return num;
+  }
+  int num = GetPixFmtPlaneNum(ii.pix_fmt);
+  int offset = 0;
+  for (int i = 0; i < num; i++) {
+    int row_bytes = 0, rows = 0;
+    GetPixFmtPlaneSize(ii.pix_fmt, i, ii.vir_width, ii.vir_height, row_bytes,
+                       rows);
+    planes[i].offset = offset;
+    planes[i].stride = row_bytes;
+    offset += row_bytes * rows;
+  }
+  return num;
+}
+
+int CalPixFmtSize(const ImageInfo &ii) {
+  if (ii.plane_num <= 0)
+    return CalPixFmtSize(ii.pix_fmt, ii.vir_width, ii.vir_height);
+  int size = 0;
+  int height = ii.vir_height > 0 ? ii.vir_height : ii.height;
+  for (int i = 0; i < ii.plane_num && i < IMAGE_MAX_PLANES; i++) {
+    int row_bytes = 0, rows = 0;
+    if (!GetPixFmtPlaneSize(ii.pix_fmt, i, ii.width, height, row_bytes, rows))
+      return 0;
+    const ImagePlane &p = ii.planes[i];
+    size = std::max(size, p.offset + p.stride * rows);
+  }
+  return size;
+}
+
 static const struct PixFmtStringEntry {
   PixelFormat fmt;
   const char *type_str;
@@ -117,6 +225,23 @@ bool ParseImageInfoFromMap(std::map<std::string, std::string> &params,
   info.vir_width = std::stoi(value);
   CHECK_EMPTY(value, params, KEY_BUFFER_VIR_HEIGHT)
   info.vir_height = std::stoi(value);
+  info.plane_num = 0;
+  value = params[KEY_BUFFER_PLANE_LAYOUT];
+  if (!value.empty()) {
+    const char *s = value.c_str();
+    while (*s && info.plane_num < IMAGE_MAX_PLANES) {
+      ImagePlane &p = info.planes[info.plane_num];
+      int n = 0;
+      if (sscanf(s, "%d:%d%n", &p.offset, &p.stride, &n) != 2) {
+        LOG("invalid plane layout %s\n", value.c_str());
+        return false;
+      }
+      info.plane_num++;
+      s += n;
+      if (*s == ',')
+        s++;
+    }
+  }
   return true;
 }
 
@@ -133,6 +258,17 @@ std::string to_param_string(const ImageInfo &info, bool input) {
   PARAM_STRING_APPEND_TO(s, KEY_BUFFER_HEIGHT, info.height);
   PARAM_STRING_APPEND_TO(s, KEY_BUFFER_VIR_WIDTH, info.vir_width);
   PARAM_STRING_APPEND_TO(s, KEY_BUFFER_VIR_HEIGHT, info.vir_height);
+  if (info.plane_num > 0) {
+    std::string layout;
+    for (int i = 0; i < info.plane_num && i < IMAGE_MAX_PLANES; i++) {
+      if (i > 0)
+        layout.append(",");
+      layout.append(std::to_string(info.planes[i].offset))
+          .append(":")
+          .append(std::to_string(info.planes[i].stride));
+    }
+    PARAM_STRING_APPEND(s, KEY_BUFFER_PLANE_LAYOUT, layout);
+  }
   return s;
 }
 
@@ -49,6 +49,13 @@ typedef enum {
   PIX_FMT_NB
 } PixelFormat;
 
+#define IMAGE_MAX_PLANES 4
+
+typedef struct {
+  int offset; // bytes from the start of buffer
+  int stride; // bytes per row
+} ImagePlane;
+
 typedef struct {
   PixelFormat pix_fmt;
   int width;      // valid pixel width
@@ -57,6 +64,11 @@ typedef struct {
                   // width, often set vir_width=(width+15)&(~15)
   int vir_height; // stride height, same to buffer_height, must greater than
                   // height, often set vir_height=(height+15)&(~15)
+  // Explicit layout of each plane, for buffers whose planes are not packed
+  // back to back, such as imported dma-buf. If plane_num is 0, the layout
+  // derives from vir_width and vir_height.
+  int plane_num;
+  ImagePlane planes[IMAGE_MAX_PLANES];
 } ImageInfo;
 
 typedef struct {
@@ -73,9 +85,15 @@ typedef struct {
 _API void GetPixFmtNumDen(const PixelFormat &fmt, int &num, int &den);
 _API int CalPixFmtSize(const PixelFormat &fmt, const int width,
                        const int height);
-_API inline int CalPixFmtSize(const ImageInfo &ii) {
-  return CalPixFmtSize(ii.pix_fmt, ii.vir_width, ii.vir_height);
-}
+_API int CalPixFmtSize(const ImageInfo &ii);
+// Bytes of each row and rows of the plane with pixel size width x height.
+// Return false if fmt has no such plane.
+_API bool GetPixFmtPlaneSize(PixelFormat fmt, int plane, int width, int height,
+                             int &row_bytes, int &rows);
+_API int GetPixFmtPlaneNum(PixelFormat fmt);
+// Fill the layout of each plane, return the plane number.
+_API int GetImagePlaneLayout(const ImageInfo &ii,
+                             ImagePlane planes[IMAGE_MAX_PLANES]);
 _API PixelFormat StringToPixFmt(const char *type);
 _API const char *PixFmtToString(PixelFormat fmt);
 
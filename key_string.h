@@ -39,6 +39,8 @@
 #define KEY_BUFFER_HEIGHT "height"
 #define KEY_BUFFER_VIR_WIDTH "virtual_width"
 #define KEY_BUFFER_VIR_HEIGHT "virtual_height"
+// optional explicit plane layout, "offset0:stride0,offset1:stride1,..."
+#define KEY_BUFFER_PLANE_LAYOUT "plane_layout"
 
 // (src_left, src_top, src_width, src_height)->(dst_left, dst_top, dst_width,
 // dst_height)
@@ -108,6 +110,61 @@
 
 #define KEY_LOOP_TIME "loop_time"
 
+// file_read_stream, file_read_flow
+#define KEY_FILE_ADVICE "fadvise"     // KEY_ADVICE_*
+#define KEY_DROP_BEHIND "drop_behind" // drop the page cache behind the cursor
+#define KEY_WILLNEED_SIZE "willneed_size" // bytes to hint ahead of the cursor
+#define KEY_READ_AHEAD "read_ahead"       // frames read in background
+
+// mmap_read_stream
+#define KEY_USE_MMAP "mmap"
+#define KEY_MMAP_POPULATE "populate"
+#define KEY_MMAP_ADVICE "madvise"
+#define KEY_ADVICE_NORMAL "normal"
+#define KEY_ADVICE_SEQUENTIAL "sequential"
+#define KEY_ADVICE_RANDOM "random"
+#define KEY_ADVICE_WILLNEED "willneed"
+
+// async_write_stream
+#define KEY_WRITE_BACKEND "backend"
+#define KEY_BACKEND_AUTO "auto"
+#define KEY_BACKEND_IO_URING "io_uring"
+#define KEY_BACKEND_THREADS "threads"
+#define KEY_WRITE_THREAD_NUM "thread_num"
+#define KEY_MAX_INFLIGHT_BYTES "max_inflight"
+#define KEY_DIRECT_IO "direct"
+#define KEY_WRITE_FULL_MODE "full_mode" // KEY_BLOCKING or KEY_DROPCURRENT
+
+// record_write_stream
+#define KEY_CHUNK_SIZE "chunk_size"
+#define KEY_PREALLOC_SIZE "prealloc_size"
+#define KEY_FLUSH_INTERVAL_MS "flush_interval_ms"
+
+// segment_write_stream
+#define KEY_SEGMENT_STREAM "segment_stream"
+#define KEY_SEGMENT_DURATION_MS "segment_duration_ms"
+#define KEY_SEGMENT_SIZE "segment_size"
+#define KEY_SEGMENT_QUOTA "quota"
+#define KEY_SEGMENT_MAX_FILES "max_files"
+#define KEY_KEY_FRAME_ALIGN "key_frame_align"
+
+// memory_stream
+#define KEY_MEMORY_NAME "mem_name"
+#define KEY_MEMORY_MODE "mem_mode"
+#define KEY_MEMORY_BUFFER "buffer"
+#define KEY_MEMORY_PIPE "pipe"
+#define KEY_MEMORY_CAPACITY "capacity"
+#define KEY_NON_BLOCK "nonblock"
+
+// ipc_sink, ipc_source
+#define KEY_IPC_RING_SIZE "ring_size"
+#define KEY_IPC_MAX_FRAMES "max_inflight_frames"
+#define KEY_IPC_RETRY_MS "retry_ms"
+
+// capture_recorder, capture_player
+#define KEY_REALTIME "realtime"
+#define KEY_START_TIMESTAMP "start_timestamp"
+
 // flow
 #define KEK_THREAD_SYNC_MODEL "thread_model"
 #define KEY_ASYNCCOMMON "asynccommon"
@@ -119,6 +176,15 @@
 #define KEY_DROPFRONT "dropfront"
 #define KEY_DROPCURRENT "dropcurrent"
 
+#define KEY_INPUT_LOCK "input_lock"
+#define KEY_LOCK_CONDITION "condition"
+#define KEY_LOCK_ADAPTIVE "adaptive"
+// lock of down flow lists, KEY_LOCK_SPIN or KEY_LOCK_NONE if down flows are
+// only linked and removed while no data flows
+#define KEY_OUTPUT_LOCK "output_lock"
+#define KEY_LOCK_SPIN "spin"
+#define KEY_LOCK_NONE "none"
+
 #define KEY_INPUT_CACHE_NUM "input_cache_num"
 #define KEY_OUTPUT_CACHE_NUM "output_cache_num"
 
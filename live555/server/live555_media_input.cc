@@ -205,6 +205,7 @@ void Live555MediaInput::PushNewAudio(std::shared_ptr<MediaBuffer> &buffer) {
 
 Live555MediaInput::Source::Source() : reduction(nullptr) {
   wakeFds[0] = wakeFds[1] = -1;
+  mtx.SetName("live555.source");
 }
 
 Live555MediaInput::Source::~Source() {
@@ -236,6 +237,16 @@ void Live555MediaInput::Source::Push(std::shared_ptr<MediaBuffer> &buffer) {
   if (reduction)
     reduction(cached_buffers);
   cached_buffers.push_back(buffer);
+  // hardware buffers pinned by lazy clones are returned to their pool
+  // as soon as the cache grows, copy the older ones
+  int pinned = 0;
+  for (auto it = cached_buffers.rbegin(); it != cached_buffers.rend(); ++it) {
+    auto &b = *it;
+    if (!b || !b->IsView() || !b->IsHwBuffer())
+      continue;
+    if (++pinned > MAX_PINNED_HW_BUFFERS && !MediaBuffer::Materialize(b))
+      LOG("fail to materialize cached hardware buffer\n");
+  }
   // mtx.notify();
   int i = 0;
   write(wakeFds[1], &i, sizeof(i));
@@ -81,6 +81,9 @@ private:
   friend class AudioFramedSource;
 };
 
+// Max number of hardware buffers held by the cached lists of a source.
+#define MAX_PINNED_HW_BUFFERS 2
+
 // Functions to set the optimal buffer size for RTP sink objects.
 // These should be called before each RTPSink is created.
 #define AUDIO_MAX_FRAME_SIZE 204800
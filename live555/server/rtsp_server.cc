@@ -66,9 +66,9 @@ bool SendVideoToServer(Flow *f, MediaBufferVector &input_vector) {
   RtspServerFlow *rtsp_flow = (RtspServerFlow *)f;
   auto &buffer = input_vector[0];
   if (buffer && buffer->IsHwBuffer()) {
-    // hardware buffer is limited, copy it
-    auto new_buffer = MediaBuffer::Clone(*buffer.get());
-    buffer = new_buffer;
+    // hardware buffer is limited, copy it only if it is cached too long,
+    // see Live555MediaInput::Source::Push
+    buffer = MediaBuffer::LazyClone(buffer);
   }
   rtsp_flow->server_input->PushNewVideo(buffer);
   return true;
@@ -95,6 +95,8 @@ RtspServerFlow::RtspServerFlow(const char *param)
   std::string value;
   CHECK_EMPTY_SETERRNO(value, params, KEY_INPUTDATATYPE, EINVAL)
   parse_media_param_list(value.c_str(), input_data_types, ',');
+  LimitDataTypes(MediaTypeSet::FromString(value.c_str()),
+                 MediaTypeSet::Anything());
   CHECK_EMPTY_SETERRNO(channel_name, params, KEY_CHANNEL_NAME, EINVAL)
   int idx = 0;
   int ports[3] = {0, 554, 8554};
@@ -267,6 +267,7 @@ int main(int argc, char **argv) {
   int h_align = UPALIGNTO16(h);
   int fps = 30;
   ImageInfo info;
+  memset(&info, 0, sizeof(info));
   info.pix_fmt = PIX_FMT_NV12;
   info.width = w;
   info.height = h;
@@ -21,15 +21,179 @@
 
 #include "lock.h"
 
+#include <errno.h>
+#include <limits.h>
+#include <linux/futex.h>
 #include <stdio.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <map>
+#include <vector>
+
+#include "key_string.h"
 
 namespace easymedia {
 
+#ifdef LOCK_PROFILE
+#define PROFILE_LOCK(try_lock_expr, lock_expr)                                 \
+  ProfileLock([&] { return (try_lock_expr); },                                 \
+              [&] {                                                            \
+                lock_expr;                                                     \
+                return true;                                                   \
+              })
+#define PROFILE_TIMED_LOCK(try_lock_expr, timed_lock_expr)                     \
+  ProfileLock([&] { return (try_lock_expr); },                                 \
+              [&] { return (timed_lock_expr); })
+#define PROFILE_SHARED_LOCK(try_lock_expr, lock_expr)                          \
+  do {                                                                         \
+    if (!stats) {                                                              \
+      lock_expr;                                                               \
+    } else if (try_lock_expr) {                                                \
+      ProfileAcquired(false, 0, true);                                         \
+    } else {                                                                   \
+      int64_t start = ProfileNow();                                            \
+      lock_expr;                                                               \
+      ProfileAcquired(true, ProfileNow() - start, true);                       \
+    }                                                                          \
+  } while (0)
+#define PROFILE_RELEASE() ProfileRelease()
+#define PROFILE_REACQUIRED() ProfileAcquired(false, 0)
+#else
+#define PROFILE_LOCK(try_lock_expr, lock_expr) lock_expr
+#define PROFILE_TIMED_LOCK(try_lock_expr, timed_lock_expr)                     \
+  ((try_lock_expr) || (timed_lock_expr))
+#define PROFILE_SHARED_LOCK(try_lock_expr, lock_expr) lock_expr
+#define PROFILE_RELEASE()
+#define PROFILE_REACQUIRED()
+#endif
+
+#ifdef LOCK_PROFILE
+struct LockStats {
+  LockStats(const std::string &n)
+      : name(n), acquire(0), contended(0), wait_total(0), wait_max(0),
+        hold_max(0) {}
+  void Reset() {
+    acquire = 0;
+    contended = 0;
+    wait_total = 0;
+    wait_max = 0;
+    hold_max = 0;
+  }
+  std::string name;
+  std::atomic<uint64_t> acquire;
+  std::atomic<uint64_t> contended;
+  std::atomic<int64_t> wait_total; // ns
+  std::atomic<int64_t> wait_max;   // ns
+  std::atomic<int64_t> hold_max;   // ns
+};
+
+static void atomic_max(std::atomic<int64_t> &v, int64_t val) {
+  int64_t cur = v.load(std::memory_order_relaxed);
+  while (val > cur &&
+         !v.compare_exchange_weak(cur, val, std::memory_order_relaxed))
+    ;
+}
+
+class LockStatsRegistry {
+public:
+  LockStats *Get(const std::string &name) {
+    std::lock_guard<std::mutex> _lg(mtx);
+    auto it = stats.find(name);
+    if (it != stats.end())
+      return it->second;
+    // never freed, locks may be destructed after registry
+    LockStats *ls = new LockStats(name);
+    stats[name] = ls;
+    return ls;
+  }
+  void Dump() {
+    std::vector<LockStats *> v;
+    {
+      std::lock_guard<std::mutex> _lg(mtx);
+      for (auto &it : stats)
+        v.push_back(it.second);
+    }
+    std::sort(v.begin(), v.end(), [](LockStats *a, LockStats *b) {
+      return a->wait_total > b->wait_total;
+    });
+    fprintf(stderr, "%-32s %12s %12s %12s %10s %10s\n", "lock", "acquire",
+            "contended", "wait(us)", "wait max", "hold max");
+    for (auto ls : v)
+      fprintf(stderr, "%-32s %12llu %12llu %12lld %10lld %10lld\n",
+              ls->name.c_str(), (unsigned long long)ls->acquire,
+              (unsigned long long)ls->contended,
+              (long long)(ls->wait_total / 1000),
+              (long long)(ls->wait_max / 1000),
+              (long long)(ls->hold_max / 1000));
+  }
+  void Reset() {
+    std::lock_guard<std::mutex> _lg(mtx);
+    for (auto &it : stats)
+      it.second->Reset();
+  }
+
+private:
+  std::mutex mtx;
+  std::map<std::string, LockStats *> stats;
+};
+
+static LockStatsRegistry &GetLockStatsRegistry() {
+  static LockStatsRegistry *registry = new LockStatsRegistry();
+  return *registry;
+}
+
+void LockMutex::SetName(const std::string &name) {
+  stats = GetLockStatsRegistry().Get(name);
+}
+
+int64_t LockMutex::ProfileNow() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (int64_t)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+void LockMutex::ProfileAcquired(bool contended, int64_t wait_ns,
+                                bool shared) {
+  if (!stats)
+    return;
+  stats->acquire.fetch_add(1, std::memory_order_relaxed);
+  if (contended) {
+    stats->contended.fetch_add(1, std::memory_order_relaxed);
+    stats->wait_total.fetch_add(wait_ns, std::memory_order_relaxed);
+    atomic_max(stats->wait_max, wait_ns);
+  }
+  if (!shared)
+    hold_start = ProfileNow();
+}
+
+void LockMutex::ProfileRelease() {
+  if (!stats || !hold_start)
+    return;
+  atomic_max(stats->hold_max, ProfileNow() - hold_start);
+  hold_start = 0;
+}
+
+void DumpLockStats() { GetLockStatsRegistry().Dump(); }
+void ResetLockStats() { GetLockStatsRegistry().Reset(); }
+#else
+void DumpLockStats() {
+  fprintf(stderr, "lock profile is disabled, rebuild with LOCK_PROFILE\n");
+}
+void ResetLockStats() {}
+#endif
+
 LockMutex::LockMutex()
 #ifndef NDEBUG
     : lock_times(0)
 #endif
 {
+#ifdef LOCK_PROFILE
+  stats = nullptr;
+  hold_start = 0;
+#endif
 }
 LockMutex::~LockMutex() {
 #ifndef NDEBUG
@@ -49,14 +213,26 @@ void LockMutex::locktimedec() {
 }
 
 void ConditionLockMutex::lock() {
-  mtx.lock();
+  PROFILE_LOCK(mtx.try_lock(), mtx.lock());
   locktimeinc();
 }
 void ConditionLockMutex::unlock() {
   locktimedec();
+  PROFILE_RELEASE();
   mtx.unlock();
 }
-void ConditionLockMutex::wait() { cond.wait(mtx); }
+void ConditionLockMutex::wait() {
+  PROFILE_RELEASE();
+  cond.wait(mtx);
+  PROFILE_REACQUIRED();
+}
+bool ConditionLockMutex::timedwait(int timeout_ms) {
+  PROFILE_RELEASE();
+  bool ret = cond.wait_for(mtx, std::chrono::milliseconds(timeout_ms)) ==
+             std::cv_status::no_timeout;
+  PROFILE_REACQUIRED();
+  return ret;
+}
 void ConditionLockMutex::notify() { cond.notify_all(); }
 
 ReadWriteLockMutex::ReadWriteLockMutex() : valid(true) {
@@ -73,29 +249,182 @@ ReadWriteLockMutex::~ReadWriteLockMutex() {
 void ReadWriteLockMutex::lock() {
   // write lock
   if (valid)
-    pthread_rwlock_wrlock(&rwlock);
+    PROFILE_LOCK(!pthread_rwlock_trywrlock(&rwlock),
+                 pthread_rwlock_wrlock(&rwlock));
   locktimeinc();
 }
 void ReadWriteLockMutex::unlock() {
   locktimedec();
+  PROFILE_RELEASE();
   if (valid)
     pthread_rwlock_unlock(&rwlock);
 }
 void ReadWriteLockMutex::read_lock() {
   if (valid)
-    pthread_rwlock_rdlock(&rwlock);
+    PROFILE_SHARED_LOCK(!pthread_rwlock_tryrdlock(&rwlock),
+                        pthread_rwlock_rdlock(&rwlock));
   locktimeinc();
 }
 
 SpinLockMutex::SpinLockMutex() : flag(ATOMIC_FLAG_INIT) {}
 void SpinLockMutex::lock() {
-  while (flag.test_and_set(std::memory_order_acquire))
-    ;
+  PROFILE_LOCK(!flag.test_and_set(std::memory_order_acquire),
+               while (flag.test_and_set(std::memory_order_acquire)));
   locktimeinc();
 }
 void SpinLockMutex::unlock() {
   locktimedec();
+  PROFILE_RELEASE();
   flag.clear(std::memory_order_release);
 }
 
+static inline void cpu_relax() {
+#if defined(__i386__) || defined(__x86_64__)
+  __builtin_ia32_pause();
+#elif defined(__aarch64__) || (defined(__arm__) && __ARM_ARCH >= 7)
+  __asm__ __volatile__("yield" ::: "memory");
+#else
+  __asm__ __volatile__("" ::: "memory");
+#endif
+}
+
+static inline int futex_wait(std::atomic_int *addr, int val,
+                             const struct timespec *timeout) {
+  return syscall(SYS_futex, reinterpret_cast<int *>(addr), FUTEX_WAIT_PRIVATE,
+                 val, timeout, nullptr, 0);
+}
+
+static inline void futex_wake(std::atomic_int *addr, int num) {
+  syscall(SYS_futex, reinterpret_cast<int *>(addr), FUTEX_WAKE_PRIVATE, num,
+          nullptr, nullptr, 0);
+}
+
+static int64_t monotonic_ms() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (int64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+// relative timeout until deadline, false if expired
+static bool remain_timespec(int64_t deadline_ms, struct timespec &ts) {
+  int64_t remain = deadline_ms - monotonic_ms();
+  if (remain <= 0)
+    return false;
+  ts.tv_sec = remain / 1000;
+  ts.tv_nsec = (remain % 1000) * 1000000;
+  return true;
+}
+
+AdaptiveLockMutex::AdaptiveLockMutex(int spin_rounds)
+    : state(0), seq(0), max_spin_rounds(spin_rounds) {}
+
+void AdaptiveLockMutex::lock() {
+  int c = 0;
+  // never timeout
+  bool ret _UNUSED = PROFILE_TIMED_LOCK(
+      state.compare_exchange_strong(c, 1, std::memory_order_acquire),
+      lock_slow(-1));
+  locktimeinc();
+}
+
+bool AdaptiveLockMutex::try_lock() {
+  int c = 0;
+  if (!state.compare_exchange_strong(c, 1, std::memory_order_acquire))
+    return false;
+  PROFILE_REACQUIRED();
+  locktimeinc();
+  return true;
+}
+
+bool AdaptiveLockMutex::timedlock(int timeout_ms) {
+  int c = 0;
+  if (!PROFILE_TIMED_LOCK(
+          state.compare_exchange_strong(c, 1, std::memory_order_acquire),
+          lock_slow(timeout_ms)))
+    return false;
+  locktimeinc();
+  return true;
+}
+
+bool AdaptiveLockMutex::lock_slow(int timeout_ms) {
+  static const int kMaxBackoff = 64; // cpu relax times
+  int backoff = 1;
+  for (int i = 0; i < max_spin_rounds; i++) {
+    for (int j = 0; j < backoff; j++)
+      cpu_relax();
+    if (backoff < kMaxBackoff)
+      backoff <<= 1;
+    int c = state.load(std::memory_order_relaxed);
+    // somebody has parked, the owner is likely to hold it long
+    if (c == 2)
+      break;
+    if (c == 0 &&
+        state.compare_exchange_weak(c, 1, std::memory_order_acquire))
+      return true;
+  }
+  int64_t deadline = timeout_ms >= 0 ? monotonic_ms() + timeout_ms : 0;
+  while (state.exchange(2, std::memory_order_acquire) != 0) {
+    struct timespec ts;
+    if (timeout_ms >= 0 && !remain_timespec(deadline, ts))
+      return false;
+    futex_wait(&state, 2, timeout_ms >= 0 ? &ts : nullptr);
+  }
+  return true;
+}
+
+void AdaptiveLockMutex::unlock() {
+  locktimedec();
+  PROFILE_RELEASE();
+  if (state.fetch_sub(1, std::memory_order_release) != 1) {
+    state.store(0, std::memory_order_release);
+    futex_wake(&state, 1);
+  }
+}
+
+void AdaptiveLockMutex::wait() {
+  int s = seq.load(std::memory_order_relaxed);
+  unlock();
+  futex_wait(&seq, s, nullptr);
+  lock();
+}
+
+bool AdaptiveLockMutex::timedwait(int timeout_ms) {
+  int s = seq.load(std::memory_order_relaxed);
+  struct timespec ts;
+  ts.tv_sec = timeout_ms / 1000;
+  ts.tv_nsec = (timeout_ms % 1000) * 1000000;
+  unlock();
+  int ret = futex_wait(&seq, s, &ts);
+  bool timeout = (ret < 0 && errno == ETIMEDOUT);
+  lock();
+  return !timeout;
+}
+
+void AdaptiveLockMutex::notify() {
+  seq.fetch_add(1, std::memory_order_release);
+  futex_wake(&seq, INT_MAX);
+}
+
+LockType GetLockTypeByString(const std::string &type) {
+  static std::map<std::string, LockType> lock_type_map = {
+      {KEY_LOCK_CONDITION, LockType::CONDITION},
+      {KEY_LOCK_ADAPTIVE, LockType::ADAPTIVE},
+      {KEY_LOCK_SPIN, LockType::SPIN}};
+  auto it = lock_type_map.find(type);
+  if (it != lock_type_map.end())
+    return it->second;
+  return LockType::NONE;
+}
+
+LockMutex *NewWaitableLockMutex(LockType type) {
+  switch (type) {
+  case LockType::CONDITION:
+    return new ConditionLockMutex();
+  case LockType::ADAPTIVE:
+    return new AdaptiveLockMutex();
+  default:
+    return nullptr;
+  }
+}
+
 } // namespace easymedia
@@ -28,16 +28,33 @@
 #include <atomic>
 #include <condition_variable>
 #include <mutex>
+#include <string>
+
+#include "utils.h"
 
 namespace easymedia {
 
-class LockMutex {
+// Per-lock contention statistics, compiled in only with LOCK_PROFILE.
+// Locks of the same name are accumulated together. The users of this
+// header must be compiled with the same LOCK_PROFILE definition as the
+// library.
+struct LockStats;
+
+class _API LockMutex {
 public:
   LockMutex();
   virtual ~LockMutex();
+  // name the lock for the statistics, only named locks are profiled
+#ifdef LOCK_PROFILE
+  void SetName(const std::string &name);
+#else
+  void SetName(const std::string &name _UNUSED) {}
+#endif
   virtual void lock() = 0;
   virtual void unlock() = 0;
   virtual void wait(){};
+  // return false if timeout
+  virtual bool timedwait(int timeout_ms _UNUSED) { return false; }
   virtual void notify(){};
   void locktimeinc();
   void locktimedec();
@@ -45,21 +62,52 @@ public:
 protected:
   std::atomic_int lock_times;
 #endif
+#ifdef LOCK_PROFILE
+protected:
+  // lock_fn is called only if try_fn fails, which is a contention.
+  // lock_fn returns false if it gives up, such as timeout.
+  template <class TryFn, class LockFn>
+  bool ProfileLock(TryFn try_fn, LockFn lock_fn) {
+    if (!stats)
+      return try_fn() || lock_fn();
+    if (try_fn()) {
+      ProfileAcquired(false, 0);
+      return true;
+    }
+    int64_t start = ProfileNow();
+    if (!lock_fn())
+      return false;
+    ProfileAcquired(true, ProfileNow() - start);
+    return true;
+  }
+  // shared acquisitions are not counted into hold time
+  void ProfileAcquired(bool contended, int64_t wait_ns, bool shared = false);
+  void ProfileRelease();
+  static int64_t ProfileNow();
+
+  LockStats *stats;
+  int64_t hold_start; // ns, 0 if not held exclusively
+#endif
 };
 
-class NonLockMutex : public LockMutex {
+// print the statistics of named locks, sorted by total wait time
+_API void DumpLockStats();
+_API void ResetLockStats();
+
+class _API NonLockMutex final : public LockMutex {
 public:
   virtual ~NonLockMutex() = default;
   virtual void lock() {}
   virtual void unlock() {}
 };
 
-class ConditionLockMutex : public LockMutex {
+class _API ConditionLockMutex final : public LockMutex {
 public:
   virtual ~ConditionLockMutex() = default;
   virtual void lock() override;
   virtual void unlock() override;
   virtual void wait() override;
+  virtual bool timedwait(int timeout_ms) override;
   virtual void notify() override;
 
 private:
@@ -67,7 +115,7 @@ private:
   std::condition_variable_any cond;
 };
 
-class ReadWriteLockMutex : public LockMutex {
+class _API ReadWriteLockMutex final : public LockMutex {
 public:
   ReadWriteLockMutex();
   virtual ~ReadWriteLockMutex();
@@ -82,7 +130,7 @@ private:
   pthread_rwlock_t rwlock;
 };
 
-class SpinLockMutex : public LockMutex {
+class _API SpinLockMutex final : public LockMutex {
 public:
   SpinLockMutex();
   virtual ~SpinLockMutex() = default;
@@ -95,7 +143,39 @@ private:
   std::atomic_flag flag;
 };
 
-class AutoLockMutex {
+// Spins with cpu relax and exponential backoff for a bounded time, then
+// parks on a futex. Suitable for the short critical sections of flow queues.
+class _API AdaptiveLockMutex final : public LockMutex {
+public:
+  static const int kDefaultSpinRounds = 10;
+  AdaptiveLockMutex(int spin_rounds = kDefaultSpinRounds);
+  virtual ~AdaptiveLockMutex() = default;
+  AdaptiveLockMutex(const AdaptiveLockMutex &) = delete;
+  AdaptiveLockMutex &operator=(const AdaptiveLockMutex &) = delete;
+  virtual void lock() override;
+  virtual void unlock() override;
+  bool try_lock();
+  // return false if timeout
+  bool timedlock(int timeout_ms);
+  virtual void wait() override;
+  virtual bool timedwait(int timeout_ms) override;
+  virtual void notify() override;
+
+private:
+  bool lock_slow(int timeout_ms);
+
+  std::atomic_int state; // 0: unlocked, 1: locked, 2: locked and parked
+  std::atomic_int seq;   // notify sequence
+  int max_spin_rounds;
+};
+
+// NONE is no lock, SPIN is not waitable
+enum class LockType { NONE, CONDITION, ADAPTIVE, SPIN };
+_API LockType GetLockTypeByString(const std::string &type);
+// lock which supports wait and notify, nullptr if type is NONE
+_API LockMutex *NewWaitableLockMutex(LockType type);
+
+class _API AutoLockMutex {
 public:
   AutoLockMutex(LockMutex &lm) : m_lm(lm) { m_lm.lock(); }
   ~AutoLockMutex() { m_lm.unlock(); }
@@ -104,6 +184,27 @@ private:
   LockMutex &m_lm;
 };
 
+// Lock policies for the hot paths. A policy is a concrete lock, which is
+// final so the calls are devirtualized, or NoLock for data only touched by
+// one thread, which compiles to nothing. Code templated on the policy is
+// selected once when the lock type is known, such as at flow setup.
+// Use AutoLockMutex where the lock is selected at runtime on every call.
+struct NoLock {
+  void lock() {}
+  void unlock() {}
+};
+
+template <class Lock> class AutoLock {
+public:
+  AutoLock(Lock &l) : m_l(l) { m_l.lock(); }
+  ~AutoLock() { m_l.unlock(); }
+  AutoLock(const AutoLock &) = delete;
+  AutoLock &operator=(const AutoLock &) = delete;
+
+private:
+  Lock &m_l;
+};
+
 } // namespace easymedia
 
 #endif // #ifndef EASYMEDIA_LOCK_H_
@@ -0,0 +1,237 @@
+/*
+ * Copyright (C) 2017 Hertz Wang 1989wanghang@163.com
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see http://www.gnu.org/licenses
+ *
+ * Any non-GPL usage of this software or parts of this software is strictly
+ * forbidden.
+ *
+ */
+
+#include "media_param.h"
+
+#include <errno.h>
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+#include <atomic>
+
+namespace easymedia {
+
+class KeyTable {
+public:
+  int Intern(const std::string &name) {
+    std::lock_guard<std::mutex> _lg(mtx);
+    auto it = ids.find(name);
+    if (it != ids.end())
+      return it->second;
+    int id = (int)names.size();
+    names.push_back(std::unique_ptr<std::string>(new std::string(name)));
+    ids[name] = id;
+    return id;
+  }
+  int Find(const char *name) {
+    std::lock_guard<std::mutex> _lg(mtx);
+    auto it = ids.find(name);
+    return it != ids.end() ? it->second : ParamKey::kInvalid;
+  }
+  const std::string &Name(int id) {
+    static const std::string empty;
+    std::lock_guard<std::mutex> _lg(mtx);
+    if (id < 0 || id >= (int)names.size())
+      return empty;
+    return *names[id];
+  }
+
+private:
+  std::mutex mtx;
+  std::unordered_map<std::string, int> ids;
+  // the address of names never changes
+  std::vector<std::unique_ptr<std::string>> names;
+};
+
+static KeyTable &GetKeyTable() {
+  // never destructed, keys may be used in static destructors
+  static KeyTable *table = new KeyTable();
+  return *table;
+}
+
+ParamKey::ParamKey(const char *name)
+    : id(GetKeyTable().Intern(name ? name : "")) {}
+ParamKey::ParamKey(const std::string &name) : id(GetKeyTable().Intern(name)) {}
+
+int ParamKey::Find(const char *name) {
+  if (!name)
+    return kInvalid;
+  return GetKeyTable().Find(name);
+}
+
+const std::string &ParamKey::Name(int id) { return GetKeyTable().Name(id); }
+
+bool MediaParam::ParseText(const char *param) {
+  std::map<int, Entry> parsed; // later duplicated keys overwrite
+  int line_num = 0;
+  const char *line = param;
+  while (*line) {
+    const char *end = strchr(line, '\n');
+    size_t len = end ? (size_t)(end - line) : strlen(line);
+    line_num++;
+    if (len > 0) {
+      const char *eq = static_cast<const char *>(memchr(line, '=', len));
+      Entry e;
+      if (!eq) {
+        error.append("line ")
+            .append(std::to_string(line_num))
+            .append(": missing '=' in \"")
+            .append(line, len)
+            .append("\"\n");
+        e.key = ParamKey(std::string(line, len)).id;
+      } else {
+        e.key = ParamKey(std::string(line, eq - line)).id;
+        e.value.assign(eq + 1, line + len - eq - 1);
+      }
+      const char *s = e.value.c_str();
+      char *num_end = nullptr;
+      errno = 0;
+      long long ll = strtoll(s, &num_end, 10);
+      e.is_int = (*s && *num_end == 0 && errno == 0);
+      e.int_val = e.is_int ? (int64_t)ll : 0;
+      errno = 0;
+      float f = strtof(s, &num_end);
+      e.is_float = (*s && *num_end == 0 && errno == 0);
+      e.float_val = e.is_float ? f : 0.0f;
+      parsed[e.key] = std::move(e);
+    }
+    if (!end)
+      break;
+    line = end + 1;
+  }
+  entries.reserve(parsed.size());
+  for (auto &it : parsed)
+    entries.push_back(std::move(it.second));
+  return IsValid();
+}
+
+const MediaParam::Entry *MediaParam::Find(int key) const {
+  if (key == ParamKey::kInvalid)
+    return nullptr;
+  auto it = std::lower_bound(
+      entries.begin(), entries.end(), key,
+      [](const Entry &e, int k) { return e.key < k; });
+  if (it == entries.end() || it->key != key)
+    return nullptr;
+  return &(*it);
+}
+
+bool MediaParam::GetInt(const ParamKey &key, int &val) const {
+  const Entry *e = Find(key.id);
+  if (!e || !e->is_int || e->int_val < INT_MIN || e->int_val > INT_MAX)
+    return false;
+  val = (int)e->int_val;
+  return true;
+}
+
+bool MediaParam::GetInt64(const ParamKey &key, int64_t &val) const {
+  const Entry *e = Find(key.id);
+  if (!e || !e->is_int)
+    return false;
+  val = e->int_val;
+  return true;
+}
+
+bool MediaParam::GetFloat(const ParamKey &key, float &val) const {
+  const Entry *e = Find(key.id);
+  if (!e || !e->is_float)
+    return false;
+  val = e->float_val;
+  return true;
+}
+
+void MediaParam::ToMap(std::map<std::string, std::string> &map) const {
+  for (auto &e : entries)
+    map[ParamKey::Name(e.key)] = e.value;
+}
+
+class MediaParamCache {
+public:
+  static const size_t kMaxSize = 256;
+  MediaParamCache() : enabled(true) {}
+  std::shared_ptr<const MediaParam> Get(const std::string &text) {
+    std::lock_guard<std::mutex> _lg(mtx);
+    auto it = params.find(text);
+    return it != params.end() ? it->second : nullptr;
+  }
+  void Put(const std::string &text,
+           const std::shared_ptr<const MediaParam> &param) {
+    std::lock_guard<std::mutex> _lg(mtx);
+    // params are small, simply restart when full
+    if (params.size() >= kMaxSize)
+      params.clear();
+    params[text] = param;
+  }
+  void Clear() {
+    std::lock_guard<std::mutex> _lg(mtx);
+    params.clear();
+  }
+
+  std::atomic_bool enabled;
+
+private:
+  std::mutex mtx;
+  std::unordered_map<std::string, std::shared_ptr<const MediaParam>> params;
+};
+
+static MediaParamCache &GetMediaParamCache() {
+  static MediaParamCache *cache = new MediaParamCache();
+  return *cache;
+}
+
+std::shared_ptr<const MediaParam> MediaParam::Parse(const char *param) {
+  if (!param)
+    return nullptr;
+  MediaParamCache &cache = GetMediaParamCache();
+  bool enabled = cache.enabled;
+  std::string text;
+  if (enabled) {
+    text = param;
+    auto cached = cache.Get(text);
+    if (cached)
+      return cached;
+  }
+  std::shared_ptr<MediaParam> mp(new MediaParam());
+  if (!mp) {
+    LOG_NO_MEMORY();
+    return nullptr;
+  }
+  if (!mp->ParseText(param))
+    LOG("bad media param:\n%s", mp->GetError().c_str());
+  if (enabled)
+    cache.Put(text, mp);
+  return mp;
+}
+
+void MediaParam::EnableCache(bool enable) {
+  MediaParamCache &cache = GetMediaParamCache();
+  cache.enabled = enable;
+  if (!enable)
+    cache.Clear();
+}
+
+bool MediaParam::IsCacheEnabled() { return GetMediaParamCache().enabled; }
+
+void MediaParam::ClearCache() { GetMediaParamCache().Clear(); }
+
+} // namespace easymedia
@@ -0,0 +1,152 @@
+/*
+ * Copyright (C) 2017 Hertz Wang 1989wanghang@163.com
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see http://www.gnu.org/licenses
+ *
+ * Any non-GPL usage of this software or parts of this software is strictly
+ * forbidden.
+ *
+ */
+
+#ifndef EASYMEDIA_MEDIA_PARAM_H_
+#define EASYMEDIA_MEDIA_PARAM_H_
+
+#include <stdint.h>
+
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "utils.h"
+
+namespace easymedia {
+
+// Interned key of param string. Keys of the same name have the same id
+// during the process lifetime.
+// Define the frequently used keys as static objects, such as
+//   static const ParamKey kFps(KEY_FPS);
+class _API ParamKey {
+public:
+  ParamKey(const char *name);
+  ParamKey(const std::string &name);
+  static const int kInvalid = -1;
+  // id of an interned name, kInvalid if never interned
+  static int Find(const char *name);
+  static const std::string &Name(int id);
+
+  int id;
+};
+
+// Compiled "key=value\n" param string. Values are converted to numbers at
+// parse time. The objects are immutable and may be shared between threads.
+class _API MediaParam {
+public:
+  // Parse param, or get the cached object of the same text.
+  // Return nullptr only if param is nullptr or out of memory.
+  static std::shared_ptr<const MediaParam> Parse(const char *param);
+  // The cache is enabled by default. Disable it to compare with plain
+  // string parsing, or to save memory.
+  static void EnableCache(bool enable);
+  static bool IsCacheEnabled();
+  static void ClearCache();
+
+  // Lines without '=' are kept as keys of empty values, but reported.
+  bool IsValid() const { return error.empty(); }
+  const std::string &GetError() const { return error; }
+
+  bool Has(const ParamKey &key) const { return Find(key.id) != nullptr; }
+  bool Has(const char *key) const { return Find(ParamKey::Find(key)); }
+  // nullptr if missing
+  const std::string *GetValue(const ParamKey &key) const {
+    const Entry *e = Find(key.id);
+    return e ? &e->value : nullptr;
+  }
+  std::string GetString(const ParamKey &key, const char *def = "") const {
+    const Entry *e = Find(key.id);
+    return e ? e->value : std::string(def);
+  }
+  // Return false and keep val if missing or not a number, so that val can be
+  // initialized with the default value.
+  bool GetInt(const ParamKey &key, int &val) const;
+  bool GetInt64(const ParamKey &key, int64_t &val) const;
+  bool GetFloat(const ParamKey &key, float &val) const;
+  size_t Size() const { return entries.size(); }
+  // insert to map as parse_media_param_map
+  void ToMap(std::map<std::string, std::string> &map) const;
+
+private:
+  struct Entry {
+    int key;
+    std::string value;
+    bool is_int;
+    bool is_float;
+    int64_t int_val;
+    float float_val;
+  };
+  MediaParam() = default;
+  bool ParseText(const char *param);
+  const Entry *Find(int key) const;
+
+  std::vector<Entry> entries; // sorted by key id
+  std::string error;
+};
+
+// Memoised results of matching rule strings, such as AcceptRules.
+class _API RuleMemo {
+public:
+  static const size_t kMaxSize = 256;
+  template <class MatchFn> bool Match(const char *rules, MatchFn fn) {
+    if (!rules)
+      return false;
+    if (!MediaParam::IsCacheEnabled())
+      return Compute(rules, fn);
+    std::string key(rules);
+    {
+      std::lock_guard<std::mutex> _lg(mtx);
+      auto it = results.find(key);
+      if (it != results.end())
+        return it->second;
+    }
+    bool ret = Compute(rules, fn);
+    std::lock_guard<std::mutex> _lg(mtx);
+    if (results.size() >= kMaxSize)
+      results.clear();
+    results[key] = ret;
+    return ret;
+  }
+  void Clear() {
+    std::lock_guard<std::mutex> _lg(mtx);
+    results.clear();
+  }
+
+private:
+  template <class MatchFn> static bool Compute(const char *rules, MatchFn fn) {
+    auto param = MediaParam::Parse(rules);
+    if (!param)
+      return false;
+    std::map<std::string, std::string> map;
+    param->ToMap(map);
+    return fn(map);
+  }
+
+  std::mutex mtx;
+  std::unordered_map<std::string, bool> results;
+};
+
+} // namespace easymedia
+
+#endif // #ifndef EASYMEDIA_MEDIA_PARAM_H_
@@ -23,6 +23,7 @@
 #define EASYMEDIA_MEDIA_REFLECTOR_H_
 
 #include "key_string.h"
+#include "media_type.h"
 #include "reflector.h"
 
 #include <algorithm>
@@ -45,39 +46,32 @@
          more ref to media_type.h */                                           \
       static const char *ExpectedInputDataType();                              \
       static const char *OutPutDataType();                                     \
+      /* capability bitsets of the above, built on first use */                \
+      static const MediaTypeSet &InputTypes();                                 \
+      static const MediaTypeSet &OutputTypes();                                \
+      const MediaTypeSet *InputTypeSet() const override {                      \
+        return &InputTypes();                                                  \
+      }                                                                        \
+      const MediaTypeSet *OutputTypeSet() const override {                     \
+        return &OutputTypes();                                                 \
+      }                                                                        \
                                                                                \
   )
 
 #define DEFINE_MEDIA_CHILD_FACTORY_EXTRA(REAL_PRODUCT)                         \
+  const MediaTypeSet &REAL_PRODUCT##Factory::InputTypes() {                    \
+    static const MediaTypeSet types =                                          \
+        MediaTypeSet::FromString(ExpectedInputDataType());                     \
+    return types;                                                              \
+  }                                                                            \
+  const MediaTypeSet &REAL_PRODUCT##Factory::OutputTypes() {                   \
+    static const MediaTypeSet types =                                          \
+        MediaTypeSet::FromString(OutPutDataType());                            \
+    return types;                                                              \
+  }                                                                            \
   bool REAL_PRODUCT##Factory::AcceptRules(                                     \
       const std::map<std::string, std::string> &map) const {                   \
-    static std::list<std::string> expected_data_type_list;                     \
-    static std::list<std::string> out_data_type_list;                          \
-    static const char *static_keys[] = {KEY_INPUTDATATYPE, KEY_OUTPUTDATATYPE, \
-                                        NULL};                                 \
-    static const decltype(ExpectedInputDataType) *static_call[] = {            \
-        &ExpectedInputDataType, &OutPutDataType, NULL};                        \
-    static std::list<std::string> *static_list[] = {                           \
-        &expected_data_type_list, &out_data_type_list, NULL};                  \
-    const char **keys = static_keys;                                           \
-    const decltype(ExpectedInputDataType) **call = static_call;                \
-    std::list<std::string> **list = static_list;                               \
-    while (*keys) {                                                            \
-      auto it = map.find(*keys);                                               \
-      if (it == map.end()) {                                                   \
-        if ((*call)())                                                         \
-          return false;                                                        \
-      } else {                                                                 \
-        const std::string &value = it->second;                                 \
-        if (!value.empty() &&                                                  \
-            !has_intersection(value.c_str(), (*call)(), *list))                \
-          return false;                                                        \
-      }                                                                        \
-      ++keys;                                                                  \
-      ++call;                                                                  \
-      ++list;                                                                  \
-    }                                                                          \
-    return true;                                                               \
+    return AcceptDataTypeRules(map, InputTypes(), OutputTypes());              \
   }
 
 #define DEFINE_MEDIA_NEW_PRODUCT_BY(REAL_PRODUCT, PRODUCT, COND)               \
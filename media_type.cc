@@ -20,6 +20,14 @@
  */
 
 #include "media_type.h"
+
+#include <string.h>
+
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+#include "key_string.h"
 #include "utils.h"
 
 namespace easymedia {
@@ -36,4 +44,143 @@ Type StringToDataType(const char *data_type) {
   return Type::None;
 }
 
-} // namespace easymedia
\ No newline at end of file
+class MediaTypeTable {
+public:
+  int GetId(const std::string &type) {
+    std::lock_guard<std::mutex> _lg(mtx);
+    auto it = ids.find(type);
+    if (it != ids.end())
+      return it->second;
+    if (names.size() >= MediaTypeSet::kMaxTypes) {
+      LOG("too many media types, can not register %s\n", type.c_str());
+      return -1;
+    }
+    int id = (int)names.size();
+    names.push_back(type);
+    ids[type] = id;
+    return id;
+  }
+  std::string GetName(int id) {
+    std::lock_guard<std::mutex> _lg(mtx);
+    if (id < 0 || id >= (int)names.size())
+      return std::string();
+    return names[id];
+  }
+
+private:
+  std::mutex mtx;
+  std::unordered_map<std::string, int> ids;
+  std::vector<std::string> names;
+};
+
+static MediaTypeTable &GetMediaTypeTable() {
+  // never destructed, factories may match types in static destructors
+  static MediaTypeTable *table = new MediaTypeTable();
+  return *table;
+}
+
+int MediaTypeSet::GetTypeId(const std::string &type) {
+  return GetMediaTypeTable().GetId(type);
+}
+
+std::string MediaTypeSet::GetTypeName(int id) {
+  return GetMediaTypeTable().GetName(id);
+}
+
+MediaTypeSet MediaTypeSet::FromString(const char *types) {
+  MediaTypeSet set;
+  if (!types)
+    return set;
+  if (!*types)
+    return Anything();
+  const char *p = types;
+  while (*p) {
+    size_t len = strcspn(p, ",\n");
+    if (len > 0 && !set.Add(std::string(p, len))) {
+      // can not be expressed, do not reject anything
+      return Anything();
+    }
+    p += len;
+    if (*p)
+      p++;
+  }
+  return set;
+}
+
+MediaTypeSet MediaTypeSet::Anything() {
+  MediaTypeSet set;
+  set.any = true;
+  return set;
+}
+
+bool MediaTypeSet::Add(const std::string &type) {
+  int id = GetTypeId(type);
+  if (id < 0)
+    return false;
+  bits.set(id);
+  return true;
+}
+
+bool MediaTypeSet::Intersects(const MediaTypeSet &other) const {
+  if (IsNothing() || other.IsNothing())
+    return false;
+  if (any || other.any)
+    return true;
+  return (bits & other.bits).any();
+}
+
+MediaTypeSet MediaTypeSet::Intersection(const MediaTypeSet &other) const {
+  if (any)
+    return other;
+  if (other.any)
+    return *this;
+  MediaTypeSet set;
+  set.bits = bits & other.bits;
+  return set;
+}
+
+std::vector<int> MediaTypeSet::GetIds() const {
+  std::vector<int> ids;
+  if (any)
+    return ids;
+  for (int i = 0; i < kMaxTypes; i++) {
+    if (bits.test(i))
+      ids.push_back(i);
+  }
+  return ids;
+}
+
+std::string MediaTypeSet::ToString() const {
+  if (any)
+    return "<anything>";
+  if (bits.none())
+    return "<nothing>";
+  std::string str;
+  for (int id : GetIds()) {
+    if (!str.empty())
+      str.append(",");
+    str.append(GetTypeName(id));
+  }
+  return str;
+}
+
+bool AcceptDataTypeRules(const std::map<std::string, std::string> &rules,
+                         const MediaTypeSet &in, const MediaTypeSet &out) {
+  static const char *keys[] = {KEY_INPUTDATATYPE, KEY_OUTPUTDATATYPE};
+  const MediaTypeSet *caps[] = {&in, &out};
+  for (int i = 0; i < 2; i++) {
+    auto it = rules.find(keys[i]);
+    if (it == rules.end()) {
+      if (!caps[i]->IsNothing())
+        return false;
+    } else {
+      const std::string &value = it->second;
+      if (!value.empty() &&
+          !MediaTypeSet::FromString(value.c_str()).Intersects(*caps[i]))
+        return false;
+    }
+  }
+  return true;
+}
+
+} // namespace easymedia
@@ -83,17 +83,66 @@ enum class Type { None = -1, Audio = 0, Image, Video, Text };
 #define NN_UINT8 "nn:uint8"
 #define NN_INT16 "nn:int16"
 
+#include <bitset>
+#include <map>
 #include <string>
+#include <vector>
+
+#include "utils.h"
 
 namespace easymedia {
 
 Type StringToDataType(const char *data_type);
 
+// A set of media types. Type strings are registered to compact ids on first
+// use, so that matching two sets is a bit operation instead of comparing
+// strings.
+class _API MediaTypeSet {
+public:
+  static const int kMaxTypes = 128;
+  // empty set, the same as TYPE_NOTHING
+  MediaTypeSet() : any(false) {}
+  // Type list separated by "\n" or ",", such as the return value of
+  // ExpectedInputDataType. TYPE_NOTHING(nullptr) is the empty set, while
+  // TYPE_ANYTHING("") matches any type.
+  static MediaTypeSet FromString(const char *types);
+  static MediaTypeSet Anything();
+  // register the type string, return -1 if too many types
+  static int GetTypeId(const std::string &type);
+  static std::string GetTypeName(int id);
+
+  bool Add(const std::string &type);
+  void AddId(int id) { bits.set(id); }
+  bool Has(int id) const {
+    return any || (id >= 0 && id < kMaxTypes && bits.test(id));
+  }
+  // ids of the registered types in set, empty if IsAnything
+  std::vector<int> GetIds() const;
+  bool IsAnything() const { return any; }
+  bool IsNothing() const { return !any && bits.none(); }
+  bool operator==(const MediaTypeSet &other) const {
+    return any == other.any && bits == other.bits;
+  }
+  bool operator!=(const MediaTypeSet &other) const { return !(*this == other); }
+  bool Intersects(const MediaTypeSet &other) const;
+  MediaTypeSet Intersection(const MediaTypeSet &other) const;
+  std::string ToString() const;
+
+private:
+  bool any;
+  std::bitset<kMaxTypes> bits;
+};
+
 class SupportMediaTypes {
 public:
   std::string types;
 };
 
+// Whether a factory of input types 'in' and output types 'out' accepts the
+// input_data_type/output_data_type of rules.
+_API bool AcceptDataTypeRules(const std::map<std::string, std::string> &rules,
+                              const MediaTypeSet &in, const MediaTypeSet &out);
+
 } // namespace easymedia
 
 #endif // #ifndef EASYMEDIA_MEDIA_TYPE_H_
@@ -0,0 +1,302 @@
+/*
+ * Copyright (C) 2017 Hertz Wang 1989wanghang@163.com
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see http://www.gnu.org/licenses
+ *
+ * Any non-GPL usage of this software or parts of this software is strictly
+ * forbidden.
+ *
+ */
+
+#include "negotiation.h"
+
+#include <stdio.h>
+
+#include <algorithm>
+#include <deque>
+#include <mutex>
+#include <set>
+#include <tuple>
+
+#include "key_string.h"
+
+namespace easymedia {
+
+FlowCaps FlowCaps::Intersection(const FlowCaps &other) const {
+  FlowCaps caps;
+  caps.types = types.Intersection(other.types);
+  caps.width = width ? width : other.width;
+  caps.height = width ? height : other.height;
+  if (!mem_types)
+    caps.mem_types = other.mem_types;
+  else if (!other.mem_types)
+    caps.mem_types = mem_types;
+  else
+    caps.mem_types = mem_types & other.mem_types;
+  return caps;
+}
+
+std::string FlowCaps::ToString() const {
+  std::string str = types.ToString();
+  if (width > 0)
+    str.append(" ")
+        .append(std::to_string(width))
+        .append("x")
+        .append(std::to_string(height));
+  if (mem_types) {
+    char mem[16];
+    snprintf(mem, sizeof(mem), " mem=0x%x", mem_types);
+    str.append(mem);
+  }
+  return str;
+}
+
+std::string LinkReport::ToString() const {
+  std::string str("link [");
+  str.append(caps.ToString()).append("]");
+  if (converters.empty())
+    return str.append(" directly");
+  str.append(" by ").append(std::to_string(converters.size()));
+  str.append(" conversion(s):");
+  for (auto &step : steps)
+    str.append("\n  ").append(step);
+  return str;
+}
+
+class ConverterRegistry {
+public:
+  bool Register(const ConverterInfo &info) {
+    if (info.name.empty() || info.filter_name.empty())
+      return false;
+    std::lock_guard<std::mutex> _lg(mtx);
+    for (auto &c : converters) {
+      if (c.name == info.name) {
+        c = info;
+        return true;
+      }
+    }
+    converters.push_back(info);
+    return true;
+  }
+  void Unregister(const std::string &name) {
+    std::lock_guard<std::mutex> _lg(mtx);
+    for (auto it = converters.begin(); it != converters.end(); ++it) {
+      if (it->name == name) {
+        converters.erase(it);
+        break;
+      }
+    }
+  }
+  // hardware converters first, then in registration order
+  std::vector<ConverterInfo> Snapshot() {
+    std::lock_guard<std::mutex> _lg(mtx);
+    std::vector<ConverterInfo> ret(converters);
+    std::stable_sort(ret.begin(), ret.end(),
+                     [](const ConverterInfo &a, const ConverterInfo &b) {
+                       return a.hardware && !b.hardware;
+                     });
+    return ret;
+  }
+
+private:
+  std::mutex mtx;
+  std::vector<ConverterInfo> converters;
+};
+
+static ConverterRegistry &GetConverterRegistry() {
+  // never destructed, converters register in static constructors
+  static ConverterRegistry *registry = new ConverterRegistry();
+  return *registry;
+}
+
+bool RegisterConverter(const ConverterInfo &info) {
+  return GetConverterRegistry().Register(info);
+}
+
+void UnregisterConverter(const std::string &name) {
+  GetConverterRegistry().Unregister(name);
+}
+
+// the type is not decided, as the producer outputs anything
+static const int kUnknownType = -1;
+// longer paths cost more than a failed link reveals
+static const int kMaxConversions = 3;
+
+struct PathNode {
+  int type;
+  bool sized; // size matches the consumer
+  bool mem;   // memory matches the consumer
+  int depth;
+  int prev;      // index of previous node, -1 for start
+  int converter; // index of converter producing this node
+};
+
+static std::string TypeName(int type) {
+  return type == kUnknownType ? std::string("<any>")
+                              : MediaTypeSet::GetTypeName(type);
+}
+
+// width and height of output, 0 if not known
+static std::shared_ptr<Flow> CreateConverterFlow(const ConverterInfo &c,
+                                                 int in_type, int out_type,
+                                                 int width, int height) {
+  // the filter gets the data types too, which also keeps its param not empty
+  std::string types;
+  if (in_type != kUnknownType)
+    PARAM_STRING_APPEND(types, KEY_INPUTDATATYPE, TypeName(in_type));
+  if (out_type != kUnknownType)
+    PARAM_STRING_APPEND(types, KEY_OUTPUTDATATYPE, TypeName(out_type));
+  if (types.empty() && c.filter_param.empty()) {
+    LOG("converter %s has no param\n", c.name.c_str());
+    return nullptr;
+  }
+  std::string param;
+  PARAM_STRING_APPEND(param, KEY_NAME, c.filter_name);
+  param.append(types);
+  if (width > 0 && height > 0) {
+    PARAM_STRING_APPEND_TO(param, KEY_BUFFER_WIDTH, width);
+    PARAM_STRING_APPEND_TO(param, KEY_BUFFER_HEIGHT, height);
+    PARAM_STRING_APPEND_TO(param, KEY_BUFFER_VIR_WIDTH, width);
+    PARAM_STRING_APPEND_TO(param, KEY_BUFFER_VIR_HEIGHT, height);
+  }
+  std::string &&flow_param = JoinFlowParam(param, 1, types + c.filter_param);
+  return REFLECTOR(Flow)::Create<Flow>("filter", flow_param.c_str());
+}
+
+bool NegotiateLink(const FlowCaps &from, const FlowCaps &to,
+                   LinkReport &report) {
+  report.converters.clear();
+  report.steps.clear();
+  if (from.Intersects(to)) {
+    report.caps = from.Intersection(to);
+    return true;
+  }
+  if (from.types.IsNothing() || to.types.IsNothing())
+    return false;
+
+  std::vector<ConverterInfo> &&converters = GetConverterRegistry().Snapshot();
+  if (converters.empty())
+    return false;
+  std::vector<PathNode> nodes;
+  std::deque<int> queue;
+  std::set<std::tuple<int, bool, bool>> visited;
+  auto is_goal = [&to](const PathNode &n) {
+    return n.sized && n.mem && (n.type == kUnknownType || to.types.Has(n.type));
+  };
+  auto visit = [&](const PathNode &n) {
+    if (!visited.insert(std::make_tuple(n.type, n.sized, n.mem)).second)
+      return -1;
+    nodes.push_back(n);
+    queue.push_back((int)nodes.size() - 1);
+    return (int)nodes.size() - 1;
+  };
+  std::vector<int> start_types = from.types.GetIds();
+  if (from.types.IsAnything())
+    start_types.push_back(kUnknownType);
+  for (int type : start_types)
+    visit({type, from.SizeIntersects(to), from.MemIntersects(to), 0, -1, -1});
+
+  int goal = -1;
+  while (!queue.empty() && goal < 0) {
+    int index = queue.front();
+    queue.pop_front();
+    if (nodes[index].depth >= kMaxConversions)
+      continue;
+    for (size_t ci = 0; ci < converters.size() && goal < 0; ci++) {
+      const ConverterInfo &c = converters[ci];
+      PathNode cur = nodes[index];
+      if (cur.type == kUnknownType ? c.input_types.IsNothing()
+                                   : !c.input_types.Has(cur.type))
+        continue;
+      std::vector<int> out_types;
+      if (c.output_types.IsAnything()) {
+        out_types.push_back(cur.type);
+      } else {
+        // try the types of consumer first
+        for (int type : c.output_types.GetIds())
+          if (to.types.Has(type))
+            out_types.push_back(type);
+        for (int type : c.output_types.GetIds())
+          if (!to.types.Has(type))
+            out_types.push_back(type);
+      }
+      FlowCaps out_mem;
+      out_mem.mem_types = c.output_mem_types;
+      for (int type : out_types) {
+        PathNode n = {type,
+                      cur.sized || c.can_scale,
+                      c.output_mem_types ? out_mem.MemIntersects(to) : cur.mem,
+                      cur.depth + 1,
+                      index,
+                      (int)ci};
+        int added = visit(n);
+        if (added >= 0 && is_goal(n)) {
+          goal = added;
+          break;
+        }
+      }
+    }
+  }
+  if (goal < 0)
+    return false;
+
+  std::vector<int> path;
+  for (int i = goal; nodes[i].prev >= 0; i = nodes[i].prev)
+    path.push_back(i);
+  std::reverse(path.begin(), path.end());
+  FlowCaps caps = from;
+  for (int i : path) {
+    const PathNode &n = nodes[i];
+    const PathNode &p = nodes[n.prev];
+    const ConverterInfo &c = converters[n.converter];
+    // scale at the first converter which can
+    bool scale = c.can_scale && !p.sized;
+    auto flow = CreateConverterFlow(c, p.type, n.type,
+                                    scale ? to.width : caps.width,
+                                    scale ? to.height : caps.height);
+    if (!flow) {
+      LOG("Fail to create converter %s\n", c.name.c_str());
+      report.converters.clear();
+      report.steps.clear();
+      return false;
+    }
+    FlowCaps in = caps;
+    FlowCaps out = caps;
+    if (p.type != kUnknownType) {
+      in.types = MediaTypeSet();
+      in.types.AddId(p.type);
+    }
+    if (n.type != kUnknownType) {
+      out.types = MediaTypeSet();
+      out.types.AddId(n.type);
+    }
+    if (scale) {
+      out.width = to.width;
+      out.height = to.height;
+    }
+    if (c.output_mem_types)
+      out.mem_types = c.output_mem_types;
+    flow->LimitCaps(in, out);
+    std::string step(c.name);
+    step.append(": ").append(in.ToString()).append(" -> ").append(
+        out.ToString());
+    report.steps.push_back(step);
+    report.converters.push_back(flow);
+    caps = out;
+  }
+  report.caps = caps.Intersection(to);
+  return true;
+}
+
+} // namespace easymedia
@@ -0,0 +1,80 @@
+/*
+ * Copyright (C) 2017 Hertz Wang 1989wanghang@163.com
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see http://www.gnu.org/licenses
+ *
+ * Any non-GPL usage of this software or parts of this software is strictly
+ * forbidden.
+ *
+ */
+
+#ifndef EASYMEDIA_NEGOTIATION_H_
+#define EASYMEDIA_NEGOTIATION_H_
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "flow.h"
+
+namespace easymedia {
+
+// A filter which can convert the format, size or memory type of buffers.
+// Flow::AddDownFlow inserts registered converters as "filter" flows when the
+// caps of two linked flows do not intersect.
+struct _API ConverterInfo {
+  ConverterInfo()
+      : input_types(MediaTypeSet::Anything()),
+        output_types(MediaTypeSet::Anything()), can_scale(false),
+        output_mem_types(0), hardware(false) {}
+  std::string name;         // unique name of the converter
+  std::string filter_name;  // identifier in REFLECTOR(Filter)
+  std::string filter_param; // param of the filter itself
+  MediaTypeSet input_types;
+  // anything means the converter keeps the input type
+  MediaTypeSet output_types;
+  bool can_scale;
+  // memory of output buffers, 0 means the same to input
+  uint32_t output_mem_types;
+  // hardware converters are preferred among paths of the same length
+  bool hardware;
+};
+
+_API bool RegisterConverter(const ConverterInfo &info);
+_API void UnregisterConverter(const std::string &name);
+
+// The negotiated result of a link from up flow to down flow.
+struct _API LinkReport {
+  Flow *up;
+  Flow *down;
+  int out_slot;
+  int in_slot;
+  // caps of buffers arriving at down flow
+  FlowCaps caps;
+  // the inserted converter flows in order, empty if linked directly
+  std::vector<std::shared_ptr<Flow>> converters;
+  // one description per conversion
+  std::vector<std::string> steps;
+  std::string ToString() const;
+};
+
+// Find the path of fewest conversions from caps 'from' to caps 'to', and
+// create the converter flows of the path into report. The converter flows
+// are not linked yet. Return false if no path exists.
+_API bool NegotiateLink(const FlowCaps &from, const FlowCaps &to,
+                        LinkReport &report);
+
+} // namespace easymedia
+
+#endif // #ifndef EASYMEDIA_NEGOTIATION_H_
@@ -103,46 +103,45 @@ bool OggMuxer::NewMuxerStream(
 
 // return the data length
 static size_t _write_ogg_page(const ogg_page &og,
-                              std::list<std::pair<void *, size_t>> &pages,
+                              std::list<std::shared_ptr<MediaBuffer>> &pages,
                               std::shared_ptr<Stream> &out) {
+  size_t len = (og.header_len + og.body_len);
   if (out) {
-    int wlen = out->Write(og.header, 1, og.header_len);
-    if (wlen != og.header_len)
-      LOG("write_ogg_page failed, %m\n");
-    wlen = out->Write(og.body, 1, og.body_len);
-    if (wlen != og.body_len)
+    struct iovec iov[2] = {{og.header, (size_t)og.header_len},
+                           {og.body, (size_t)og.body_len}};
+    size_t wlen = out->WriteV(iov, 2);
+    if (wlen != len)
       LOG("write_ogg_page failed, %m\n");
   }
-  size_t len = (og.header_len + og.body_len);
-  void *buffer = malloc(len);
+  // the page memory belongs to ogg stream, copy it once
+  auto buffer = MediaBuffer::Alloc(len);
   if (!buffer) {
     errno = ENOMEM;
     return 0;
   }
-  memcpy(buffer, og.header, og.header_len);
-  memcpy(((unsigned char *)buffer) + og.header_len, og.body, og.body_len);
-  pages.push_back(std::pair<void *, size_t>(buffer, len));
+  memcpy(buffer->GetPtr(), og.header, og.header_len);
+  memcpy(((unsigned char *)buffer->GetPtr()) + og.header_len, og.body,
+         og.body_len);
+  buffer->SetValidSize(len);
+  pages.push_back(buffer);
   return len;
 }
 
+// chain the pages without copying
 std::shared_ptr<MediaBuffer>
-_gather_data(const std::list<std::pair<void *, size_t>> &pages,
+_gather_data(const std::list<std::shared_ptr<MediaBuffer>> &pages,
              size_t total_len) {
   if (total_len == 0)
     return nullptr;
-  unsigned char *total_buffer;
-  auto ret = MediaBuffer::Alloc(total_len);
-  if (ret) {
-    ret->SetValidSize(total_len);
-  } else {
+  if (pages.size() == 1)
+    return pages.front();
+  auto ret = std::make_shared<ChainBuffer>();
+  if (!ret) {
     errno = ENOMEM;
     return nullptr;
   }
-  total_buffer = (unsigned char *)ret->GetPtr();
-  for (auto &p : pages) {
-    memcpy(total_buffer, p.first, p.second);
-    total_buffer += p.second;
-  }
+  for (auto &p : pages)
+    ret->Append(p);
   return ret;
 }
 
@@ -155,7 +154,7 @@ std::shared_ptr<MediaBuffer> OggMuxer::WriteHeader(int stream_no) {
   ogg_stream_state &os = s->second;
   std::shared_ptr<MediaBuffer> ret;
   size_t total_len = 0;
-  std::list<std::pair<void *, size_t>> pages;
+  std::list<std::shared_ptr<MediaBuffer>> pages;
   while (true) {
     ogg_page og;
     int result = ogg_stream_flush(&os, &og);
@@ -169,8 +168,6 @@ std::shared_ptr<MediaBuffer> OggMuxer::WriteHeader(int stream_no) {
   ret = _gather_data(pages, total_len);
 
 out:
-  for (auto &p : pages)
-    free(p.first);
   return ret;
 }
 
@@ -203,7 +200,7 @@ OggMuxer::Write(std::shared_ptr<MediaBuffer> orig_data, int stream_no) {
   bool eos = false;
   std::shared_ptr<MediaBuffer> ret;
   size_t total_len = 0;
-  std::list<std::pair<void *, size_t>> pages;
+  std::list<std::shared_ptr<MediaBuffer>> pages;
   while (!eos) {
     ogg_page og;
     result = ogg_stream_pageout(&os, &og);
@@ -218,14 +215,13 @@ OggMuxer::Write(std::shared_ptr<MediaBuffer> orig_data, int stream_no) {
   }
   ret = _gather_data(pages, total_len);
   if (eos) {
-    ret->SetEOF(true);
+    if (ret)
+      ret->SetEOF(true);
     ogg_stream_clear(&os);
     streams.erase(stream_no);
   }
 
 out:
-  for (auto &p : pages)
-    free(p.first);
   return ret;
 }
 
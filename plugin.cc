@@ -0,0 +1,339 @@
+/*
+ * Copyright (C) 2017 Hertz Wang 1989wanghang@163.com
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see http://www.gnu.org/licenses
+ *
+ * Any non-GPL usage of this software or parts of this software is strictly
+ * forbidden.
+ *
+ */
+
+#include "plugin.h"
+
+#include <dirent.h>
+#include <dlfcn.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <fstream>
+#include <list>
+#include <mutex>
+#include <set>
+
+#include "media_param.h"
+
+namespace easymedia {
+
+static const char kManifestSuffix[] = ".manifest";
+
+struct RegisteredFactory {
+  std::string product;
+  std::string identifier;
+  bool has_types;
+  MediaTypeSet input_types;
+  MediaTypeSet output_types;
+};
+// factories registered by the library being loaded on this thread
+static thread_local std::vector<RegisteredFactory> *loading_factories;
+
+class PluginRegistry {
+public:
+  PluginRegistry() : scanned(false) {
+    const char *env = getenv("EASYMEDIA_PLUGIN_PATH");
+    if (env)
+      path = env;
+#ifdef EASYMEDIA_PLUGIN_DIR
+    else
+      path = EASYMEDIA_PLUGIN_DIR;
+#endif
+  }
+  void SetPath(const std::string &p) {
+    std::lock_guard<std::mutex> _lg(mtx);
+    path = p;
+    scanned = false;
+  }
+  std::vector<PluginFactoryInfo> GetFactories() {
+    std::lock_guard<std::mutex> _lg(mtx);
+    Scan();
+    return std::vector<PluginFactoryInfo>(entries.begin(), entries.end());
+  }
+  bool Load(const char *product, const char *identifier);
+  const char *Find(const char *product, const char *rules);
+  bool Accepts(const char *product, const char *identifier, const char *rules);
+  void Dump(const char *product);
+
+private:
+  void Scan();
+  void ParseManifest(const std::string &dir, const std::string &file);
+  void CheckManifest(const std::string &library,
+                     const std::vector<RegisteredFactory> &registered);
+  PluginFactoryInfo *Get(const char *product, const char *identifier);
+
+  std::mutex mtx;
+  bool scanned;
+  std::string path;
+  // never erased, Find returns the identifiers
+  std::list<PluginFactoryInfo> entries;
+  std::set<std::string> libraries;
+};
+
+void PluginRegistry::ParseManifest(const std::string &dir,
+                                   const std::string &file) {
+  std::ifstream in(dir + "/" + file);
+  std::string line;
+  std::string library;
+  PluginFactoryInfo *cur = nullptr;
+  while (std::getline(in, line)) {
+    if (line.empty() || line[0] == '#')
+      continue;
+    size_t eq = line.find('=');
+    if (eq == std::string::npos) {
+      LOG("%s: bad line \"%s\"\n", file.c_str(), line.c_str());
+      continue;
+    }
+    std::string key = line.substr(0, eq);
+    std::string value = line.substr(eq + 1);
+    if (key == "library") {
+      library = value[0] == '/' ? value : dir + "/" + value;
+    } else if (key == "factory") {
+      size_t sp = value.find(' ');
+      if (library.empty() || sp == std::string::npos) {
+        LOG("%s: bad factory \"%s\"\n", file.c_str(), value.c_str());
+        cur = nullptr;
+        continue;
+      }
+      std::string product = value.substr(0, sp);
+      std::string identifier = value.substr(sp + 1);
+      cur = Get(product.c_str(), identifier.c_str());
+      if (cur) {
+        // the first directory in path wins
+        cur = nullptr;
+        continue;
+      }
+      PluginFactoryInfo info;
+      info.product = product;
+      info.identifier = identifier;
+      info.library = library;
+      info.loaded = libraries.count(library) > 0;
+      info.mismatched = false;
+      entries.push_back(info);
+      cur = &entries.back();
+    } else if (cur && key == "input") {
+      cur->input_types = MediaTypeSet::FromString(value.c_str());
+    } else if (cur && key == "output") {
+      cur->output_types = MediaTypeSet::FromString(value.c_str());
+    }
+  }
+}
+
+void PluginRegistry::Scan() {
+  if (scanned)
+    return;
+  scanned = true;
+  size_t start = 0;
+  while (start <= path.size()) {
+    size_t end = path.find(':', start);
+    if (end == std::string::npos)
+      end = path.size();
+    std::string dir = path.substr(start, end - start);
+    start = end + 1;
+    if (dir.empty())
+      continue;
+    DIR *d = opendir(dir.c_str());
+    if (!d)
+      continue;
+    struct dirent *ent;
+    while ((ent = readdir(d)) != nullptr) {
+      size_t len = strlen(ent->d_name);
+      size_t suffix_len = sizeof(kManifestSuffix) - 1;
+      if (len > suffix_len &&
+          !strcmp(ent->d_name + len - suffix_len, kManifestSuffix))
+        ParseManifest(dir, ent->d_name);
+    }
+    closedir(d);
+  }
+}
+
+PluginFactoryInfo *PluginRegistry::Get(const char *product,
+                                       const char *identifier) {
+  for (auto &e : entries) {
+    if (e.product == product && e.identifier == identifier)
+      return &e;
+  }
+  return nullptr;
+}
+
+bool PluginRegistry::Load(const char *product, const char *identifier) {
+  std::lock_guard<std::mutex> _lg(mtx);
+  Scan();
+  PluginFactoryInfo *e = Get(product, identifier);
+  if (!e || e->loaded)
+    return false;
+  int64_t start = gettimeofday();
+  // factories register themselves in static constructors
+  std::vector<RegisteredFactory> registered;
+  loading_factories = &registered;
+  void *handle = dlopen(e->library.c_str(), RTLD_NOW);
+  loading_factories = nullptr;
+  if (!handle) {
+    LOG("Fail to load plugin %s: %s\n", e->library.c_str(), dlerror());
+    return false;
+  }
+  LOGD("loaded plugin %s for %s %s, %lld us\n", e->library.c_str(), product,
+       identifier, (long long)(gettimeofday() - start));
+  libraries.insert(e->library);
+  for (auto &it : entries) {
+    if (it.library == e->library)
+      it.loaded = true;
+  }
+  CheckManifest(e->library, registered);
+  return true;
+}
+
+void PluginRegistry::CheckManifest(
+    const std::string &library,
+    const std::vector<RegisteredFactory> &registered) {
+  for (auto &r : registered) {
+    PluginFactoryInfo *e = Get(r.product.c_str(), r.identifier.c_str());
+    if (!e || e->library != library) {
+      LOG("%s: %s %s is not in the manifest\n", library.c_str(),
+          r.product.c_str(), r.identifier.c_str());
+      continue;
+    }
+    if (r.has_types && (r.input_types != e->input_types ||
+                        r.output_types != e->output_types)) {
+      LOG("%s: manifest of %s %s is input=%s output=%s, while the factory is "
+          "input=%s output=%s\n",
+          library.c_str(), r.product.c_str(), r.identifier.c_str(),
+          e->input_types.ToString().c_str(),
+          e->output_types.ToString().c_str(),
+          r.input_types.ToString().c_str(), r.output_types.ToString().c_str());
+      e->mismatched = true;
+    }
+  }
+  for (auto &e : entries) {
+    if (e.library != library)
+      continue;
+    bool found = false;
+    for (auto &r : registered) {
+      if (r.product == e.product && r.identifier == e.identifier) {
+        found = true;
+        break;
+      }
+    }
+    if (!found) {
+      LOG("%s: %s %s of the manifest is not registered\n", library.c_str(),
+          e.product.c_str(), e.identifier.c_str());
+      e.mismatched = true;
+    }
+  }
+}
+
+const char *PluginRegistry::Find(const char *product, const char *rules) {
+  auto param = MediaParam::Parse(rules);
+  if (!param)
+    return nullptr;
+  std::map<std::string, std::string> map;
+  param->ToMap(map);
+  std::lock_guard<std::mutex> _lg(mtx);
+  Scan();
+  for (auto &e : entries) {
+    if (!e.loaded && e.product == product &&
+        AcceptDataTypeRules(map, e.input_types, e.output_types))
+      return e.identifier.c_str();
+  }
+  return nullptr;
+}
+
+bool PluginRegistry::Accepts(const char *product, const char *identifier,
+                             const char *rules) {
+  auto param = MediaParam::Parse(rules);
+  if (!param)
+    return false;
+  std::map<std::string, std::string> map;
+  param->ToMap(map);
+  std::lock_guard<std::mutex> _lg(mtx);
+  Scan();
+  PluginFactoryInfo *e = Get(product, identifier);
+  if (!e || e->loaded)
+    return false;
+  return AcceptDataTypeRules(map, e->input_types, e->output_types);
+}
+
+void PluginRegistry::Dump(const char *product) {
+  std::lock_guard<std::mutex> _lg(mtx);
+  Scan();
+  for (auto &e : entries) {
+    if (!e.loaded && e.product == product)
+      printf(" %s(plugin)", e.identifier.c_str());
+  }
+}
+
+static PluginRegistry &GetPluginRegistry() {
+  // never destructed, lookups may happen in static destructors
+  static PluginRegistry *registry = new PluginRegistry();
+  return *registry;
+}
+
+void SetPluginPath(const std::string &path) {
+  GetPluginRegistry().SetPath(path);
+}
+
+std::vector<PluginFactoryInfo> GetPluginFactories() {
+  return GetPluginRegistry().GetFactories();
+}
+
+bool LoadPluginFactory(const char *product, const char *identifier) {
+  if (!product || !identifier)
+    return false;
+  return GetPluginRegistry().Load(product, identifier);
+}
+
+const char *FindPluginFactory(const char *product, const char *rules) {
+  if (!product || !rules)
+    return nullptr;
+  return GetPluginRegistry().Find(product, rules);
+}
+
+bool PluginFactoryAccepts(const char *product, const char *identifier,
+                          const char *rules) {
+  if (!product || !identifier || !rules)
+    return false;
+  return GetPluginRegistry().Accepts(product, identifier, rules);
+}
+
+void DumpPluginFactories(const char *product) {
+  GetPluginRegistry().Dump(product);
+}
+
+void NotePluginFactoryRegistered(const char *product, const char *identifier,
+                                 const MediaTypeSet *input_types,
+                                 const MediaTypeSet *output_types) {
+  // called in the static constructors of the library, while the registry is
+  // locked by Load on the same thread
+  if (!loading_factories)
+    return;
+  RegisteredFactory r;
+  r.product = product;
+  r.identifier = identifier;
+  r.has_types = input_types && output_types;
+  if (r.has_types) {
+    r.input_types = *input_types;
+    r.output_types = *output_types;
+  }
+  loading_factories->push_back(r);
+}
+
+} // namespace easymedia
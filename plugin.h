@@ -0,0 +1,86 @@
+/*
+ * Copyright (C) 2017 Hertz Wang 1989wanghang@163.com
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see http://www.gnu.org/licenses
+ *
+ * Any non-GPL usage of this software or parts of this software is strictly
+ * forbidden.
+ *
+ */
+
+#ifndef EASYMEDIA_PLUGIN_H_
+#define EASYMEDIA_PLUGIN_H_
+
+#include <string>
+#include <vector>
+
+#include "media_type.h"
+
+namespace easymedia {
+
+// Optional modules, such as ffmpeg, ogg, live555, rkmpp and rknn, can be built
+// as plugins with cmake -DPLUGINS=ON. A plugin is a shared library with a text
+// manifest of the same name in the plugin directory, for example:
+//   ogg.manifest
+//     library=libeasymedia_ogg.so
+//     factory=Muxer liboggmuxer
+//     input=audio:vorbis
+//     output=stream:ogg
+// "input" and "output" apply to the last "factory", missing means
+// TYPE_NOTHING and empty means TYPE_ANYTHING.
+// Manifests are read on the first lookup which misses the reflector. The
+// library is loaded when one of its factories is created, and registers its
+// factories in static constructors as if it is linked. Libraries are never
+// unloaded.
+// The manifest is written by hand in the CMakeLists of the module, so when a
+// library is loaded, the factories it registers are compared with its
+// manifest and the differences are logged.
+
+struct _API PluginFactoryInfo {
+  std::string product; // "Flow", "Stream", "Encoder", etc.
+  std::string identifier;
+  std::string library; // path of the shared library
+  MediaTypeSet input_types;
+  MediaTypeSet output_types;
+  bool loaded;
+  // set when loaded, if the library does not register the factory or
+  // registers it with other types than the manifest
+  bool mismatched;
+};
+
+// Directories separated by ':'. Default is $EASYMEDIA_PLUGIN_PATH, or the
+// installed plugin directory.
+_API void SetPluginPath(const std::string &path);
+// factories of the manifests, without loading any library
+_API std::vector<PluginFactoryInfo> GetPluginFactories();
+// Load the library of the factory if it is not loaded.
+// Return true if the library is loaded by this call.
+_API bool LoadPluginFactory(const char *product, const char *identifier);
+// The identifier of the first not loaded factory which accepts rules, or
+// nullptr. The returned string is valid during the process lifetime.
+_API const char *FindPluginFactory(const char *product, const char *rules);
+// match rules with the manifest of a not loaded factory
+_API bool PluginFactoryAccepts(const char *product, const char *identifier,
+                               const char *rules);
+_API void DumpPluginFactories(const char *product);
+// Called by the reflectors when a factory registers, types are nullptr if the
+// factory declares none. Only registrations during a plugin load are noted.
+_API void NotePluginFactoryRegistered(const char *product,
+                                      const char *identifier,
+                                      const MediaTypeSet *input_types,
+                                      const MediaTypeSet *output_types);
+
+} // namespace easymedia
+
+#endif // #ifndef EASYMEDIA_PLUGIN_H_
@@ -24,8 +24,11 @@
 
 #include <map>
 #include <memory>
+#include <mutex>
 #include <string>
 
+#include "media_param.h"
+#include "plugin.h"
 #include "utils.h"
 
 // all come the external interface
@@ -54,9 +57,10 @@
       if (!identifier)                                                         \
         return nullptr;                                                        \
                                                                                \
-      auto it = factories.find(identifier);                                    \
-      if (it != factories.end()) {                                             \
-        const PRODUCT##Factory *f = it->second;                                \
+      const PRODUCT##Factory *f = Find(identifier);                            \
+      if (!f && LoadPluginFactory(#PRODUCT, identifier))                       \
+        f = Find(identifier);                                                  \
+      if (f) {                                                                 \
         if (!T::Compatible(f)) {                                               \
           LOG("%s is not compatible with the template\n", request);            \
           return nullptr;                                                      \
@@ -76,43 +80,88 @@
     ~PRODUCT##Reflector() = default;                                           \
     PRODUCT##Reflector(const PRODUCT##Reflector &) = delete;                   \
     PRODUCT##Reflector &operator=(const PRODUCT##Reflector &) = delete;        \
+    static const PRODUCT##Factory *Find(const char *identifier);               \
                                                                                \
     static std::map<std::string, const PRODUCT##Factory *> factories;          \
+    /* guard factories, plugins register when loaded at runtime. */            \
+    /* Also guard memoised results of FindFirstMatchIdentifier. */             \
+    static std::mutex match_mtx;                                               \
+    static std::map<std::string, const char *> first_matches;                  \
   };
 
 // macro of define reflector
 #define DEFINE_REFLECTOR(PRODUCT)                                              \
   std::map<std::string, const PRODUCT##Factory *>                              \
       PRODUCT##Reflector::factories;                                           \
+  std::mutex PRODUCT##Reflector::match_mtx;                                    \
+  std::map<std::string, const char *> PRODUCT##Reflector::first_matches;       \
+  const PRODUCT##Factory *PRODUCT##Reflector::Find(const char *identifier) {   \
+    std::lock_guard<std::mutex> _lg(match_mtx);                                \
+    auto it = factories.find(identifier);                                      \
+    return it != factories.end() ? it->second : nullptr;                       \
+  }                                                                            \
   const char *PRODUCT##Reflector::FindFirstMatchIdentifier(                    \
       const char *rules) {                                                     \
-    for (auto &it : factories) {                                               \
-      const PRODUCT##Factory *f = it.second;                                   \
-      if (f->AcceptRules(rules))                                               \
-        return it.first.c_str();                                               \
+    if (!rules)                                                                \
+      return nullptr;                                                          \
+    bool memo = MediaParam::IsCacheEnabled();                                  \
+    const char *identifier = nullptr;                                          \
+    {                                                                          \
+      std::lock_guard<std::mutex> _lg(match_mtx);                              \
+      if (memo) {                                                              \
+        auto it = first_matches.find(rules);                                   \
+        if (it != first_matches.end())                                         \
+          return it->second;                                                   \
+      }                                                                        \
+      for (auto &it : factories) {                                             \
+        const PRODUCT##Factory *f = it.second;                                 \
+        if (f->AcceptRules(rules)) {                                           \
+          identifier = it.first.c_str();                                       \
+          break;                                                               \
+        }                                                                      \
+      }                                                                        \
+    }                                                                          \
+    /* not loaded plugins match by their manifests */                          \
+    if (!identifier)                                                           \
+      identifier = FindPluginFactory(#PRODUCT, rules);                         \
+    if (memo) {                                                                \
+      std::lock_guard<std::mutex> _lg(match_mtx);                              \
+      if (first_matches.size() >= RuleMemo::kMaxSize)                          \
+        first_matches.clear();                                                 \
+      first_matches[rules] = identifier;                                       \
     }                                                                          \
-    return nullptr;                                                            \
+    return identifier;                                                         \
   }                                                                            \
   bool PRODUCT##Reflector::IsMatch(const char *identifier,                     \
                                    const char *rules) {                        \
-    auto it = factories.find(identifier);                                      \
-    if (it == factories.end())                                                 \
-      return false;                                                            \
-    return it->second->AcceptRules(rules);                                     \
+    const PRODUCT##Factory *f = Find(identifier);                              \
+    if (!f)                                                                    \
+      return PluginFactoryAccepts(#PRODUCT, identifier, rules);                \
+    return f->AcceptRules(rules);                                              \
   }                                                                            \
   void PRODUCT##Reflector::RegisterFactory(std::string identifier,             \
                                            const PRODUCT##Factory *factory) {  \
+    std::lock_guard<std::mutex> _lg(match_mtx);                                \
     auto it = factories.find(identifier);                                      \
-    if (it == factories.end())                                                 \
+    if (it == factories.end()) {                                               \
       factories[identifier] = factory;                                         \
-    else                                                                       \
+      first_matches.clear();                                                   \
+    } else                                                                     \
       printf("repeated identifier : %s\n", identifier.c_str());                \
+    /* compared with the manifest if a plugin is loading */                    \
+    NotePluginFactoryRegistered(#PRODUCT, identifier.c_str(),                  \
+                                factory->InputTypeSet(),                       \
+                                factory->OutputTypeSet());                     \
   }                                                                            \
   void PRODUCT##Reflector::DumpFactories() {                                   \
     printf("\n%s:\n", #PRODUCT);                                               \
-    for (auto &it : factories) {                                               \
-      printf(" %s", it.first.c_str());                                         \
+    {                                                                          \
+      std::lock_guard<std::mutex> _lg(match_mtx);                              \
+      for (auto &it : factories) {                                             \
+        printf(" %s", it.first.c_str());                                       \
+      }                                                                        \
     }                                                                          \
+    DumpPluginFactories(#PRODUCT);                                             \
     printf("\n\n");                                                            \
   }
 
@@ -124,14 +173,18 @@
     virtual const char *Identifier() const = 0;                                \
     static _API const char *Parse(const char *request);                        \
     virtual std::shared_ptr<PRODUCT> NewProduct(const char *param) = 0;        \
+    /* the result of the same rules is memoised */                             \
     bool AcceptRules(const char *rules) const {                                \
-      std::map<std::string, std::string> map;                                  \
-      if (!parse_media_param_map(rules, map))                                  \
-        return false;                                                          \
-      return AcceptRules(map);                                                 \
+      return rule_memo.Match(                                                  \
+          rules, [this](const std::map<std::string, std::string> &map) {       \
+            return AcceptRules(map);                                           \
+          });                                                                  \
     }                                                                          \
     virtual bool                                                               \
     AcceptRules(const std::map<std::string, std::string> &map) const = 0;      \
+    /* types of media factories, nullptr if the factory declares none */       \
+    virtual const MediaTypeSet *InputTypeSet() const { return nullptr; }       \
+    virtual const MediaTypeSet *OutputTypeSet() const { return nullptr; }      \
                                                                                \
   protected:                                                                   \
     PRODUCT##Factory() = default;                                              \
@@ -140,6 +193,7 @@
   private:                                                                     \
     PRODUCT##Factory(const PRODUCT##Factory &) = delete;                       \
     PRODUCT##Factory &operator=(const PRODUCT##Factory &) = delete;            \
+    mutable RuleMemo rule_memo;                                                \
   };
 
 #define DEFINE_FACTORY_COMMON_PARSE(PRODUCT)                                   \
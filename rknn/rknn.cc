@@ -253,7 +253,9 @@ int RKNNFilter::Process(std::shared_ptr<MediaBuffer> input,
   if (io_num.n_input != 1) {
     LOG_TODO();
   }
+  input->BeginCPUAccess(MediaBuffer::kCPURead);
   int ret = rknn_inputs_set(ctx, io_num.n_input, inputs);
+  input->EndCPUAccess(MediaBuffer::kCPURead);
   if (ret < 0) {
     LOG("Fail to rknn_input_set, ret=%d\n", ret);
     return -1;
@@ -29,6 +29,7 @@
 
 #include "buffer.h"
 #include "filter.h"
+#include "negotiation.h"
 
 namespace easymedia {
 
@@ -126,12 +127,54 @@ static int get_rga_format(PixelFormat f) {
   return -1;
 }
 
+// rga only knows the width stride in pixels and the height stride in rows,
+// the chroma plane must follow the luma plane with the same stride.
+static bool get_rga_stride(const std::shared_ptr<ImageBuffer> &ib,
+                           int &wstride, int &hstride) {
+  const ImageInfo &info = ib->GetImageInfo();
+  wstride = info.vir_width;
+  hstride = info.vir_height;
+  if (info.plane_num <= 0)
+    return true;
+  ImagePlane planes[IMAGE_MAX_PLANES];
+  int num = ib->GetPlaneLayout(planes);
+  int row_bytes = 0, rows = 0;
+  if (!GetPixFmtPlaneSize(info.pix_fmt, 0, 1, 1, row_bytes, rows) ||
+      planes[0].offset != 0 || planes[0].stride % row_bytes)
+    goto err;
+  wstride = planes[0].stride / row_bytes;
+  if (num == 1) {
+    hstride = info.vir_height > 0 ? info.vir_height : info.height;
+    return true;
+  }
+  if (planes[1].offset % planes[0].stride)
+    goto err;
+  hstride = planes[1].offset / planes[0].stride;
+  if (num == 2 && planes[1].stride == planes[0].stride)
+    return true;
+  if (num == 3 && planes[1].stride == planes[0].stride / 2 &&
+      planes[2].stride == planes[1].stride) {
+    int chroma_rows = 0;
+    GetPixFmtPlaneSize(info.pix_fmt, 1, wstride, hstride, row_bytes,
+                       chroma_rows);
+    if (planes[2].offset == planes[1].offset + planes[1].stride * chroma_rows)
+      return true;
+  }
+err:
+  LOG("rga can not handle the plane layout of pixel fmt %d\n", info.pix_fmt);
+  return false;
+}
+
 int rga_blit(std::shared_ptr<ImageBuffer> src, std::shared_ptr<ImageBuffer> dst,
              ImageRect *src_rect, ImageRect *dst_rect, int rotate) {
   if (!src || !src->IsValid())
     return -EINVAL;
   if (!dst || !dst->IsValid())
     return -EINVAL;
+  int src_wstride, src_hstride, dst_wstride, dst_hstride;
+  if (!get_rga_stride(src, src_wstride, src_hstride) ||
+      !get_rga_stride(dst, dst_wstride, dst_hstride))
+    return -EINVAL;
   rga_info_t src_info, dst_info;
   memset(&src_info, 0, sizeof(src_info));
   src_info.fd = src->GetFD();
@@ -141,11 +184,11 @@ int rga_blit(std::shared_ptr<ImageBuffer> src, std::shared_ptr<ImageBuffer> dst,
   src_info.rotation = rotate;
   if (src_rect)
     rga_set_rect(&src_info.rect, src_rect->x, src_rect->y, src_rect->w,
-                 src_rect->h, src->GetVirWidth(), src->GetVirHeight(),
+                 src_rect->h, src_wstride, src_hstride,
                  get_rga_format(src->GetPixelFormat()));
   else
     rga_set_rect(&src_info.rect, 0, 0, src->GetWidth(), src->GetHeight(),
-                 src->GetVirWidth(), src->GetVirHeight(),
+                 src_wstride, src_hstride,
                  get_rga_format(src->GetPixelFormat()));
 
   memset(&dst_info, 0, sizeof(dst_info));
@@ -155,11 +198,11 @@ int rga_blit(std::shared_ptr<ImageBuffer> src, std::shared_ptr<ImageBuffer> dst,
   dst_info.mmuFlag = 1;
   if (dst_rect)
     rga_set_rect(&dst_info.rect, dst_rect->x, dst_rect->y, dst_rect->w,
-                 dst_rect->h, dst->GetVirWidth(), dst->GetVirHeight(),
+                 dst_rect->h, dst_wstride, dst_hstride,
                  get_rga_format(dst->GetPixelFormat()));
   else
     rga_set_rect(&dst_info.rect, 0, 0, dst->GetWidth(), dst->GetHeight(),
-                 dst->GetVirWidth(), dst->GetVirHeight(),
+                 dst_wstride, dst_hstride,
                  get_rga_format(dst->GetPixelFormat()));
 
   int ret = RgaFilter::gRkRga.RkRgaBlit(&src_info, &dst_info, NULL);
@@ -201,4 +244,25 @@ const char *FACTORY(RgaFilter)::OutPutDataType() {
   return priv_fmts.types.c_str();
 }
 
+// rga converts and scales between the formats above for link negotiation
+class _PRIVATE_RGA_CONVERTER {
+public:
+  _PRIVATE_RGA_CONVERTER() {
+    ConverterInfo info;
+    info.name = RgaFilter::GetFilterName();
+    info.filter_name = RgaFilter::GetFilterName();
+    std::vector<ImageRect> full = {{0, 0, 0, 0}, {0, 0, 0, 0}};
+    PARAM_STRING_APPEND(info.filter_param, KEY_BUFFER_RECT,
+                        TwoImageRectToString(full));
+    info.input_types = MediaTypeSet::FromString(priv_fmts.types.c_str());
+    info.output_types = info.input_types;
+    info.can_scale = true;
+    info.output_mem_types =
+        1 << static_cast<int>(MediaBuffer::MemType::MEM_HARD_WARE);
+    info.hardware = true;
+    RegisterConverter(info);
+  }
+};
+static _PRIVATE_RGA_CONVERTER rga_converter;
+
 } // namespace easymedia
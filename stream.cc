@@ -25,6 +25,8 @@
 #include <assert.h>
 #include <errno.h>
 
+#include <vector>
+
 #include "utils.h"
 
 namespace easymedia {
@@ -70,6 +72,36 @@ int Stream::Close() {
   return 0;
 }
 
+size_t Stream::ReadV(const struct iovec *iov, int iovcnt) {
+  size_t total = 0;
+  for (int i = 0; i < iovcnt; i++) {
+    if (iov[i].iov_len == 0)
+      continue;
+    size_t ret = Read(iov[i].iov_base, 1, iov[i].iov_len);
+    if (ret == (size_t)-1)
+      return total > 0 ? total : ret;
+    total += ret;
+    if (ret != iov[i].iov_len)
+      break;
+  }
+  return total;
+}
+
+size_t Stream::WriteV(const struct iovec *iov, int iovcnt) {
+  size_t total = 0;
+  for (int i = 0; i < iovcnt; i++) {
+    if (iov[i].iov_len == 0)
+      continue;
+    size_t ret = Write(iov[i].iov_base, 1, iov[i].iov_len);
+    if (ret == (size_t)-1)
+      return total > 0 ? total : ret;
+    total += ret;
+    if (ret != iov[i].iov_len)
+      break;
+  }
+  return total;
+}
+
 DEFINE_REFLECTOR(Stream)
 
 // request should equal stream_name
@@ -77,49 +109,56 @@ DEFINE_FACTORY_COMMON_PARSE(Stream)
 
 DEFINE_PART_FINAL_EXPOSE_PRODUCT(Stream, Stream)
 
-bool Stream::ReadImage(void *ptr, const ImageInfo &info) {
-  size_t read_size;
-  if (info.width == info.vir_width && info.height == info.vir_height) {
-    int num, den;
-    GetPixFmtNumDen(info.pix_fmt, num, den);
-    read_size = info.width * info.height * num / den;
-    if (!read_size)
-      return false;
-    size_t ret = Read(ptr, 1, read_size);
-    if (ret != read_size) {
-      // LOG("read ori stream failed, %d != %d\n", ret, read_size);
-      return false;
-    }
-    return true;
+// The rows of all planes, merged if contiguous in memory.
+static size_t image_iovec(const void *ptr, const ImageInfo &info,
+                          std::vector<struct iovec> &iov) {
+  ImagePlane planes[IMAGE_MAX_PLANES];
+  int plane_num = GetImagePlaneLayout(info, planes);
+  if (plane_num <= 0) {
+    LOG("TODO: image fmt %d\n", info.pix_fmt);
+    return 0;
   }
-  int row = 0;
-  uint8_t *buf_y = (uint8_t *)ptr;
-  uint8_t *buf_u = buf_y + info.vir_width * info.vir_height;
-  // uint8_t *buf_v = buf_u + info.vir_width * info.vir_height / 4;
-  switch (info.pix_fmt) {
-  case PIX_FMT_NV12:
-    for (row = 0; row < info.height; row++) {
-      read_size = Read(buf_y + row * info.vir_width, 1, info.width);
-      if ((int)read_size != info.width) {
-        // LOG("read ori yuv stream luma failed, %d != %d\n",
-        // read_size,info.width);
-        return false;
-      }
+  size_t total = 0;
+  uint8_t *buf = (uint8_t *)ptr;
+  for (int i = 0; i < plane_num; i++) {
+    int row_bytes = 0, rows = 0;
+    if (!GetPixFmtPlaneSize(info.pix_fmt, i, info.width, info.height,
+                            row_bytes, rows) ||
+        row_bytes <= 0 || rows <= 0)
+      return 0;
+    int stride = planes[i].stride;
+    // a plane without padding is one segment
+    if (stride == row_bytes) {
+      row_bytes *= rows;
+      rows = 1;
     }
-    for (row = 0; row < info.height / 2; row++) {
-      read_size = Read(buf_u + row * info.vir_width, 1, info.width);
-      if ((int)read_size != info.width) {
-        // LOG("read ori yuv stream cb failed, %d != %d\n", read_size,
-        // info.width);
-        return false;
-      }
+    uint8_t *row = buf + planes[i].offset;
+    for (int r = 0; r < rows; r++, row += stride) {
+      if (!iov.empty() &&
+          (uint8_t *)iov.back().iov_base + iov.back().iov_len == row)
+        iov.back().iov_len += row_bytes;
+      else
+        iov.push_back({row, (size_t)row_bytes});
+      total += row_bytes;
     }
-    break;
-  default:
-    LOG("TODO: read image fmt %d\n", info.pix_fmt);
-    return false;
   }
-  return true;
+  return total;
+}
+
+bool Stream::ReadImage(void *ptr, const ImageInfo &info) {
+  std::vector<struct iovec> iov;
+  size_t total = image_iovec(ptr, info, iov);
+  if (total == 0)
+    return false;
+  return ReadV(iov.data(), iov.size()) == total;
+}
+
+bool Stream::WriteImage(const void *ptr, const ImageInfo &info) {
+  std::vector<struct iovec> iov;
+  size_t total = image_iovec(ptr, info, iov);
+  if (total == 0)
+    return false;
+  return WriteV(iov.data(), iov.size()) == total;
 }
 
 } // namespace easymedia
@@ -24,6 +24,7 @@
 
 #include <stddef.h>
 #include <stdint.h>
+#include <sys/uio.h>
 
 #ifdef __cplusplus
 extern "C" {
@@ -70,6 +71,12 @@ public:
 
   virtual size_t Read(void *ptr, size_t size, size_t nmemb) = 0;
   virtual size_t Write(const void *ptr, size_t size, size_t nmemb) = 0;
+  // Scatter read, return the read bytes.
+  // Default implementation reads the segments one by one.
+  virtual size_t ReadV(const struct iovec *iov, int iovcnt);
+  // Gather write, return the written bytes.
+  // Default implementation writes the segments one by one.
+  virtual size_t WriteV(const struct iovec *iov, int iovcnt);
   // whence: SEEK_SET, SEEK_CUR, SEEK_END
   virtual int Seek(int64_t offset, int whence) = 0;
   virtual long Tell() = 0;
@@ -95,8 +102,11 @@ public:
     return IoCtrl(S_SUB_REQUEST, &subreq);
   }
 
-  // read data as image by ImageInfo
+  // Read/write data as image by ImageInfo. The rows in file are packed,
+  // the rows in memory follow the strides of planes. A whole image moves
+  // in one ReadV/WriteV.
   bool ReadImage(void *ptr, const ImageInfo &info);
+  bool WriteImage(const void *ptr, const ImageInfo &info);
 
 protected:
   virtual int Open() = 0;
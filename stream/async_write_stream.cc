@@ -0,0 +1,848 @@
+/*
+ * Copyright (C) 2017 Hertz Wang 1989wanghang@163.com
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see http://www.gnu.org/licenses
+ *
+ * Any non-GPL usage of this software or parts of this software is strictly
+ * forbidden.
+ *
+ */
+
+#include "stream.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/prctl.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#ifdef HAVE_IO_URING_H
+#include <linux/io_uring.h>
+#endif
+
+#include "buffer.h"
+#include "media_type.h"
+#include "utils.h"
+
+namespace easymedia {
+
+// One positioned write. The data is held until the write completes.
+struct WriteRequest {
+  WriteRequest() : offset(0), len(0), done(0), reserved(0) {}
+  int64_t offset;
+  size_t len;
+  size_t done;
+  size_t reserved; // counted in flight, len without the O_DIRECT padding
+  std::vector<struct iovec> iov; // the rest to write
+  std::shared_ptr<MediaBuffer> buffer;
+  std::shared_ptr<void> data;
+
+  void Advance(size_t n) {
+    done += n;
+    offset += n;
+    auto it = iov.begin();
+    while (it != iov.end() && n >= it->iov_len) {
+      n -= it->iov_len;
+      ++it;
+    }
+    iov.erase(iov.begin(), it);
+    if (!iov.empty() && n > 0) {
+      iov[0].iov_base = (uint8_t *)iov[0].iov_base + n;
+      iov[0].iov_len -= n;
+    }
+  }
+};
+
+// Runs requests in background and reports them by complete(req, errno).
+// A file which can not seek, such as a pipe, is written at its current
+// position one request after another.
+class WriteBackend {
+public:
+  typedef std::function<void(WriteRequest *, int)> CompleteFn;
+  WriteBackend() : fd(-1), seekable(true) {}
+  virtual ~WriteBackend() = default;
+  virtual const char *GetName() = 0;
+  virtual bool Start(int file_fd, bool can_seek, CompleteFn fn) = 0;
+  // Take the ownership of req.
+  virtual void Submit(WriteRequest *req) = 0;
+  // Finish the submitted requests and quit.
+  virtual void Stop() = 0;
+
+protected:
+  int fd;
+  bool seekable;
+  CompleteFn complete;
+};
+
+class ThreadPoolBackend : public WriteBackend {
+public:
+  ThreadPoolBackend(int num) : thread_num(std::max(num, 1)), quit(false) {}
+  virtual ~ThreadPoolBackend() { ThreadPoolBackend::Stop(); }
+  virtual const char *GetName() override { return KEY_BACKEND_THREADS; }
+  virtual bool Start(int file_fd, bool can_seek, CompleteFn fn) override;
+  virtual void Submit(WriteRequest *req) override;
+  virtual void Stop() override;
+
+private:
+  void Run();
+
+  int thread_num;
+  bool quit;
+  std::mutex mtx;
+  std::condition_variable cond;
+  std::deque<WriteRequest *> queue;
+  std::vector<std::thread> threads;
+};
+
+bool ThreadPoolBackend::Start(int file_fd, bool can_seek, CompleteFn fn) {
+  fd = file_fd;
+  seekable = can_seek;
+  complete = fn;
+  quit = false;
+  // one thread keeps the order of the writes
+  if (!seekable)
+    thread_num = 1;
+  for (int i = 0; i < thread_num; i++)
+    threads.push_back(std::thread(&ThreadPoolBackend::Run, this));
+  return true;
+}
+
+void ThreadPoolBackend::Submit(WriteRequest *req) {
+  std::lock_guard<std::mutex> _lg(mtx);
+  queue.push_back(req);
+  cond.notify_one();
+}
+
+void ThreadPoolBackend::Stop() {
+  {
+    std::lock_guard<std::mutex> _lg(mtx);
+    quit = true;
+    cond.notify_all();
+  }
+  for (auto &t : threads)
+    t.join();
+  threads.clear();
+}
+
+void ThreadPoolBackend::Run() {
+  prctl(PR_SET_NAME, "async_write");
+  while (true) {
+    WriteRequest *req;
+    {
+      std::unique_lock<std::mutex> _ul(mtx);
+      cond.wait(_ul, [this] { return quit || !queue.empty(); });
+      if (queue.empty())
+        break; // quit after the queue is drained
+      req = queue.front();
+      queue.pop_front();
+    }
+    int err = 0;
+    while (req->done < req->len) {
+      int iovcnt = std::min((int)req->iov.size(), IOV_MAX);
+      ssize_t ret = seekable ? pwritev(fd, req->iov.data(), iovcnt, req->offset)
+                             : writev(fd, req->iov.data(), iovcnt);
+      if (ret < 0) {
+        if (errno == EINTR)
+          continue;
+        err = errno;
+        break;
+      }
+      if (ret == 0) {
+        err = EIO;
+        break;
+      }
+      req->Advance(ret);
+    }
+    complete(req, err);
+  }
+}
+
+#ifdef HAVE_IO_URING_H
+
+// io_uring by raw syscalls, no dependency on liburing.
+// Submissions are serialized by mtx, a thread reaps the completions.
+class IoUringBackend : public WriteBackend {
+public:
+  IoUringBackend();
+  virtual ~IoUringBackend();
+  virtual const char *GetName() override { return KEY_BACKEND_IO_URING; }
+  virtual bool Start(int file_fd, bool can_seek, CompleteFn fn) override;
+  virtual void Submit(WriteRequest *req) override;
+  virtual void Stop() override;
+
+private:
+  static const unsigned kEntries = 64;
+  bool Setup();
+  void Release();
+  // with mtx locked
+  bool Push(uint8_t opcode, WriteRequest *req);
+  void Run();
+
+  int ring_fd;
+  struct io_uring_params params;
+  void *sq_ring;
+  size_t sq_ring_size;
+  void *cq_ring;
+  size_t cq_ring_size;
+  struct io_uring_sqe *sqes;
+  unsigned *sq_head;
+  unsigned *sq_tail;
+  unsigned *sq_mask;
+  unsigned *sq_array;
+  unsigned *cq_head;
+  unsigned *cq_tail;
+  unsigned *cq_mask;
+  struct io_uring_cqe *cqes;
+
+  std::mutex mtx;
+  std::condition_variable cond;
+  unsigned pending; // submitted but not completed, limited by cq size
+  std::deque<WriteRequest *> waiting; // not submitted, if not seekable
+  std::thread *reaper;
+};
+
+IoUringBackend::IoUringBackend()
+    : ring_fd(-1), sq_ring(MAP_FAILED), sq_ring_size(0), cq_ring(MAP_FAILED),
+      cq_ring_size(0), sqes((struct io_uring_sqe *)MAP_FAILED), pending(0),
+      reaper(nullptr) {
+  memset(&params, 0, sizeof(params));
+}
+
+IoUringBackend::~IoUringBackend() {
+  IoUringBackend::Stop();
+  Release();
+}
+
+bool IoUringBackend::Setup() {
+  ring_fd = syscall(__NR_io_uring_setup, kEntries, &params);
+  if (ring_fd < 0) {
+    LOG("io_uring is not available, %m\n");
+    return false;
+  }
+  sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+  cq_ring_size =
+      params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+  bool single = !!(params.features & IORING_FEAT_SINGLE_MMAP);
+  if (single)
+    sq_ring_size = cq_ring_size = std::max(sq_ring_size, cq_ring_size);
+  sq_ring = mmap(nullptr, sq_ring_size, PROT_READ | PROT_WRITE,
+                 MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_SQ_RING);
+  if (sq_ring == MAP_FAILED)
+    return false;
+  if (single) {
+    cq_ring = sq_ring;
+  } else {
+    cq_ring = mmap(nullptr, cq_ring_size, PROT_READ | PROT_WRITE,
+                   MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_CQ_RING);
+    if (cq_ring == MAP_FAILED)
+      return false;
+  }
+  sqes = (struct io_uring_sqe *)mmap(
+      nullptr, params.sq_entries * sizeof(struct io_uring_sqe),
+      PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd,
+      IORING_OFF_SQES);
+  if (sqes == MAP_FAILED)
+    return false;
+  uint8_t *sq = (uint8_t *)sq_ring;
+  sq_head = (unsigned *)(sq + params.sq_off.head);
+  sq_tail = (unsigned *)(sq + params.sq_off.tail);
+  sq_mask = (unsigned *)(sq + params.sq_off.ring_mask);
+  sq_array = (unsigned *)(sq + params.sq_off.array);
+  uint8_t *cq = (uint8_t *)cq_ring;
+  cq_head = (unsigned *)(cq + params.cq_off.head);
+  cq_tail = (unsigned *)(cq + params.cq_off.tail);
+  cq_mask = (unsigned *)(cq + params.cq_off.ring_mask);
+  cqes = (struct io_uring_cqe *)(cq + params.cq_off.cqes);
+  return true;
+}
+
+void IoUringBackend::Release() {
+  if (sqes != MAP_FAILED)
+    munmap(sqes, params.sq_entries * sizeof(struct io_uring_sqe));
+  if (cq_ring != MAP_FAILED && cq_ring != sq_ring)
+    munmap(cq_ring, cq_ring_size);
+  if (sq_ring != MAP_FAILED)
+    munmap(sq_ring, sq_ring_size);
+  sqes = (struct io_uring_sqe *)MAP_FAILED;
+  sq_ring = cq_ring = MAP_FAILED;
+  if (ring_fd >= 0)
+    close(ring_fd);
+  ring_fd = -1;
+}
+
+bool IoUringBackend::Start(int file_fd, bool can_seek, CompleteFn fn) {
+  fd = file_fd;
+  seekable = can_seek;
+  complete = fn;
+  if (!Setup()) {
+    Release();
+    return false;
+  }
+  reaper = new std::thread(&IoUringBackend::Run, this);
+  if (!reaper) {
+    Release();
+    return false;
+  }
+  return true;
+}
+
+bool IoUringBackend::Push(uint8_t opcode, WriteRequest *req) {
+  unsigned tail = *sq_tail;
+  unsigned index = tail & *sq_mask;
+  struct io_uring_sqe *sqe = &sqes[index];
+  memset(sqe, 0, sizeof(*sqe));
+  sqe->opcode = opcode;
+  sqe->user_data = (uint64_t)(uintptr_t)req;
+  if (req) {
+    sqe->fd = fd;
+    sqe->addr = (uint64_t)(uintptr_t)req->iov.data();
+    sqe->len = std::min((int)req->iov.size(), IOV_MAX);
+    // -1 is the current position
+    sqe->off = seekable ? req->offset : (uint64_t)-1;
+  }
+  sq_array[index] = index;
+  __atomic_store_n(sq_tail, tail + 1, __ATOMIC_RELEASE);
+  while (syscall(__NR_io_uring_enter, ring_fd, 1, 0, 0, nullptr, 0) < 0) {
+    if (errno != EINTR && errno != EAGAIN && errno != EBUSY) {
+      LOG("io_uring_enter submit failed, %m\n");
+      // Take the entry back if the kernel has not consumed it, otherwise
+      // it is in flight and its completion frees req.
+      if (__atomic_load_n(sq_head, __ATOMIC_ACQUIRE) == tail) {
+        __atomic_store_n(sq_tail, tail, __ATOMIC_RELEASE);
+        return false;
+      }
+      break;
+    }
+  }
+  pending++;
+  return true;
+}
+
+void IoUringBackend::Submit(WriteRequest *req) {
+  std::unique_lock<std::mutex> _ul(mtx);
+  if (!seekable && pending > 0) {
+    waiting.push_back(req);
+    return;
+  }
+  // keep a slot for the quit request
+  cond.wait(_ul, [this] { return pending + 1 < params.cq_entries; });
+  if (!Push(IORING_OP_WRITEV, req)) {
+    _ul.unlock();
+    complete(req, EIO);
+  }
+}
+
+void IoUringBackend::Stop() {
+  if (!reaper)
+    return;
+  {
+    std::unique_lock<std::mutex> _ul(mtx);
+    cond.wait(_ul, [this] { return pending == 0; });
+    // a nop of null request tells the reaper to quit
+    Push(IORING_OP_NOP, nullptr);
+  }
+  reaper->join();
+  delete reaper;
+  reaper = nullptr;
+}
+
+void IoUringBackend::Run() {
+  prctl(PR_SET_NAME, "async_write");
+  bool quit = false;
+  while (!quit) {
+    int ret = syscall(__NR_io_uring_enter, ring_fd, 0, 1,
+                      IORING_ENTER_GETEVENTS, nullptr, 0);
+    if (ret < 0 && errno != EINTR) {
+      LOG("io_uring_enter wait failed, %m\n");
+      break;
+    }
+    unsigned head = *cq_head;
+    unsigned tail = __atomic_load_n(cq_tail, __ATOMIC_ACQUIRE);
+    for (; head != tail; head++) {
+      struct io_uring_cqe *cqe = &cqes[head & *cq_mask];
+      WriteRequest *req = (WriteRequest *)(uintptr_t)cqe->user_data;
+      int res = cqe->res;
+      __atomic_store_n(cq_head, head + 1, __ATOMIC_RELEASE);
+      std::unique_lock<std::mutex> _ul(mtx);
+      pending--;
+      if (!req) {
+        quit = true;
+        continue;
+      }
+      int err = 0;
+      if (res == -EINTR || res == -EAGAIN) {
+        if (Push(IORING_OP_WRITEV, req))
+          continue;
+        err = EIO;
+      } else if (res < 0) {
+        err = -res;
+      } else if (res == 0) {
+        err = EIO;
+      } else {
+        req->Advance(res);
+        if (req->done < req->len) {
+          if (Push(IORING_OP_WRITEV, req))
+            continue;
+          err = EIO;
+        }
+      }
+      cond.notify_all();
+      // the next write starts after this one is done
+      while (!waiting.empty()) {
+        WriteRequest *next = waiting.front();
+        waiting.pop_front();
+        if (Push(IORING_OP_WRITEV, next))
+          break;
+        _ul.unlock();
+        complete(next, EIO);
+        _ul.lock();
+      }
+      _ul.unlock();
+      complete(req, err);
+    }
+  }
+}
+
+#endif // #ifdef HAVE_IO_URING_H
+
+// Write stream which returns before the data reaches the file.
+// Writes run in background by io_uring, or by a thread pool if the kernel
+// does not support io_uring. The bytes in flight are limited by
+// KEY_MAX_INFLIGHT_BYTES. When the limit is reached, Write() waits or drops
+// the data according to KEY_WRITE_FULL_MODE, the default is to drop, so that
+// a stall of storage never blocks the caller.
+// Written MediaBuffers are held and released when their writes complete.
+// With KEY_DIRECT_IO the file is opened with O_DIRECT, data is gathered into
+// aligned chunks and the padding of the last chunk is truncated at close.
+// The file is always written from the start or appended, so it can not seek.
+// A pipe or another file which can not seek is written in order.
+class AsyncWriteStream : public Stream {
+public:
+  static const size_t kAlign = 4096;
+  static const size_t kDirectChunk = 1024 * 1024;
+
+  AsyncWriteStream(const char *param);
+  virtual ~AsyncWriteStream() { AsyncWriteStream::Close(); }
+  static const char *GetStreamName() { return "async_write_stream"; }
+
+  virtual size_t Read(void *ptr _UNUSED, size_t size _UNUSED,
+                      size_t nmemb _UNUSED) final {
+    return -1;
+  }
+  virtual size_t Write(const void *ptr, size_t size, size_t nmemb) final;
+  virtual size_t WriteV(const struct iovec *iov, int iovcnt) final;
+  virtual bool Write(std::shared_ptr<MediaBuffer> buffer) final;
+  virtual int Seek(int64_t off _UNUSED, int whence _UNUSED) final {
+    return -1;
+  }
+  virtual long Tell() final { return fd >= 0 ? (long)offset : -1; }
+  virtual int IoCtrl(unsigned long int request, ...) final;
+  virtual int Open() final;
+
+protected:
+  virtual int Close() final;
+
+private:
+  // Reserve len bytes in flight, false if dropped or failed.
+  bool Reserve(size_t len);
+  void Unreserve(size_t len);
+  void Enqueue(WriteRequest *req);
+  void OnComplete(WriteRequest *req, int err);
+  // O_DIRECT: copy into the aligned chunk
+  bool Gather(const struct iovec *iov, int iovcnt, size_t len);
+  void FlushChunk(bool last);
+  bool NewChunk();
+  void UpdateWriteTime(int64_t start);
+
+  std::string path;
+  std::string open_mode;
+  std::string backend_name;
+  int thread_num;
+  size_t max_inflight;
+  bool direct;
+  bool block_when_full;
+
+  int fd;
+  int64_t offset;
+  std::unique_ptr<WriteBackend> backend;
+  std::shared_ptr<void> chunk;
+  size_t chunk_fill;
+
+  std::mutex mtx;
+  std::condition_variable cond;
+  StreamWriteStats stats;
+};
+
+AsyncWriteStream::AsyncWriteStream(const char *param)
+    : open_mode("w"), backend_name(KEY_BACKEND_AUTO), thread_num(1),
+      max_inflight(8 * 1024 * 1024), direct(false), block_when_full(false),
+      fd(-1), offset(0), chunk_fill(0) {
+  memset(&stats, 0, sizeof(stats));
+  std::map<std::string, std::string> params;
+  if (!parse_media_param_map(param, params))
+    return;
+  path = params[KEY_PATH];
+  std::string value = params[KEY_OPEN_MODE];
+  if (!value.empty())
+    open_mode = value;
+  value = params[KEY_WRITE_BACKEND];
+  if (!value.empty())
+    backend_name = value;
+  value = params[KEY_WRITE_THREAD_NUM];
+  if (!value.empty())
+    thread_num = std::stoi(value);
+  value = params[KEY_MAX_INFLIGHT_BYTES];
+  if (!value.empty())
+    max_inflight = std::stoul(value);
+  value = params[KEY_DIRECT_IO];
+  if (!value.empty())
+    direct = !!std::stoi(value);
+  block_when_full = (params[KEY_WRITE_FULL_MODE] == KEY_BLOCKING);
+}
+
+int AsyncWriteStream::Open() {
+  if (path.empty())
+    return -1;
+  int flags = O_WRONLY | O_CREAT | O_CLOEXEC;
+  if (open_mode[0] == 'a') {
+    flags |= O_APPEND;
+    // O_DIRECT needs aligned file offsets
+    if (direct) {
+      LOG("%s: can not append with O_DIRECT, disable it\n", path.c_str());
+      direct = false;
+    }
+  } else {
+    flags |= O_TRUNC;
+  }
+  if (direct)
+    flags |= O_DIRECT;
+  fd = open(path.c_str(), flags, 0644);
+  if (fd < 0 && direct && errno == EINVAL) {
+    LOG("%s: O_DIRECT is not supported, disable it\n", path.c_str());
+    direct = false;
+    fd = open(path.c_str(), flags & ~O_DIRECT, 0644);
+  }
+  if (fd < 0) {
+    LOG("open %s failed, %m\n", path.c_str());
+    return -1;
+  }
+  // a pipe is written at its current position
+  bool can_seek = (lseek(fd, 0, SEEK_CUR) >= 0);
+  if (!can_seek && direct) {
+    LOG("%s: can not seek, disable O_DIRECT\n", path.c_str());
+    direct = false;
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) & ~O_DIRECT);
+  }
+  offset = (can_seek && (flags & O_APPEND)) ? lseek(fd, 0, SEEK_END) : 0;
+  // pwrite ignores the offset with O_APPEND, reopen without it
+  if (can_seek && (flags & O_APPEND)) {
+    close(fd);
+    fd = open(path.c_str(), flags & ~O_APPEND, 0644);
+    if (fd < 0) {
+      LOG("open %s failed, %m\n", path.c_str());
+      return -1;
+    }
+  }
+  if (direct && max_inflight < kDirectChunk)
+    max_inflight = kDirectChunk;
+  auto fn = std::bind(&AsyncWriteStream::OnComplete, this,
+                      std::placeholders::_1, std::placeholders::_2);
+#ifdef HAVE_IO_URING_H
+  if (backend_name != KEY_BACKEND_THREADS) {
+    backend.reset(new IoUringBackend());
+    if (!backend->Start(fd, can_seek, fn))
+      backend.reset();
+  }
+#endif
+  if (!backend) {
+    if (backend_name == KEY_BACKEND_IO_URING)
+      LOG("%s: fall back to %s\n", path.c_str(), KEY_BACKEND_THREADS);
+    backend.reset(new ThreadPoolBackend(thread_num));
+    backend->Start(fd, can_seek, fn);
+  }
+  LOGD("%s: async write by %s%s\n", path.c_str(), backend->GetName(),
+       direct ? ", O_DIRECT" : "");
+  SetReadable(false);
+  SetWriteable(true);
+  SetSeekable(false);
+  return 0;
+}
+
+int AsyncWriteStream::Close() {
+  if (fd < 0) {
+    errno = EBADF;
+    return -1;
+  }
+  if (direct && chunk_fill > 0)
+    FlushChunk(true);
+  backend->Stop();
+  backend.reset();
+  chunk.reset();
+  int ret = 0;
+  if (direct && ftruncate(fd, offset)) {
+    LOG("truncate %s failed, %m\n", path.c_str());
+    ret = -1;
+  }
+  if (stats.error) {
+    LOG("%s: background write failed, %s\n", path.c_str(),
+        strerror(stats.error));
+    ret = -1;
+  }
+  if (close(fd))
+    ret = -1;
+  fd = -1;
+  Stream::Close();
+  return ret;
+}
+
+bool AsyncWriteStream::Reserve(size_t len) {
+  std::unique_lock<std::mutex> _ul(mtx);
+  if (stats.error)
+    return false;
+  // Only the submitted bytes can complete, never wait for the O_DIRECT
+  // chunk being filled.
+  auto full = [this, len] {
+    return stats.inflight_bytes > chunk_fill &&
+           stats.inflight_bytes + len > max_inflight;
+  };
+  if (full()) {
+    if (!block_when_full) {
+      stats.dropped_bytes += len;
+      stats.dropped_times++;
+      return false;
+    }
+    cond.wait(_ul, [&] { return !full() || stats.error; });
+    if (stats.error)
+      return false;
+  }
+  stats.inflight_bytes += len;
+  stats.peak_inflight_bytes =
+      std::max(stats.peak_inflight_bytes, stats.inflight_bytes);
+  return true;
+}
+
+void AsyncWriteStream::Unreserve(size_t len) {
+  std::lock_guard<std::mutex> _lg(mtx);
+  stats.inflight_bytes -= len;
+  cond.notify_all();
+}
+
+void AsyncWriteStream::Enqueue(WriteRequest *req) {
+  req->offset = offset;
+  req->done = 0;
+  offset += req->len;
+  backend->Submit(req);
+}
+
+void AsyncWriteStream::OnComplete(WriteRequest *req, int err) {
+  if (req->buffer)
+    req->buffer->EndCPUAccess(MediaBuffer::kCPURead);
+  {
+    std::lock_guard<std::mutex> _lg(mtx);
+    if (err && !stats.error) {
+      stats.error = err;
+      LOG("%s: write %zu bytes at %lld failed, %s\n", path.c_str(), req->len,
+          (long long)req->offset, strerror(err));
+    }
+    stats.written_bytes += std::min(req->done, req->reserved);
+    stats.inflight_bytes -= req->reserved;
+    cond.notify_all();
+  }
+  // the buffer may go back to its pool here
+  delete req;
+}
+
+void AsyncWriteStream::UpdateWriteTime(int64_t start) {
+  int64_t cost = gettimeofday() - start;
+  std::lock_guard<std::mutex> _lg(mtx);
+  stats.max_write_us = std::max(stats.max_write_us, cost);
+}
+
+bool AsyncWriteStream::NewChunk() {
+  void *ptr = nullptr;
+  if (posix_memalign(&ptr, kAlign, kDirectChunk)) {
+    LOG_NO_MEMORY();
+    return false;
+  }
+  chunk.reset(ptr, free);
+  chunk_fill = 0;
+  return true;
+}
+
+void AsyncWriteStream::FlushChunk(bool last) {
+  auto req = new WriteRequest();
+  if (!req) {
+    LOG_NO_MEMORY();
+    return;
+  }
+  size_t len = chunk_fill;
+  if (last) {
+    // O_DIRECT writes whole blocks, the padding is truncated at close
+    size_t padded = (len + kAlign - 1) / kAlign * kAlign;
+    memset((uint8_t *)chunk.get() + len, 0, padded - len);
+    len = padded;
+  }
+  int64_t end = offset + chunk_fill;
+  req->len = len;
+  req->reserved = chunk_fill;
+  req->data = chunk;
+  req->iov.push_back({chunk.get(), len});
+  chunk.reset();
+  chunk_fill = 0;
+  Enqueue(req);
+  // the padding is not a part of the file
+  offset = end;
+}
+
+bool AsyncWriteStream::Gather(const struct iovec *iov, int iovcnt,
+                              size_t len) {
+  // the chunk being filled is counted in flight too
+  if (!Reserve(len))
+    return false;
+  for (int i = 0; i < iovcnt; i++) {
+    const uint8_t *src = (const uint8_t *)iov[i].iov_base;
+    size_t left = iov[i].iov_len;
+    while (left > 0) {
+      if (!chunk && !NewChunk()) {
+        Unreserve(left);
+        for (int j = i + 1; j < iovcnt; j++)
+          Unreserve(iov[j].iov_len);
+        return false;
+      }
+      size_t n = std::min(left, kDirectChunk - chunk_fill);
+      memcpy((uint8_t *)chunk.get() + chunk_fill, src, n);
+      chunk_fill += n;
+      src += n;
+      left -= n;
+      if (chunk_fill == kDirectChunk)
+        FlushChunk(false);
+    }
+  }
+  return true;
+}
+
+size_t AsyncWriteStream::WriteV(const struct iovec *iov, int iovcnt) {
+  if (!Writeable())
+    return -1;
+  int64_t start = gettimeofday();
+  size_t len = 0;
+  for (int i = 0; i < iovcnt; i++)
+    len += iov[i].iov_len;
+  if (len == 0)
+    return 0;
+  bool ret;
+  if (direct) {
+    ret = Gather(iov, iovcnt, len);
+  } else if ((ret = Reserve(len))) {
+    // the caller owns the memory, keep a copy
+    auto req = new WriteRequest();
+    void *ptr = malloc(len);
+    if (!req || !ptr) {
+      LOG_NO_MEMORY();
+      delete req;
+      free(ptr);
+      Unreserve(len);
+      return -1;
+    }
+    uint8_t *dst = (uint8_t *)ptr;
+    for (int i = 0; i < iovcnt; i++) {
+      memcpy(dst, iov[i].iov_base, iov[i].iov_len);
+      dst += iov[i].iov_len;
+    }
+    req->len = req->reserved = len;
+    req->data.reset(ptr, free);
+    req->iov.push_back({ptr, len});
+    Enqueue(req);
+  }
+  UpdateWriteTime(start);
+  return ret ? len : 0;
+}
+
+size_t AsyncWriteStream::Write(const void *ptr, size_t size, size_t nmemb) {
+  struct iovec iov = {const_cast<void *>(ptr), size * nmemb};
+  size_t ret = WriteV(&iov, 1);
+  if (ret == (size_t)-1 || size == 0)
+    return ret;
+  return ret / size;
+}
+
+bool AsyncWriteStream::Write(std::shared_ptr<MediaBuffer> buffer) {
+  if (!buffer)
+    return false;
+  if (!Writeable())
+    return false;
+  std::vector<struct iovec> iov;
+  size_t len = buffer->GetIOVec(iov);
+  if (len == 0)
+    return true;
+  if (direct) {
+    AutoCPUAccess _aca(buffer.get(), MediaBuffer::kCPURead);
+    return WriteV(iov.data(), iov.size()) == len;
+  }
+  int64_t start = gettimeofday();
+  if (!Reserve(len)) {
+    UpdateWriteTime(start);
+    return false;
+  }
+  // zero copy, the buffer is released when the write completes
+  auto req = new WriteRequest();
+  if (!req) {
+    LOG_NO_MEMORY();
+    Unreserve(len);
+    return false;
+  }
+  buffer->BeginCPUAccess(MediaBuffer::kCPURead);
+  req->len = req->reserved = len;
+  req->iov = std::move(iov);
+  req->buffer = buffer;
+  Enqueue(req);
+  UpdateWriteTime(start);
+  return true;
+}
+
+int AsyncWriteStream::IoCtrl(unsigned long int request, ...) {
+  va_list vl;
+  va_start(vl, request);
+  void *arg = va_arg(vl, void *);
+  va_end(vl);
+  if (request != G_STREAM_WRITE_STATS || !arg)
+    return -1;
+  std::lock_guard<std::mutex> _lg(mtx);
+  *static_cast<StreamWriteStats *>(arg) = stats;
+  return 0;
+}
+
+DEFINE_STREAM_FACTORY(AsyncWriteStream, Stream)
+
+const char *FACTORY(AsyncWriteStream)::ExpectedInputDataType() {
+  return TYPE_ANYTHING;
+}
+
+const char *FACTORY(AsyncWriteStream)::OutPutDataType() { return STREAM_FILE; }
+
+} // namespace easymedia
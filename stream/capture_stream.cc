@@ -0,0 +1,575 @@
+/*
+ * Copyright (C) 2017 Hertz Wang 1989wanghang@163.com
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see http://www.gnu.org/licenses
+ *
+ * Any non-GPL usage of this software or parts of this software is strictly
+ * forbidden.
+ *
+ */
+
+#include "stream.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdarg.h>
+#include <limits.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <vector>
+
+#include "buffer.h"
+#include "media_type.h"
+#include "utils.h"
+
+namespace easymedia {
+
+// Raw frame capture container, in host byte order:
+//   file header
+//   frame header, frame data
+//   ...
+//   index entries of all frames, index tail
+// The header sizes are recorded in the file header, so that fields can be
+// appended later. If the index is missing, such as the recorder crashed,
+// the frames are scanned and a truncated last frame is dropped.
+
+static const char kCaptureMagic[8] = {'E', 'M', 'C', 'A', 'P', 'T', 'R', '1'};
+static const char kFrameMagic[4] = {'E', 'M', 'F', 'R'};
+static const char kIndexMagic[4] = {'E', 'M', 'I', 'X'};
+
+struct CaptureFileHeader {
+  char magic[8];
+  uint32_t header_size;
+  uint32_t frame_header_size;
+};
+
+struct CaptureFrameHeader {
+  char magic[4];
+  int32_t type;
+  uint32_t user_flag;
+  uint32_t eof;
+  int64_t timestamp;
+  uint64_t size;
+  // Type::Image
+  int32_t pix_fmt;
+  int32_t width;
+  int32_t height;
+  int32_t vir_width;
+  int32_t vir_height;
+  int32_t plane_num;
+  int32_t plane_offset[IMAGE_MAX_PLANES];
+  int32_t plane_stride[IMAGE_MAX_PLANES];
+  // Type::Audio
+  int32_t sample_fmt;
+  int32_t channels;
+  int32_t sample_rate;
+  int32_t nb_samples;
+};
+
+struct CaptureIndexEntry {
+  uint64_t offset; // of the frame header
+  int64_t timestamp;
+  uint32_t user_flag;
+  uint32_t reserved;
+};
+
+struct CaptureIndexTail {
+  char magic[4];
+  uint32_t entry_size;
+  uint64_t count;
+  uint64_t index_offset;
+};
+
+// write all or fail
+static bool write_all(int fd, struct iovec *iov, int cnt) {
+  while (cnt > 0) {
+    ssize_t ret = writev(fd, iov, std::min(cnt, IOV_MAX));
+    if (ret < 0) {
+      if (errno == EINTR)
+        continue;
+      return false;
+    }
+    size_t left = ret;
+    while (cnt > 0 && left >= iov->iov_len) {
+      left -= iov->iov_len;
+      iov++;
+      cnt--;
+    }
+    if (cnt > 0) {
+      iov->iov_base = (uint8_t *)iov->iov_base + left;
+      iov->iov_len -= left;
+    }
+  }
+  return true;
+}
+
+// read all or fail
+static bool pread_all(int fd, void *ptr, size_t size, uint64_t offset) {
+  uint8_t *p = static_cast<uint8_t *>(ptr);
+  while (size > 0) {
+    ssize_t ret = pread(fd, p, size, offset);
+    if (ret < 0 && errno == EINTR)
+      continue;
+    if (ret <= 0)
+      return false;
+    p += ret;
+    size -= ret;
+    offset += ret;
+  }
+  return true;
+}
+
+// Write buffers into a capture file, with their type, timestamp, flags and
+// image or sample info. Only Write(std::shared_ptr<MediaBuffer>) is valid.
+class CaptureWriteStream : public Stream {
+public:
+  CaptureWriteStream(const char *param);
+  virtual ~CaptureWriteStream() { CaptureWriteStream::Close(); }
+  static const char *GetStreamName() { return "capture_write_stream"; }
+
+  virtual size_t Read(void *ptr _UNUSED, size_t size _UNUSED,
+                      size_t nmemb _UNUSED) final {
+    errno = EINVAL;
+    return -1;
+  }
+  virtual size_t Write(const void *ptr _UNUSED, size_t size _UNUSED,
+                       size_t nmemb _UNUSED) final {
+    errno = EINVAL;
+    return -1;
+  }
+  virtual int Seek(int64_t off _UNUSED, int whence _UNUSED) final {
+    errno = ESPIPE;
+    return -1;
+  }
+  virtual long Tell() final { return fd >= 0 ? (long)offset : -1; }
+  virtual bool Write(std::shared_ptr<MediaBuffer> buffer) final;
+  virtual int IoCtrl(unsigned long int request, ...) final;
+  virtual int Open() final;
+
+protected:
+  virtual int Close() final;
+
+private:
+  std::string path;
+  int fd;
+  uint64_t offset;
+  std::vector<CaptureIndexEntry> index;
+};
+
+CaptureWriteStream::CaptureWriteStream(const char *param)
+    : fd(-1), offset(0) {
+  std::map<std::string, std::string> params;
+  if (!parse_media_param_map(param, params))
+    return;
+  path = params[KEY_PATH];
+}
+
+int CaptureWriteStream::Open() {
+  if (path.empty()) {
+    LOG("missing %s of capture\n", KEY_PATH);
+    return -1;
+  }
+  fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+  if (fd < 0) {
+    LOG("open %s failed, %m\n", path.c_str());
+    return -1;
+  }
+  CaptureFileHeader header;
+  memcpy(header.magic, kCaptureMagic, sizeof(header.magic));
+  header.header_size = sizeof(header);
+  header.frame_header_size = sizeof(CaptureFrameHeader);
+  struct iovec iov = {&header, sizeof(header)};
+  if (!write_all(fd, &iov, 1)) {
+    LOG("write %s failed, %m\n", path.c_str());
+    close(fd);
+    fd = -1;
+    return -1;
+  }
+  offset = sizeof(header);
+  index.clear();
+  SetWriteable(true);
+  return 0;
+}
+
+bool CaptureWriteStream::Write(std::shared_ptr<MediaBuffer> buffer) {
+  if (!Writeable() || fd < 0 || !buffer)
+    return false;
+  CaptureFrameHeader header;
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, kFrameMagic, sizeof(header.magic));
+  header.type = (int32_t)buffer->GetType();
+  header.user_flag = buffer->GetUserFlag();
+  header.eof = buffer->IsEOF();
+  header.timestamp = buffer->GetUSTimeStamp();
+  if (buffer->GetType() == Type::Image) {
+    const ImageInfo &info =
+        static_cast<ImageBuffer *>(buffer.get())->GetImageInfo();
+    header.pix_fmt = info.pix_fmt;
+    header.width = info.width;
+    header.height = info.height;
+    header.vir_width = info.vir_width;
+    header.vir_height = info.vir_height;
+    header.plane_num = info.plane_num;
+    for (int i = 0; i < info.plane_num && i < IMAGE_MAX_PLANES; i++) {
+      header.plane_offset[i] = info.planes[i].offset;
+      header.plane_stride[i] = info.planes[i].stride;
+    }
+  } else if (buffer->GetType() == Type::Audio) {
+    const SampleInfo &info =
+        static_cast<SampleBuffer *>(buffer.get())->GetSampleInfo();
+    header.sample_fmt = info.fmt;
+    header.channels = info.channels;
+    header.sample_rate = info.sample_rate;
+    header.nb_samples = info.nb_samples;
+  }
+  // the header goes with the data in one call
+  std::vector<struct iovec> iov(1, {&header, sizeof(header)});
+  header.size = buffer->GetIOVec(iov);
+  AutoCPUAccess _aca(buffer.get(), MediaBuffer::kCPURead);
+  if (!write_all(fd, iov.data(), iov.size())) {
+    LOG("write %s failed, %m\n", path.c_str());
+    // the frames before are still found by scanning
+    if (ftruncate(fd, offset))
+      LOG("truncate %s failed, %m\n", path.c_str());
+    lseek(fd, offset, SEEK_SET);
+    return false;
+  }
+  index.push_back({offset, header.timestamp, header.user_flag, 0});
+  offset += sizeof(header) + header.size;
+  return true;
+}
+
+int CaptureWriteStream::Close() {
+  if (fd < 0)
+    return 0;
+  CaptureIndexTail tail;
+  memcpy(tail.magic, kIndexMagic, sizeof(tail.magic));
+  tail.entry_size = sizeof(CaptureIndexEntry);
+  tail.count = index.size();
+  tail.index_offset = offset;
+  struct iovec iov[2] = {
+      {index.data(), index.size() * sizeof(CaptureIndexEntry)},
+      {&tail, sizeof(tail)}};
+  int ret = 0;
+  if (!write_all(fd, iov, 2)) {
+    LOG("write index of %s failed, %m\n", path.c_str());
+    ret = -1;
+  }
+  close(fd);
+  fd = -1;
+  index.clear();
+  Stream::Close();
+  return ret;
+}
+
+int CaptureWriteStream::IoCtrl(unsigned long int request, ...) {
+  va_list vl;
+  va_start(vl, request);
+  void *arg = va_arg(vl, void *);
+  va_end(vl);
+  if (request != G_CAPTURE_FRAME_NUM || !arg)
+    return -1;
+  *static_cast<uint64_t *>(arg) = index.size();
+  return 0;
+}
+
+DEFINE_STREAM_FACTORY(CaptureWriteStream, Stream)
+
+const char *FACTORY(CaptureWriteStream)::ExpectedInputDataType() {
+  return TYPE_ANYTHING;
+}
+
+const char *FACTORY(CaptureWriteStream)::OutPutDataType() {
+  return STREAM_FILE;
+}
+
+// Read the frames of a capture file by Read(), in the original type,
+// timestamp, flags and image or sample info.
+// Seek/Tell count in frames. IoCtrl:
+//   S_CAPTURE_SEEK_TIME, int64_t *: seek to the intra frame which the frame
+//     at the timestamp depends on, or to the kExtraIntra frame right before
+//     that intra frame, or to that frame if no intra frame is before it.
+//     Timestamps are expected to increase.
+//   G_CAPTURE_FRAME_NUM, uint64_t *
+class CaptureReadStream : public Stream {
+public:
+  CaptureReadStream(const char *param);
+  virtual ~CaptureReadStream() { CaptureReadStream::Close(); }
+  static const char *GetStreamName() { return "capture_read_stream"; }
+
+  virtual size_t Read(void *ptr _UNUSED, size_t size _UNUSED,
+                      size_t nmemb _UNUSED) final {
+    errno = EINVAL;
+    return -1;
+  }
+  virtual size_t Write(const void *ptr _UNUSED, size_t size _UNUSED,
+                       size_t nmemb _UNUSED) final {
+    errno = EINVAL;
+    return -1;
+  }
+  virtual int Seek(int64_t offset, int whence) final;
+  virtual long Tell() final { return fd >= 0 ? (long)cur : -1; }
+  virtual bool Eof() final { return fd < 0 || cur >= index.size(); }
+  virtual std::shared_ptr<MediaBuffer> Read() final;
+  virtual int IoCtrl(unsigned long int request, ...) final;
+  virtual int Open() final;
+
+protected:
+  virtual int Close() final;
+
+private:
+  bool LoadIndex();
+  void ScanFrames();
+
+  std::string path;
+  MediaBuffer::MemType mtype;
+  int fd;
+  uint32_t frame_header_size;
+  uint64_t data_offset;
+  uint64_t file_size;
+  std::vector<CaptureIndexEntry> index;
+  size_t cur;
+};
+
+CaptureReadStream::CaptureReadStream(const char *param)
+    : mtype(MediaBuffer::MemType::MEM_COMMON), fd(-1), frame_header_size(0),
+      data_offset(0), file_size(0), cur(0) {
+  std::map<std::string, std::string> params;
+  if (!parse_media_param_map(param, params))
+    return;
+  path = params[KEY_PATH];
+  const std::string &value = params[KEY_MEM_TYPE];
+  if (!value.empty())
+    mtype = StringToMemType(value.c_str());
+}
+
+int CaptureReadStream::Open() {
+  if (path.empty()) {
+    LOG("missing %s of capture\n", KEY_PATH);
+    return -1;
+  }
+  fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    LOG("open %s failed, %m\n", path.c_str());
+    return -1;
+  }
+  CaptureFileHeader header;
+  struct stat st;
+  if (fstat(fd, &st) || !pread_all(fd, &header, sizeof(header), 0) ||
+      memcmp(header.magic, kCaptureMagic, sizeof(header.magic)) ||
+      header.header_size < sizeof(header) ||
+      header.frame_header_size < offsetof(CaptureFrameHeader, pix_fmt)) {
+    LOG("%s is not a capture file\n", path.c_str());
+    close(fd);
+    fd = -1;
+    return -1;
+  }
+  frame_header_size = header.frame_header_size;
+  data_offset = header.header_size;
+  file_size = st.st_size;
+  if (!LoadIndex()) {
+    LOG("%s has no index, scan the frames\n", path.c_str());
+    ScanFrames();
+  }
+  cur = 0;
+  SetReadable(true);
+  SetSeekable(true);
+  return 0;
+}
+
+bool CaptureReadStream::LoadIndex() {
+  CaptureIndexTail tail;
+  if (file_size < data_offset + sizeof(tail) ||
+      !pread_all(fd, &tail, sizeof(tail), file_size - sizeof(tail)) ||
+      memcmp(tail.magic, kIndexMagic, sizeof(tail.magic)) ||
+      tail.entry_size < sizeof(CaptureIndexEntry) ||
+      tail.count > file_size / tail.entry_size ||
+      tail.index_offset + tail.count * tail.entry_size + sizeof(tail) !=
+          file_size)
+    return false;
+  std::vector<uint8_t> data(tail.count * tail.entry_size);
+  if (!data.empty() &&
+      !pread_all(fd, data.data(), data.size(), tail.index_offset))
+    return false;
+  index.resize(tail.count);
+  for (uint64_t i = 0; i < tail.count; i++)
+    memcpy(&index[i], &data[i * tail.entry_size], sizeof(CaptureIndexEntry));
+  return true;
+}
+
+void CaptureReadStream::ScanFrames() {
+  index.clear();
+  uint64_t pos = data_offset;
+  CaptureFrameHeader header;
+  size_t header_size = std::min<size_t>(frame_header_size, sizeof(header));
+  while (pos + frame_header_size <= file_size) {
+    memset(&header, 0, sizeof(header));
+    if (!pread_all(fd, &header, header_size, pos) ||
+        memcmp(header.magic, kFrameMagic, sizeof(header.magic)) ||
+        pos + frame_header_size + header.size > file_size)
+      break;
+    index.push_back({pos, header.timestamp, header.user_flag, 0});
+    pos += frame_header_size + header.size;
+  }
+}
+
+std::shared_ptr<MediaBuffer> CaptureReadStream::Read() {
+  if (!Readable() || Eof())
+    return nullptr;
+  uint64_t pos = index[cur++].offset;
+  CaptureFrameHeader header;
+  memset(&header, 0, sizeof(header));
+  size_t header_size = std::min<size_t>(frame_header_size, sizeof(header));
+  // the index may be corrupt, never allocate beyond the file
+  if (!pread_all(fd, &header, header_size, pos) ||
+      memcmp(header.magic, kFrameMagic, sizeof(header.magic)) ||
+      header.size > file_size ||
+      pos + frame_header_size + header.size > file_size) {
+    LOG("bad frame at %llu of %s\n", (unsigned long long)pos, path.c_str());
+    return nullptr;
+  }
+  // keep one byte for empty frames, such as eof
+  auto mb = MediaBuffer::Alloc(std::max<uint64_t>(header.size, 1), mtype);
+  if (!mb) {
+    LOG_NO_MEMORY();
+    return nullptr;
+  }
+  if (header.size > 0) {
+    AutoCPUAccess _aca(mb.get(), MediaBuffer::kCPUWrite);
+    if (!pread_all(fd, mb->GetPtr(), header.size, pos + frame_header_size)) {
+      LOG("read frame at %llu of %s failed\n", (unsigned long long)pos,
+          path.c_str());
+      return nullptr;
+    }
+  }
+  std::shared_ptr<MediaBuffer> buffer;
+  Type type = (Type)header.type;
+  if (type == Type::Image) {
+    ImageInfo info;
+    memset(&info, 0, sizeof(info));
+    info.pix_fmt = (PixelFormat)header.pix_fmt;
+    info.width = header.width;
+    info.height = header.height;
+    info.vir_width = header.vir_width;
+    info.vir_height = header.vir_height;
+    info.plane_num = std::min(header.plane_num, IMAGE_MAX_PLANES);
+    for (int i = 0; i < info.plane_num; i++) {
+      info.planes[i].offset = header.plane_offset[i];
+      info.planes[i].stride = header.plane_stride[i];
+    }
+    buffer = std::make_shared<ImageBuffer>(*mb, info);
+  } else if (type == Type::Audio) {
+    SampleInfo info = {(SampleFormat)header.sample_fmt, header.channels,
+                       header.sample_rate, header.nb_samples};
+    buffer = std::make_shared<SampleBuffer>(*mb, info);
+  } else {
+    buffer = mb;
+    buffer->SetType(type);
+  }
+  if (!buffer) {
+    LOG_NO_MEMORY();
+    return nullptr;
+  }
+  buffer->SetValidSize(header.size);
+  buffer->SetUserFlag(header.user_flag);
+  buffer->SetUSTimeStamp(header.timestamp);
+  buffer->SetEOF(!!header.eof);
+  return buffer;
+}
+
+int CaptureReadStream::Seek(int64_t offset, int whence) {
+  if (!Seekable())
+    return -1;
+  int64_t pos;
+  switch (whence) {
+  case SEEK_SET:
+    pos = offset;
+    break;
+  case SEEK_CUR:
+    pos = (int64_t)cur + offset;
+    break;
+  case SEEK_END:
+    pos = (int64_t)index.size() + offset;
+    break;
+  default:
+    errno = EINVAL;
+    return -1;
+  }
+  if (pos < 0 || pos > (int64_t)index.size()) {
+    errno = EINVAL;
+    return -1;
+  }
+  cur = pos;
+  return 0;
+}
+
+int CaptureReadStream::IoCtrl(unsigned long int request, ...) {
+  va_list vl;
+  va_start(vl, request);
+  void *arg = va_arg(vl, void *);
+  va_end(vl);
+  if (!arg)
+    return -1;
+  switch (request) {
+  case S_CAPTURE_SEEK_TIME: {
+    int64_t ts = *static_cast<int64_t *>(arg);
+    size_t i = 0;
+    while (i < index.size() && index[i].timestamp <= ts)
+      i++;
+    if (i == 0)
+      return -1;
+    size_t target = --i;
+    const uint32_t key_flags = MediaBuffer::kIntra | MediaBuffer::kExtraIntra;
+    while (!(index[i].user_flag & key_flags) && i > 0)
+      i--;
+    if (!(index[i].user_flag & key_flags))
+      i = target;
+    else if ((index[i].user_flag & MediaBuffer::kIntra) && i > 0 &&
+             (index[i - 1].user_flag & MediaBuffer::kExtraIntra))
+      i--; // the intra frame needs the sps and pps before it
+    cur = i;
+    return 0;
+  }
+  case G_CAPTURE_FRAME_NUM:
+    *static_cast<uint64_t *>(arg) = index.size();
+    return 0;
+  default:
+    return -1;
+  }
+}
+
+int CaptureReadStream::Close() {
+  if (fd < 0)
+    return 0;
+  close(fd);
+  fd = -1;
+  index.clear();
+  Stream::Close();
+  return 0;
+}
+
+DEFINE_STREAM_FACTORY(CaptureReadStream, Stream)
+
+const char *FACTORY(CaptureReadStream)::ExpectedInputDataType() {
+  return STREAM_FILE;
+}
+
+const char *FACTORY(CaptureReadStream)::OutPutDataType() {
+  return TYPE_ANYTHING;
+}
+
+} // namespace easymedia
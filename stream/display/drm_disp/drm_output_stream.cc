@@ -93,6 +93,19 @@ public:
       LOG("TODO format for drm %c%c%c%c\n", DUMP_FOURCC(drm_fmt));
       return;
     }
+    const ImageInfo &info = buffer->GetImageInfo();
+    if (info.plane_num > 0) {
+      // explicit layout, such as imported dma-buf
+      ImagePlane planes[IMAGE_MAX_PLANES];
+      int plane_num = buffer->GetPlaneLayout(planes);
+      for (int i = 0; i < plane_num; i++) {
+        handles[i] = handle;
+        pitches[i] = planes[i].stride;
+        offsets[i] = buffer->GetFDOffset() + planes[i].offset;
+      }
+      w = info.width;
+      h = info.height;
+    }
     ret = drmModeAddFB2(drm_fd, w, h, drm_fmt, handles, pitches, offsets,
                         &fb_id, 0);
     if (ret) {
@@ -23,8 +23,15 @@
 
 #include <assert.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
 #include <stdio.h>
+#include <unistd.h>
 
+#include <algorithm>
+#include <vector>
+
+#include "buffer.h"
 #include "media_type.h"
 #include "utils.h"
 
@@ -47,13 +54,24 @@ public:
     if (!Readable())
       return -1;
     CHECK_FILE(file)
-    return fread(ptr, size, nmemb, file);
+    size_t ret = fread(ptr, size, nmemb, file);
+    AfterRead(ret * size);
+    return ret;
   }
   virtual int Seek(int64_t offset, int whence) final {
     if (!Seekable())
       return -1;
     CHECK_FILE(file)
-    return fseek(file, offset, whence);
+    int ret = fseek(file, offset, whence);
+    if (!ret) {
+      eof = false;
+      // restart the hints from the new position
+      long pos = ftell(file);
+      if (pos >= 0 && (size_t)pos < dropped_to)
+        dropped_to = pos & ~(kPageSize - 1);
+      willneed_end = 0;
+    }
+    return ret;
   }
   virtual long Tell() final {
     CHECK_FILE(file)
@@ -65,6 +83,18 @@ public:
     CHECK_FILE(file)
     return fwrite(ptr, size, nmemb, file);
   }
+  virtual size_t ReadV(const struct iovec *iov, int iovcnt) final;
+  virtual size_t WriteV(const struct iovec *iov, int iovcnt) final;
+  virtual bool Write(std::shared_ptr<MediaBuffer> buffer) final {
+    if (!buffer)
+      return false;
+    std::vector<struct iovec> iov;
+    size_t len = buffer->GetIOVec(iov);
+    if (len == 0)
+      return true;
+    AutoCPUAccess _aca(buffer.get(), MediaBuffer::kCPURead);
+    return WriteV(iov.data(), iov.size()) == len;
+  }
 
   virtual bool Eof() final {
     if (!file) {
@@ -81,6 +111,9 @@ protected:
     file = fopen(path.c_str(), open_mode.c_str());
     if (!file)
       return -1;
+    if (advice != POSIX_FADV_NORMAL)
+      posix_fadvise(fileno(file), 0, 0, advice);
+    dropped_to = willneed_end = 0;
     eof = false;
     SetReadable(true);
     SetWriteable(true);
@@ -99,13 +132,104 @@ protected:
   }
 
 private:
+  static const size_t kPageSize = 4096;
+  static const size_t kDropStep = 1024 * 1024;
+  // page cache hints of the bytes read
+  void AfterRead(size_t bytes);
+
   std::string path;
   std::string open_mode;
   FILE *file;
   bool eof;
+  int advice;
+  bool drop_behind;
+  size_t dropped_to;
+  size_t willneed_size;
+  size_t willneed_end;
 };
 
-FileStream::FileStream(const char *param) : file(NULL), eof(true) {
+void FileStream::AfterRead(size_t bytes) {
+  if (bytes == 0 || (!drop_behind && willneed_size == 0))
+    return;
+  long pos = ftell(file);
+  if (pos < 0)
+    return;
+  int fd = fileno(file);
+  if (drop_behind && (size_t)pos >= dropped_to + kDropStep) {
+    // replaying a huge file should not evict the page cache of others
+    size_t end = pos & ~(kPageSize - 1);
+    posix_fadvise(fd, dropped_to, end - dropped_to, POSIX_FADV_DONTNEED);
+    dropped_to = end;
+  }
+  if (willneed_size > 0 && (size_t)pos + willneed_size / 2 >= willneed_end) {
+    posix_fadvise(fd, pos, willneed_size, POSIX_FADV_WILLNEED);
+    willneed_end = pos + willneed_size;
+  }
+}
+
+// readv/writev all the segments, return the transferred bytes
+static size_t transfer_vector(int fd, const struct iovec *iov, int iovcnt,
+                              bool write) {
+  std::vector<struct iovec> vec(iov, iov + iovcnt);
+  struct iovec *v = vec.data();
+  int cnt = iovcnt;
+  size_t total = 0;
+  while (cnt > 0) {
+    ssize_t ret = write ? writev(fd, v, std::min(cnt, IOV_MAX))
+                        : readv(fd, v, std::min(cnt, IOV_MAX));
+    if (ret < 0) {
+      if (errno == EINTR)
+        continue;
+      LOG("%s failed, %m\n", write ? "writev" : "readv");
+      break;
+    }
+    if (ret == 0)
+      break; // end of file
+    total += ret;
+    size_t left = ret;
+    while (cnt > 0 && left >= v->iov_len) {
+      left -= v->iov_len;
+      v++;
+      cnt--;
+    }
+    if (cnt > 0) {
+      v->iov_base = (uint8_t *)v->iov_base + left;
+      v->iov_len -= left;
+    }
+  }
+  return total;
+}
+
+size_t FileStream::ReadV(const struct iovec *iov, int iovcnt) {
+  if (!Readable())
+    return -1;
+  CHECK_FILE(file)
+  // drop the stdio buffer, the file offset goes back to the stream position
+  if (fflush(file))
+    return -1;
+  size_t want = 0;
+  for (int i = 0; i < iovcnt; i++)
+    want += iov[i].iov_len;
+  size_t total = transfer_vector(fileno(file), iov, iovcnt, false);
+  if (total < want)
+    eof = true;
+  AfterRead(total);
+  return total;
+}
+
+size_t FileStream::WriteV(const struct iovec *iov, int iovcnt) {
+  if (!Writeable())
+    return -1;
+  CHECK_FILE(file)
+  // bypass the stdio buffer, keep the order of data
+  if (fflush(file))
+    return -1;
+  return transfer_vector(fileno(file), iov, iovcnt, true);
+}
+
+FileStream::FileStream(const char *param)
+    : file(NULL), eof(true), advice(POSIX_FADV_NORMAL), drop_behind(false),
+      dropped_to(0), willneed_size(0), willneed_end(0) {
   std::map<std::string, std::string> params;
   std::list<std::pair<const std::string, std::string &>> req_list;
   req_list.push_back(
@@ -114,6 +238,20 @@ FileStream::FileStream(const char *param) : file(NULL), eof(true) {
       std::pair<const std::string, std::string &>(KEY_OPEN_MODE, open_mode));
   int ret = parse_media_param_match(param, params, req_list);
   UNUSED(ret);
+  std::string value = params[KEY_FILE_ADVICE];
+  if (value == KEY_ADVICE_SEQUENTIAL)
+    advice = POSIX_FADV_SEQUENTIAL;
+  else if (value == KEY_ADVICE_RANDOM)
+    advice = POSIX_FADV_RANDOM;
+  else if (value == KEY_ADVICE_WILLNEED)
+    advice = POSIX_FADV_WILLNEED;
+  else if (!value.empty() && value != KEY_ADVICE_NORMAL)
+    LOG("unknown %s: %s\n", KEY_FILE_ADVICE, value.c_str());
+  value = params[KEY_DROP_BEHIND];
+  drop_behind = !value.empty() && !!std::stoi(value);
+  value = params[KEY_WILLNEED_SIZE];
+  if (!value.empty())
+    willneed_size = std::stoul(value);
 }
 
 // FileWriteStream
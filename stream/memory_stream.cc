@@ -0,0 +1,409 @@
+/*
+ * Copyright (C) 2017 Hertz Wang 1989wanghang@163.com
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see http://www.gnu.org/licenses
+ *
+ * Any non-GPL usage of this software or parts of this software is strictly
+ * forbidden.
+ *
+ */
+
+#include "stream.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <algorithm>
+#include <condition_variable>
+#include <mutex>
+#include <vector>
+
+#include "buffer.h"
+#include "media_type.h"
+#include "utils.h"
+
+namespace easymedia {
+
+// Memory shared by the memory streams of the same name.
+class MemoryStore {
+public:
+  MemoryStore(bool is_pipe, size_t cap)
+      : pipe(is_pipe), capacity(cap), head(0), size(0), readers(0),
+        writers(0), had_reader(false), had_writer(false) {
+    if (pipe)
+      data.resize(capacity);
+  }
+
+  // get the store of name, create it if not exist
+  static std::shared_ptr<MemoryStore> Get(const std::string &name,
+                                          bool is_pipe, size_t cap);
+
+  const bool pipe;
+  const size_t capacity; // pipe: ring size, buffer: max size, 0 unlimited
+  std::mutex mtx;
+  std::condition_variable cond;
+  std::vector<uint8_t> data;
+  size_t head; // pipe: read position in ring
+  size_t size; // valid bytes
+  int readers;
+  int writers;
+  bool had_reader;
+  bool had_writer;
+  // the pipe ends once opened and then all closed
+  bool ReaderGone() const { return had_reader && readers == 0; }
+  bool WriterGone() const { return had_writer && writers == 0; }
+};
+
+std::shared_ptr<MemoryStore>
+MemoryStore::Get(const std::string &name, bool is_pipe, size_t cap) {
+  if (name.empty())
+    return std::make_shared<MemoryStore>(is_pipe, cap);
+  static std::mutex stores_mtx;
+  static std::map<std::string, std::weak_ptr<MemoryStore>> stores;
+  std::lock_guard<std::mutex> _lg(stores_mtx);
+  auto &weak = stores[name];
+  auto store = weak.lock();
+  if (store) {
+    if (store->pipe != is_pipe)
+      LOG("memory %s is opened as %s\n", name.c_str(),
+          store->pipe ? KEY_MEMORY_PIPE : KEY_MEMORY_BUFFER);
+    return store;
+  }
+  // drop the names of released stores
+  for (auto it = stores.begin(); it != stores.end();) {
+    if (it->second.expired() && it->first != name)
+      it = stores.erase(it);
+    else
+      ++it;
+  }
+  store = std::make_shared<MemoryStore>(is_pipe, cap);
+  weak = store;
+  return store;
+}
+
+// Stream backed by memory, no file system io.
+// KEY_MEMORY_MODE:
+//   KEY_MEMORY_BUFFER: growable buffer, seekable, each stream has its own
+//     position. KEY_MEMORY_CAPACITY limits its size, 0 is unlimited.
+//     Open mode "w" or "w+" truncates the buffer.
+//   KEY_MEMORY_PIPE: ring of KEY_MEMORY_CAPACITY bytes, not seekable.
+//     Open mode "r" is the read end, others are the write end. Read waits
+//     for data until all write ends are closed, then reaches Eof. A read
+//     end opened first waits for the first write end. Write waits for
+//     space, fails with EPIPE after all read ends are closed.
+//     With KEY_NON_BLOCK, Read and Write return what they can do at once,
+//     and 0 with errno EAGAIN if nothing.
+// Streams opened with the same KEY_MEMORY_NAME share the memory while any
+// of them is alive, so that one pipeline can write what another reads.
+// Without a name, the memory is private.
+class MemoryStream : public Stream {
+public:
+  MemoryStream(const char *param);
+  virtual ~MemoryStream() { MemoryStream::Close(); }
+  static const char *GetStreamName() { return "memory_stream"; }
+
+  virtual size_t Read(void *ptr, size_t size, size_t nmemb) final;
+  virtual size_t Write(const void *ptr, size_t size, size_t nmemb) final;
+  virtual bool Write(std::shared_ptr<MediaBuffer> buffer) final {
+    if (!buffer)
+      return false;
+    std::vector<struct iovec> iov;
+    size_t len = buffer->GetIOVec(iov);
+    if (len == 0)
+      return true;
+    AutoCPUAccess _aca(buffer.get(), MediaBuffer::kCPURead);
+    return WriteV(iov.data(), iov.size()) == len;
+  }
+  virtual int Seek(int64_t offset, int whence) final;
+  virtual long Tell() final { return store ? (long)pos : -1; }
+  virtual bool Eof() final;
+  virtual int Open() final;
+
+protected:
+  virtual int Close() final;
+
+private:
+  size_t ReadBuffer(uint8_t *ptr, size_t len);
+  size_t WriteBuffer(const uint8_t *ptr, size_t len);
+  // only whole items of item_size are taken from the pipe
+  size_t ReadPipe(uint8_t *ptr, size_t len, size_t item_size);
+  size_t WritePipe(const uint8_t *ptr, size_t len);
+
+  std::string name;
+  std::string open_mode;
+  bool pipe;
+  size_t capacity;
+  bool nonblock;
+  bool reader;
+  bool writer;
+  std::shared_ptr<MemoryStore> store;
+  size_t pos; // buffer: stream position, pipe: bytes passed
+  bool eof;
+};
+
+MemoryStream::MemoryStream(const char *param)
+    : open_mode("w+"), pipe(false), capacity(0), nonblock(false),
+      reader(false), writer(false), pos(0), eof(false) {
+  std::map<std::string, std::string> params;
+  if (!parse_media_param_map(param, params))
+    return;
+  name = params[KEY_MEMORY_NAME];
+  std::string value = params[KEY_OPEN_MODE];
+  if (!value.empty())
+    open_mode = value;
+  pipe = (params[KEY_MEMORY_MODE] == KEY_MEMORY_PIPE);
+  value = params[KEY_MEMORY_CAPACITY];
+  if (!value.empty())
+    capacity = std::stoul(value);
+  else if (pipe)
+    capacity = 1024 * 1024;
+  value = params[KEY_NON_BLOCK];
+  if (!value.empty())
+    nonblock = !!std::stoi(value);
+}
+
+int MemoryStream::Open() {
+  if (pipe && capacity == 0)
+    return -1;
+  store = MemoryStore::Get(name, pipe, capacity);
+  if (!store)
+    return -1;
+  pipe = store->pipe;
+  bool plus = (open_mode.find('+') != std::string::npos);
+  if (pipe) {
+    reader = (open_mode[0] == 'r' && !plus);
+    writer = !reader;
+  } else {
+    reader = (open_mode[0] == 'r' || plus);
+    writer = (open_mode[0] != 'r' || plus);
+  }
+  std::lock_guard<std::mutex> _lg(store->mtx);
+  if (!pipe && open_mode[0] == 'w') {
+    store->data.clear();
+    store->size = 0;
+  }
+  if (!pipe && open_mode[0] == 'a')
+    pos = store->size;
+  if (reader) {
+    store->readers++;
+    store->had_reader = true;
+  }
+  if (writer) {
+    store->writers++;
+    store->had_writer = true;
+  }
+  SetReadable(reader);
+  SetWriteable(writer);
+  SetSeekable(!pipe);
+  return 0;
+}
+
+int MemoryStream::Close() {
+  if (!store) {
+    errno = EBADF;
+    return -1;
+  }
+  {
+    std::lock_guard<std::mutex> _lg(store->mtx);
+    if (reader)
+      store->readers--;
+    if (writer)
+      store->writers--;
+    store->cond.notify_all();
+  }
+  store.reset();
+  return Stream::Close();
+}
+
+size_t MemoryStream::Read(void *ptr, size_t size, size_t nmemb) {
+  if (!Readable() || !store)
+    return -1;
+  size_t len = size * nmemb;
+  if (len == 0)
+    return 0;
+  size_t ret = pipe ? ReadPipe((uint8_t *)ptr, len, size)
+                    : ReadBuffer((uint8_t *)ptr, len);
+  if (ret == (size_t)-1)
+    return ret;
+  return ret / size;
+}
+
+size_t MemoryStream::Write(const void *ptr, size_t size, size_t nmemb) {
+  if (!Writeable() || !store)
+    return -1;
+  size_t len = size * nmemb;
+  if (len == 0)
+    return 0;
+  size_t ret = pipe ? WritePipe((const uint8_t *)ptr, len)
+                    : WriteBuffer((const uint8_t *)ptr, len);
+  if (ret == (size_t)-1)
+    return ret;
+  return ret / size;
+}
+
+size_t MemoryStream::ReadBuffer(uint8_t *ptr, size_t len) {
+  std::lock_guard<std::mutex> _lg(store->mtx);
+  if (pos >= store->size) {
+    eof = true;
+    return 0;
+  }
+  if (len > store->size - pos) {
+    // as fread, a short read reaches the end
+    len = store->size - pos;
+    eof = true;
+  }
+  memcpy(ptr, store->data.data() + pos, len);
+  pos += len;
+  return len;
+}
+
+size_t MemoryStream::WriteBuffer(const uint8_t *ptr, size_t len) {
+  std::lock_guard<std::mutex> _lg(store->mtx);
+  if (open_mode[0] == 'a')
+    pos = store->size;
+  size_t end = pos + len;
+  if (store->capacity > 0 && end > store->capacity) {
+    if (pos >= store->capacity) {
+      errno = ENOSPC;
+      return -1;
+    }
+    end = store->capacity;
+    len = end - pos;
+  }
+  if (end > store->data.size()) {
+    // grow geometrically, writers append small pieces
+    size_t cap = std::max(end, store->data.size() * 2);
+    if (store->capacity > 0)
+      cap = std::min(cap, store->capacity);
+    store->data.resize(cap);
+  }
+  // a seek beyond the end leaves a zero gap, as files
+  if (pos > store->size)
+    memset(store->data.data() + store->size, 0, pos - store->size);
+  memcpy(store->data.data() + pos, ptr, len);
+  pos = end;
+  store->size = std::max(store->size, end);
+  return len;
+}
+
+size_t MemoryStream::ReadPipe(uint8_t *ptr, size_t len, size_t item_size) {
+  std::unique_lock<std::mutex> _ul(store->mtx);
+  MemoryStore *s = store.get();
+  if (item_size > s->capacity) {
+    errno = EINVAL;
+    return -1;
+  }
+  if (!nonblock)
+    s->cond.wait(_ul, [s, item_size] {
+      return s->size >= item_size || s->WriterGone();
+    });
+  if (s->size < item_size) {
+    // a partial item at the end is left in the pipe
+    if (s->WriterGone()) {
+      eof = true;
+    } else {
+      errno = EAGAIN;
+    }
+    return 0;
+  }
+  size_t done = 0;
+  // return what is there as read(2), but only whole items, as the caller
+  // counts the items read
+  len = std::min(len, s->size);
+  len -= len % item_size;
+  while (done < len) {
+    size_t n = std::min(len - done, s->capacity - s->head);
+    memcpy(ptr + done, s->data.data() + s->head, n);
+    s->head = (s->head + n) % s->capacity;
+    s->size -= n;
+    done += n;
+  }
+  pos += done;
+  s->cond.notify_all();
+  return done;
+}
+
+size_t MemoryStream::WritePipe(const uint8_t *ptr, size_t len) {
+  std::unique_lock<std::mutex> _ul(store->mtx);
+  MemoryStore *s = store.get();
+  size_t done = 0;
+  while (done < len) {
+    if (!nonblock)
+      s->cond.wait(
+          _ul, [s] { return s->size < s->capacity || s->ReaderGone(); });
+    if (s->ReaderGone()) {
+      errno = EPIPE;
+      return done > 0 ? done : (size_t)-1;
+    }
+    if (s->size == s->capacity) {
+      errno = EAGAIN;
+      break;
+    }
+    size_t tail = (s->head + s->size) % s->capacity;
+    size_t n = std::min(len - done, s->capacity - s->size);
+    n = std::min(n, s->capacity - tail);
+    memcpy(s->data.data() + tail, ptr + done, n);
+    s->size += n;
+    done += n;
+    s->cond.notify_all();
+  }
+  pos += done;
+  return done;
+}
+
+int MemoryStream::Seek(int64_t offset, int whence) {
+  if (!Seekable() || !store) {
+    errno = ESPIPE;
+    return -1;
+  }
+  std::lock_guard<std::mutex> _lg(store->mtx);
+  int64_t base = 0;
+  if (whence == SEEK_CUR)
+    base = pos;
+  else if (whence == SEEK_END)
+    base = store->size;
+  else if (whence != SEEK_SET) {
+    errno = EINVAL;
+    return -1;
+  }
+  if (base + offset < 0) {
+    errno = EINVAL;
+    return -1;
+  }
+  pos = base + offset;
+  eof = false;
+  return 0;
+}
+
+bool MemoryStream::Eof() {
+  if (!store) {
+    errno = EBADF;
+    return true;
+  }
+  std::lock_guard<std::mutex> _lg(store->mtx);
+  if (pipe) // or only a partial item is left
+    return store->WriterGone() && (store->size == 0 || eof);
+  return eof;
+}
+
+DEFINE_STREAM_FACTORY(MemoryStream, Stream)
+
+const char *FACTORY(MemoryStream)::ExpectedInputDataType() {
+  return TYPE_ANYTHING;
+}
+
+const char *FACTORY(MemoryStream)::OutPutDataType() { return TYPE_ANYTHING; }
+
+} // namespace easymedia
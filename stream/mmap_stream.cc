@@ -0,0 +1,278 @@
+/*
+ * Copyright (C) 2017 Hertz Wang 1989wanghang@163.com
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see http://www.gnu.org/licenses
+ *
+ * Any non-GPL usage of this software or parts of this software is strictly
+ * forbidden.
+ *
+ */
+
+#include "stream.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+
+#include "buffer.h"
+#include "media_type.h"
+#include "utils.h"
+
+namespace easymedia {
+
+// Read only mapping of a whole file. Buffers from the mapping hold it, so
+// that it lives until the last buffer is released.
+class FileMapping {
+public:
+  FileMapping() : addr(nullptr), length(0) {}
+  ~FileMapping() {
+    if (addr)
+      munmap(addr, length);
+  }
+  int Map(const std::string &path, bool populate, int advice);
+
+  uint8_t *addr;
+  size_t length;
+};
+
+int FileMapping::Map(const std::string &path, bool populate, int advice) {
+  int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    LOG("open %s failed, %m\n", path.c_str());
+    return -1;
+  }
+  struct stat st;
+  if (fstat(fd, &st) < 0) {
+    LOG("fstat %s failed, %m\n", path.c_str());
+    close(fd);
+    return -1;
+  }
+  length = st.st_size;
+  if (length == 0) {
+    close(fd);
+    return 0;
+  }
+  int flags = MAP_PRIVATE;
+  if (populate)
+    flags |= MAP_POPULATE;
+  void *ptr = mmap(nullptr, length, PROT_READ, flags, fd, 0);
+  // the mapping keeps the file referenced
+  close(fd);
+  if (ptr == MAP_FAILED) {
+    LOG("mmap %s failed, %m\n", path.c_str());
+    length = 0;
+    return -1;
+  }
+  addr = static_cast<uint8_t *>(ptr);
+  if (advice != MADV_NORMAL && madvise(addr, length, advice))
+    LOG("madvise %d on %s failed, %m\n", advice, path.c_str());
+  return 0;
+}
+
+// Replay a file of raw frames without copy. Read() returns read-only buffers
+// which point into the mapped file.
+// The frame size is KEY_MEM_SIZE_PERTIME, or the size of an image described
+// as in ParseImageInfoFromMap. Images must be stored packed, as written by
+// file_write_stream, the buffers are described with vir_width=width and
+// vir_height=height. Without both, Read() returns the rest of the file.
+// KEY_LOOP_TIME is the times to replay after the end, negative is endless.
+class MmapReadStream : public Stream {
+public:
+  MmapReadStream(const char *param);
+  virtual ~MmapReadStream() { MmapReadStream::Close(); }
+  static const char *GetStreamName() { return "mmap_read_stream"; }
+
+  virtual size_t Read(void *ptr, size_t size, size_t nmemb) final;
+  virtual size_t Write(const void *ptr _UNUSED, size_t size _UNUSED,
+                       size_t nmemb _UNUSED) final {
+    return -1;
+  }
+  virtual int Seek(int64_t offset, int whence) final;
+  virtual long Tell() final { return mapping ? (long)pos : -1; }
+  virtual bool Eof() final {
+    if (!mapping)
+      return true;
+    size_t need = std::max<size_t>(frame_size, 1);
+    return loop_time == 0 && pos + need > mapping->length;
+  }
+  virtual std::shared_ptr<MediaBuffer> Read() final;
+  virtual int Open() final;
+
+protected:
+  virtual int Close() final {
+    mapping.reset();
+    pos = 0;
+    return Stream::Close();
+  }
+
+private:
+  // wrap around at the end if loop
+  bool Rewind();
+
+  std::string path;
+  bool populate;
+  int advice;
+  size_t frame_size;
+  ImageInfo info;
+  int loop_time;
+  std::shared_ptr<FileMapping> mapping;
+  size_t pos;
+};
+
+MmapReadStream::MmapReadStream(const char *param)
+    : populate(false), advice(MADV_SEQUENTIAL), frame_size(0), loop_time(0),
+      pos(0) {
+  memset(&info, 0, sizeof(info));
+  info.pix_fmt = PIX_FMT_NONE;
+  std::map<std::string, std::string> params;
+  if (!parse_media_param_map(param, params))
+    return;
+  path = params[KEY_PATH];
+  std::string value = params[KEY_MMAP_POPULATE];
+  if (!value.empty())
+    populate = !!std::stoi(value);
+  value = params[KEY_MMAP_ADVICE];
+  if (value == KEY_ADVICE_NORMAL)
+    advice = MADV_NORMAL;
+  else if (value == KEY_ADVICE_RANDOM)
+    advice = MADV_RANDOM;
+  else if (value == KEY_ADVICE_WILLNEED)
+    advice = MADV_WILLNEED;
+  else if (!value.empty() && value != KEY_ADVICE_SEQUENTIAL)
+    LOG("unknown %s %s, use %s\n", KEY_MMAP_ADVICE, value.c_str(),
+        KEY_ADVICE_SEQUENTIAL);
+  value = params[KEY_LOOP_TIME];
+  if (!value.empty())
+    loop_time = std::stoi(value);
+  value = params[KEY_MEM_SIZE_PERTIME];
+  if (!value.empty()) {
+    frame_size = std::stoul(value);
+  } else if (!params[KEY_INPUTDATATYPE].empty() &&
+             ParseImageInfoFromMap(params, info)) {
+    info.vir_width = info.width;
+    info.vir_height = info.height;
+    info.plane_num = 0;
+    int size = CalPixFmtSize(info);
+    if (size > 0)
+      frame_size = size;
+    else
+      info.pix_fmt = PIX_FMT_NONE;
+  }
+}
+
+int MmapReadStream::Open() {
+  if (path.empty())
+    return -1;
+  auto m = std::make_shared<FileMapping>();
+  if (!m || m->Map(path, populate, advice))
+    return -1;
+  if (frame_size > 0 && m->length % frame_size)
+    LOG("%s: size %zu is not a multiple of frame size %zu, tail dropped\n",
+        path.c_str(), m->length, frame_size);
+  mapping = m;
+  pos = 0;
+  SetReadable(true);
+  SetWriteable(false);
+  SetSeekable(true);
+  return 0;
+}
+
+bool MmapReadStream::Rewind() {
+  if (!mapping || mapping->length == 0 || loop_time == 0)
+    return false;
+  if (loop_time > 0)
+    loop_time--;
+  pos = 0;
+  return true;
+}
+
+size_t MmapReadStream::Read(void *ptr, size_t size, size_t nmemb) {
+  if (!Readable() || !mapping)
+    return -1;
+  size_t total = size * nmemb;
+  if (pos >= mapping->length && !Rewind())
+    return 0;
+  size_t len = std::min(total, mapping->length - pos);
+  memcpy(ptr, mapping->addr + pos, len);
+  pos += len;
+  return size > 0 ? len / size : 0;
+}
+
+int MmapReadStream::Seek(int64_t offset, int whence) {
+  if (!mapping) {
+    errno = EBADF;
+    return -1;
+  }
+  int64_t base = 0;
+  if (whence == SEEK_CUR)
+    base = pos;
+  else if (whence == SEEK_END)
+    base = mapping->length;
+  else if (whence != SEEK_SET) {
+    errno = EINVAL;
+    return -1;
+  }
+  if (base + offset < 0) {
+    errno = EINVAL;
+    return -1;
+  }
+  pos = base + offset;
+  return 0;
+}
+
+std::shared_ptr<MediaBuffer> MmapReadStream::Read() {
+  if (!Readable() || !mapping)
+    return nullptr;
+  size_t size = frame_size;
+  if (size == 0)
+    size = mapping->length > pos ? mapping->length - pos : 0;
+  if (size == 0 || pos + size > mapping->length) {
+    if (!Rewind())
+      return nullptr;
+    if (frame_size == 0)
+      size = mapping->length;
+    if (size > mapping->length)
+      return nullptr;
+  }
+  MediaBuffer mb(mapping->addr + pos, size);
+  // the buffer holds the mapping, not the stream
+  mb.SetUserData(mapping);
+  mb.SetValidSize(size);
+  mb.SetReadOnly(true);
+  mb.SetUSTimeStamp(gettimeofday());
+  pos += size;
+  std::shared_ptr<MediaBuffer> ret;
+  if (info.pix_fmt != PIX_FMT_NONE)
+    ret = std::make_shared<ImageBuffer>(mb, info);
+  else
+    ret = std::make_shared<MediaBuffer>(mb);
+  if (!ret)
+    LOG_NO_MEMORY();
+  return ret;
+}
+
+DEFINE_STREAM_FACTORY(MmapReadStream, Stream)
+
+const char *FACTORY(MmapReadStream)::ExpectedInputDataType() {
+  return STREAM_FILE;
+}
+
+const char *FACTORY(MmapReadStream)::OutPutDataType() { return TYPE_ANYTHING; }
+
+} // namespace easymedia
@@ -0,0 +1,402 @@
+/*
+ * Copyright (C) 2017 Hertz Wang 1989wanghang@163.com
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see http://www.gnu.org/licenses
+ *
+ * Any non-GPL usage of this software or parts of this software is strictly
+ * forbidden.
+ *
+ */
+
+#include "stream.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/prctl.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+#include "buffer.h"
+#include "media_type.h"
+#include "utils.h"
+
+namespace easymedia {
+
+// Sink for long recordings on slow flash.
+// Data is gathered into large aligned chunks and written with one pwrite
+// per chunk. The file extents are preallocated by fallocate ahead of the
+// writes, and the unused preallocation is trimmed at close.
+// A background thread pushes the written range to the storage with
+// sync_file_range every KEY_FLUSH_INTERVAL_MS, and drops the flushed pages
+// from the page cache, so that the dirty pages and the latency of the
+// kernel writeback stay bounded.
+class RecordWriteStream : public Stream {
+public:
+  static const size_t kAlign = 4096;
+
+  RecordWriteStream(const char *param);
+  virtual ~RecordWriteStream() { RecordWriteStream::Close(); }
+  static const char *GetStreamName() { return "record_write_stream"; }
+
+  virtual size_t Read(void *ptr _UNUSED, size_t size _UNUSED,
+                      size_t nmemb _UNUSED) final {
+    return -1;
+  }
+  virtual size_t Write(const void *ptr, size_t size, size_t nmemb) final;
+  virtual size_t WriteV(const struct iovec *iov, int iovcnt) final;
+  virtual bool Write(std::shared_ptr<MediaBuffer> buffer) final;
+  virtual int Seek(int64_t off _UNUSED, int whence _UNUSED) final {
+    return -1;
+  }
+  virtual long Tell() final { return fd >= 0 ? (long)offset : -1; }
+  virtual int IoCtrl(unsigned long int request, ...) final;
+  virtual int Open() final;
+
+protected:
+  virtual int Close() final;
+
+private:
+  // write iov at the end of the written data
+  bool WriteOut(const struct iovec *iov, int iovcnt, size_t len);
+  bool WriteChunk();
+  void Preallocate(int64_t end);
+  void FlushRun();
+  void Flush(bool wait_all);
+
+  std::string path;
+  std::string open_mode;
+  size_t chunk_size;
+  size_t prealloc_size;
+  int flush_interval_ms;
+
+  int fd;
+  int64_t offset;     // end of the accepted data
+  int64_t prealloc_end;
+  uint8_t *chunk;
+  size_t chunk_fill;
+  std::atomic<int64_t> written; // end of the data passed to the kernel
+  int64_t flushed;              // end of the range of started writeback
+  int64_t synced;               // end of the range written back
+  int64_t open_time;
+
+  bool quit;
+  std::thread *flush_thread;
+  std::mutex mtx;
+  std::condition_variable cond;
+  StreamWriteStats stats;
+  int64_t total_flush_us;
+};
+
+RecordWriteStream::RecordWriteStream(const char *param)
+    : open_mode("w"), chunk_size(1024 * 1024), prealloc_size(64 * 1024 * 1024),
+      flush_interval_ms(1000), fd(-1), offset(0), prealloc_end(0),
+      chunk(nullptr), chunk_fill(0), written(0), flushed(0), synced(0),
+      open_time(0),
+      quit(false), flush_thread(nullptr), total_flush_us(0) {
+  memset(&stats, 0, sizeof(stats));
+  std::map<std::string, std::string> params;
+  if (!parse_media_param_map(param, params))
+    return;
+  path = params[KEY_PATH];
+  std::string value = params[KEY_OPEN_MODE];
+  if (!value.empty())
+    open_mode = value;
+  value = params[KEY_CHUNK_SIZE];
+  if (!value.empty())
+    chunk_size = std::stoul(value);
+  chunk_size = (chunk_size + kAlign - 1) / kAlign * kAlign;
+  if (chunk_size == 0)
+    chunk_size = kAlign;
+  value = params[KEY_PREALLOC_SIZE];
+  if (!value.empty())
+    prealloc_size = std::stoul(value);
+  value = params[KEY_FLUSH_INTERVAL_MS];
+  if (!value.empty())
+    flush_interval_ms = std::stoi(value);
+}
+
+int RecordWriteStream::Open() {
+  if (path.empty())
+    return -1;
+  int flags = O_WRONLY | O_CREAT | O_CLOEXEC;
+  if (open_mode[0] != 'a')
+    flags |= O_TRUNC;
+  fd = open(path.c_str(), flags, 0644);
+  if (fd < 0) {
+    LOG("open %s failed, %m\n", path.c_str());
+    return -1;
+  }
+  offset = (open_mode[0] == 'a') ? lseek(fd, 0, SEEK_END) : 0;
+  written = flushed = synced = prealloc_end = offset;
+  void *ptr = nullptr;
+  if (posix_memalign(&ptr, kAlign, chunk_size)) {
+    LOG_NO_MEMORY();
+    close(fd);
+    fd = -1;
+    return -1;
+  }
+  chunk = static_cast<uint8_t *>(ptr);
+  chunk_fill = 0;
+  open_time = gettimeofday();
+  quit = false;
+  if (flush_interval_ms > 0)
+    flush_thread = new std::thread(&RecordWriteStream::FlushRun, this);
+  SetReadable(false);
+  SetWriteable(true);
+  SetSeekable(false);
+  return 0;
+}
+
+int RecordWriteStream::Close() {
+  if (fd < 0) {
+    errno = EBADF;
+    return -1;
+  }
+  int ret = 0;
+  if (chunk_fill > 0 && !WriteChunk())
+    ret = -1;
+  if (flush_thread) {
+    {
+      std::lock_guard<std::mutex> _lg(mtx);
+      quit = true;
+      cond.notify_all();
+    }
+    flush_thread->join();
+    delete flush_thread;
+    flush_thread = nullptr;
+  }
+  Flush(true);
+  // release the preallocated blocks beyond the data
+  if (prealloc_end > offset && ftruncate(fd, offset)) {
+    LOG("trim %s failed, %m\n", path.c_str());
+    ret = -1;
+  }
+  if (close(fd))
+    ret = -1;
+  fd = -1;
+  free(chunk);
+  chunk = nullptr;
+  StreamWriteStats s;
+  IoCtrl(G_STREAM_WRITE_STATS, &s);
+  LOGD("%s: %llu bytes, %llu B/s, flush %llu times, avg %lld us, max %lld us, "
+       "longest write %lld us\n",
+       path.c_str(), (unsigned long long)s.written_bytes,
+       (unsigned long long)s.bytes_per_second,
+       (unsigned long long)s.flush_times, (long long)s.avg_flush_us,
+       (long long)s.max_flush_us, (long long)s.max_write_us);
+  Stream::Close();
+  return ret;
+}
+
+void RecordWriteStream::Preallocate(int64_t end) {
+  if (prealloc_size == 0 || end <= prealloc_end)
+    return;
+  int64_t len = std::max<int64_t>(prealloc_size, end - prealloc_end);
+  // keep the file size, readers see only the written data
+  if (fallocate(fd, FALLOC_FL_KEEP_SIZE, prealloc_end, len)) {
+    if (errno == EOPNOTSUPP || errno == ENOSYS)
+      LOG("%s: fallocate is not supported, %m\n", path.c_str());
+    else
+      LOG("%s: fallocate failed, %m\n", path.c_str());
+    prealloc_size = 0;
+    return;
+  }
+  prealloc_end += len;
+}
+
+bool RecordWriteStream::WriteOut(const struct iovec *iov, int iovcnt,
+                                 size_t len) {
+  int64_t pos = written;
+  Preallocate(pos + len);
+  std::vector<struct iovec> vec(iov, iov + iovcnt);
+  struct iovec *v = vec.data();
+  int cnt = iovcnt;
+  size_t left = len;
+  while (left > 0) {
+    ssize_t ret = pwritev(fd, v, std::min(cnt, IOV_MAX), pos);
+    if (ret <= 0) {
+      if (ret < 0 && errno == EINTR)
+        continue;
+      int err = ret < 0 ? errno : EIO;
+      LOG("%s: write failed, %s\n", path.c_str(), strerror(err));
+      std::lock_guard<std::mutex> _lg(mtx);
+      if (!stats.error)
+        stats.error = err;
+      return false;
+    }
+    pos += ret;
+    left -= ret;
+    size_t n = ret;
+    while (cnt > 0 && n >= v->iov_len) {
+      n -= v->iov_len;
+      v++;
+      cnt--;
+    }
+    if (cnt > 0) {
+      v->iov_base = (uint8_t *)v->iov_base + n;
+      v->iov_len -= n;
+    }
+  }
+  written = pos;
+  std::lock_guard<std::mutex> _lg(mtx);
+  stats.written_bytes += len;
+  return true;
+}
+
+bool RecordWriteStream::WriteChunk() {
+  struct iovec iov = {chunk, chunk_fill};
+  bool ret = WriteOut(&iov, 1, chunk_fill);
+  chunk_fill = 0;
+  return ret;
+}
+
+size_t RecordWriteStream::WriteV(const struct iovec *iov, int iovcnt) {
+  if (!Writeable())
+    return -1;
+  int64_t start = gettimeofday();
+  size_t len = 0;
+  for (int i = 0; i < iovcnt; i++)
+    len += iov[i].iov_len;
+  bool ret = true;
+  if (chunk_fill == 0 && len >= chunk_size) {
+    // large enough, no need to gather
+    ret = WriteOut(iov, iovcnt, len);
+  } else {
+    for (int i = 0; i < iovcnt && ret; i++) {
+      const uint8_t *src = (const uint8_t *)iov[i].iov_base;
+      size_t left = iov[i].iov_len;
+      while (left > 0 && ret) {
+        size_t n = std::min(left, chunk_size - chunk_fill);
+        memcpy(chunk + chunk_fill, src, n);
+        chunk_fill += n;
+        src += n;
+        left -= n;
+        if (chunk_fill == chunk_size)
+          ret = WriteChunk();
+      }
+    }
+  }
+  if (ret)
+    offset += len;
+  int64_t cost = gettimeofday() - start;
+  std::lock_guard<std::mutex> _lg(mtx);
+  stats.max_write_us = std::max(stats.max_write_us, cost);
+  return ret ? len : (size_t)-1;
+}
+
+size_t RecordWriteStream::Write(const void *ptr, size_t size, size_t nmemb) {
+  struct iovec iov = {const_cast<void *>(ptr), size * nmemb};
+  size_t ret = WriteV(&iov, 1);
+  if (ret == (size_t)-1 || size == 0)
+    return ret;
+  return ret / size;
+}
+
+bool RecordWriteStream::Write(std::shared_ptr<MediaBuffer> buffer) {
+  if (!buffer)
+    return false;
+  std::vector<struct iovec> iov;
+  size_t len = buffer->GetIOVec(iov);
+  if (len == 0)
+    return true;
+  AutoCPUAccess _aca(buffer.get(), MediaBuffer::kCPURead);
+  return WriteV(iov.data(), iov.size()) == len;
+}
+
+void RecordWriteStream::Flush(bool wait_all) {
+  static const unsigned int kWait = SYNC_FILE_RANGE_WAIT_BEFORE |
+                                    SYNC_FILE_RANGE_WRITE |
+                                    SYNC_FILE_RANGE_WAIT_AFTER;
+  int64_t end = written;
+  if (end <= synced)
+    return;
+  int64_t start = gettimeofday();
+  int64_t clean; // end of the range written back after this flush
+  if (wait_all) {
+    if (sync_file_range(fd, synced, end - synced, kWait))
+      LOG("%s: sync_file_range failed, %m\n", path.c_str());
+    clean = end;
+  } else {
+    // start the new range, then wait the range started by the last flush,
+    // which should be done by now
+    if (end > flushed &&
+        sync_file_range(fd, flushed, end - flushed, SYNC_FILE_RANGE_WRITE))
+      LOG("%s: sync_file_range failed, %m\n", path.c_str());
+    if (flushed > synced)
+      sync_file_range(fd, synced, flushed - synced, kWait);
+    clean = flushed;
+  }
+  flushed = end;
+  // the recorded data is not read back soon
+  if (clean > synced)
+    posix_fadvise(fd, synced, clean - synced, POSIX_FADV_DONTNEED);
+  synced = clean;
+  int64_t cost = gettimeofday() - start;
+  std::lock_guard<std::mutex> _lg(mtx);
+  stats.flush_times++;
+  stats.max_flush_us = std::max(stats.max_flush_us, cost);
+  total_flush_us += cost;
+}
+
+void RecordWriteStream::FlushRun() {
+  prctl(PR_SET_NAME, "record_flush");
+  std::unique_lock<std::mutex> _ul(mtx);
+  while (!quit) {
+    cond.wait_for(_ul, std::chrono::milliseconds(flush_interval_ms),
+                  [this] { return quit; });
+    if (quit)
+      break;
+    _ul.unlock();
+    Flush(false);
+    _ul.lock();
+  }
+}
+
+int RecordWriteStream::IoCtrl(unsigned long int request, ...) {
+  va_list vl;
+  va_start(vl, request);
+  void *arg = va_arg(vl, void *);
+  va_end(vl);
+  if (request != G_STREAM_WRITE_STATS || !arg)
+    return -1;
+  std::lock_guard<std::mutex> _lg(mtx);
+  StreamWriteStats *s = static_cast<StreamWriteStats *>(arg);
+  *s = stats;
+  int64_t elapsed = gettimeofday() - open_time;
+  if (elapsed > 0)
+    s->bytes_per_second = stats.written_bytes * 1000000 / elapsed;
+  if (stats.flush_times > 0)
+    s->avg_flush_us = total_flush_us / stats.flush_times;
+  return 0;
+}
+
+DEFINE_STREAM_FACTORY(RecordWriteStream, Stream)
+
+const char *FACTORY(RecordWriteStream)::ExpectedInputDataType() {
+  return TYPE_ANYTHING;
+}
+
+const char *FACTORY(RecordWriteStream)::OutPutDataType() { return STREAM_FILE; }
+
+} // namespace easymedia
@@ -0,0 +1,576 @@
+/*
+ * Copyright (C) 2017 Hertz Wang 1989wanghang@163.com
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see http://www.gnu.org/licenses
+ *
+ * Any non-GPL usage of this software or parts of this software is strictly
+ * forbidden.
+ *
+ */
+
+#include "stream.h"
+
+#include <dirent.h>
+#include <errno.h>
+#include <limits.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/prctl.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <tuple>
+
+#include "buffer.h"
+#include "media_type.h"
+#include "utils.h"
+
+namespace easymedia {
+
+struct Segment {
+  std::shared_ptr<Stream> stream;
+  std::string part_path; // written path until the segment is finished
+  int index;
+  time_t start; // wall time of the first data
+};
+
+// A part of the template name when matching the names of segments.
+struct NamePart {
+  enum Kind { LITERAL, DIGITS, ANY } kind;
+  std::string text; // of LITERAL
+};
+
+// strftime conversions which only give digits
+static const char kNumericConversions[] = "CdGgHIjmMsSuUVwWyY";
+
+// match name from parts[i], backtracking over the lengths of DIGITS and ANY
+static bool MatchNameParts(const std::vector<NamePart> &parts, size_t i,
+                           const char *name) {
+  if (i == parts.size())
+    return *name == 0;
+  const NamePart &p = parts[i];
+  if (p.kind == NamePart::LITERAL)
+    return !strncmp(name, p.text.c_str(), p.text.size()) &&
+           MatchNameParts(parts, i + 1, name + p.text.size());
+  for (size_t len = 1; name[len - 1]; len++) {
+    char ch = name[len - 1];
+    if (p.kind == NamePart::DIGITS && (ch < '0' || ch > '9'))
+      return false;
+    if (MatchNameParts(parts, i + 1, name + len))
+      return true;
+  }
+  return false;
+}
+
+// Recorder sink which splits the data into segment files.
+// The segments are written by the stream named KEY_SEGMENT_STREAM
+// (file_write_stream by default), which gets all the other params.
+// A segment ends when it lasts KEY_SEGMENT_DURATION_MS or reaches
+// KEY_SEGMENT_SIZE. With KEY_KEY_FRAME_ALIGN, the default, a new segment
+// starts only at a buffer flagged kExtraIntra, or kIntra without a leading
+// kExtraIntra, so that every segment can be decoded alone.
+// KEY_PATH is the template of segment names. %n is replaced by the segment
+// index, then the strftime conversions by the local time of the segment
+// start, such as "/mnt/sdcard/rec_%Y%m%d_%H%M%S_%n.h264".
+// When the finished segments exceed KEY_SEGMENT_QUOTA bytes or
+// KEY_SEGMENT_MAX_FILES files, the oldest ones are deleted. The files in the
+// directory matching the template, such as the recordings of earlier runs,
+// are counted too. The template then needs a literal prefix and %n or a
+// numeric strftime conversion, which only match digits. A name which already exists gets a suffix "_1", "_2"...
+// before the extension rather than overwriting it.
+// The next segment is opened ahead as a hidden part file, unique to the
+// process and the stream, and renamed at finish. Opening, closing, renaming
+// and deleting run in a background thread, so that a switch only swaps the
+// streams and never drops data.
+class SegmentWriteStream : public Stream {
+public:
+  SegmentWriteStream(const char *param);
+  virtual ~SegmentWriteStream() { SegmentWriteStream::Close(); }
+  static const char *GetStreamName() { return "segment_write_stream"; }
+
+  virtual size_t Read(void *ptr _UNUSED, size_t size _UNUSED,
+                      size_t nmemb _UNUSED) final {
+    return -1;
+  }
+  virtual size_t Write(const void *ptr, size_t size, size_t nmemb) final;
+  virtual size_t WriteV(const struct iovec *iov, int iovcnt) final;
+  virtual bool Write(std::shared_ptr<MediaBuffer> buffer) final;
+  virtual int Seek(int64_t off _UNUSED, int whence _UNUSED) final {
+    return -1;
+  }
+  virtual long Tell() final { return cur ? (long)cur_size : -1; }
+  // forwarded to the current segment stream
+  virtual int IoCtrl(unsigned long int request, ...) final;
+  virtual int Open() final;
+
+protected:
+  virtual int Close() final;
+
+private:
+  // data of size and time us arrives, switch segments if needed
+  void CheckSwitch(size_t size, int64_t us, bool key_frame);
+  // false if the next segment is not ready
+  bool Switch();
+  std::shared_ptr<Segment> OpenSegment(int index);
+  void Prepare(int index);
+  void Finish(std::shared_ptr<Segment> seg);
+  void ApplyQuota(const std::string &path);
+  // the finished files of earlier runs
+  void ScanExisting();
+  // whether name is a segment of the template, maybe with a unique suffix
+  bool IsSegmentName(const std::string &name);
+  std::string FormatName(int index, time_t t);
+  // a name not used yet, based on path
+  std::string UniqueName(const std::string &path);
+  void Post(std::function<void()> task);
+  void WorkerRun();
+
+  std::string stream_name;
+  std::string stream_param; // without path
+  std::string path_template;
+  std::string part_dir;
+  std::string part_prefix; // "<dir>/.<name>.<pid>.<instance>."
+  // The template name split at the conversions. %n and the numeric strftime
+  // conversions match digits, the others any characters.
+  std::vector<NamePart> name_parts;
+  int64_t duration_us;
+  size_t max_size;
+  uint64_t quota;
+  int max_files;
+  bool key_frame_align;
+
+  std::shared_ptr<Segment> cur;
+  size_t cur_size;
+  int64_t cur_start_us;
+  bool last_extra_intra;
+  int next_index;
+
+  std::mutex mtx;
+  std::condition_variable cond;
+  std::shared_ptr<Segment> spare; // opened ahead by worker
+  bool preparing;
+  std::deque<std::function<void()>> tasks;
+  bool quit;
+  std::thread *worker;
+  // finished segments, oldest first
+  std::deque<std::pair<std::string, uint64_t>> finished;
+  uint64_t finished_size;
+};
+
+SegmentWriteStream::SegmentWriteStream(const char *param)
+    : stream_name("file_write_stream"), duration_us(0), max_size(0),
+      quota(0), max_files(0), key_frame_align(true), cur_size(0),
+      cur_start_us(0), last_extra_intra(false), next_index(0),
+      preparing(false), quit(false),
+      worker(nullptr), finished_size(0) {
+  std::map<std::string, std::string> params;
+  if (!parse_media_param_map(param, params))
+    return;
+  for (auto &p : params) {
+    const std::string &k = p.first;
+    const std::string &v = p.second;
+    if (k == KEY_PATH)
+      path_template = v;
+    else if (k == KEY_SEGMENT_STREAM)
+      stream_name = v;
+    else if (k == KEY_SEGMENT_DURATION_MS)
+      duration_us = std::stoll(v) * 1000;
+    else if (k == KEY_SEGMENT_SIZE)
+      max_size = std::stoul(v);
+    else if (k == KEY_SEGMENT_QUOTA)
+      quota = std::stoull(v);
+    else if (k == KEY_SEGMENT_MAX_FILES)
+      max_files = std::stoi(v);
+    else if (k == KEY_KEY_FRAME_ALIGN)
+      key_frame_align = !!std::stoi(v);
+    else
+      stream_param.append(k).append("=").append(v).append("\n");
+  }
+  size_t pos = path_template.rfind('/');
+  part_dir = (pos == std::string::npos) ? "." : path_template.substr(0, pos);
+  std::string name = (pos == std::string::npos)
+                         ? path_template
+                         : path_template.substr(pos + 1);
+  // several streams may write in one directory, such as audio and video
+  static std::atomic_int instance_num(0);
+  part_prefix = part_dir + "/." + name + "." + std::to_string(getpid()) +
+                "." + std::to_string(instance_num++) + ".";
+  for (size_t i = 0; i < name.size(); i++) {
+    char ch = name[i];
+    if (ch == '%' && i + 1 < name.size() && name[i + 1] != '%') {
+      ch = name[++i];
+      NamePart p;
+      p.kind = (ch == 'n' || strchr(kNumericConversions, ch)) ? NamePart::DIGITS
+                                                              : NamePart::ANY;
+      name_parts.push_back(p);
+      continue;
+    }
+    if (ch == '%')
+      i++; // %%
+    if (name_parts.empty() || name_parts.back().kind != NamePart::LITERAL) {
+      NamePart p;
+      p.kind = NamePart::LITERAL;
+      name_parts.push_back(p);
+    }
+    name_parts.back().text.push_back(ch);
+  }
+}
+
+bool SegmentWriteStream::IsSegmentName(const std::string &name) {
+  if (MatchNameParts(name_parts, 0, name.c_str()))
+    return true;
+  // UniqueName inserts "_<digits>" before the extension
+  size_t dot = name.rfind('.');
+  if (dot == std::string::npos)
+    dot = name.size();
+  size_t pos = dot;
+  while (pos > 0 && name[pos - 1] >= '0' && name[pos - 1] <= '9')
+    pos--;
+  if (pos == dot || pos == 0 || name[pos - 1] != '_')
+    return false;
+  std::string base = name.substr(0, pos - 1) + name.substr(dot);
+  return MatchNameParts(name_parts, 0, base.c_str());
+}
+
+std::string SegmentWriteStream::FormatName(int index, time_t t) {
+  std::string fmt;
+  for (size_t i = 0; i < path_template.size(); i++) {
+    if (path_template[i] == '%' && i + 1 < path_template.size()) {
+      if (path_template[i + 1] == 'n') {
+        char num[16];
+        snprintf(num, sizeof(num), "%05d", index);
+        fmt.append(num);
+        i++;
+        continue;
+      }
+      // keep the other conversions to strftime
+      fmt.push_back(path_template[i++]);
+    }
+    fmt.push_back(path_template[i]);
+  }
+  struct tm tm;
+  localtime_r(&t, &tm);
+  char name[PATH_MAX];
+  size_t len = strftime(name, sizeof(name), fmt.c_str(), &tm);
+  return len > 0 ? std::string(name, len) : fmt;
+}
+
+std::shared_ptr<Segment> SegmentWriteStream::OpenSegment(int index) {
+  auto seg = std::make_shared<Segment>();
+  if (!seg)
+    return nullptr;
+  seg->index = index;
+  seg->start = 0;
+  seg->part_path = part_prefix + std::to_string(index) + ".part";
+  std::string param = stream_param;
+  PARAM_STRING_APPEND(param, KEY_PATH, seg->part_path);
+  seg->stream =
+      REFLECTOR(Stream)::Create<Stream>(stream_name.c_str(), param.c_str());
+  if (!seg->stream) {
+    LOG("Fail to create %s for %s\n", stream_name.c_str(),
+        seg->part_path.c_str());
+    return nullptr;
+  }
+  return seg;
+}
+
+void SegmentWriteStream::Prepare(int index) {
+  auto seg = OpenSegment(index);
+  std::lock_guard<std::mutex> _lg(mtx);
+  spare = seg;
+  preparing = false;
+}
+
+void SegmentWriteStream::Finish(std::shared_ptr<Segment> seg) {
+  // close before rename, muxers may write the trailer
+  seg->stream.reset();
+  if (seg->start == 0) {
+    // never written
+    unlink(seg->part_path.c_str());
+    return;
+  }
+  std::string path = UniqueName(FormatName(seg->index, seg->start));
+  if (rename(seg->part_path.c_str(), path.c_str())) {
+    LOG("rename %s to %s failed, %m\n", seg->part_path.c_str(),
+        path.c_str());
+    path = seg->part_path;
+  }
+  ApplyQuota(path);
+}
+
+std::string SegmentWriteStream::UniqueName(const std::string &path) {
+  // Only the worker renames, but link() with EEXIST is not supported by
+  // all the file systems, such as vfat of sdcards. Check before rename.
+  struct stat st;
+  if (stat(path.c_str(), &st))
+    return path;
+  size_t slash = path.rfind('/');
+  size_t dot = path.rfind('.');
+  if (dot == std::string::npos || (slash != std::string::npos && dot < slash))
+    dot = path.size();
+  for (int i = 1;; i++) {
+    std::string name = path.substr(0, dot) + "_" + std::to_string(i) +
+                       path.substr(dot);
+    if (stat(name.c_str(), &st))
+      return name;
+  }
+}
+
+void SegmentWriteStream::ScanExisting() {
+  DIR *dir = opendir(part_dir.c_str());
+  if (!dir)
+    return;
+  // mtime, path and size
+  std::vector<std::tuple<time_t, std::string, uint64_t>> files;
+  struct dirent *e;
+  while ((e = readdir(dir)) != nullptr) {
+    // the part files are hidden, the template starts with a literal
+    if (!IsSegmentName(e->d_name))
+      continue;
+    std::string path = part_dir + "/" + e->d_name;
+    struct stat st;
+    if (!stat(path.c_str(), &st) && S_ISREG(st.st_mode))
+      files.push_back(std::make_tuple(st.st_mtime, path, st.st_size));
+  }
+  closedir(dir);
+  std::sort(files.begin(), files.end());
+  std::lock_guard<std::mutex> _lg(mtx);
+  finished.clear();
+  finished_size = 0;
+  for (auto &f : files) {
+    finished.push_back(std::make_pair(std::get<1>(f), std::get<2>(f)));
+    finished_size += std::get<2>(f);
+  }
+}
+
+void SegmentWriteStream::ApplyQuota(const std::string &path) {
+  struct stat st;
+  uint64_t size = stat(path.c_str(), &st) ? 0 : st.st_size;
+  std::unique_lock<std::mutex> _ul(mtx);
+  finished.push_back(std::make_pair(path, size));
+  finished_size += size;
+  while (finished.size() > 1 &&
+         ((quota > 0 && finished_size > quota) ||
+          (max_files > 0 && (int)finished.size() > max_files))) {
+    auto oldest = finished.front();
+    finished.pop_front();
+    finished_size -= oldest.second;
+    _ul.unlock();
+    if (unlink(oldest.first.c_str()) && errno != ENOENT)
+      LOG("remove %s failed, %m\n", oldest.first.c_str());
+    else
+      LOGD("quota: removed %s\n", oldest.first.c_str());
+    _ul.lock();
+  }
+}
+
+void SegmentWriteStream::Post(std::function<void()> task) {
+  std::lock_guard<std::mutex> _lg(mtx);
+  tasks.push_back(task);
+  cond.notify_one();
+}
+
+void SegmentWriteStream::WorkerRun() {
+  prctl(PR_SET_NAME, "segment_worker");
+  std::unique_lock<std::mutex> _ul(mtx);
+  while (true) {
+    cond.wait(_ul, [this] { return quit || !tasks.empty(); });
+    if (tasks.empty())
+      break; // quit after all tasks
+    auto task = tasks.front();
+    tasks.pop_front();
+    _ul.unlock();
+    task();
+    _ul.lock();
+  }
+}
+
+int SegmentWriteStream::Open() {
+  if (path_template.empty())
+    return -1;
+  if (quota > 0 || max_files > 0) {
+    // the quota deletes the files matching the template, which must not
+    // match other files in the directory
+    bool has_digits = false;
+    for (auto &p : name_parts)
+      has_digits |= (p.kind == NamePart::DIGITS);
+    if (name_parts.empty() || name_parts[0].kind != NamePart::LITERAL ||
+        !has_digits) {
+      LOG("%s: a template with quota needs a literal prefix and %%n or a "
+          "numeric time field\n",
+          path_template.c_str());
+      return -1;
+    }
+    ScanExisting();
+  }
+  cur = OpenSegment(next_index++);
+  if (!cur)
+    return -1;
+  cur_size = 0;
+  cur_start_us = 0;
+  quit = false;
+  worker = new std::thread(&SegmentWriteStream::WorkerRun, this);
+  if (!worker)
+    return -1;
+  int index = next_index++;
+  preparing = true;
+  Post([this, index] { Prepare(index); });
+  SetReadable(false);
+  SetWriteable(true);
+  SetSeekable(false);
+  return 0;
+}
+
+int SegmentWriteStream::Close() {
+  if (!worker) {
+    errno = EBADF;
+    return -1;
+  }
+  if (cur) {
+    auto seg = cur;
+    Post([this, seg] { Finish(seg); });
+    cur.reset();
+  }
+  {
+    std::lock_guard<std::mutex> _lg(mtx);
+    quit = true;
+    cond.notify_all();
+  }
+  worker->join();
+  delete worker;
+  worker = nullptr;
+  if (spare) {
+    Finish(spare);
+    spare.reset();
+  }
+  Stream::Close();
+  return 0;
+}
+
+bool SegmentWriteStream::Switch() {
+  std::shared_ptr<Segment> next;
+  int index = -1;
+  {
+    std::lock_guard<std::mutex> _lg(mtx);
+    next.swap(spare);
+    if (!preparing) {
+      preparing = true;
+      index = next_index++;
+    }
+  }
+  if (index >= 0)
+    Post([this, index] { Prepare(index); });
+  if (!next) {
+    // Storage is too slow to open ahead, or failed to open. Continue the
+    // current segment and retry at the next boundary.
+    LOG("the next segment is not ready, continue %s\n",
+        cur->part_path.c_str());
+    return false;
+  }
+  auto old = cur;
+  cur = next;
+  Post([this, old] { Finish(old); });
+  return true;
+}
+
+void SegmentWriteStream::CheckSwitch(size_t size, int64_t us,
+                                     bool key_frame) {
+  if (cur->start == 0) {
+    cur->start = time(nullptr);
+    cur_start_us = us;
+  }
+  if (cur_size == 0)
+    return;
+  bool full = (max_size > 0 && cur_size + size > max_size) ||
+              (duration_us > 0 && us - cur_start_us >= duration_us);
+  if (!full || (key_frame_align && !key_frame))
+    return;
+  if (!Switch())
+    return;
+  cur->start = time(nullptr);
+  cur_start_us = us;
+  cur_size = 0;
+}
+
+bool SegmentWriteStream::Write(std::shared_ptr<MediaBuffer> buffer) {
+  if (!buffer || !cur)
+    return false;
+  uint32_t flag = buffer->GetUserFlag();
+  bool extra = !!(flag & MediaBuffer::kExtraIntra);
+  // the intra frame following its extra data stays with it
+  bool key_frame =
+      extra || ((flag & MediaBuffer::kIntra) && !last_extra_intra);
+  last_extra_intra = extra;
+  int64_t us = buffer->GetUSTimeStamp();
+  if (us == 0)
+    us = gettimeofday();
+  CheckSwitch(buffer->GetValidSize(), us, key_frame);
+  if (!cur->stream->Write(buffer))
+    return false;
+  cur_size += buffer->GetValidSize();
+  return true;
+}
+
+size_t SegmentWriteStream::WriteV(const struct iovec *iov, int iovcnt) {
+  if (!cur)
+    return -1;
+  size_t len = 0;
+  for (int i = 0; i < iovcnt; i++)
+    len += iov[i].iov_len;
+  // no flags, switch between calls
+  CheckSwitch(len, gettimeofday(), true);
+  size_t ret = cur->stream->WriteV(iov, iovcnt);
+  if (ret != (size_t)-1)
+    cur_size += ret;
+  return ret;
+}
+
+size_t SegmentWriteStream::Write(const void *ptr, size_t size, size_t nmemb) {
+  struct iovec iov = {const_cast<void *>(ptr), size * nmemb};
+  size_t ret = WriteV(&iov, 1);
+  if (ret == (size_t)-1 || size == 0)
+    return ret;
+  return ret / size;
+}
+
+int SegmentWriteStream::IoCtrl(unsigned long int request, ...) {
+  if (!cur)
+    return -1;
+  va_list vl;
+  va_start(vl, request);
+  void *arg = va_arg(vl, void *);
+  va_end(vl);
+  return cur->stream->IoCtrl(request, arg);
+}
+
+DEFINE_STREAM_FACTORY(SegmentWriteStream, Stream)
+
+const char *FACTORY(SegmentWriteStream)::ExpectedInputDataType() {
+  return TYPE_ANYTHING;
+}
+
+const char *FACTORY(SegmentWriteStream)::OutPutDataType() {
+  return STREAM_FILE;
+}
+
+} // namespace easymedia
@@ -0,0 +1,426 @@
+/*
+ * Copyright (C) 2017 Hertz Wang 1989wanghang@163.com
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see http://www.gnu.org/licenses
+ *
+ * Any non-GPL usage of this software or parts of this software is strictly
+ * forbidden.
+ *
+ */
+
+#include "stream.h"
+
+#include <errno.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#include "buffer.h"
+#include "media_type.h"
+#include "sound.h"
+#include "utils.h"
+
+namespace easymedia {
+
+// RIFF WAVE of integer PCM, 8/16/32 bits, little endian.
+
+static const uint16_t kWavFormatPcm = 1;
+static const uint16_t kWavFormatExtensible = 0xFFFE;
+static const size_t kWavHeaderSize = 44; // canonical, as written
+
+static uint16_t get_le16(const uint8_t *p) { return p[0] | (p[1] << 8); }
+static uint32_t get_le32(const uint8_t *p) {
+  return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+static void put_le16(uint8_t *p, uint16_t v) {
+  p[0] = v & 0xFF;
+  p[1] = v >> 8;
+}
+static void put_le32(uint8_t *p, uint32_t v) {
+  for (int i = 0; i < 4; i++)
+    p[i] = (v >> (i * 8)) & 0xFF;
+}
+
+static SampleFormat wav_bits_to_sample_fmt(int bits) {
+  switch (bits) {
+  case 8:
+    return SAMPLE_FMT_U8;
+  case 16:
+    return SAMPLE_FMT_S16;
+  case 32:
+    return SAMPLE_FMT_S32;
+  default:
+    return SAMPLE_FMT_NONE;
+  }
+}
+
+static std::shared_ptr<Stream> open_wav_file(const std::string &path,
+                                             const char *mode) {
+  std::string param;
+  PARAM_STRING_APPEND(param, KEY_PATH, path);
+  PARAM_STRING_APPEND(param, KEY_OPEN_MODE, mode);
+  return REFLECTOR(Stream)::Create<Stream>(
+      mode[0] == 'r' ? "file_read_stream" : "file_write_stream",
+      param.c_str());
+}
+
+// Read() returns a SampleBuffer of KEY_FRAMES (default 1024) sample frames,
+// timestamp from the sample rate. Read(ptr, size, nmemb) reads the raw
+// samples. Seek/Tell count in sample frames.
+class WavReadStream : public Stream {
+public:
+  WavReadStream(const char *param);
+  virtual ~WavReadStream() { WavReadStream::Close(); }
+  static const char *GetStreamName() { return "wav_read_stream"; }
+
+  virtual size_t Read(void *ptr, size_t size, size_t nmemb) final;
+  virtual size_t Write(const void *ptr _UNUSED, size_t size _UNUSED,
+                       size_t nmemb _UNUSED) final {
+    errno = EINVAL;
+    return -1;
+  }
+  virtual int Seek(int64_t offset, int whence) final;
+  virtual long Tell() final {
+    return file ? (long)(pos / frame_bytes) : -1;
+  }
+  virtual bool Eof() final { return !file || pos + frame_bytes > data_size; }
+  virtual std::shared_ptr<MediaBuffer> Read() final;
+  virtual int Open() final;
+
+protected:
+  virtual int Close() final;
+
+private:
+  bool ParseHeader(uint64_t file_size);
+
+  std::string path;
+  int nb_samples;
+  std::shared_ptr<Stream> file;
+  SampleInfo info;
+  size_t frame_bytes; // bytes of one sample of all channels
+  uint64_t data_offset;
+  uint64_t data_size;
+  uint64_t pos; // bytes read of data
+};
+
+WavReadStream::WavReadStream(const char *param)
+    : nb_samples(1024), frame_bytes(1), data_offset(0), data_size(0),
+      pos(0) {
+  memset(&info, 0, sizeof(info));
+  info.fmt = SAMPLE_FMT_NONE;
+  std::map<std::string, std::string> params;
+  if (!parse_media_param_map(param, params))
+    return;
+  path = params[KEY_PATH];
+  const std::string &value = params[KEY_FRAMES];
+  if (!value.empty())
+    nb_samples = std::stoi(value);
+}
+
+bool WavReadStream::ParseHeader(uint64_t file_size) {
+  uint8_t buf[40];
+  if (file->Read(buf, 1, 12) != 12 || memcmp(buf, "RIFF", 4) ||
+      memcmp(buf + 8, "WAVE", 4))
+    return false;
+  uint64_t offset = 12;
+  bool has_fmt = false;
+  while (offset + 8 <= file_size) {
+    if (file->Seek(offset, SEEK_SET) || file->Read(buf, 1, 8) != 8)
+      return false;
+    uint32_t chunk_size = get_le32(buf + 4);
+    if (!memcmp(buf, "fmt ", 4)) {
+      size_t len = std::min<size_t>(chunk_size, sizeof(buf));
+      if (len < 16 || file->Read(buf, 1, len) != len)
+        return false;
+      uint16_t tag = get_le16(buf);
+      // the sub format guid starts with the format tag
+      if (tag == kWavFormatExtensible && len >= 26)
+        tag = get_le16(buf + 24);
+      int bits = get_le16(buf + 14);
+      info.fmt = wav_bits_to_sample_fmt(bits);
+      info.channels = get_le16(buf + 2);
+      info.sample_rate = get_le32(buf + 4);
+      if (tag != kWavFormatPcm || info.fmt == SAMPLE_FMT_NONE ||
+          info.channels <= 0 || info.sample_rate <= 0) {
+        LOG("unsupport wav format %d, %d bits\n", tag, bits);
+        return false;
+      }
+      has_fmt = true;
+    } else if (!memcmp(buf, "data", 4)) {
+      if (!has_fmt)
+        return false;
+      data_offset = offset + 8;
+      data_size = chunk_size;
+      // unknown size of streaming writers
+      if (data_size == 0 || data_size == 0xFFFFFFFF ||
+          data_offset + data_size > file_size)
+        data_size = file_size - data_offset;
+      frame_bytes = GetSampleSize(info);
+      data_size -= data_size % frame_bytes;
+      return file->Seek(data_offset, SEEK_SET) == 0;
+    }
+    // chunks are padded to even size
+    offset += 8 + chunk_size + (chunk_size & 1);
+  }
+  return false;
+}
+
+int WavReadStream::Open() {
+  struct stat st;
+  if (path.empty() || stat(path.c_str(), &st)) {
+    LOG("no wav file <%s>\n", path.c_str());
+    return -1;
+  }
+  file = open_wav_file(path, "re");
+  if (!file)
+    return -1;
+  if (!ParseHeader(st.st_size)) {
+    LOG("%s is not a supported wav file\n", path.c_str());
+    file.reset();
+    return -1;
+  }
+  pos = 0;
+  SetReadable(true);
+  SetSeekable(true);
+  return 0;
+}
+
+int WavReadStream::Close() {
+  file.reset();
+  Stream::Close();
+  return 0;
+}
+
+size_t WavReadStream::Read(void *ptr, size_t size, size_t nmemb) {
+  if (!Readable() || !file || size == 0)
+    return -1;
+  uint64_t left = data_size - pos;
+  nmemb = std::min<uint64_t>(nmemb, left / size);
+  size_t ret = file->Read(ptr, size, nmemb);
+  if (ret != (size_t)-1)
+    pos += ret * size;
+  return ret;
+}
+
+std::shared_ptr<MediaBuffer> WavReadStream::Read() {
+  if (!Readable() || Eof())
+    return nullptr;
+  int64_t ts = pos / frame_bytes * 1000000 / info.sample_rate;
+  auto mb = MediaBuffer::Alloc2(nb_samples * frame_bytes);
+  if (!mb.GetPtr()) {
+    LOG_NO_MEMORY();
+    return nullptr;
+  }
+  size_t frames = Read(mb.GetPtr(), frame_bytes, nb_samples);
+  if (frames == 0 || frames == (size_t)-1)
+    return nullptr;
+  SampleInfo si = info;
+  si.nb_samples = frames;
+  auto buffer = std::make_shared<SampleBuffer>(mb, si);
+  if (!buffer) {
+    LOG_NO_MEMORY();
+    return nullptr;
+  }
+  buffer->SetValidSize(frames * frame_bytes);
+  buffer->SetUSTimeStamp(ts);
+  return buffer;
+}
+
+int WavReadStream::Seek(int64_t offset, int whence) {
+  if (!Seekable())
+    return -1;
+  int64_t frames = data_size / frame_bytes;
+  int64_t target;
+  switch (whence) {
+  case SEEK_SET:
+    target = offset;
+    break;
+  case SEEK_CUR:
+    target = (int64_t)(pos / frame_bytes) + offset;
+    break;
+  case SEEK_END:
+    target = frames + offset;
+    break;
+  default:
+    errno = EINVAL;
+    return -1;
+  }
+  if (target < 0 || target > frames) {
+    errno = EINVAL;
+    return -1;
+  }
+  if (file->Seek(data_offset + target * frame_bytes, SEEK_SET))
+    return -1;
+  pos = target * frame_bytes;
+  return 0;
+}
+
+DEFINE_STREAM_FACTORY(WavReadStream, Stream)
+
+const char *FACTORY(WavReadStream)::ExpectedInputDataType() {
+  return STREAM_FILE;
+}
+
+const char *FACTORY(WavReadStream)::OutPutDataType() { return AUDIO_PCM; }
+
+// Write PCM samples. The format is KEY_INPUTDATATYPE, KEY_CHANNELS and
+// KEY_SAMPLE_RATE if given, otherwise the info of the first SampleBuffer.
+// The sizes in header are filled at close.
+class WavWriteStream : public Stream {
+public:
+  WavWriteStream(const char *param);
+  virtual ~WavWriteStream() { WavWriteStream::Close(); }
+  static const char *GetStreamName() { return "wav_write_stream"; }
+
+  virtual size_t Read(void *ptr _UNUSED, size_t size _UNUSED,
+                      size_t nmemb _UNUSED) final {
+    errno = EINVAL;
+    return -1;
+  }
+  virtual size_t Write(const void *ptr, size_t size, size_t nmemb) final;
+  virtual bool Write(std::shared_ptr<MediaBuffer> buffer) final;
+  virtual int Seek(int64_t off _UNUSED, int whence _UNUSED) final {
+    errno = ESPIPE;
+    return -1;
+  }
+  virtual long Tell() final {
+    size_t fb = GetSampleSize(info);
+    return file && fb ? (long)(data_size / fb) : -1;
+  }
+  virtual int Open() final;
+
+protected:
+  virtual int Close() final;
+
+private:
+  // header of data_size bytes
+  void MakeHeader(uint8_t *header);
+
+  std::string path;
+  std::shared_ptr<Stream> file;
+  SampleInfo info;
+  bool header_written;
+  uint64_t data_size;
+};
+
+WavWriteStream::WavWriteStream(const char *param)
+    : header_written(false), data_size(0) {
+  memset(&info, 0, sizeof(info));
+  info.fmt = SAMPLE_FMT_NONE;
+  std::map<std::string, std::string> params;
+  if (!parse_media_param_map(param, params))
+    return;
+  path = params[KEY_PATH];
+  const std::string &fmt = params[KEY_INPUTDATATYPE];
+  const std::string &channels = params[KEY_CHANNELS];
+  const std::string &rate = params[KEY_SAMPLE_RATE];
+  if (!fmt.empty() && !channels.empty() && !rate.empty()) {
+    info.fmt = StringToSampleFmt(fmt.c_str());
+    info.channels = std::stoi(channels);
+    info.sample_rate = std::stoi(rate);
+  }
+}
+
+int WavWriteStream::Open() {
+  if (path.empty())
+    return -1;
+  file = open_wav_file(path, "we");
+  if (!file)
+    return -1;
+  header_written = false;
+  data_size = 0;
+  SetWriteable(true);
+  return 0;
+}
+
+void WavWriteStream::MakeHeader(uint8_t *header) {
+  int bytes = GetSampleSize(info) / info.channels;
+  // sizes over 4G are saturated, readers take the rest of file
+  uint32_t size = std::min<uint64_t>(data_size, 0xFFFFFFFF - kWavHeaderSize);
+  memcpy(header, "RIFF", 4);
+  put_le32(header + 4, size + kWavHeaderSize - 8);
+  memcpy(header + 8, "WAVEfmt ", 8);
+  put_le32(header + 16, 16);
+  put_le16(header + 20, kWavFormatPcm);
+  put_le16(header + 22, info.channels);
+  put_le32(header + 24, info.sample_rate);
+  put_le32(header + 28, info.sample_rate * info.channels * bytes);
+  put_le16(header + 32, info.channels * bytes);
+  put_le16(header + 34, bytes * 8);
+  memcpy(header + 36, "data", 4);
+  put_le32(header + 40, size);
+}
+
+int WavWriteStream::Close() {
+  if (file && header_written) {
+    uint8_t header[kWavHeaderSize];
+    MakeHeader(header);
+    if (file->Seek(0, SEEK_SET) ||
+        file->Write(header, 1, sizeof(header)) != sizeof(header))
+      LOG("update the wav header of %s failed\n", path.c_str());
+  }
+  file.reset();
+  Stream::Close();
+  return 0;
+}
+
+size_t WavWriteStream::Write(const void *ptr, size_t size, size_t nmemb) {
+  if (!Writeable() || !file)
+    return -1;
+  if (!header_written) {
+    if (GetSampleSize(info) == 0 || info.sample_rate <= 0) {
+      LOG("unknown pcm format of wav %s\n", path.c_str());
+      errno = EINVAL;
+      return -1;
+    }
+    // sizes are filled at close
+    uint8_t header[kWavHeaderSize];
+    MakeHeader(header);
+    if (file->Write(header, 1, sizeof(header)) != sizeof(header))
+      return -1;
+    header_written = true;
+  }
+  size_t ret = file->Write(ptr, size, nmemb);
+  if (ret != (size_t)-1)
+    data_size += ret * size;
+  return ret;
+}
+
+bool WavWriteStream::Write(std::shared_ptr<MediaBuffer> buffer) {
+  if (!buffer || buffer->GetType() != Type::Audio)
+    return false;
+  const SampleInfo &si =
+      std::static_pointer_cast<SampleBuffer>(buffer)->GetSampleInfo();
+  if (info.fmt == SAMPLE_FMT_NONE && !header_written)
+    info = si;
+  if (si.fmt != info.fmt || si.channels != info.channels ||
+      si.sample_rate != info.sample_rate) {
+    LOG("wav samples differ from the header\n");
+    return false;
+  }
+  size_t size = buffer->GetValidSize();
+  if (size == 0)
+    return true;
+  AutoCPUAccess _aca(buffer.get(), MediaBuffer::kCPURead);
+  return Write(buffer->GetPtr(), 1, size) == size;
+}
+
+DEFINE_STREAM_FACTORY(WavWriteStream, Stream)
+
+const char *FACTORY(WavWriteStream)::ExpectedInputDataType() {
+  return AUDIO_PCM;
+}
+
+const char *FACTORY(WavWriteStream)::OutPutDataType() { return STREAM_FILE; }
+
+} // namespace easymedia
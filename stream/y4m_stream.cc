@@ -0,0 +1,476 @@
+/*
+ * Copyright (C) 2017 Hertz Wang 1989wanghang@163.com
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see http://www.gnu.org/licenses
+ *
+ * Any non-GPL usage of this software or parts of this software is strictly
+ * forbidden.
+ *
+ */
+
+#include "stream.h"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#include <sstream>
+#include <vector>
+
+#include "buffer.h"
+#include "media_type.h"
+#include "utils.h"
+
+namespace easymedia {
+
+// YUV4MPEG2, the raw video of ffmpeg and mjpegtools:
+//   "YUV4MPEG2 W<width> H<height> F<num>:<den> C<chroma> ...\n"
+//   "FRAME[ params]\n" planes of frame 0, packed
+//   ...
+// Chroma 420jpeg, 420paldv, 420mpeg2 and 420 are PIX_FMT_YUV420P, 422 is
+// PIX_FMT_YUV422P. The sample siting is not converted.
+
+static const char kY4mMagic[] = "YUV4MPEG2";
+static const char kY4mFrame[] = "FRAME";
+static const size_t kY4mMaxLine = 1024;
+
+// read a line without '\n', false if no '\n' in max bytes
+static bool read_line(Stream *s, std::string &line, size_t max) {
+  line.clear();
+  char c;
+  while (line.size() < max) {
+    if (s->Read(&c, 1, 1) != 1)
+      return false;
+    if (c == '\n')
+      return true;
+    line.push_back(c);
+  }
+  return false;
+}
+
+static PixelFormat y4m_chroma_to_pix_fmt(const std::string &c) {
+  if (c == "420jpeg" || c == "420paldv" || c == "420mpeg2" || c == "420")
+    return PIX_FMT_YUV420P;
+  if (c == "422")
+    return PIX_FMT_YUV422P;
+  return PIX_FMT_NONE;
+}
+
+// bytes of the packed planes
+static size_t y4m_frame_size(const ImageInfo &info) {
+  size_t size = 0;
+  for (int i = 0; i < GetPixFmtPlaneNum(info.pix_fmt); i++) {
+    int row_bytes = 0, rows = 0;
+    if (GetPixFmtPlaneSize(info.pix_fmt, i, info.width, info.height,
+                           row_bytes, rows))
+      size += (size_t)row_bytes * rows;
+  }
+  return size;
+}
+
+static std::shared_ptr<Stream> open_file_stream(const std::string &path,
+                                                const char *mode) {
+  std::string param;
+  PARAM_STRING_APPEND(param, KEY_PATH, path);
+  PARAM_STRING_APPEND(param, KEY_OPEN_MODE, mode);
+  return REFLECTOR(Stream)::Create<Stream>(
+      mode[0] == 'r' ? "file_read_stream" : "file_write_stream",
+      param.c_str());
+}
+
+// Read() returns an ImageBuffer of each frame, timestamp from the frame
+// rate. KEY_BUFFER_VIR_WIDTH/KEY_BUFFER_VIR_HEIGHT set the strides of the
+// buffers. Seek/Tell count in frames.
+class Y4mReadStream : public Stream {
+public:
+  Y4mReadStream(const char *param);
+  virtual ~Y4mReadStream() { Y4mReadStream::Close(); }
+  static const char *GetStreamName() { return "y4m_read_stream"; }
+
+  virtual size_t Read(void *ptr _UNUSED, size_t size _UNUSED,
+                      size_t nmemb _UNUSED) final {
+    errno = EINVAL;
+    return -1;
+  }
+  virtual size_t Write(const void *ptr _UNUSED, size_t size _UNUSED,
+                       size_t nmemb _UNUSED) final {
+    errno = EINVAL;
+    return -1;
+  }
+  virtual int Seek(int64_t offset, int whence) final;
+  virtual long Tell() final { return file ? (long)cur : -1; }
+  virtual bool Eof() final;
+  virtual std::shared_ptr<MediaBuffer> Read() final;
+  virtual int Open() final;
+
+protected:
+  virtual int Close() final;
+
+private:
+  bool ParseHeader(const std::string &line);
+  // locate frame n, the file is positioned at its FRAME line
+  bool SeekFrame(size_t n);
+  // a whole frame fits in the file from pos, a truncated one is dropped
+  bool HasFrame(uint64_t pos) {
+    return pos + sizeof(kY4mFrame) + frame_size <= file_size;
+  }
+
+  std::string path;
+  int vir_width;
+  int vir_height;
+  std::shared_ptr<Stream> file;
+  uint64_t file_size;
+  ImageInfo info;
+  size_t frame_size;
+  int fps_num;
+  int fps_den;
+  // offsets of the FRAME lines found so far
+  std::vector<uint64_t> offsets;
+  size_t cur;
+  long positioned; // the frame the file is at, -1 unknown
+};
+
+Y4mReadStream::Y4mReadStream(const char *param)
+    : vir_width(0), vir_height(0), file_size(0), frame_size(0), fps_num(0),
+      fps_den(1), cur(0), positioned(-1) {
+  memset(&info, 0, sizeof(info));
+  std::map<std::string, std::string> params;
+  if (!parse_media_param_map(param, params))
+    return;
+  path = params[KEY_PATH];
+  const std::string &w = params[KEY_BUFFER_VIR_WIDTH];
+  if (!w.empty())
+    vir_width = std::stoi(w);
+  const std::string &h = params[KEY_BUFFER_VIR_HEIGHT];
+  if (!h.empty())
+    vir_height = std::stoi(h);
+}
+
+bool Y4mReadStream::ParseHeader(const std::string &line) {
+  std::istringstream is(line);
+  std::string token;
+  is >> token;
+  if (token != kY4mMagic)
+    return false;
+  info.pix_fmt = PIX_FMT_YUV420P;
+  while (is >> token) {
+    const char *v = token.c_str() + 1;
+    switch (token[0]) {
+    case 'W':
+      info.width = atoi(v);
+      break;
+    case 'H':
+      info.height = atoi(v);
+      break;
+    case 'F':
+      if (sscanf(v, "%d:%d", &fps_num, &fps_den) != 2 || fps_den <= 0)
+        fps_num = 0;
+      break;
+    case 'C':
+      info.pix_fmt = y4m_chroma_to_pix_fmt(v);
+      if (info.pix_fmt == PIX_FMT_NONE) {
+        LOG("unsupport y4m chroma %s\n", v);
+        return false;
+      }
+      break;
+    default:
+      // interlace, aspect and extensions
+      break;
+    }
+  }
+  if (info.width <= 0 || info.height <= 0 || (info.width & 1) ||
+      (info.height & 1)) {
+    LOG("unsupport y4m size %dx%d\n", info.width, info.height);
+    return false;
+  }
+  info.vir_width = std::max(vir_width, info.width);
+  info.vir_height = std::max(vir_height, info.height);
+  frame_size = y4m_frame_size(info);
+  return true;
+}
+
+int Y4mReadStream::Open() {
+  struct stat st;
+  if (path.empty() || stat(path.c_str(), &st)) {
+    LOG("no y4m file <%s>\n", path.c_str());
+    return -1;
+  }
+  file_size = st.st_size;
+  file = open_file_stream(path, "re");
+  if (!file)
+    return -1;
+  std::string line;
+  if (!read_line(file.get(), line, kY4mMaxLine) || !ParseHeader(line)) {
+    LOG("%s is not a supported y4m file\n", path.c_str());
+    file.reset();
+    return -1;
+  }
+  offsets.assign(1, line.size() + 1);
+  cur = 0;
+  positioned = 0;
+  SetReadable(true);
+  SetSeekable(true);
+  return 0;
+}
+
+int Y4mReadStream::Close() {
+  file.reset();
+  offsets.clear();
+  Stream::Close();
+  return 0;
+}
+
+bool Y4mReadStream::SeekFrame(size_t n) {
+  if ((long)n == positioned)
+    return HasFrame(offsets[n]);
+  // walk the FRAME lines, they may have parameters
+  while (offsets.size() <= n) {
+    uint64_t pos = offsets.back();
+    std::string line;
+    if (!HasFrame(pos) || file->Seek(pos, SEEK_SET) ||
+        !read_line(file.get(), line, kY4mMaxLine) ||
+        line.compare(0, strlen(kY4mFrame), kY4mFrame))
+      return false;
+    offsets.push_back(pos + line.size() + 1 + frame_size);
+  }
+  positioned = -1;
+  if (!HasFrame(offsets[n]) || file->Seek(offsets[n], SEEK_SET))
+    return false;
+  positioned = n;
+  return true;
+}
+
+bool Y4mReadStream::Eof() {
+  if (!file)
+    return true;
+  return cur < offsets.size() ? !HasFrame(offsets[cur]) : !SeekFrame(cur);
+}
+
+std::shared_ptr<MediaBuffer> Y4mReadStream::Read() {
+  if (!Readable() || !SeekFrame(cur))
+    return nullptr;
+  std::string line;
+  positioned = -1;
+  if (!read_line(file.get(), line, kY4mMaxLine) ||
+      line.compare(0, strlen(kY4mFrame), kY4mFrame)) {
+    LOG("bad y4m frame %d of %s\n", (int)cur, path.c_str());
+    return nullptr;
+  }
+  auto mb = MediaBuffer::Alloc2(CalPixFmtSize(info));
+  if (!mb.GetPtr()) {
+    LOG_NO_MEMORY();
+    return nullptr;
+  }
+  auto buffer = std::make_shared<ImageBuffer>(mb, info);
+  if (!buffer || !file->ReadImage(buffer->GetPtr(), info)) {
+    LOG("read y4m frame %d of %s failed\n", (int)cur, path.c_str());
+    return nullptr;
+  }
+  if (offsets.size() == cur + 1)
+    offsets.push_back(offsets[cur] + line.size() + 1 + frame_size);
+  if (fps_num > 0)
+    buffer->SetUSTimeStamp((int64_t)cur * 1000000 * fps_den / fps_num);
+  cur++;
+  positioned = cur;
+  return buffer;
+}
+
+int Y4mReadStream::Seek(int64_t offset, int whence) {
+  if (!Seekable())
+    return -1;
+  int64_t pos;
+  switch (whence) {
+  case SEEK_SET:
+    pos = offset;
+    break;
+  case SEEK_CUR:
+    pos = (int64_t)cur + offset;
+    break;
+  case SEEK_END: {
+    // count all the frames
+    size_t n = offsets.size() - 1;
+    while (SeekFrame(n))
+      n++;
+    pos = (int64_t)n + offset;
+    break;
+  }
+  default:
+    errno = EINVAL;
+    return -1;
+  }
+  // the end is a valid position
+  if (pos < 0 || (pos > 0 && !SeekFrame(pos - 1))) {
+    errno = EINVAL;
+    return -1;
+  }
+  cur = pos;
+  return 0;
+}
+
+DEFINE_STREAM_FACTORY(Y4mReadStream, Stream)
+
+const char *FACTORY(Y4mReadStream)::ExpectedInputDataType() {
+  return STREAM_FILE;
+}
+
+const char *FACTORY(Y4mReadStream)::OutPutDataType() {
+  return TYPENEAR(IMAGE_YUV420P) TYPENEAR(IMAGE_YUV422P);
+}
+
+// Write images of PIX_FMT_YUV420P or PIX_FMT_YUV422P. The header is made of
+// the image params and KEY_FPS if given, otherwise of the first image.
+class Y4mWriteStream : public Stream {
+public:
+  Y4mWriteStream(const char *param);
+  virtual ~Y4mWriteStream() { Y4mWriteStream::Close(); }
+  static const char *GetStreamName() { return "y4m_write_stream"; }
+
+  virtual size_t Read(void *ptr _UNUSED, size_t size _UNUSED,
+                      size_t nmemb _UNUSED) final {
+    errno = EINVAL;
+    return -1;
+  }
+  // a packed frame
+  virtual size_t Write(const void *ptr, size_t size, size_t nmemb) final;
+  virtual bool Write(std::shared_ptr<MediaBuffer> buffer) final;
+  virtual int Seek(int64_t off _UNUSED, int whence _UNUSED) final {
+    errno = ESPIPE;
+    return -1;
+  }
+  virtual long Tell() final { return file ? (long)frames : -1; }
+  virtual int Open() final;
+
+protected:
+  virtual int Close() final;
+
+private:
+  bool WriteHeader();
+  bool WriteFrame(const void *ptr, const ImageInfo &ii);
+
+  std::string path;
+  std::shared_ptr<Stream> file;
+  ImageInfo info;
+  int fps;
+  bool header_written;
+  long frames;
+};
+
+Y4mWriteStream::Y4mWriteStream(const char *param)
+    : fps(25), header_written(false), frames(0) {
+  memset(&info, 0, sizeof(info));
+  info.pix_fmt = PIX_FMT_NONE;
+  std::map<std::string, std::string> params;
+  if (!parse_media_param_map(param, params))
+    return;
+  path = params[KEY_PATH];
+  const std::string &value = params[KEY_FPS];
+  if (!value.empty())
+    fps = std::stoi(value);
+  if (!params[KEY_INPUTDATATYPE].empty() &&
+      !ParseImageInfoFromMap(params, info))
+    info.pix_fmt = PIX_FMT_NONE;
+}
+
+int Y4mWriteStream::Open() {
+  if (path.empty())
+    return -1;
+  file = open_file_stream(path, "we");
+  if (!file)
+    return -1;
+  header_written = false;
+  frames = 0;
+  SetWriteable(true);
+  return 0;
+}
+
+int Y4mWriteStream::Close() {
+  file.reset();
+  Stream::Close();
+  return 0;
+}
+
+bool Y4mWriteStream::WriteHeader() {
+  const char *chroma = nullptr;
+  if (info.pix_fmt == PIX_FMT_YUV420P)
+    chroma = "420jpeg";
+  else if (info.pix_fmt == PIX_FMT_YUV422P)
+    chroma = "422";
+  if (!chroma || info.width <= 0 || info.height <= 0 || fps <= 0) {
+    LOG("unsupport y4m of fmt %d, %dx%d\n", info.pix_fmt, info.width,
+        info.height);
+    return false;
+  }
+  char header[128];
+  int len = snprintf(header, sizeof(header), "%s W%d H%d F%d:1 Ip A1:1 C%s\n",
+                     kY4mMagic, info.width, info.height, fps, chroma);
+  if (file->Write(header, 1, len) != (size_t)len)
+    return false;
+  header_written = true;
+  return true;
+}
+
+bool Y4mWriteStream::WriteFrame(const void *ptr, const ImageInfo &ii) {
+  if (!Writeable() || !file)
+    return false;
+  if (!header_written) {
+    if (info.pix_fmt == PIX_FMT_NONE)
+      info = ii;
+    if (!WriteHeader())
+      return false;
+  }
+  if (ii.pix_fmt != info.pix_fmt || ii.width != info.width ||
+      ii.height != info.height) {
+    LOG("y4m frame %dx%d fmt %d differs from the header\n", ii.width,
+        ii.height, ii.pix_fmt);
+    return false;
+  }
+  static const char line[] = "FRAME\n";
+  if (file->Write(line, 1, sizeof(line) - 1) != sizeof(line) - 1 ||
+      !file->WriteImage(ptr, ii))
+    return false;
+  frames++;
+  return true;
+}
+
+size_t Y4mWriteStream::Write(const void *ptr, size_t size, size_t nmemb) {
+  // the header must be known from params
+  ImageInfo ii = info;
+  ii.vir_width = ii.width;
+  ii.vir_height = ii.height;
+  ii.plane_num = 0;
+  if (info.pix_fmt == PIX_FMT_NONE || size * nmemb != y4m_frame_size(ii)) {
+    errno = EINVAL;
+    return -1;
+  }
+  return WriteFrame(ptr, ii) ? nmemb : 0;
+}
+
+bool Y4mWriteStream::Write(std::shared_ptr<MediaBuffer> buffer) {
+  if (!buffer || buffer->GetType() != Type::Image)
+    return false;
+  auto image = std::static_pointer_cast<ImageBuffer>(buffer);
+  AutoCPUAccess _aca(buffer.get(), MediaBuffer::kCPURead);
+  return WriteFrame(image->GetPtr(), image->GetImageInfo());
+}
+
+DEFINE_STREAM_FACTORY(Y4mWriteStream, Stream)
+
+const char *FACTORY(Y4mWriteStream)::ExpectedInputDataType() {
+  return TYPENEAR(IMAGE_YUV420P) TYPENEAR(IMAGE_YUV422P);
+}
+
+const char *FACTORY(Y4mWriteStream)::OutPutDataType() { return STREAM_FILE; }
+
+} // namespace easymedia
@@ -0,0 +1,198 @@
+/*
+ * Copyright (C) 2017 Hertz Wang 1989wanghang@163.com
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see http://www.gnu.org/licenses
+ *
+ * Any non-GPL usage of this software or parts of this software is strictly
+ * forbidden.
+ *
+ */
+
+#ifdef NDEBUG
+#undef NDEBUG
+#endif
+#ifndef DEBUG
+#define DEBUG
+#endif
+
+#include <assert.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <thread>
+#include <vector>
+
+#include "buffer.h"
+#include "control.h"
+#include "stream.h"
+#include "utils.h"
+
+static char optstr[] = "?f:s:";
+
+static const size_t kFrameSize = 256 * 1024 + 123;
+
+static std::shared_ptr<easymedia::Stream>
+open_stream(const std::string &path, const char *backend, bool direct,
+            size_t max_inflight, const char *full_mode) {
+  std::string param;
+  PARAM_STRING_APPEND(param, KEY_PATH, path);
+  PARAM_STRING_APPEND(param, KEY_OPEN_MODE, "w");
+  PARAM_STRING_APPEND(param, KEY_WRITE_BACKEND, backend);
+  PARAM_STRING_APPEND_TO(param, KEY_DIRECT_IO, direct ? 1 : 0);
+  PARAM_STRING_APPEND_TO(param, KEY_MAX_INFLIGHT_BYTES, max_inflight);
+  PARAM_STRING_APPEND(param, KEY_WRITE_FULL_MODE, full_mode);
+  return easymedia::REFLECTOR(Stream)::Create<easymedia::Stream>(
+      "async_write_stream", param.c_str());
+}
+
+static std::shared_ptr<easymedia::MediaBuffer> new_frame(int index) {
+  auto buffer = easymedia::MediaBuffer::Alloc(kFrameSize);
+  assert(buffer);
+  memset(buffer->GetPtr(), index & 0xFF, kFrameSize);
+  buffer->SetValidSize(kFrameSize);
+  return buffer;
+}
+
+// frames by buffers and by pointers must land in order
+static void test_content(const std::string &path, const char *backend,
+                         bool direct) {
+  const int num = 20;
+  auto stream =
+      open_stream(path, backend, direct, 4 * kFrameSize, KEY_BLOCKING);
+  assert(stream);
+  for (int i = 0; i < num; i++) {
+    auto buffer = new_frame(i);
+    if (i % 2)
+      assert(stream->Write(buffer));
+    else
+      assert(stream->Write(buffer->GetPtr(), 1, kFrameSize) == kFrameSize);
+  }
+  easymedia::StreamWriteStats stats;
+  assert(!stream->IoCtrl(easymedia::G_STREAM_WRITE_STATS, &stats));
+  // O_DIRECT keeps a partial chunk in flight
+  if (!direct)
+    assert(stats.peak_inflight_bytes <= 4 * kFrameSize);
+  stream.reset();
+
+  FILE *f = fopen(path.c_str(), "r");
+  assert(f);
+  std::vector<uint8_t> frame(kFrameSize);
+  for (int i = 0; i < num; i++) {
+    assert(fread(frame.data(), 1, kFrameSize, f) == kFrameSize);
+    assert(frame[0] == i && frame[kFrameSize - 1] == i);
+  }
+  assert(fgetc(f) == EOF);
+  fclose(f);
+  printf("%s%s: content ok\n", backend, direct ? " direct" : "");
+}
+
+// Storage which takes stall_us for every frame, read from the fifo.
+// The frames must come in order, return the read bytes.
+static size_t slow_storage(const std::string &fifo, int stall_us) {
+  int fd = open(fifo.c_str(), O_RDONLY);
+  assert(fd >= 0);
+  std::vector<uint8_t> frame(kFrameSize);
+  size_t total = 0;
+  int last = -1;
+  while (true) {
+    usleep(stall_us);
+    size_t got = 0;
+    ssize_t ret = 0;
+    while (got < kFrameSize &&
+           (ret = read(fd, frame.data() + got, kFrameSize - got)) > 0)
+      got += ret;
+    total += got;
+    if (ret <= 0)
+      break;
+    assert(frame[0] > last && frame[kFrameSize - 1] == frame[0]);
+    last = frame[0];
+  }
+  close(fd);
+  return total;
+}
+
+// Write frames at 100 fps to a fifo while the storage stalls stall_us
+// for every frame, return the longest Write() call.
+static int64_t test_stall(const std::string &path, const char *backend,
+                          int stall_us, size_t max_inflight,
+                          const char *full_mode) {
+  const int num = 20;
+  std::string fifo = path + ".fifo";
+  unlink(fifo.c_str());
+  assert(!mkfifo(fifo.c_str(), 0600));
+  size_t stored = 0;
+  std::thread storage([&] { stored = slow_storage(fifo, stall_us); });
+  auto stream = open_stream(fifo, backend, false, max_inflight, full_mode);
+  assert(stream);
+  for (int i = 0; i < num; i++) {
+    stream->Write(new_frame(i));
+    easymedia::msleep(10);
+  }
+  easymedia::StreamWriteStats stats;
+  assert(!stream->IoCtrl(easymedia::G_STREAM_WRITE_STATS, &stats));
+  printf("%s %s, stall %d ms: longest Write() %lld us, dropped %llu times, "
+         "peak in flight %zu bytes\n",
+         backend, full_mode, stall_us / 1000, (long long)stats.max_write_us,
+         (unsigned long long)stats.dropped_times, stats.peak_inflight_bytes);
+  assert(stats.error == 0);
+  stream.reset();
+  storage.join();
+  unlink(fifo.c_str());
+  // the written frames reach the storage
+  assert(stored == (num - stats.dropped_times) * kFrameSize);
+  return stats.max_write_us;
+}
+
+int main(int argc, char **argv) {
+  int c;
+  std::string path = "/tmp/async_write_test.bin";
+  int stall_ms = 100;
+
+  opterr = 1;
+  while ((c = getopt(argc, argv, optstr)) != -1) {
+    switch (c) {
+    case 'f':
+      path = optarg;
+      break;
+    case 's':
+      stall_ms = atoi(optarg);
+      break;
+    case '?':
+    default:
+      printf("usage: %s [-f tmp file] [-s stall ms]\n", argv[0]);
+      exit(0);
+    }
+  }
+
+  const char *backends[] = {KEY_BACKEND_THREADS, KEY_BACKEND_IO_URING};
+  for (const char *backend : backends) {
+    test_content(path, backend, false);
+    test_content(path, backend, true);
+    int stall_us = stall_ms * 1000;
+    // in flight bytes of one frame, the writer waits for the storage
+    int64_t blocked =
+        test_stall(path, backend, stall_us, kFrameSize, KEY_BLOCKING);
+    // the default in flight bytes absorb the stall
+    int64_t absorbed =
+        test_stall(path, backend, stall_us, 8 * 1024 * 1024, KEY_DROPCURRENT);
+    assert(blocked >= stall_us / 2);
+    assert(absorbed < stall_us / 4);
+  }
+  unlink(path.c_str());
+  return 0;
+}
@@ -0,0 +1,132 @@
+/*
+ * Copyright (C) 2017 Hertz Wang 1989wanghang@163.com
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see http://www.gnu.org/licenses
+ *
+ * Any non-GPL usage of this software or parts of this software is strictly
+ * forbidden.
+ *
+ */
+
+#ifdef NDEBUG
+#undef NDEBUG
+#endif
+#ifndef DEBUG
+#define DEBUG
+#endif
+
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "buffer.h"
+
+using easymedia::ImageBuffer;
+using easymedia::MediaBuffer;
+
+static std::shared_ptr<MediaBuffer> new_buffer(size_t size, uint8_t val) {
+  auto buffer = MediaBuffer::Alloc(size);
+  assert(buffer);
+  memset(buffer->GetPtr(), val, size);
+  buffer->SetValidSize(size);
+  return buffer;
+}
+
+static void test_make_writable() {
+  auto buffer = new_buffer(256, 1);
+  assert(MediaBuffer::IsWritable(buffer));
+  void *ptr = buffer->GetPtr();
+  assert(MediaBuffer::MakeWritable(buffer) && buffer->GetPtr() == ptr);
+
+  // a second reference makes the writer copy
+  auto other = buffer;
+  assert(!MediaBuffer::IsWritable(buffer));
+  buffer->SetUSTimeStamp(42);
+  assert(MediaBuffer::MakeWritable(buffer));
+  assert(buffer != other && buffer->GetPtr() != other->GetPtr());
+  assert(buffer->GetValidSize() == 256 && buffer->GetUSTimeStamp() == 42);
+  assert(MediaBuffer::IsWritable(buffer));
+  memset(buffer->GetPtr(), 2, 256);
+  assert(static_cast<uint8_t *>(other->GetPtr())[0] == 1);
+
+  // so does another object sharing the memory
+  MediaBuffer copy(*other);
+  assert(!MediaBuffer::IsWritable(other));
+
+  auto ro = new_buffer(16, 3);
+  ro->SetReadOnly(true);
+  assert(ro->IsReadOnly() && !MediaBuffer::IsWritable(ro));
+  assert(MediaBuffer::MakeWritable(ro));
+  assert(!ro->IsReadOnly() && MediaBuffer::IsWritable(ro));
+  assert(static_cast<uint8_t *>(ro->GetPtr())[15] == 3);
+}
+
+static void test_shallow_copy() {
+  ImageInfo info = {PIX_FMT_NV12, 16, 16, 16, 16, 0, {}};
+  auto mb = MediaBuffer::Alloc(CalPixFmtSize(info));
+  assert(mb);
+  auto src = std::make_shared<ImageBuffer>(*mb, info);
+  mb.reset();
+  memset(src->GetPtr(), 4, src->GetValidSize());
+
+  // the same class and memory, private attributes
+  auto view = MediaBuffer::ShallowCopy(src);
+  assert(view && view->GetType() == Type::Image && view->IsView());
+  assert(view->GetPtr() == src->GetPtr());
+  assert(view->GetValidSize() == src->GetValidSize());
+  auto image = std::static_pointer_cast<ImageBuffer>(view);
+  image->GetImageInfo().width = 8;
+  view->SetUserFlag(MediaBuffer::kIntra);
+  assert(src->GetWidth() == 16 && src->GetUserFlag() == 0);
+  assert(view->IsReadOnly() && !MediaBuffer::IsWritable(view));
+
+  // writing the view copies it, the source is untouched
+  assert(MediaBuffer::MakeWritable(view));
+  assert(!view->IsView() && view->GetPtr() != src->GetPtr());
+  image = std::static_pointer_cast<ImageBuffer>(view);
+  assert(image->GetWidth() == 8 && view->GetUserFlag() == MediaBuffer::kIntra);
+  memset(view->GetPtr(), 5, view->GetValidSize());
+  assert(static_cast<uint8_t *>(src->GetPtr())[0] == 4);
+}
+
+static void test_lazy_clone() {
+  auto src = new_buffer(1000, 6);
+  src->SetUSTimeStamp(7);
+  std::weak_ptr<MediaBuffer> weak = src;
+
+  // no copy until materialized, the source is held
+  auto clone = MediaBuffer::LazyClone(src);
+  assert(clone && clone->GetPtr() == src->GetPtr());
+  src.reset();
+  assert(!weak.expired());
+
+  assert(MediaBuffer::Materialize(clone));
+  assert(weak.expired());
+  assert(!clone->IsView() && clone->GetValidSize() == 1000);
+  assert(clone->GetUSTimeStamp() == 7);
+  assert(static_cast<uint8_t *>(clone->GetPtr())[999] == 6);
+  assert(MediaBuffer::IsWritable(clone));
+
+  // nothing to do for a buffer owning its memory
+  void *ptr = clone->GetPtr();
+  assert(MediaBuffer::Materialize(clone) && clone->GetPtr() == ptr);
+}
+
+int main() {
+  test_make_writable();
+  test_shallow_copy();
+  test_lazy_clone();
+  printf("buffer cow test ok\n");
+  return 0;
+}
@@ -0,0 +1,125 @@
+/*
+ * Copyright (C) 2017 Hertz Wang 1989wanghang@163.com
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see http://www.gnu.org/licenses
+ *
+ * Any non-GPL usage of this software or parts of this software is strictly
+ * forbidden.
+ *
+ */
+
+#ifdef NDEBUG
+#undef NDEBUG
+#endif
+#ifndef DEBUG
+#define DEBUG
+#endif
+
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "buffer.h"
+#include "codec.h"
+
+using easymedia::MediaBuffer;
+
+static void test_slice() {
+  auto parent = MediaBuffer::Alloc(1024);
+  assert(parent);
+  uint8_t *base = static_cast<uint8_t *>(parent->GetPtr());
+  for (int i = 0; i < 1024; i++)
+    base[i] = (uint8_t)i;
+  parent->SetValidSize(1024);
+  parent->SetUSTimeStamp(1234);
+  parent->SetUserFlag(MediaBuffer::kIntra);
+
+  // a view of the parent memory with its attributes
+  auto slice = MediaBuffer::Slice(parent, 100, 200);
+  assert(slice);
+  assert(slice->GetPtr() == base + 100);
+  assert(slice->GetSize() == 200 && slice->GetValidSize() == 200);
+  assert(slice->GetFD() == parent->GetFD());
+  assert(slice->GetFDOffset() == 100);
+  assert(slice->GetUSTimeStamp() == 1234);
+  assert(slice->GetUserFlag() == MediaBuffer::kIntra);
+  assert(static_cast<uint8_t *>(slice->GetPtr())[0] == 100);
+
+  // offsets add up for a slice of a slice
+  auto sub = MediaBuffer::Slice(slice, 50, 10);
+  assert(sub && sub->GetPtr() == base + 150 && sub->GetFDOffset() == 150);
+
+  // the bounds are checked
+  assert(!MediaBuffer::Slice(parent, 1024, 1));
+  assert(!MediaBuffer::Slice(parent, 1000, 25));
+  assert(!MediaBuffer::Slice(slice, 0, 201));
+  assert(!MediaBuffer::Slice(nullptr, 0, 0));
+  auto empty = MediaBuffer::Slice(parent, 1024, 0);
+  assert(empty && empty->GetSize() == 0);
+
+  // the views hold the parent alive
+  std::weak_ptr<MediaBuffer> weak = parent;
+  parent.reset();
+  slice.reset();
+  empty.reset();
+  assert(!weak.expired());
+  assert(static_cast<uint8_t *>(sub->GetPtr())[9] == 159);
+  sub.reset();
+  assert(weak.expired());
+}
+
+static void test_split_h264() {
+  static const uint8_t stream[] = {
+      0, 0, 0, 1, 0x67, 0x42, 0x00, 0x1f, // sps
+      0, 0, 0, 1, 0x68, 0xce, 0x38, 0x80, // pps
+      0, 0, 0, 1, 0x65, 0x88, 0x84,       // idr
+  };
+  auto buffer = MediaBuffer::Alloc(sizeof(stream));
+  assert(buffer);
+  memcpy(buffer->GetPtr(), stream, sizeof(stream));
+  buffer->SetValidSize(sizeof(stream));
+  const uint8_t *base = static_cast<const uint8_t *>(buffer->GetPtr());
+
+  auto slices = easymedia::split_h264_separate(buffer, 5678);
+  auto copies = easymedia::split_h264_separate(stream, sizeof(stream), 5678);
+  assert(slices.size() == 3 && copies.size() == 3);
+  const size_t offsets[] = {0, 8, 16};
+  const size_t sizes[] = {8, 8, 7};
+  const uint32_t flags[] = {MediaBuffer::kExtraIntra, MediaBuffer::kExtraIntra,
+                            MediaBuffer::kIntra};
+  auto copy = copies.begin();
+  int i = 0;
+  for (auto &s : slices) {
+    // no copy, the same bytes as the copying version
+    assert(s->GetPtr() == base + offsets[i]);
+    assert(s->GetFDOffset() == offsets[i]);
+    assert(s->GetValidSize() == sizes[i]);
+    assert(s->GetUserFlag() == flags[i] && s->GetUSTimeStamp() == 5678);
+    assert((*copy)->GetValidSize() == sizes[i]);
+    assert((*copy)->GetUserFlag() == flags[i]);
+    assert(!memcmp((*copy)->GetPtr(), s->GetPtr(), sizes[i]));
+    ++copy;
+    i++;
+  }
+
+  buffer->SetValidSize(0);
+  assert(easymedia::split_h264_separate(buffer, 0).empty());
+}
+
+int main() {
+  test_slice();
+  test_split_h264();
+  printf("buffer slice test ok\n");
+  return 0;
+}
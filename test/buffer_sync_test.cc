@@ -0,0 +1,126 @@
+/*
+ * Copyright (C) 2017 Hertz Wang 1989wanghang@163.com
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see http://www.gnu.org/licenses
+ *
+ * Any non-GPL usage of this software or parts of this software is strictly
+ * forbidden.
+ *
+ */
+
+#ifdef NDEBUG
+#undef NDEBUG
+#endif
+#ifndef DEBUG
+#define DEBUG
+#endif
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "buffer.h"
+
+static char optstr[] = "?s:c";
+
+static void fill(easymedia::MediaBuffer *mb, uint8_t seed) {
+  easymedia::AutoCPUAccess _aca(mb, easymedia::MediaBuffer::kCPUWrite);
+  uint8_t *p = static_cast<uint8_t *>(mb->GetPtr());
+  for (size_t i = 0; i < mb->GetSize(); i++)
+    p[i] = (uint8_t)(seed + i);
+  mb->SetValidSize(mb->GetSize());
+}
+
+static void check(easymedia::MediaBuffer *mb, uint8_t seed) {
+  easymedia::AutoCPUAccess _aca(mb, easymedia::MediaBuffer::kCPURead);
+  uint8_t *p = static_cast<uint8_t *>(mb->GetPtr());
+  for (size_t i = 0; i < mb->GetValidSize(); i++)
+    assert(p[i] == (uint8_t)(seed + i));
+}
+
+int main(int argc, char **argv) {
+  int c;
+  size_t size = 1920 * 1080 * 3 / 2;
+  uint32_t flags = 0;
+
+  opterr = 1;
+  while ((c = getopt(argc, argv, optstr)) != -1) {
+    switch (c) {
+    case 's':
+      size = atoi(optarg);
+      break;
+    case 'c':
+      flags |= easymedia::MediaBuffer::kMemCacheable;
+      break;
+    case '?':
+    default:
+      printf("usage: %s [-s size] [-c]\n", argv[0]);
+      printf("\t-c: alloc cacheable hardware memory\n");
+      exit(0);
+    }
+  }
+
+  // common memory, no-op
+  auto common = easymedia::MediaBuffer::Alloc(size);
+  assert(common);
+  assert(!common->IsHwBuffer());
+  assert(common->BeginCPUAccess(easymedia::MediaBuffer::kCPURead |
+                                easymedia::MediaBuffer::kCPUWrite));
+  assert(common->EndCPUAccess(easymedia::MediaBuffer::kCPURead |
+                              easymedia::MediaBuffer::kCPUWrite));
+
+  auto hw = easymedia::MediaBuffer::Alloc(
+      size, easymedia::MediaBuffer::MemType::MEM_HARD_WARE, flags);
+  if (!hw) {
+    fprintf(stderr, "no hardware memory, skip\n");
+    return 0;
+  }
+  assert(hw->IsHwBuffer());
+  assert(hw->GetSize() >= size);
+  printf("hardware buffer: fd %d, size %zu\n", hw->GetFD(), hw->GetSize());
+
+  // cpu write then cpu read by clone
+  fill(hw.get(), 7);
+  auto clone = easymedia::MediaBuffer::Clone(*hw);
+  assert(clone);
+  check(clone.get(), 7);
+
+  // common to hardware
+  fill(common.get(), 13);
+  auto hw_clone = easymedia::MediaBuffer::Clone(
+      *common, easymedia::MediaBuffer::MemType::MEM_HARD_WARE);
+  assert(hw_clone && hw_clone->IsHwBuffer());
+  check(hw_clone.get(), 13);
+
+  // views sync the whole dma-buf of parent
+  size_t offset = hw->GetSize() / 2;
+  auto slice =
+      easymedia::MediaBuffer::Slice(hw, offset, hw->GetSize() - offset);
+  assert(slice);
+  assert(slice->GetFD() == hw->GetFD() && slice->GetFDOffset() == offset);
+  check(slice.get(), (uint8_t)(7 + offset));
+
+  // chained segments
+  auto chain = std::make_shared<easymedia::ChainBuffer>();
+  assert(chain->Append(slice));
+  assert(chain->Append(common));
+  assert(chain->BeginCPUAccess(easymedia::MediaBuffer::kCPURead));
+  assert(!memcmp(chain->GetPtr(), slice->GetPtr(), slice->GetValidSize()));
+  assert(chain->EndCPUAccess(easymedia::MediaBuffer::kCPURead));
+
+  printf("%s pass\n", argv[0]);
+  return 0;
+}
@@ -0,0 +1,154 @@
+/*
+ * Copyright (C) 2017 Hertz Wang 1989wanghang@163.com
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see http://www.gnu.org/licenses
+ *
+ * Any non-GPL usage of this software or parts of this software is strictly
+ * forbidden.
+ *
+ */
+
+#ifdef NDEBUG
+#undef NDEBUG
+#endif
+#ifndef DEBUG
+#define DEBUG
+#endif
+
+#include <assert.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <string>
+
+#include "buffer.h"
+#include "utils.h"
+
+static char optstr[] = "?f:";
+
+using easymedia::MediaBuffer;
+
+static std::string log_path;
+
+// Run func with stderr redirected, return what it printed.
+template <typename Func> static std::string capture_log(Func func) {
+  fflush(stderr);
+  int saved = dup(STDERR_FILENO);
+  FILE *f = fopen(log_path.c_str(), "w+");
+  assert(saved >= 0 && f);
+  dup2(fileno(f), STDERR_FILENO);
+  func();
+  fflush(stderr);
+  dup2(saved, STDERR_FILENO);
+  close(saved);
+  std::string log;
+  char buf[256];
+  rewind(f);
+  size_t n;
+  while ((n = fread(buf, 1, sizeof(buf), f)) > 0)
+    log.append(buf, n);
+  fclose(f);
+  unlink(log_path.c_str());
+  return log;
+}
+
+static int count_of(const std::string &log, const std::string &s) {
+  int num = 0;
+  for (size_t pos = log.find(s); pos != std::string::npos;
+       pos = log.find(s, pos + s.size()))
+    num++;
+  return num;
+}
+
+int main(int argc, char **argv) {
+  int c;
+  log_path = "/tmp/buffer_trace_test.log";
+
+  opterr = 1;
+  while ((c = getopt(argc, argv, optstr)) != -1) {
+    switch (c) {
+    case 'f':
+      log_path = optarg;
+      break;
+    case '?':
+    default:
+      printf("usage: %s [-f tmp file]\n", argv[0]);
+      exit(0);
+    }
+  }
+
+  // not traced when disabled
+  easymedia::EnableBufferTrace(false);
+  auto untraced = MediaBuffer::Alloc(100);
+  assert(untraced);
+  untraced->TraceHolder(easymedia::GetMemoryOwner("trace_flow"), 0);
+  std::string log = capture_log([] { easymedia::DumpBufferTrace(); });
+  assert(log.find("0 traced buffers alive") != std::string::npos);
+
+  easymedia::EnableBufferTrace(true);
+  std::shared_ptr<MediaBuffer> owned, passed;
+  {
+    easymedia::AutoMemoryOwner _amo(
+        easymedia::GetMemoryOwner("trace_test_owner"));
+    owned = MediaBuffer::Alloc(1000);
+    passed = MediaBuffer::Alloc(2000);
+  }
+  assert(owned && passed);
+  // the last four hops are kept
+  auto *flow = easymedia::GetMemoryOwner("trace_flow");
+  for (int i = 0; i < 6; i++)
+    passed->TraceHolder(flow, i);
+  // a copy of the object holds the memory too
+  MediaBuffer copy(*passed);
+
+  log = capture_log([] { easymedia::DumpBufferTrace(); });
+  assert(log.find("2 traced buffers alive") != std::string::npos);
+  assert(count_of(log, "owner trace_test_owner") == 2);
+  assert(log.find("1000 bytes") != std::string::npos);
+  assert(log.find("2000 bytes, type 0, owner trace_test_owner, age") !=
+         std::string::npos);
+  assert(log.find("holders 2") != std::string::npos);
+  assert(count_of(log, "-> trace_flow slot") == 4);
+  assert(log.find("trace_flow slot 1,") == std::string::npos);
+  assert(log.find("trace_flow slot 2,") != std::string::npos);
+  assert(log.find("trace_flow slot 5,") != std::string::npos);
+
+  // young buffers are filtered out
+  log = capture_log([] { easymedia::DumpBufferTrace(60 * 1000); });
+  assert(log.find("bytes") == std::string::npos);
+  assert(log.find("2 traced buffers alive") != std::string::npos);
+
+  // released buffers leave the trace
+  owned.reset();
+  log = capture_log([] { easymedia::DumpBufferTrace(); });
+  assert(log.find("1 traced buffers alive") != std::string::npos);
+  passed.reset();
+  log = capture_log([] { easymedia::DumpBufferTrace(); });
+  assert(log.find("1 traced buffers alive") != std::string::npos);
+  copy.SetUserData(nullptr);
+
+  // dump on signal
+  assert(easymedia::InstallBufferTraceSignal(SIGUSR1));
+  log = capture_log([] {
+    raise(SIGUSR1);
+    easymedia::msleep(200);
+  });
+  assert(log.find("0 traced buffers alive") != std::string::npos);
+
+  printf("buffer trace test ok\n");
+  return 0;
+}
@@ -0,0 +1,321 @@
+/*
+ * Copyright (C) 2017 Hertz Wang 1989wanghang@163.com
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see http://www.gnu.org/licenses
+ *
+ * Any non-GPL usage of this software or parts of this software is strictly
+ * forbidden.
+ *
+ */
+
+#ifdef NDEBUG
+#undef NDEBUG
+#endif
+#ifndef DEBUG
+#define DEBUG
+#endif
+
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <mutex>
+
+#include "buffer.h"
+#include "control.h"
+#include "flow.h"
+#include "key_string.h"
+#include "stream.h"
+#include "utils.h"
+
+static char optstr[] = "?f:";
+
+static const int kFrameNum = 12;
+static const int64_t kFrameUs = 20000;
+
+static std::mutex received_mtx;
+static std::vector<std::shared_ptr<easymedia::MediaBuffer>> received;
+static std::vector<int64_t> received_time;
+
+// keep all the input and when it comes
+class CollectFlow : public easymedia::Flow {
+public:
+  CollectFlow() {
+    easymedia::SlotMap sm;
+    sm.input_slots.push_back(0);
+    sm.thread_model = easymedia::Model::SYNC;
+    sm.mode_when_full = easymedia::InputMode::DROPFRONT;
+    sm.process = collect;
+    if (!InstallSlotMap(sm, "collect", -1))
+      SetError(-EINVAL);
+  }
+  virtual ~CollectFlow() { StopAllThread(); }
+
+private:
+  static bool collect(easymedia::Flow *f _UNUSED,
+                      easymedia::MediaBufferVector &input_vector) {
+    if (input_vector[0]) {
+      std::lock_guard<std::mutex> _lg(received_mtx);
+      received.push_back(input_vector[0]);
+      received_time.push_back(easymedia::gettimeofday());
+    }
+    return true;
+  }
+};
+
+// images whose size changes, compressed video and audio
+static std::vector<std::shared_ptr<easymedia::MediaBuffer>> make_frames() {
+  std::vector<std::shared_ptr<easymedia::MediaBuffer>> frames;
+  for (int i = 0; i < kFrameNum; i++) {
+    std::shared_ptr<easymedia::MediaBuffer> buffer;
+    if (i % 3 == 0) {
+      ImageInfo info = {PIX_FMT_NV12, 64, 48, 64, 48, 0, {}};
+      if (i >= kFrameNum / 2)
+        info = {PIX_FMT_NV12, 32, 16, 48, 16, 2, {{0, 48}, {1024, 48}}};
+      auto mb = easymedia::MediaBuffer::Alloc2(CalPixFmtSize(info));
+      buffer = std::make_shared<easymedia::ImageBuffer>(mb, info);
+    } else if (i % 3 == 1) {
+      auto mb = easymedia::MediaBuffer::Alloc2(4096);
+      mb.SetValidSize(100 + i * 37);
+      mb.SetType(Type::Video);
+      mb.SetUserFlag(i % 6 == 1 ? easymedia::MediaBuffer::kIntra
+                                : easymedia::MediaBuffer::kPredicted);
+      buffer = std::make_shared<easymedia::MediaBuffer>(mb);
+    } else {
+      SampleInfo info = {SAMPLE_FMT_S16, 2, 48000, 64};
+      auto mb = easymedia::MediaBuffer::Alloc2(GetSampleSize(info) * 64);
+      mb.SetValidSize(GetSampleSize(info) * 64);
+      buffer = std::make_shared<easymedia::SampleBuffer>(mb, info);
+    }
+    uint8_t *ptr = static_cast<uint8_t *>(buffer->GetPtr());
+    for (size_t j = 0; j < buffer->GetValidSize(); j++)
+      ptr[j] = (uint8_t)(i * 31 + j);
+    buffer->SetUSTimeStamp(1000000 + i * kFrameUs);
+    buffer->SetEOF(i == kFrameNum - 1);
+    frames.push_back(buffer);
+  }
+  return frames;
+}
+
+static void check_frame(const std::shared_ptr<easymedia::MediaBuffer> &a,
+                        const std::shared_ptr<easymedia::MediaBuffer> &b) {
+  assert(a && b);
+  assert(a->GetType() == b->GetType());
+  assert(a->GetValidSize() == b->GetValidSize());
+  assert(a->GetUSTimeStamp() == b->GetUSTimeStamp());
+  assert(a->GetUserFlag() == b->GetUserFlag());
+  assert(a->IsEOF() == b->IsEOF());
+  assert(!memcmp(a->GetPtr(), b->GetPtr(), a->GetValidSize()));
+  if (a->GetType() == Type::Image) {
+    auto ia = std::static_pointer_cast<easymedia::ImageBuffer>(a);
+    auto ib = std::static_pointer_cast<easymedia::ImageBuffer>(b);
+    assert(!memcmp(&ia->GetImageInfo(), &ib->GetImageInfo(),
+                   sizeof(ImageInfo)));
+  } else if (a->GetType() == Type::Audio) {
+    auto sa = std::static_pointer_cast<easymedia::SampleBuffer>(a);
+    auto sb = std::static_pointer_cast<easymedia::SampleBuffer>(b);
+    assert(!memcmp(&sa->GetSampleInfo(), &sb->GetSampleInfo(),
+                   sizeof(SampleInfo)));
+  }
+}
+
+static std::shared_ptr<easymedia::Stream> open_capture(const std::string &path,
+                                                       bool write) {
+  std::string param;
+  PARAM_STRING_APPEND(param, KEY_PATH, path);
+  return easymedia::REFLECTOR(Stream)::Create<easymedia::Stream>(
+      write ? "capture_write_stream" : "capture_read_stream", param.c_str());
+}
+
+static uint64_t frame_num(std::shared_ptr<easymedia::Stream> &stream) {
+  uint64_t num = 0;
+  assert(!stream->IoCtrl(easymedia::G_CAPTURE_FRAME_NUM, &num));
+  return num;
+}
+
+// replay into collect, return the time from the first to the last frame
+static int64_t play(const std::string &path, bool realtime,
+                    const std::vector<std::shared_ptr<easymedia::MediaBuffer>>
+                        &frames) {
+  std::string param;
+  PARAM_STRING_APPEND(param, KEY_PATH, path);
+  PARAM_STRING_APPEND_TO(param, KEY_REALTIME, realtime ? 1 : 0);
+  auto player = easymedia::REFLECTOR(Flow)::Create<easymedia::Flow>(
+      "capture_player", param.c_str());
+  assert(player && player->GetError() == 0);
+  auto collect = std::make_shared<CollectFlow>();
+  received.clear();
+  received_time.clear();
+  assert(player->AddDownFlow(collect, 0, 0));
+  for (int i = 0; i < 300; i++) {
+    {
+      std::lock_guard<std::mutex> _lg(received_mtx);
+      if (received.size() == frames.size())
+        break;
+    }
+    easymedia::msleep(10);
+  }
+  player->RemoveDownFlow(collect);
+  player.reset();
+  assert(received.size() == frames.size());
+  for (size_t i = 0; i < frames.size(); i++)
+    check_frame(frames[i], received[i]);
+  return received_time.back() - received_time.front();
+}
+
+int main(int argc, char **argv) {
+  int c;
+  std::string path = "/tmp/capture_test.cap";
+
+  opterr = 1;
+  while ((c = getopt(argc, argv, optstr)) != -1) {
+    switch (c) {
+    case 'f':
+      path = optarg;
+      break;
+    case '?':
+    default:
+      printf("usage: %s [-f tmp file]\n", argv[0]);
+      exit(0);
+    }
+  }
+  auto frames = make_frames();
+
+  // stream round trip
+  auto writer = open_capture(path, true);
+  assert(writer);
+  for (auto &frame : frames)
+    assert(writer->Write(frame));
+  assert(frame_num(writer) == kFrameNum);
+  writer.reset();
+  auto reader = open_capture(path, false);
+  assert(reader && frame_num(reader) == kFrameNum);
+  for (auto &frame : frames)
+    check_frame(frame, reader->Read());
+  assert(reader->Eof() && !reader->Read());
+
+  // seek by the index, frame 10 depends on the intra frame 7
+  int64_t ts = frames[10]->GetUSTimeStamp() + 1;
+  assert(!reader->IoCtrl(easymedia::S_CAPTURE_SEEK_TIME, &ts));
+  assert(reader->Tell() == 7);
+  check_frame(frames[7], reader->Read());
+  assert(!reader->Seek(-2, SEEK_END));
+  check_frame(frames[kFrameNum - 2], reader->Read());
+  reader.reset();
+
+  // lose the index and half of the last frame, as if the recorder crashed
+  std::string cut_path = path + ".cut";
+  {
+    FILE *in = fopen(path.c_str(), "rb");
+    FILE *out = fopen(cut_path.c_str(), "wb");
+    assert(in && out);
+    std::vector<uint8_t> data(1 << 20);
+    size_t size = fread(data.data(), 1, data.size(), in);
+    size_t index_size = kFrameNum * 24 + 24;
+    size_t cut = size - index_size - frames.back()->GetValidSize() / 2;
+    assert(fwrite(data.data(), 1, cut, out) == cut);
+    fclose(in);
+    fclose(out);
+  }
+  reader = open_capture(cut_path, false);
+  assert(reader && frame_num(reader) == kFrameNum - 1);
+  for (int i = 0; i < kFrameNum - 1; i++)
+    check_frame(frames[i], reader->Read());
+  assert(reader->Eof());
+  reader.reset();
+  unlink(cut_path.c_str());
+
+  // a seek lands on the sps and pps before the intra frame
+  {
+    const uint32_t flags[] = {easymedia::MediaBuffer::kExtraIntra,
+                              easymedia::MediaBuffer::kIntra,
+                              easymedia::MediaBuffer::kPredicted,
+                              easymedia::MediaBuffer::kExtraIntra,
+                              easymedia::MediaBuffer::kIntra,
+                              easymedia::MediaBuffer::kPredicted,
+                              easymedia::MediaBuffer::kPredicted};
+    auto gop_writer = open_capture(cut_path, true);
+    assert(gop_writer);
+    for (size_t i = 0; i < sizeof(flags) / sizeof(flags[0]); i++) {
+      auto mb = easymedia::MediaBuffer::Alloc(64);
+      mb->SetValidSize(64);
+      mb->SetType(Type::Video);
+      mb->SetUserFlag(flags[i]);
+      mb->SetUSTimeStamp(i * kFrameUs);
+      assert(gop_writer->Write(mb));
+    }
+    gop_writer.reset();
+    auto gop_reader = open_capture(cut_path, false);
+    assert(gop_reader);
+    for (int64_t t : {6 * kFrameUs, 4 * kFrameUs, 3 * kFrameUs}) {
+      ts = t;
+      assert(!gop_reader->IoCtrl(easymedia::S_CAPTURE_SEEK_TIME, &ts));
+      assert(gop_reader->Tell() == 3);
+    }
+    ts = 2 * kFrameUs;
+    assert(!gop_reader->IoCtrl(easymedia::S_CAPTURE_SEEK_TIME, &ts));
+    assert(gop_reader->Tell() == 0);
+    auto buffer = gop_reader->Read();
+    assert(buffer &&
+           buffer->GetUserFlag() == easymedia::MediaBuffer::kExtraIntra);
+  }
+
+  // a corrupt frame size is refused, not allocated
+  {
+    FILE *f = fopen(cut_path.c_str(), "r+b");
+    assert(f);
+    // the size field of the first frame header
+    uint64_t size = 1ULL << 60;
+    assert(!fseek(f, 16 + 24, SEEK_SET) && fwrite(&size, 8, 1, f) == 1);
+    fclose(f);
+    reader = open_capture(cut_path, false);
+    assert(reader && frame_num(reader) == 7);
+    assert(!reader->Read());
+    auto next = reader->Read();
+    assert(next && next->GetUserFlag() == easymedia::MediaBuffer::kIntra);
+  }
+  reader.reset();
+  unlink(cut_path.c_str());
+
+  // record by flow
+  std::string param;
+  PARAM_STRING_APPEND(param, KEY_PATH, path);
+  PARAM_STRING_APPEND(param, KEK_THREAD_SYNC_MODEL, KEY_SYNC);
+  auto recorder = easymedia::REFLECTOR(Flow)::Create<easymedia::Flow>(
+      "capture_recorder", param.c_str());
+  assert(recorder && recorder->GetError() == 0);
+  for (auto &frame : frames)
+    recorder->SendInput(frame, 0);
+  uint64_t num = 0;
+  assert(!recorder->Control(easymedia::G_CAPTURE_FRAME_NUM, &num));
+  assert(num == kFrameNum);
+  recorder.reset();
+
+  // replay at the original timing and at full speed
+  int64_t realtime_cost = play(path, true, frames);
+  int64_t fast_cost = play(path, false, frames);
+  printf("replay %d frames of %lld us: realtime %lld us, full speed %lld us\n",
+         kFrameNum, (long long)((kFrameNum - 1) * kFrameUs),
+         (long long)realtime_cost, (long long)fast_cost);
+  assert(realtime_cost >= (kFrameNum - 1) * kFrameUs - 2000);
+  assert(realtime_cost < (kFrameNum - 1) * kFrameUs + 50000);
+  assert(fast_cost < (kFrameNum - 1) * kFrameUs / 2);
+
+  unlink(path.c_str());
+  printf("capture test ok\n");
+  return 0;
+}
@@ -0,0 +1,182 @@
+/*
+ * Copyright (C) 2017 Hertz Wang 1989wanghang@163.com
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see http://www.gnu.org/licenses
+ *
+ * Any non-GPL usage of this software or parts of this software is strictly
+ * forbidden.
+ *
+ */
+
+#ifdef NDEBUG
+#undef NDEBUG
+#endif
+#ifndef DEBUG
+#define DEBUG
+#endif
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <string>
+
+#include "buffer.h"
+#include "control.h"
+#include "stream.h"
+
+static char optstr[] = "?f:";
+
+using easymedia::ChainBuffer;
+using easymedia::MediaBuffer;
+
+// Stream which takes at most limit bytes per Write(), by the default WriteV.
+class LimitedStream : public easymedia::Stream {
+public:
+  LimitedStream(size_t max) : limit(max) { SetWriteable(true); }
+  virtual size_t Read(void *ptr _UNUSED, size_t size _UNUSED,
+                      size_t nmemb _UNUSED) override {
+    return -1;
+  }
+  virtual size_t Write(const void *ptr, size_t size, size_t nmemb) override {
+    size_t len = std::min(size * nmemb, limit);
+    data.append((const char *)ptr, len);
+    limit -= len;
+    return len;
+  }
+  virtual int Seek(int64_t offset _UNUSED, int whence _UNUSED) override {
+    return -1;
+  }
+  virtual long Tell() override { return data.size(); }
+  std::string data;
+
+protected:
+  virtual int Open() override { return 0; }
+  virtual int Close() override { return 0; }
+
+private:
+  size_t limit;
+};
+
+static std::shared_ptr<MediaBuffer> new_text(const char *s) {
+  auto buffer = MediaBuffer::Alloc(strlen(s));
+  assert(buffer);
+  memcpy(buffer->GetPtr(), s, strlen(s));
+  buffer->SetValidSize(strlen(s));
+  return buffer;
+}
+
+static std::shared_ptr<ChainBuffer> new_chain() {
+  auto parent = new_text("0123456789");
+  auto chain = std::make_shared<ChainBuffer>();
+  assert(chain->Append(MediaBuffer::Slice(parent, 0, 3)));
+  assert(chain->Append(new_text("abc")));
+  assert(chain->Append(MediaBuffer::Slice(parent, 7, 3)));
+  assert(!chain->Append(nullptr));
+  return chain;
+}
+
+static void test_chain() {
+  auto chain = new_chain();
+  assert(chain->GetValidSize() == 9 && chain->GetSegments().size() == 3);
+
+  // the segments are not copied for vectored io
+  std::vector<struct iovec> iov;
+  assert(chain->GetIOVec(iov) == 9 && iov.size() == 3);
+  for (size_t i = 0; i < iov.size(); i++) {
+    assert(iov[i].iov_base == chain->GetSegments()[i]->GetPtr());
+    assert(iov[i].iov_len == 3);
+  }
+
+  // gathered once on GetPtr(), again after Append()
+  void *flat = chain->GetPtr();
+  assert(flat && !memcmp(flat, "012abc789", 9));
+  assert(chain->GetPtr() == flat);
+  assert(chain->Append(new_text("!")));
+  assert(chain->GetValidSize() == 10);
+  assert(!memcmp(chain->GetPtr(), "012abc789!", 10));
+
+  // a single segment needs no gathering
+  auto one = std::make_shared<ChainBuffer>();
+  auto seg = new_text("xyz");
+  assert(one->Append(seg) && one->GetPtr() == seg->GetPtr());
+
+  // a plain buffer is one segment
+  iov.clear();
+  assert(seg->GetIOVec(iov) == 3 && iov.size() == 1);
+  seg->SetValidSize(0);
+  assert(seg->GetIOVec(iov) == 0 && iov.size() == 1);
+}
+
+static void test_default_writev() {
+  struct iovec iov[] = {
+      {(void *)"abc", 3}, {(void *)"", 0}, {(void *)"defg", 4}};
+  LimitedStream all(100);
+  assert(all.WriteV(iov, 3) == 7 && all.data == "abcdefg");
+  // stops at the first short write
+  LimitedStream part(5);
+  assert(part.WriteV(iov, 3) == 5 && part.data == "abcde");
+}
+
+static void test_file_writev(const std::string &path) {
+  std::string param;
+  PARAM_STRING_APPEND(param, KEY_PATH, path);
+  PARAM_STRING_APPEND(param, KEY_OPEN_MODE, "w");
+  auto stream = easymedia::REFLECTOR(Stream)::Create<easymedia::Stream>(
+      "file_write_stream", param.c_str());
+  assert(stream);
+  // buffered writes stay in order with the vectored ones
+  assert(stream->Write("<", 1, 1) == 1);
+  assert(stream->Write(new_chain()));
+  assert(stream->Write("|", 1, 1) == 1);
+  struct iovec iov[] = {{(void *)"xy", 2}, {(void *)"z", 1}};
+  assert(stream->WriteV(iov, 2) == 3);
+  assert(stream->Write(">", 1, 1) == 1);
+  stream.reset();
+
+  FILE *f = fopen(path.c_str(), "r");
+  assert(f);
+  char buf[32] = {0};
+  assert(fread(buf, 1, sizeof(buf), f) == 15);
+  fclose(f);
+  assert(!memcmp(buf, "<012abc789|xyz>", 15));
+  unlink(path.c_str());
+}
+
+int main(int argc, char **argv) {
+  int c;
+  std::string path = "/tmp/chain_buffer_test.bin";
+
+  opterr = 1;
+  while ((c = getopt(argc, argv, optstr)) != -1) {
+    switch (c) {
+    case 'f':
+      path = optarg;
+      break;
+    case '?':
+    default:
+      printf("usage: %s [-f tmp file]\n", argv[0]);
+      exit(0);
+    }
+  }
+
+  test_chain();
+  test_default_writev();
+  test_file_writev(path);
+  printf("chain buffer test ok\n");
+  return 0;
+}
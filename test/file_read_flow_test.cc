@@ -0,0 +1,198 @@
+/*
+ * Copyright (C) 2017 Hertz Wang 1989wanghang@163.com
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see http://www.gnu.org/licenses
+ *
+ * Any non-GPL usage of this software or parts of this software is strictly
+ * forbidden.
+ *
+ */
+
+#ifdef NDEBUG
+#undef NDEBUG
+#endif
+#ifndef DEBUG
+#define DEBUG
+#endif
+
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <mutex>
+#include <thread>
+
+#include "buffer.h"
+#include "control.h"
+#include "flow.h"
+#include "key_string.h"
+#include "utils.h"
+
+static char optstr[] = "?f:";
+
+static const int kFrameNum = 50;
+static const size_t kFrameSize = 64 * 1024;
+static const int kFps = 50;
+
+static std::mutex received_mtx;
+static int received_num;
+static bool received_in_order;
+
+// count the input, whose first byte is the frame index
+class CountFlow : public easymedia::Flow {
+public:
+  CountFlow() {
+    easymedia::SlotMap sm;
+    sm.input_slots.push_back(0);
+    sm.thread_model = easymedia::Model::SYNC;
+    sm.mode_when_full = easymedia::InputMode::DROPFRONT;
+    sm.process = count;
+    if (!InstallSlotMap(sm, "count", -1))
+      SetError(-EINVAL);
+  }
+  virtual ~CountFlow() { StopAllThread(); }
+
+private:
+  static bool count(easymedia::Flow *f _UNUSED,
+                    easymedia::MediaBufferVector &input_vector) {
+    auto &buffer = input_vector[0];
+    if (!buffer)
+      return true;
+    std::lock_guard<std::mutex> _lg(received_mtx);
+    uint8_t *ptr = static_cast<uint8_t *>(buffer->GetPtr());
+    if (buffer->GetValidSize() != kFrameSize || ptr[0] != received_num)
+      received_in_order = false;
+    received_num++;
+    return true;
+  }
+};
+
+// Write the frames, stall stall_ms after every 10 frames. Written to a fifo,
+// it is a throttled device for the reader.
+static bool write_frames(const char *path, int stall_ms) {
+  FILE *f = fopen(path, "wb");
+  if (!f)
+    return false;
+  std::vector<uint8_t> frame(kFrameSize);
+  for (int i = 0; i < kFrameNum; i++) {
+    if (stall_ms > 0 && i > 0 && i % 10 == 0)
+      easymedia::msleep(stall_ms);
+    memset(frame.data(), i, frame.size());
+    if (fwrite(frame.data(), 1, frame.size(), f) != frame.size()) {
+      fclose(f);
+      return false;
+    }
+  }
+  fclose(f);
+  return true;
+}
+
+// Replay the frames of path. Without hints, path is a fifo fed by a device
+// which stalls 150ms every 10 frames.
+static easymedia::FileReadStats replay(const std::string &path,
+                                       int read_ahead, bool hints) {
+  std::thread *device = nullptr;
+  if (!hints) {
+    // the open blocks until both ends are opened
+    device = new std::thread([path] {
+      assert(write_frames(path.c_str(), 150));
+    });
+  }
+  std::string param;
+  PARAM_STRING_APPEND(param, KEY_PATH, path);
+  PARAM_STRING_APPEND(param, KEY_OPEN_MODE, "re");
+  PARAM_STRING_APPEND_TO(param, KEY_MEM_SIZE_PERTIME, kFrameSize);
+  PARAM_STRING_APPEND_TO(param, KEY_FPS, kFps);
+  PARAM_STRING_APPEND_TO(param, KEY_READ_AHEAD, read_ahead);
+  if (hints) {
+    PARAM_STRING_APPEND_TO(param, KEY_DROP_BEHIND, 1);
+    PARAM_STRING_APPEND_TO(param, KEY_WILLNEED_SIZE, 4 * kFrameSize);
+  }
+  auto flow = easymedia::REFLECTOR(Flow)::Create<easymedia::Flow>(
+      "file_read_flow", param.c_str());
+  assert(flow && flow->GetError() == 0);
+  auto sink = std::make_shared<CountFlow>();
+  received_num = 0;
+  received_in_order = true;
+  assert(flow->AddDownFlow(sink, 0, 0));
+  for (int i = 0; i < 500; i++) {
+    {
+      std::lock_guard<std::mutex> _lg(received_mtx);
+      if (received_num == kFrameNum)
+        break;
+    }
+    easymedia::msleep(10);
+  }
+  easymedia::FileReadStats stats;
+  assert(!flow->Control(easymedia::G_FILE_READ_STATS, &stats));
+  flow->RemoveDownFlow(sink);
+  flow.reset();
+  if (device) {
+    device->join();
+    delete device;
+  }
+  assert(received_num == kFrameNum && received_in_order);
+  assert(stats.frames == kFrameNum && stats.bytes == kFrameNum * kFrameSize);
+  printf("read_ahead %d: %llu B/s, max read %lld us, jitter avg %lld us max "
+         "%lld us, %llu late, %llu underruns\n",
+         read_ahead, (unsigned long long)stats.bytes_per_second,
+         (long long)stats.max_read_us, (long long)stats.avg_jitter_us,
+         (long long)stats.max_jitter_us, (unsigned long long)stats.late_frames,
+         (unsigned long long)stats.underruns);
+  return stats;
+}
+
+int main(int argc, char **argv) {
+  int c;
+  std::string path = "/tmp/file_read_flow_test.bin";
+
+  opterr = 1;
+  while ((c = getopt(argc, argv, optstr)) != -1) {
+    switch (c) {
+    case 'f':
+      path = optarg;
+      break;
+    case '?':
+    default:
+      printf("usage: %s [-f tmp file]\n", argv[0]);
+      exit(0);
+    }
+  }
+  // a file with page cache hints
+  assert(write_frames(path.c_str(), 0));
+  auto stats = replay(path, 4, true);
+  assert(stats.late_frames == 0);
+  unlink(path.c_str());
+
+  // the stalls reach the output
+  std::string fifo = path + ".fifo";
+  unlink(fifo.c_str());
+  assert(!mkfifo(fifo.c_str(), 0600));
+  stats = replay(fifo, 0, false);
+  assert(stats.max_read_us >= 100000);
+  assert(stats.late_frames > 0 && stats.max_jitter_us >= 1000000 / kFps);
+
+  // hidden by reading ahead
+  stats = replay(fifo, 10, false);
+  assert(stats.max_read_us >= 100000);
+  assert(stats.late_frames == 0 && stats.max_jitter_us < 1000000 / kFps);
+
+  unlink(fifo.c_str());
+  printf("file read flow test ok\n");
+  return 0;
+}
@@ -0,0 +1,145 @@
+/*
+ * Copyright (C) 2017 Hertz Wang 1989wanghang@163.com
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see http://www.gnu.org/licenses
+ *
+ * Any non-GPL usage of this software or parts of this software is strictly
+ * forbidden.
+ *
+ */
+
+#ifdef NDEBUG
+#undef NDEBUG
+#endif
+#ifndef DEBUG
+#define DEBUG
+#endif
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <vector>
+
+#include "buffer.h"
+#include "flow.h"
+#include "utils.h"
+
+static char optstr[] = "?n:l:";
+
+static volatile int64_t received = 0;
+
+// pass the input to the output, or count it if it is the last
+class HopFlow : public easymedia::Flow {
+public:
+  HopFlow(bool last, easymedia::LockType output_lock,
+          easymedia::LockType input_lock = easymedia::LockType::NONE) {
+    easymedia::SlotMap sm;
+    sm.input_slots.push_back(0);
+    if (!last)
+      sm.output_slots.push_back(0);
+    if (input_lock == easymedia::LockType::NONE) {
+      sm.thread_model = easymedia::Model::SYNC;
+      sm.mode_when_full = easymedia::InputMode::DROPFRONT;
+    } else {
+      sm.thread_model = easymedia::Model::ASYNCCOMMON;
+      sm.mode_when_full = easymedia::InputMode::BLOCKING;
+      sm.input_maxcachenum.push_back(16);
+      sm.input_lock = input_lock;
+    }
+    sm.process = last ? count : easymedia::Flow::void_transaction00;
+    sm.output_lock = output_lock;
+    if (!InstallSlotMap(sm, "hop", -1))
+      SetError(-EINVAL);
+  }
+  virtual ~HopFlow() { StopAllThread(); }
+
+private:
+  static bool count(easymedia::Flow *f _UNUSED,
+                    easymedia::MediaBufferVector &input_vector) {
+    if (input_vector[0])
+      received++;
+    return true;
+  }
+};
+
+// the chain is only linked and removed while no buffer flows, so the
+// down flow lists may go without lock
+static void run_chain(int length, int loops, easymedia::LockType output_lock,
+                      easymedia::LockType input_lock, const char *lock_name) {
+  std::vector<std::shared_ptr<HopFlow>> chain;
+  for (int i = 0; i < length; i++) {
+    auto flow =
+        std::make_shared<HopFlow>(i == length - 1, output_lock, input_lock);
+    assert(flow && flow->GetError() == 0);
+    if (!chain.empty())
+      assert(chain.back()->AddDownFlow(flow, 0, 0));
+    chain.push_back(flow);
+  }
+
+  auto buffer = easymedia::MediaBuffer::Alloc(64);
+  assert(buffer);
+  received = 0;
+  int64_t start = easymedia::gettimeofday();
+  for (int i = 0; i < loops; i++) {
+    std::shared_ptr<easymedia::MediaBuffer> in = buffer;
+    chain.front()->SendInput(in, 0);
+  }
+  // async flows block when full, nothing is dropped
+  while (received < loops)
+    easymedia::msleep(1);
+  int64_t cost = easymedia::gettimeofday() - start;
+  assert(received == loops);
+  printf("%s chain of %d flows, %s lock: %.1f ns/buffer, %.1f ns/hop\n",
+         input_lock == easymedia::LockType::NONE ? "sync" : "async", length,
+         lock_name, cost * 1000.0 / loops, cost * 1000.0 / loops / length);
+
+  for (size_t i = 0; i + 1 < chain.size(); i++)
+    chain[i]->RemoveDownFlow(chain[i + 1]);
+}
+
+int main(int argc, char **argv) {
+  int c;
+  int loops = 200000;
+  int length = 8;
+
+  opterr = 1;
+  while ((c = getopt(argc, argv, optstr)) != -1) {
+    switch (c) {
+    case 'n':
+      loops = atoi(optarg);
+      break;
+    case 'l':
+      length = atoi(optarg);
+      break;
+    case '?':
+    default:
+      printf("usage: %s [-n buffers] [-l chain length]\n", argv[0]);
+      exit(0);
+    }
+  }
+  assert(length >= 1);
+
+  run_chain(length, loops, easymedia::LockType::SPIN, easymedia::LockType::NONE,
+            "spin output");
+  run_chain(length, loops, easymedia::LockType::NONE, easymedia::LockType::NONE,
+            "no output");
+  // the queue between the threads, fewer buffers as each hop switches thread
+  run_chain(length, loops / 100, easymedia::LockType::NONE,
+            easymedia::LockType::CONDITION, "condition input");
+  run_chain(length, loops / 100, easymedia::LockType::NONE,
+            easymedia::LockType::ADAPTIVE, "adaptive input");
+  return 0;
+}
@@ -0,0 +1,164 @@
+/*
+ * Copyright (C) 2017 Hertz Wang 1989wanghang@163.com
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see http://www.gnu.org/licenses
+ *
+ * Any non-GPL usage of this software or parts of this software is strictly
+ * forbidden.
+ *
+ */
+
+#ifdef NDEBUG
+#undef NDEBUG
+#endif
+#ifndef DEBUG
+#define DEBUG
+#endif
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <string>
+#include <vector>
+
+#include "buffer.h"
+#include "image.h"
+#include "key_string.h"
+#include "stream.h"
+#include "utils.h"
+
+static char optstr[] = "?f:";
+
+// the derived layout packs the planes by vir_width and vir_height
+static void test_derived_layout() {
+  ImagePlane planes[IMAGE_MAX_PLANES];
+  ImageInfo nv12 = {PIX_FMT_NV12, 30, 20, 32, 32, 0, {}};
+  assert(GetImagePlaneLayout(nv12, planes) == 2);
+  assert(planes[0].offset == 0 && planes[0].stride == 32);
+  assert(planes[1].offset == 32 * 32 && planes[1].stride == 32);
+  assert(CalPixFmtSize(nv12) == 32 * 32 * 3 / 2);
+
+  ImageInfo i420 = {PIX_FMT_YUV420P, 32, 16, 32, 16, 0, {}};
+  assert(GetImagePlaneLayout(i420, planes) == 3);
+  assert(planes[1].offset == 512 && planes[1].stride == 16);
+  assert(planes[2].offset == 512 + 16 * 8 && planes[2].stride == 16);
+
+  ImageInfo rgb = {PIX_FMT_RGB888, 10, 10, 16, 16, 0, {}};
+  assert(GetImagePlaneLayout(rgb, planes) == 1);
+  assert(planes[0].offset == 0 && planes[0].stride == 16 * 3);
+
+  int row_bytes = 0, rows = 0;
+  assert(GetPixFmtPlaneSize(PIX_FMT_YUV422P, 2, 32, 16, row_bytes, rows));
+  assert(row_bytes == 16 && rows == 16);
+  assert(!GetPixFmtPlaneSize(PIX_FMT_NV12, 2, 32, 16, row_bytes, rows));
+  assert(GetPixFmtPlaneNum(PIX_FMT_NONE) == 0);
+}
+
+// 16x8 nv12 with a 64 bytes stride and the uv plane at 4096, like a
+// dma-buf from another device
+static ImageInfo explicit_nv12() {
+  ImageInfo info = {PIX_FMT_NV12, 16, 8, 16, 8, 2, {{0, 64}, {4096, 64}}};
+  return info;
+}
+
+static void test_explicit_layout() {
+  ImageInfo info = explicit_nv12();
+  ImagePlane planes[IMAGE_MAX_PLANES];
+  assert(GetImagePlaneLayout(info, planes) == 2);
+  assert(planes[1].offset == 4096 && planes[1].stride == 64);
+  // the end of the last row of the last plane
+  assert(CalPixFmtSize(info) == 4096 + 64 * 4);
+
+  auto mb = easymedia::MediaBuffer::Alloc(CalPixFmtSize(info));
+  assert(mb);
+  easymedia::ImageBuffer image(*mb, info);
+  assert(image.GetValidSize() == (size_t)CalPixFmtSize(info));
+  assert(image.GetPlaneLayout(planes) == 2 && planes[1].offset == 4096);
+
+  std::string param = easymedia::to_param_string(info);
+  std::string expect = std::string(KEY_BUFFER_PLANE_LAYOUT) + "=0:64,4096:64";
+  assert(param.find(expect) != std::string::npos);
+  ImageInfo derived = {PIX_FMT_NV12, 16, 8, 16, 8, 0, {}};
+  param = easymedia::to_param_string(derived);
+  assert(param.find(KEY_BUFFER_PLANE_LAYOUT) == std::string::npos);
+}
+
+static std::shared_ptr<easymedia::Stream> open_stream(const std::string &path,
+                                                      bool write) {
+  std::string param;
+  PARAM_STRING_APPEND(param, KEY_PATH, path);
+  PARAM_STRING_APPEND(param, KEY_OPEN_MODE, write ? "we" : "re");
+  auto stream = easymedia::REFLECTOR(Stream)::Create<easymedia::Stream>(
+      write ? "file_write_stream" : "file_read_stream", param.c_str());
+  assert(stream);
+  return stream;
+}
+
+// the rows move between the packed file and the explicit planes
+static void test_explicit_stream(const std::string &path) {
+  ImageInfo info = explicit_nv12();
+  std::vector<uint8_t> packed(16 * 8 * 3 / 2);
+  for (size_t i = 0; i < packed.size(); i++)
+    packed[i] = (uint8_t)(i * 7);
+  auto writer = open_stream(path, true);
+  assert(writer->Write(packed.data(), 1, packed.size()) == packed.size());
+  writer.reset();
+
+  std::vector<uint8_t> mem(CalPixFmtSize(info), 0xFF);
+  auto reader = open_stream(path, false);
+  assert(reader->ReadImage(mem.data(), info));
+  reader.reset();
+  for (int r = 0; r < 8; r++)
+    assert(!memcmp(&mem[r * 64], &packed[r * 16], 16) && mem[r * 64 + 16]);
+  for (int r = 0; r < 4; r++)
+    assert(!memcmp(&mem[4096 + r * 64], &packed[128 + r * 16], 16));
+
+  writer = open_stream(path, true);
+  assert(writer->WriteImage(mem.data(), info));
+  writer.reset();
+  std::vector<uint8_t> back(packed.size() + 1);
+  FILE *f = fopen(path.c_str(), "r");
+  assert(f);
+  assert(fread(back.data(), 1, back.size(), f) == packed.size());
+  fclose(f);
+  assert(!memcmp(back.data(), packed.data(), packed.size()));
+  unlink(path.c_str());
+}
+
+int main(int argc, char **argv) {
+  int c;
+  std::string path = "/tmp/image_layout_test.yuv";
+
+  opterr = 1;
+  while ((c = getopt(argc, argv, optstr)) != -1) {
+    switch (c) {
+    case 'f':
+      path = optarg;
+      break;
+    case '?':
+    default:
+      printf("usage: %s [-f tmp file]\n", argv[0]);
+      exit(0);
+    }
+  }
+
+  test_derived_layout();
+  test_explicit_layout();
+  test_explicit_stream(path);
+  printf("image layout test ok\n");
+  return 0;
+}
@@ -0,0 +1,137 @@
+/*
+ * Copyright (C) 2017 Hertz Wang 1989wanghang@163.com
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see http://www.gnu.org/licenses
+ *
+ * Any non-GPL usage of this software or parts of this software is strictly
+ * forbidden.
+ *
+ */
+
+#ifdef NDEBUG
+#undef NDEBUG
+#endif
+#ifndef DEBUG
+#define DEBUG
+#endif
+
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <vector>
+
+#include "key_string.h"
+#include "stream.h"
+#include "utils.h"
+
+static char optstr[] = "?f:";
+
+static std::shared_ptr<easymedia::Stream> open_stream(const std::string &path,
+                                                      bool write) {
+  std::string param;
+  PARAM_STRING_APPEND(param, KEY_PATH, path);
+  PARAM_STRING_APPEND(param, KEY_OPEN_MODE, write ? "we" : "re");
+  auto stream = easymedia::REFLECTOR(Stream)::Create<easymedia::Stream>(
+      write ? "file_write_stream" : "file_read_stream", param.c_str());
+  assert(stream);
+  return stream;
+}
+
+// Write a padded image, read it back into another padded image and compare
+// the valid rows. Return the packed size in file.
+static size_t check_format(const std::string &path, PixelFormat fmt, int w,
+                           int h, int pad_w, int pad_h) {
+  ImageInfo info = {fmt, w, h, w + pad_w, h + pad_h, 0, {}};
+  size_t size = CalPixFmtSize(info);
+  std::vector<uint8_t> src(size), dst(size, 0);
+  for (size_t i = 0; i < size; i++)
+    src[i] = (uint8_t)(i * 7 + (i >> 12));
+  auto writer = open_stream(path, true);
+  assert(writer->WriteImage(src.data(), info));
+  writer.reset();
+
+  auto reader = open_stream(path, false);
+  assert(reader->ReadImage(dst.data(), info));
+  size_t packed = reader->Tell();
+  assert(!reader->ReadImage(dst.data(), info) && reader->Eof());
+  reader.reset();
+
+  ImagePlane planes[IMAGE_MAX_PLANES];
+  int plane_num = GetImagePlaneLayout(info, planes);
+  size_t expect = 0;
+  for (int i = 0; i < plane_num; i++) {
+    int row_bytes = 0, rows = 0;
+    assert(GetPixFmtPlaneSize(fmt, i, w, h, row_bytes, rows));
+    for (int r = 0; r < rows; r++) {
+      size_t offset = planes[i].offset + r * planes[i].stride;
+      assert(!memcmp(&src[offset], &dst[offset], row_bytes));
+      // the padding is not touched
+      if (planes[i].stride > row_bytes)
+        assert(dst[offset + row_bytes] == 0);
+    }
+    expect += (size_t)row_bytes * rows;
+  }
+  assert(packed == expect);
+  return packed;
+}
+
+int main(int argc, char **argv) {
+  int c;
+  std::string path = "/tmp/image_stream_test.bin";
+
+  opterr = 1;
+  while ((c = getopt(argc, argv, optstr)) != -1) {
+    switch (c) {
+    case 'f':
+      path = optarg;
+      break;
+    case '?':
+    default:
+      printf("usage: %s [-f tmp file]\n", argv[0]);
+      exit(0);
+    }
+  }
+
+  for (int fmt = PIX_FMT_YUV420P; fmt < PIX_FMT_JPEG; fmt++) {
+    // with and without padding
+    check_format(path, (PixelFormat)fmt, 64, 36, 16, 4);
+    check_format(path, (PixelFormat)fmt, 64, 36, 0, 0);
+  }
+
+  // 4K nv12 with padded stride, rows by Read against one ReadV
+  const int w = 3840, h = 2160;
+  ImageInfo info = {PIX_FMT_NV12, w, h, w + 64, h, 0, {}};
+  size_t packed = check_format(path, PIX_FMT_NV12, w, h, 64, 0);
+  std::vector<uint8_t> frame(CalPixFmtSize(info));
+  auto reader = open_stream(path, false);
+  int64_t start = easymedia::gettimeofday();
+  for (int r = 0; r < h * 3 / 2; r++)
+    assert(reader->Read(&frame[r * info.vir_width], 1, w) == (size_t)w);
+  int64_t row_cost = easymedia::gettimeofday() - start;
+  assert((size_t)reader->Tell() == packed);
+  reader->Seek(0, SEEK_SET);
+  start = easymedia::gettimeofday();
+  assert(reader->ReadImage(frame.data(), info));
+  int64_t vector_cost = easymedia::gettimeofday() - start;
+  printf("4K nv12: %d row reads in %lld us, one vectored read in %lld us\n",
+         h * 3 / 2, (long long)row_cost, (long long)vector_cost);
+
+  unlink(path.c_str());
+  printf("image stream test ok\n");
+  return 0;
+}
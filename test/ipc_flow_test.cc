@@ -0,0 +1,280 @@
+/*
+ * Copyright (C) 2017 Hertz Wang 1989wanghang@163.com
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see http://www.gnu.org/licenses
+ *
+ * Any non-GPL usage of this software or parts of this software is strictly
+ * forbidden.
+ *
+ */
+
+#ifdef NDEBUG
+#undef NDEBUG
+#endif
+#ifndef DEBUG
+#define DEBUG
+#endif
+
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <linux/memfd.h>
+
+#include <mutex>
+
+#include "buffer.h"
+#include "control.h"
+#include "flow.h"
+#include "key_string.h"
+#include "utils.h"
+
+static char optstr[] = "?";
+
+static std::mutex received_mtx;
+static std::vector<std::shared_ptr<easymedia::MediaBuffer>> received;
+
+// keep all the input
+class CollectFlow : public easymedia::Flow {
+public:
+  CollectFlow() {
+    easymedia::SlotMap sm;
+    sm.input_slots.push_back(0);
+    sm.thread_model = easymedia::Model::SYNC;
+    sm.mode_when_full = easymedia::InputMode::DROPFRONT;
+    sm.process = collect;
+    if (!InstallSlotMap(sm, "collect", -1))
+      SetError(-EINVAL);
+  }
+  virtual ~CollectFlow() { StopAllThread(); }
+
+private:
+  static bool collect(easymedia::Flow *f _UNUSED,
+                      easymedia::MediaBufferVector &input_vector) {
+    if (input_vector[0]) {
+      std::lock_guard<std::mutex> _lg(received_mtx);
+      received.push_back(input_vector[0]);
+    }
+    return true;
+  }
+};
+
+static size_t received_num() {
+  std::lock_guard<std::mutex> _lg(received_mtx);
+  return received.size();
+}
+
+static void clear_received() {
+  std::lock_guard<std::mutex> _lg(received_mtx);
+  received.clear();
+}
+
+static easymedia::IpcSinkStats sink_stats(std::shared_ptr<easymedia::Flow> &sink) {
+  easymedia::IpcSinkStats stats;
+  assert(!sink->Control(easymedia::G_IPC_SINK_STATS, &stats));
+  return stats;
+}
+
+// wait at most 2s
+#define WAIT_UNTIL(cond)                                                       \
+  do {                                                                         \
+    for (int i = 0; i < 200 && !(cond); i++)                                   \
+      easymedia::msleep(10);                                                   \
+    assert(cond);                                                              \
+  } while (0)
+
+static std::shared_ptr<easymedia::Flow> create_source(const std::string &path) {
+  std::string param;
+  PARAM_STRING_APPEND(param, KEY_PATH, path);
+  PARAM_STRING_APPEND_TO(param, KEY_IPC_RETRY_MS, 20);
+  auto source =
+      easymedia::REFLECTOR(Flow)::Create<easymedia::Flow>("ipc_source",
+                                                          param.c_str());
+  assert(source && source->GetError() == 0);
+  return source;
+}
+
+static std::shared_ptr<easymedia::MediaBuffer> new_image(int64_t ts) {
+  ImageInfo info = {PIX_FMT_NV12, 64, 48, 64, 48, 0, {}};
+  auto mb = easymedia::MediaBuffer::Alloc2(CalPixFmtSize(info));
+  memset(mb.GetPtr(), ts & 0xFF, mb.GetSize());
+  auto img = std::make_shared<easymedia::ImageBuffer>(mb, info);
+  img->SetValidSize(CalPixFmtSize(info));
+  img->SetUSTimeStamp(ts);
+  img->SetUserFlag(easymedia::MediaBuffer::kExtraIntra);
+  return img;
+}
+
+static int release_memfd(void *arg) {
+  auto *mb = static_cast<easymedia::MediaBuffer *>(arg);
+  munmap(mb->GetPtr(), mb->GetSize());
+  close(mb->GetFD());
+  delete mb;
+  return 0;
+}
+
+// a buffer of fd, whose data is at fd offset 4096
+static std::shared_ptr<easymedia::MediaBuffer> new_fd_buffer(int64_t ts) {
+  const size_t size = 8192;
+  int fd = syscall(__NR_memfd_create, "ipc_test", MFD_CLOEXEC);
+  assert(fd >= 0 && !ftruncate(fd, size));
+  void *ptr = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  assert(ptr != MAP_FAILED);
+  memset(static_cast<char *>(ptr) + 4096, 0x5A, 4096);
+  auto *hold = new easymedia::MediaBuffer(ptr, size, fd);
+  easymedia::MediaBuffer mb(static_cast<char *>(ptr) + 4096, 4096, fd, hold,
+                            release_memfd);
+  mb.SetFDOffset(4096);
+  auto buffer = std::make_shared<easymedia::MediaBuffer>(mb);
+  buffer->SetValidSize(4096);
+  buffer->SetUSTimeStamp(ts);
+  buffer->SetType(Type::Video);
+  return buffer;
+}
+
+int main(int argc, char **argv) {
+  int c;
+
+  opterr = 1;
+  while ((c = getopt(argc, argv, optstr)) != -1) {
+    switch (c) {
+    case '?':
+    default:
+      printf("usage: %s\n", argv[0]);
+      exit(0);
+    }
+  }
+
+  std::string path = "@easymedia_ipc_test_" + std::to_string(getpid());
+  std::string param;
+  PARAM_STRING_APPEND(param, KEY_PATH, path);
+  PARAM_STRING_APPEND_TO(param, KEY_IPC_RING_SIZE, 64 * 1024);
+  PARAM_STRING_APPEND_TO(param, KEY_IPC_MAX_FRAMES, 4);
+  auto sink = easymedia::REFLECTOR(Flow)::Create<easymedia::Flow>(
+      "ipc_sink", param.c_str());
+  assert(sink && sink->GetError() == 0);
+  auto collect = std::make_shared<CollectFlow>();
+  assert(collect->GetError() == 0);
+
+  // nobody connected, frames are not queued
+  auto buffer = new_image(1);
+  sink->SendInput(buffer, 0);
+  assert(sink_stats(sink).inflight_frames == 0);
+
+  auto source = create_source(path);
+  assert(source->AddDownFlow(collect, 0, 0));
+  WAIT_UNTIL(sink_stats(sink).connected);
+
+  // common memory through the ring
+  buffer = new_image(1000);
+  sink->SendInput(buffer, 0);
+  WAIT_UNTIL(received_num() == 1);
+  {
+    auto out = std::static_pointer_cast<easymedia::ImageBuffer>(received[0]);
+    assert(out->GetType() == Type::Image);
+    assert(out->GetPixelFormat() == PIX_FMT_NV12);
+    assert(out->GetWidth() == 64 && out->GetVirHeight() == 48);
+    assert(out->GetValidSize() == buffer->GetValidSize());
+    assert(out->GetUSTimeStamp() == 1000);
+    assert(out->GetUserFlag() == easymedia::MediaBuffer::kExtraIntra);
+    assert(out->IsReadOnly() && out->GetFD() < 0);
+    assert(!memcmp(out->GetPtr(), buffer->GetPtr(), out->GetValidSize()));
+  }
+
+  // fd without copy
+  buffer = new_fd_buffer(2000);
+  sink->SendInput(buffer, 0);
+  WAIT_UNTIL(received_num() == 2);
+  {
+    auto out = received[1];
+    assert(out->GetType() == Type::Video);
+    assert(out->GetFD() >= 0 && out->GetFD() != buffer->GetFD());
+    assert(out->GetFDOffset() == 4096 && out->GetValidSize() == 4096);
+    assert(out->GetUSTimeStamp() == 2000);
+    assert(!memcmp(out->GetPtr(), buffer->GetPtr(), 4096));
+  }
+  easymedia::IpcSinkStats stats = sink_stats(sink);
+  assert(stats.inflight_frames == 2 && stats.ring_used_bytes > 0);
+  // the source keeps its last output until the next one
+  clear_received();
+  WAIT_UNTIL(sink_stats(sink).inflight_frames == 1);
+
+  // a slow consumer holds the buffers, the producer drops instead of waiting.
+  // one more may be released when the source replaces its last output
+  int64_t start = easymedia::gettimeofday();
+  for (int i = 0; i < 10; i++) {
+    buffer = new_image(3000 + i);
+    sink->SendInput(buffer, 0);
+  }
+  int64_t cost = easymedia::gettimeofday() - start;
+  stats = sink_stats(sink);
+  printf("10 frames sent in %lld us, %d in flight, %llu dropped\n",
+         (long long)cost, stats.inflight_frames,
+         (unsigned long long)stats.dropped_frames);
+  assert(stats.inflight_frames == 4 && stats.dropped_frames >= 6);
+  WAIT_UNTIL(received_num() + stats.dropped_frames == 10);
+
+  // the consumer goes away with the buffers held
+  source.reset();
+  WAIT_UNTIL(!sink_stats(sink).connected);
+  assert(sink_stats(sink).inflight_frames == 0);
+  start = easymedia::gettimeofday();
+  buffer = new_image(4000);
+  sink->SendInput(buffer, 0);
+  assert(easymedia::gettimeofday() - start < 100000);
+  // release after disconnected
+  clear_received();
+
+  // restarted consumer
+  source = create_source(path);
+  assert(source->AddDownFlow(collect, 0, 0));
+  WAIT_UNTIL(sink_stats(sink).connected);
+  buffer = new_image(5000);
+  sink->SendInput(buffer, 0);
+  WAIT_UNTIL(received_num() == 1);
+  assert(received[0]->GetUSTimeStamp() == 5000);
+  clear_received();
+
+  // a replaced consumer which is still alive keeps its data
+  buffer = new_image(6000);
+  sink->SendInput(buffer, 0);
+  WAIT_UNTIL(received_num() == 1);
+  auto held = received[0];
+  clear_received();
+  source.reset(); // the connection lives with held
+  source = create_source(path);
+  assert(source->AddDownFlow(collect, 0, 0));
+  WAIT_UNTIL(sink_stats(sink).inflight_frames == 0);
+  WAIT_UNTIL(sink_stats(sink).connected);
+  for (int n = 0; n < 20; n++) {
+    buffer = new_image(7000 + n);
+    sink->SendInput(buffer, 0);
+    WAIT_UNTIL(received_num() == 1);
+    clear_received();
+  }
+  const uint8_t *p = static_cast<const uint8_t *>(held->GetPtr());
+  for (size_t i = 0; i < held->GetValidSize(); i++)
+    assert(p[i] == (6000 & 0xFF));
+  held.reset();
+
+  source.reset();
+  sink.reset();
+  printf("ipc flow test ok\n");
+  return 0;
+}
@@ -0,0 +1,171 @@
+/*
+ * Copyright (C) 2017 Hertz Wang 1989wanghang@163.com
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see http://www.gnu.org/licenses
+ *
+ * Any non-GPL usage of this software or parts of this software is strictly
+ * forbidden.
+ *
+ */
+
+#ifdef NDEBUG
+#undef NDEBUG
+#endif
+#ifndef DEBUG
+#define DEBUG
+#endif
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <deque>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include "lock.h"
+#include "utils.h"
+
+static char optstr[] = "?n:t:w:";
+
+// shared data of the critical section, padded from the lock
+struct Shared {
+  char pad0[64];
+  volatile int64_t counter;
+  char pad1[64];
+};
+
+static void contend(easymedia::LockMutex *lm, Shared *shared, int loops,
+                    int work) {
+  for (int i = 0; i < loops; i++) {
+    easymedia::AutoLockMutex _alm(*lm);
+    for (int j = 0; j <= work; j++)
+      shared->counter = shared->counter + 1;
+  }
+}
+
+static void bench(const char *name, easymedia::LockMutex *lm, int threads,
+                  int loops, int work) {
+  Shared shared;
+  shared.counter = 0;
+  std::vector<std::thread> ths;
+  int64_t start = easymedia::gettimeofday();
+  for (int i = 0; i < threads; i++)
+    ths.emplace_back(contend, lm, &shared, loops, work);
+  for (auto &th : ths)
+    th.join();
+  int64_t cost = easymedia::gettimeofday() - start;
+  int64_t ops = (int64_t)threads * loops;
+  assert(shared.counter == ops * (work + 1));
+  printf("%-12s threads %d: %8.1f ns/op, %8.2f Mops/s\n", name, threads,
+         cost * 1000.0 / ops, cost > 0 ? (double)ops / cost : 0.0);
+}
+
+// producer/consumer through wait/notify, like the flow input queue
+static void check_waitable(easymedia::LockMutex *lm, int loops) {
+  std::deque<int> queue;
+  bool quit = false;
+  std::thread consumer([&] {
+    int expect = 0;
+    easymedia::AutoLockMutex _alm(*lm);
+    while (expect < loops) {
+      while (queue.empty())
+        lm->wait();
+      assert(queue.front() == expect);
+      queue.pop_front();
+      expect++;
+    }
+    quit = true;
+  });
+  for (int i = 0; i < loops; i++) {
+    easymedia::AutoLockMutex _alm(*lm);
+    queue.push_back(i);
+    lm->notify();
+  }
+  consumer.join();
+  assert(quit);
+  lm->lock();
+  int64_t start = easymedia::gettimeofday();
+  assert(!lm->timedwait(20));
+  assert(easymedia::gettimeofday() - start >= 20000);
+  lm->unlock();
+}
+
+int main(int argc, char **argv) {
+  int c;
+  int loops = 200000;
+  int max_threads = 8;
+  int work = 0;
+
+  opterr = 1;
+  while ((c = getopt(argc, argv, optstr)) != -1) {
+    switch (c) {
+    case 'n':
+      loops = atoi(optarg);
+      break;
+    case 't':
+      max_threads = atoi(optarg);
+      break;
+    case 'w':
+      work = atoi(optarg);
+      break;
+    case '?':
+    default:
+      printf("usage: %s [-n loops per thread] [-t max threads] "
+             "[-w critical section work]\n",
+             argv[0]);
+      exit(0);
+    }
+  }
+
+  easymedia::AdaptiveLockMutex adaptive;
+  check_waitable(&adaptive, 10000);
+  assert(adaptive.try_lock());
+  std::thread th([&] {
+    assert(!adaptive.try_lock());
+    assert(!adaptive.timedlock(10));
+  });
+  th.join();
+  adaptive.unlock();
+  easymedia::ConditionLockMutex condition;
+  check_waitable(&condition, 10000);
+
+  for (int threads = 1; threads <= max_threads; threads *= 2) {
+    // not thread safe, the baseline of single thread
+    if (threads == 1) {
+      easymedia::NonLockMutex lm;
+      bench("none", &lm, threads, loops, work);
+    }
+    {
+      easymedia::SpinLockMutex lm;
+      bench("spin", &lm, threads, loops, work);
+    }
+    {
+      easymedia::ReadWriteLockMutex lm;
+      bench("rwlock", &lm, threads, loops, work);
+    }
+    {
+      easymedia::ConditionLockMutex lm;
+      bench("condition", &lm, threads, loops, work);
+    }
+    {
+      easymedia::AdaptiveLockMutex lm;
+      bench("adaptive", &lm, threads, loops, work);
+    }
+  }
+
+  return 0;
+}
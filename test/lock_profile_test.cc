@@ -0,0 +1,163 @@
+/*
+ * Copyright (C) 2017 Hertz Wang 1989wanghang@163.com
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see http://www.gnu.org/licenses
+ *
+ * Any non-GPL usage of this software or parts of this software is strictly
+ * forbidden.
+ *
+ */
+
+#ifdef NDEBUG
+#undef NDEBUG
+#endif
+#ifndef DEBUG
+#define DEBUG
+#endif
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <sstream>
+#include <string>
+#include <thread>
+
+#include "lock.h"
+#include "utils.h"
+
+static char optstr[] = "?f:";
+
+static std::string log_path;
+
+// Run DumpLockStats() with stderr redirected, return what it printed.
+static std::string dump_lock_stats() {
+  fflush(stderr);
+  int saved = dup(STDERR_FILENO);
+  FILE *f = fopen(log_path.c_str(), "w+");
+  assert(saved >= 0 && f);
+  dup2(fileno(f), STDERR_FILENO);
+  easymedia::DumpLockStats();
+  fflush(stderr);
+  dup2(saved, STDERR_FILENO);
+  close(saved);
+  std::string log;
+  char buf[256];
+  rewind(f);
+  size_t n;
+  while ((n = fread(buf, 1, sizeof(buf), f)) > 0)
+    log.append(buf, n);
+  fclose(f);
+  unlink(log_path.c_str());
+  return log;
+}
+
+#ifdef LOCK_PROFILE
+struct Row {
+  std::string name;
+  unsigned long long acquire, contended;
+  long long wait_us, wait_max_us, hold_max_us;
+};
+
+// the row of name, its position in the table is returned in order
+static bool find_row(const std::string &log, const char *name, Row &row,
+                     int &order) {
+  std::istringstream in(log);
+  std::string line;
+  std::getline(in, line); // header
+  order = 0;
+  while (std::getline(in, line)) {
+    std::istringstream ls(line);
+    if ((ls >> row.name >> row.acquire >> row.contended >> row.wait_us >>
+         row.wait_max_us >> row.hold_max_us) &&
+        row.name == name)
+      return true;
+    order++;
+  }
+  return false;
+}
+#endif
+
+int main(int argc, char **argv) {
+  int c;
+  log_path = "/tmp/lock_profile_test.log";
+
+  opterr = 1;
+  while ((c = getopt(argc, argv, optstr)) != -1) {
+    switch (c) {
+    case 'f':
+      log_path = optarg;
+      break;
+    case '?':
+    default:
+      printf("usage: %s [-f tmp file]\n", argv[0]);
+      exit(0);
+    }
+  }
+
+  easymedia::AdaptiveLockMutex busy, busy2, idle, unnamed;
+  busy.SetName("lock_profile_busy");
+  // locks of the same name are accumulated together
+  busy2.SetName("lock_profile_busy");
+  idle.SetName("lock_profile_idle");
+
+  // holds busy for 50ms while the main thread waits for it
+  volatile bool locked = false;
+  std::thread holder([&] {
+    busy.lock();
+    locked = true;
+    easymedia::msleep(50);
+    busy.unlock();
+  });
+  while (!locked)
+    easymedia::msleep(1);
+  busy.lock();
+  busy.unlock();
+  holder.join();
+  busy2.lock();
+  busy2.unlock();
+  for (int i = 0; i < 10; i++) {
+    idle.lock();
+    idle.unlock();
+    unnamed.lock();
+    unnamed.unlock();
+  }
+
+  std::string log = dump_lock_stats();
+#ifdef LOCK_PROFILE
+  Row row;
+  int busy_order = 0, idle_order = 0;
+  assert(find_row(log, "lock_profile_busy", row, busy_order));
+  assert(row.acquire == 3 && row.contended == 1);
+  assert(row.wait_us >= 30000 && row.wait_max_us == row.wait_us);
+  assert(row.hold_max_us >= 40000);
+  assert(find_row(log, "lock_profile_idle", row, idle_order));
+  assert(row.acquire == 10 && row.contended == 0 && row.wait_us == 0);
+  // sorted by the total wait time
+  assert(busy_order < idle_order);
+
+  easymedia::ResetLockStats();
+  log = dump_lock_stats();
+  assert(find_row(log, "lock_profile_busy", row, busy_order));
+  assert(row.acquire == 0 && row.contended == 0 && row.hold_max_us == 0);
+#else
+  assert(log.find("lock profile is disabled") != std::string::npos);
+  easymedia::ResetLockStats();
+#endif
+
+  printf("lock profile test ok\n");
+  return 0;
+}
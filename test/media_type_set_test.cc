@@ -0,0 +1,111 @@
+/*
+ * Copyright (C) 2017 Hertz Wang 1989wanghang@163.com
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see http://www.gnu.org/licenses
+ *
+ * Any non-GPL usage of this software or parts of this software is strictly
+ * forbidden.
+ *
+ */
+
+#ifdef NDEBUG
+#undef NDEBUG
+#endif
+#ifndef DEBUG
+#define DEBUG
+#endif
+
+#include <assert.h>
+#include <stdio.h>
+
+#include <string>
+
+#include "key_string.h"
+#include "media_type.h"
+#include "stream.h"
+
+using easymedia::MediaTypeSet;
+
+static void test_ids() {
+  int id = MediaTypeSet::GetTypeId(IMAGE_NV12);
+  assert(id >= 0 && MediaTypeSet::GetTypeId(IMAGE_NV12) == id);
+  assert(MediaTypeSet::GetTypeName(id) == IMAGE_NV12);
+  assert(MediaTypeSet::GetTypeId(VIDEO_H264) != id);
+  assert(MediaTypeSet::GetTypeName(-1).empty());
+  assert(MediaTypeSet::GetTypeName(MediaTypeSet::kMaxTypes).empty());
+}
+
+static void test_sets() {
+  MediaTypeSet nothing = MediaTypeSet::FromString(TYPE_NOTHING);
+  MediaTypeSet anything = MediaTypeSet::FromString(TYPE_ANYTHING);
+  assert(nothing.IsNothing() && !nothing.IsAnything());
+  assert(anything.IsAnything() && !anything.IsNothing());
+  assert(MediaTypeSet().IsNothing());
+
+  // both separators, empty items are skipped
+  MediaTypeSet yuv = MediaTypeSet::FromString(IMAGE_NV12 "," IMAGE_YUV420P);
+  MediaTypeSet nv12 = MediaTypeSet::FromString(IMAGE_NV12 "\n\n");
+  MediaTypeSet h264 = MediaTypeSet::FromString(VIDEO_H264);
+  assert(yuv.ToString() == IMAGE_NV12 "," IMAGE_YUV420P ||
+         yuv.ToString() == IMAGE_YUV420P "," IMAGE_NV12);
+  assert(nv12.ToString() == IMAGE_NV12);
+
+  assert(yuv.Intersects(nv12) && nv12.Intersects(yuv));
+  assert(!yuv.Intersects(h264));
+  assert(yuv.Intersection(nv12).ToString() == IMAGE_NV12);
+  assert(yuv.Intersection(h264).IsNothing());
+
+  // anything matches all but nothing
+  assert(anything.Intersects(h264) && h264.Intersects(anything));
+  assert(anything.Intersects(anything));
+  assert(!anything.Intersects(nothing) && !nothing.Intersects(anything));
+  assert(!nothing.Intersects(nothing));
+  assert(anything.Intersection(yuv).ToString() == yuv.ToString());
+  assert(yuv.Intersection(anything).ToString() == yuv.ToString());
+  assert(anything.Intersection(anything).IsAnything());
+  assert(anything.ToString() == "<anything>");
+  assert(nothing.ToString() == "<nothing>");
+
+  MediaTypeSet set;
+  assert(set.Add(VIDEO_H264) && set.Intersects(h264));
+}
+
+// factories declaring TYPE_ANYTHING accept any concrete type
+static void test_factory_rules() {
+  // image to file, file to image
+  std::string nv12_rule, file_rule;
+  PARAM_STRING_APPEND(nv12_rule, KEY_INPUTDATATYPE, IMAGE_NV12);
+  PARAM_STRING_APPEND(nv12_rule, KEY_OUTPUTDATATYPE, STREAM_FILE);
+  PARAM_STRING_APPEND(file_rule, KEY_INPUTDATATYPE, STREAM_FILE);
+  PARAM_STRING_APPEND(file_rule, KEY_OUTPUTDATATYPE, IMAGE_NV12);
+  assert(easymedia::REFLECTOR(Stream)::IsMatch("file_write_stream",
+                                               nv12_rule.c_str()));
+  assert(!easymedia::REFLECTOR(Stream)::IsMatch("file_read_stream",
+                                                nv12_rule.c_str()));
+  assert(easymedia::REFLECTOR(Stream)::IsMatch("file_read_stream",
+                                               file_rule.c_str()));
+  // a missing key only matches a factory of TYPE_NOTHING
+  std::string input_rule;
+  PARAM_STRING_APPEND(input_rule, KEY_INPUTDATATYPE, IMAGE_NV12);
+  assert(!easymedia::REFLECTOR(Stream)::IsMatch("file_write_stream",
+                                                input_rule.c_str()));
+}
+
+int main() {
+  test_ids();
+  test_sets();
+  test_factory_rules();
+  printf("media type set test ok\n");
+  return 0;
+}
@@ -0,0 +1,125 @@
+/*
+ * Copyright (C) 2017 Hertz Wang 1989wanghang@163.com
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see http://www.gnu.org/licenses
+ *
+ * Any non-GPL usage of this software or parts of this software is strictly
+ * forbidden.
+ *
+ */
+
+#ifdef NDEBUG
+#undef NDEBUG
+#endif
+#ifndef DEBUG
+#define DEBUG
+#endif
+
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <thread>
+
+#include "buffer.h"
+#include "utils.h"
+
+using easymedia::MediaBuffer;
+using easymedia::MemoryStats;
+
+static const MediaBuffer::MemType kType = MediaBuffer::MemType::MEM_COMMON;
+static const size_t kMB = 1 << 20;
+
+// freed by the static destructors, after the account may be gone
+static std::shared_ptr<MediaBuffer> leftover;
+
+static MemoryStats stats() {
+  MemoryStats s;
+  easymedia::GetMemoryStats(kType, s);
+  return s;
+}
+
+int main() {
+  MemoryStats base = stats();
+
+  // current, count and peak follow the buffers
+  {
+    easymedia::AutoMemoryOwner _amo(easymedia::GetMemoryOwner("test"));
+    auto a = MediaBuffer::Alloc(kMB);
+    auto b = MediaBuffer::Alloc(2 * kMB);
+    assert(a && b);
+    MemoryStats s = stats();
+    assert(s.current == base.current + 3 * kMB);
+    assert(s.count == base.count + 2);
+    assert(s.peak >= s.current);
+    easymedia::DumpMemoryStats();
+  }
+  MemoryStats s = stats();
+  assert(s.current == base.current && s.count == base.count);
+  assert(s.peak >= base.current + 3 * kMB);
+
+  // fail at once over the limit
+  easymedia::SetMemoryLimit(kType, base.current + 2 * kMB, 0);
+  auto a = MediaBuffer::Alloc(kMB);
+  assert(a);
+  assert(!MediaBuffer::Alloc(2 * kMB));
+  s = stats();
+  assert(s.fail_times == base.fail_times + 1);
+  assert(s.limit == base.current + 2 * kMB);
+  assert(s.current == base.current + kMB);
+
+  // wait at most the timeout
+  easymedia::SetMemoryLimit(kType, base.current + 2 * kMB, 50);
+  int64_t begin = easymedia::gettimeofday();
+  assert(!MediaBuffer::Alloc(2 * kMB));
+  int64_t cost = easymedia::gettimeofday() - begin;
+  assert(cost >= 45000 && cost < 1000000);
+  assert(stats().fail_times == base.fail_times + 2);
+
+  // wait until enough memory is released
+  easymedia::SetMemoryLimit(kType, base.current + 2 * kMB, -1);
+  std::shared_ptr<MediaBuffer> b;
+  std::thread waiter([&b] { b = MediaBuffer::Alloc(2 * kMB); });
+  easymedia::msleep(100);
+  assert(!b && stats().current == base.current + kMB);
+  begin = easymedia::gettimeofday();
+  a.reset();
+  waiter.join();
+  assert(b && stats().current == base.current + 2 * kMB);
+  assert(easymedia::gettimeofday() - begin < 1000000);
+  b.reset();
+
+  // a request over the limit never fits, it fails without waiting
+  begin = easymedia::gettimeofday();
+  assert(!MediaBuffer::Alloc(base.current + 3 * kMB));
+  assert(easymedia::gettimeofday() - begin < 100000);
+  assert(stats().fail_times == base.fail_times + 3);
+
+  // raising the limit wakes the waiters too
+  a = MediaBuffer::Alloc(kMB);
+  std::thread waiter2([&b] { b = MediaBuffer::Alloc(2 * kMB); });
+  easymedia::msleep(50);
+  assert(!b);
+  easymedia::SetMemoryLimit(kType, 0);
+  waiter2.join();
+  assert(b && stats().limit == 0);
+  a.reset();
+  b.reset();
+
+  leftover = MediaBuffer::Alloc(kMB);
+  assert(leftover);
+  printf("memory account test ok\n");
+  return 0;
+}
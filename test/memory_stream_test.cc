@@ -0,0 +1,177 @@
+/*
+ * Copyright (C) 2017 Hertz Wang 1989wanghang@163.com
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see http://www.gnu.org/licenses
+ *
+ * Any non-GPL usage of this software or parts of this software is strictly
+ * forbidden.
+ *
+ */
+
+#ifdef NDEBUG
+#undef NDEBUG
+#endif
+#ifndef DEBUG
+#define DEBUG
+#endif
+
+#include <assert.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <thread>
+
+#include "stream.h"
+#include "utils.h"
+
+static char optstr[] = "?";
+
+static std::shared_ptr<easymedia::Stream>
+open_memory(const char *name, const char *mode, const char *mem_mode,
+            size_t capacity = 0, bool nonblock = false) {
+  std::string param;
+  PARAM_STRING_APPEND(param, KEY_MEMORY_NAME, name);
+  PARAM_STRING_APPEND(param, KEY_OPEN_MODE, mode);
+  PARAM_STRING_APPEND(param, KEY_MEMORY_MODE, mem_mode);
+  if (capacity)
+    PARAM_STRING_APPEND_TO(param, KEY_MEMORY_CAPACITY, capacity);
+  PARAM_STRING_APPEND_TO(param, KEY_NON_BLOCK, nonblock ? 1 : 0);
+  return easymedia::REFLECTOR(Stream)::Create<easymedia::Stream>(
+      "memory_stream", param.c_str());
+}
+
+static void test_buffer() {
+  auto s = open_memory("", "w+", KEY_MEMORY_BUFFER);
+  assert(s && s->Readable() && s->Writeable() && s->Seekable());
+  // through the c operations, as the demuxers
+  StreamOperation &ops = easymedia::Stream::c_operations;
+  void *h = s.get();
+  assert(ops.write("hello world", 1, 11, h) == 11);
+  assert(ops.tell(h) == 11);
+  assert(!ops.seek(h, 6, SEEK_SET));
+  assert(ops.write("there", 1, 5, h) == 5);
+  assert(!ops.seek(h, 0, SEEK_SET));
+  char buf[32] = {0};
+  assert(ops.read(buf, 1, sizeof(buf), h) == 11);
+  assert(!strcmp(buf, "hello there"));
+  assert(s->Eof());
+  assert(!s->Seek(-5, SEEK_END));
+  assert(!s->Eof());
+  memset(buf, 0, sizeof(buf));
+  assert(s->Read(buf, 5, 1) == 1 && !strcmp(buf, "there"));
+
+  // named memory is shared by streams
+  auto w = open_memory("shared", "w", KEY_MEMORY_BUFFER);
+  assert(w && !w->Readable());
+  assert(w->Write("abc", 1, 3) == 3);
+  auto r = open_memory("shared", "r", KEY_MEMORY_BUFFER);
+  assert(r && !r->Writeable());
+  memset(buf, 0, sizeof(buf));
+  assert(r->Read(buf, 1, sizeof(buf)) == 3 && !strcmp(buf, "abc"));
+
+  // capacity limits the buffer
+  auto l = open_memory("", "w", KEY_MEMORY_BUFFER, 4);
+  assert(l->Write("abcdef", 1, 6) == 4);
+  assert(l->Write("g", 1, 1) == (size_t)-1 && errno == ENOSPC);
+  printf("buffer ok\n");
+}
+
+static void test_pipe() {
+  const size_t total = 1024 * 1024 + 17;
+  auto r = open_memory("pipe", "r", KEY_MEMORY_PIPE, 4096);
+  auto w = open_memory("pipe", "w", KEY_MEMORY_PIPE, 4096);
+  assert(r && w && !r->Seekable() && r->Seek(0, SEEK_SET) < 0);
+  std::thread writer([&w, total] {
+    uint8_t chunk[1000];
+    size_t sent = 0;
+    while (sent < total) {
+      size_t n = std::min(sizeof(chunk), total - sent);
+      for (size_t i = 0; i < n; i++)
+        chunk[i] = (sent + i) & 0xFF;
+      assert(w->Write(chunk, 1, n) == n);
+      sent += n;
+    }
+    w.reset(); // close the write end
+  });
+  uint8_t buf[3000];
+  size_t got = 0;
+  while (!r->Eof()) {
+    size_t n = r->Read(buf, 1, sizeof(buf));
+    for (size_t i = 0; i < n; i++)
+      assert(buf[i] == ((got + i) & 0xFF));
+    got += n;
+  }
+  writer.join();
+  assert(got == total);
+
+  // the read end opened before any write end waits for it
+  r = open_memory("late", "r", KEY_MEMORY_PIPE, 64);
+  assert(!r->Eof());
+  std::thread late_writer([&w] {
+    easymedia::msleep(50);
+    w = open_memory("late", "w", KEY_MEMORY_PIPE, 64);
+    assert(w->Write("late", 1, 4) == 4);
+    w.reset();
+  });
+  assert(r->Read(buf, 1, sizeof(buf)) == 4 && !memcmp(buf, "late", 4));
+  late_writer.join();
+  assert(r->Read(buf, 1, sizeof(buf)) == 0 && r->Eof());
+
+  // non-blocking ends
+  r = open_memory("nb", "r", KEY_MEMORY_PIPE, 8, true);
+  errno = 0;
+  assert(r->Read(buf, 1, 4) == 0 && errno == EAGAIN && !r->Eof());
+  w = open_memory("nb", "w", KEY_MEMORY_PIPE, 8, true);
+  errno = 0;
+  assert(r->Read(buf, 1, 4) == 0 && errno == EAGAIN && !r->Eof());
+  assert(w->Write("0123456789", 1, 10) == 8);
+  assert(r->Read(buf, 1, 4) == 4 && !memcmp(buf, "0123", 4));
+  // the write end fails after the read ends are closed
+  r.reset();
+  assert(w->Write("x", 1, 1) == (size_t)-1 && errno == EPIPE);
+
+  // items larger than a byte are only read whole
+  r = open_memory("items", "r", KEY_MEMORY_PIPE, 64, true);
+  w = open_memory("items", "w", KEY_MEMORY_PIPE, 64, true);
+  assert(w->Write("abcdefghij", 1, 10) == 10);
+  assert(r->Read(buf, 4, 8) == 2 && !memcmp(buf, "abcdefgh", 8));
+  errno = 0;
+  assert(r->Read(buf, 4, 8) == 0 && errno == EAGAIN && !r->Eof());
+  assert(w->Write("kl", 1, 2) == 2);
+  assert(r->Read(buf, 4, 8) == 1 && !memcmp(buf, "ijkl", 4));
+  // a partial item is never read, the end comes after the write end closes
+  assert(w->Write("mn", 1, 2) == 2);
+  w.reset();
+  assert(r->Read(buf, 4, 8) == 0 && r->Eof());
+  printf("pipe ok\n");
+}
+
+int main(int argc, char **argv) {
+  int c;
+  opterr = 1;
+  while ((c = getopt(argc, argv, optstr)) != -1) {
+    switch (c) {
+    case '?':
+    default:
+      printf("usage: %s\n", argv[0]);
+      exit(0);
+    }
+  }
+  test_buffer();
+  test_pipe();
+  return 0;
+}
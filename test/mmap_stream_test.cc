@@ -0,0 +1,162 @@
+/*
+ * Copyright (C) 2017 Hertz Wang 1989wanghang@163.com
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see http://www.gnu.org/licenses
+ *
+ * Any non-GPL usage of this software or parts of this software is strictly
+ * forbidden.
+ *
+ */
+
+#ifdef NDEBUG
+#undef NDEBUG
+#endif
+#ifndef DEBUG
+#define DEBUG
+#endif
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "buffer.h"
+#include "stream.h"
+#include "utils.h"
+
+static char optstr[] = "?f:n:s:";
+
+static bool write_frames(const char *path, int num, size_t size) {
+  FILE *f = fopen(path, "w");
+  if (!f)
+    return false;
+  std::vector<uint8_t> frame(size);
+  for (int i = 0; i < num; i++) {
+    memset(frame.data(), i & 0xFF, size);
+    if (fwrite(frame.data(), 1, size, f) != size) {
+      fclose(f);
+      return false;
+    }
+  }
+  fclose(f);
+  return true;
+}
+
+static std::shared_ptr<easymedia::Stream> open_stream(const std::string &param) {
+  return easymedia::REFLECTOR(Stream)::Create<easymedia::Stream>(
+      "mmap_read_stream", param.c_str());
+}
+
+int main(int argc, char **argv) {
+  int c;
+  std::string path = "/tmp/mmap_stream_test.bin";
+  int num = 16;
+  size_t size = 1920 * 1080 * 3 / 2;
+
+  opterr = 1;
+  while ((c = getopt(argc, argv, optstr)) != -1) {
+    switch (c) {
+    case 'f':
+      path = optarg;
+      break;
+    case 'n':
+      num = atoi(optarg);
+      break;
+    case 's':
+      size = atoi(optarg);
+      break;
+    case '?':
+    default:
+      printf("usage: %s [-f tmp file] [-n frame num] [-s frame size]\n",
+             argv[0]);
+      exit(0);
+    }
+  }
+  assert(num > 0 && size > 0);
+  assert(write_frames(path.c_str(), num, size));
+
+  std::string param;
+  PARAM_STRING_APPEND(param, KEY_PATH, path);
+  PARAM_STRING_APPEND_TO(param, KEY_MEM_SIZE_PERTIME, size);
+  PARAM_STRING_APPEND_TO(param, KEY_LOOP_TIME, 1);
+  auto stream = open_stream(param);
+  assert(stream);
+  // frames of two passes, then eof
+  std::shared_ptr<easymedia::MediaBuffer> kept;
+  for (int i = 0; i < num * 2; i++) {
+    assert(!stream->Eof());
+    auto buffer = stream->Read();
+    assert(buffer);
+    assert(buffer->GetValidSize() == size);
+    assert(buffer->IsReadOnly());
+    uint8_t *ptr = (uint8_t *)buffer->GetPtr();
+    assert(ptr[0] == (i % num & 0xFF) && ptr[size - 1] == ptr[0]);
+    if (i == 1)
+      kept = buffer;
+  }
+  assert(stream->Eof());
+  assert(!stream->Read());
+  // the mapping lives with the buffer
+  stream.reset();
+  assert(((uint8_t *)kept->GetPtr())[size / 2] == 1);
+  kept.reset();
+
+  // images are described packed
+  param.clear();
+  PARAM_STRING_APPEND(param, KEY_PATH, path);
+  PARAM_STRING_APPEND(param, KEY_INPUTDATATYPE, IMAGE_NV12);
+  PARAM_STRING_APPEND_TO(param, KEY_BUFFER_WIDTH, 64);
+  PARAM_STRING_APPEND_TO(param, KEY_BUFFER_HEIGHT, 32);
+  PARAM_STRING_APPEND_TO(param, KEY_BUFFER_VIR_WIDTH, 128);
+  PARAM_STRING_APPEND_TO(param, KEY_BUFFER_VIR_HEIGHT, 32);
+  stream = open_stream(param);
+  assert(stream);
+  auto image = std::static_pointer_cast<easymedia::ImageBuffer>(stream->Read());
+  assert(image && image->GetType() == Type::Image);
+  assert(image->GetVirWidth() == 64 && image->GetValidSize() == 64 * 32 * 3 / 2);
+  stream.reset();
+
+  // the replay rate, with and without touching every page
+  param.clear();
+  PARAM_STRING_APPEND(param, KEY_PATH, path);
+  PARAM_STRING_APPEND_TO(param, KEY_MEM_SIZE_PERTIME, size);
+  PARAM_STRING_APPEND_TO(param, KEY_MMAP_POPULATE, 1);
+  PARAM_STRING_APPEND_TO(param, KEY_LOOP_TIME, -1);
+  stream = open_stream(param);
+  assert(stream);
+  const int rounds = 1000;
+  for (int touch = 0; touch < 2; touch++) {
+    uint32_t sum = 0;
+    int64_t start = easymedia::gettimeofday();
+    for (int i = 0; i < rounds; i++) {
+      auto buffer = stream->Read();
+      assert(buffer);
+      if (touch) {
+        const uint8_t *ptr = (const uint8_t *)buffer->GetPtr();
+        for (size_t off = 0; off < size; off += 4096)
+          sum += ptr[off];
+      }
+    }
+    int64_t cost = easymedia::gettimeofday() - start;
+    if (cost <= 0)
+      cost = 1;
+    printf("%s: %d frames in %lld us, %.2f GB/s (sum %u)\n",
+           touch ? "touch pages" : "no access", rounds, (long long)cost,
+           (double)size * rounds / cost / 1000.0, sum);
+  }
+  stream.reset();
+  unlink(path.c_str());
+  return 0;
+}
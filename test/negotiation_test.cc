@@ -0,0 +1,198 @@
+/*
+ * Copyright (C) 2017 Hertz Wang 1989wanghang@163.com
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see http://www.gnu.org/licenses
+ *
+ * Any non-GPL usage of this software or parts of this software is strictly
+ * forbidden.
+ *
+ */
+
+#ifdef NDEBUG
+#undef NDEBUG
+#endif
+#ifndef DEBUG
+#define DEBUG
+#endif
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "buffer.h"
+#include "filter.h"
+#include "flow.h"
+#include "media_type.h"
+#include "negotiation.h"
+#include "utils.h"
+
+static char optstr[] = "?";
+
+namespace easymedia {
+
+// Software converter of the test. It only sets the image info, the bytes
+// are not converted.
+class TestConvertFilter : public Filter {
+public:
+  TestConvertFilter(const char *param _UNUSED) {}
+  virtual ~TestConvertFilter() = default;
+  static const char *GetFilterName() { return "test_convert"; }
+  virtual int Process(std::shared_ptr<MediaBuffer> input,
+                      std::shared_ptr<MediaBuffer> output) override {
+    if (!input || input->GetType() != Type::Image)
+      return -EINVAL;
+    if (!output || output->GetType() != Type::Image)
+      return -EINVAL;
+    auto src = std::static_pointer_cast<ImageBuffer>(input);
+    auto dst = std::static_pointer_cast<ImageBuffer>(output);
+    if (!dst->IsValid()) {
+      ImageInfo info = src->GetImageInfo();
+      info.pix_fmt = dst->GetPixelFormat();
+      auto &&mb = MediaBuffer::Alloc2(CalPixFmtSize(info));
+      *dst.get() = ImageBuffer(mb, info);
+    }
+    dst->SetUSTimeStamp(src->GetUSTimeStamp());
+    return 0;
+  }
+};
+
+DEFINE_COMMON_FILTER_FACTORY(TestConvertFilter)
+const char *FACTORY(TestConvertFilter)::ExpectedInputDataType() {
+  return TYPE_ANYTHING;
+}
+const char *FACTORY(TestConvertFilter)::OutPutDataType() {
+  return TYPE_ANYTHING;
+}
+
+} // namespace easymedia
+
+static std::shared_ptr<easymedia::ImageBuffer> received;
+
+// pass the input to the output, or keep it if it is the last
+class CapsFlow : public easymedia::Flow {
+public:
+  CapsFlow(bool last, const easymedia::FlowCaps &in,
+           const easymedia::FlowCaps &out) {
+    easymedia::SlotMap sm;
+    sm.input_slots.push_back(0);
+    if (!last)
+      sm.output_slots.push_back(0);
+    sm.thread_model = easymedia::Model::SYNC;
+    sm.mode_when_full = easymedia::InputMode::DROPFRONT;
+    sm.process = last ? keep : easymedia::Flow::void_transaction00;
+    if (!InstallSlotMap(sm, last ? "sink" : "source", -1))
+      SetError(-EINVAL);
+    LimitCaps(in, out);
+  }
+  virtual ~CapsFlow() { StopAllThread(); }
+
+private:
+  static bool keep(easymedia::Flow *f _UNUSED,
+                   easymedia::MediaBufferVector &input_vector) {
+    if (input_vector[0])
+      received =
+          std::static_pointer_cast<easymedia::ImageBuffer>(input_vector[0]);
+    return true;
+  }
+};
+
+static easymedia::FlowCaps image_caps(const char *type, int w, int h) {
+  easymedia::FlowCaps caps;
+  caps.types = easymedia::MediaTypeSet::FromString(type);
+  caps.width = w;
+  caps.height = h;
+  return caps;
+}
+
+static void add_converter(const char *name, const char *in, const char *out,
+                          bool can_scale) {
+  easymedia::ConverterInfo info;
+  info.name = name;
+  info.filter_name = easymedia::TestConvertFilter::GetFilterName();
+  info.input_types = easymedia::MediaTypeSet::FromString(in);
+  info.output_types = easymedia::MediaTypeSet::FromString(out);
+  info.can_scale = can_scale;
+  assert(easymedia::RegisterConverter(info));
+}
+
+// link source to sink, send one nv12 640x480 image and check the result
+static size_t link_and_send(const std::shared_ptr<CapsFlow> &source,
+                            const std::shared_ptr<CapsFlow> &sink) {
+  assert(source->AddDownFlow(sink, 0, 0));
+  auto reports = source->GetLinkReports();
+  assert(reports.size() == 1 && reports[0]->down == sink.get());
+  printf("%s\n", reports[0]->ToString().c_str());
+
+  ImageInfo info = {PIX_FMT_NV12, 640, 480, 640, 480, 0, {}};
+  auto mb = easymedia::MediaBuffer::Alloc2(CalPixFmtSize(info));
+  std::shared_ptr<easymedia::MediaBuffer> in =
+      std::make_shared<easymedia::ImageBuffer>(mb, info);
+  received.reset();
+  source->SendInput(in, 0);
+  assert(received);
+  assert(received->GetPixelFormat() == PIX_FMT_RGB888);
+  assert(received->GetWidth() == 320 && received->GetHeight() == 240);
+
+  size_t n = reports[0]->converters.size();
+  source->RemoveDownFlow(sink);
+  assert(source->GetLinkReports().empty());
+  return n;
+}
+
+int main(int argc, char **argv) {
+  int c;
+
+  opterr = 1;
+  while ((c = getopt(argc, argv, optstr)) != -1) {
+    switch (c) {
+    case '?':
+    default:
+      printf("usage: %s\n", argv[0]);
+      exit(0);
+    }
+  }
+
+  auto source = std::make_shared<CapsFlow>(
+      false, easymedia::FlowCaps(), image_caps(IMAGE_NV12, 640, 480));
+  auto sink = std::make_shared<CapsFlow>(
+      true, image_caps(IMAGE_RGB888, 320, 240), easymedia::FlowCaps());
+  assert(source->GetError() == 0 && sink->GetError() == 0);
+
+  // no converter
+  assert(!source->AddDownFlow(sink, 0, 0));
+
+  // a format converter and a scaler
+  add_converter("yuv2rgb", IMAGE_NV12, IMAGE_BGR888 "\n" IMAGE_RGB888, false);
+  add_converter("scaler", TYPE_ANYTHING, TYPE_ANYTHING, true);
+  assert(link_and_send(source, sink) == 2);
+
+  // fewest conversions
+  add_converter("yuv2rgb_scale", IMAGE_NV12, IMAGE_RGB888, true);
+  assert(link_and_send(source, sink) == 1);
+
+  // compatible caps are linked directly
+  auto any_sink = std::make_shared<CapsFlow>(true, easymedia::FlowCaps(),
+                                             easymedia::FlowCaps());
+  assert(source->AddDownFlow(any_sink, 0, 0));
+  assert(source->GetLinkReports()[0]->converters.empty());
+  source->RemoveDownFlow(any_sink);
+
+  easymedia::UnregisterConverter("yuv2rgb");
+  easymedia::UnregisterConverter("scaler");
+  easymedia::UnregisterConverter("yuv2rgb_scale");
+  assert(!source->AddDownFlow(sink, 0, 0));
+  printf("negotiation test ok\n");
+  return 0;
+}
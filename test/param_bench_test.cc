@@ -0,0 +1,160 @@
+/*
+ * Copyright (C) 2017 Hertz Wang 1989wanghang@163.com
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see http://www.gnu.org/licenses
+ *
+ * Any non-GPL usage of this software or parts of this software is strictly
+ * forbidden.
+ *
+ */
+
+#ifdef NDEBUG
+#undef NDEBUG
+#endif
+#ifndef DEBUG
+#define DEBUG
+#endif
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <sstream>
+#include <string>
+
+#include "flow.h"
+#include "key_string.h"
+#include "media_param.h"
+#include "media_type.h"
+#include "utils.h"
+
+static char optstr[] = "?n:";
+
+// the string path before MediaParam
+static void string_parse(const char *param,
+                         std::map<std::string, std::string> &map) {
+  std::string token;
+  std::istringstream tokenStream(param);
+  while (std::getline(tokenStream, token)) {
+    std::string key, value;
+    std::istringstream subTokenStream(token);
+    if (std::getline(subTokenStream, key, '='))
+      std::getline(subTokenStream, value);
+    map[key] = value;
+  }
+}
+
+static std::string image_param() {
+  std::string param;
+  PARAM_STRING_APPEND(param, KEY_NAME, "rkrga");
+  PARAM_STRING_APPEND(param, KEY_INPUTDATATYPE, IMAGE_NV12);
+  PARAM_STRING_APPEND(param, KEY_OUTPUTDATATYPE, IMAGE_RGB888);
+  PARAM_STRING_APPEND_TO(param, KEY_BUFFER_WIDTH, 1920);
+  PARAM_STRING_APPEND_TO(param, KEY_BUFFER_HEIGHT, 1080);
+  PARAM_STRING_APPEND_TO(param, KEY_BUFFER_VIR_WIDTH, 1920);
+  PARAM_STRING_APPEND_TO(param, KEY_BUFFER_VIR_HEIGHT, 1088);
+  PARAM_STRING_APPEND_TO(param, KEY_FPS, 30);
+  PARAM_STRING_APPEND(param, KEK_THREAD_SYNC_MODEL, KEY_SYNC);
+  return param;
+}
+
+static void bench_parse(int loops) {
+  std::string param = image_param();
+  int64_t sum = 0;
+  int64_t start = easymedia::gettimeofday();
+  for (int i = 0; i < loops; i++) {
+    std::map<std::string, std::string> map;
+    string_parse(param.c_str(), map);
+    sum += std::stoi(map[KEY_BUFFER_WIDTH]) + std::stoi(map[KEY_BUFFER_HEIGHT]);
+  }
+  int64_t string_cost = easymedia::gettimeofday() - start;
+
+  static const easymedia::ParamKey kWidth(KEY_BUFFER_WIDTH);
+  static const easymedia::ParamKey kHeight(KEY_BUFFER_HEIGHT);
+  int64_t sum2 = 0;
+  start = easymedia::gettimeofday();
+  for (int i = 0; i < loops; i++) {
+    auto mp = easymedia::MediaParam::Parse(param.c_str());
+    int w = 0, h = 0;
+    assert(mp->GetInt(kWidth, w) && mp->GetInt(kHeight, h));
+    sum2 += w + h;
+  }
+  int64_t param_cost = easymedia::gettimeofday() - start;
+  assert(sum == sum2);
+  printf("parse: string %.1f ns, media param %.1f ns\n",
+         string_cost * 1000.0 / loops, param_cost * 1000.0 / loops);
+}
+
+// create and destroy a flow with its stream, as a pipeline rebuild
+static int64_t bench_create(int loops) {
+  std::string flow_param;
+  PARAM_STRING_APPEND(flow_param, KEY_NAME, "file_write_stream");
+  PARAM_STRING_APPEND(flow_param, KEK_THREAD_SYNC_MODEL, KEY_SYNC);
+  std::string stream_param;
+  PARAM_STRING_APPEND(stream_param, KEY_PATH, "/dev/null");
+  PARAM_STRING_APPEND(stream_param, KEY_OPEN_MODE, "w");
+  std::string param = easymedia::JoinFlowParam(flow_param, 1, stream_param);
+  std::string rule;
+  PARAM_STRING_APPEND(rule, KEY_INPUTDATATYPE, IMAGE_NV12);
+  int64_t start = easymedia::gettimeofday();
+  for (int i = 0; i < loops; i++) {
+    // results are not checked, only the cost of matching
+    easymedia::REFLECTOR(Flow)::FindFirstMatchIdentifier(rule.c_str());
+    easymedia::REFLECTOR(Flow)::IsMatch("output_stream", rule.c_str());
+    auto flow = easymedia::REFLECTOR(Flow)::Create<easymedia::Flow>(
+        "output_stream", param.c_str());
+    assert(flow);
+  }
+  return easymedia::gettimeofday() - start;
+}
+
+int main(int argc, char **argv) {
+  int c;
+  int loops = 20000;
+
+  opterr = 1;
+  while ((c = getopt(argc, argv, optstr)) != -1) {
+    switch (c) {
+    case 'n':
+      loops = atoi(optarg);
+      break;
+    case '?':
+    default:
+      printf("usage: %s [-n loops]\n", argv[0]);
+      exit(0);
+    }
+  }
+
+  auto bad = easymedia::MediaParam::Parse("a=1\nb\n");
+  assert(bad && !bad->IsValid() && bad->Has("b"));
+  int a = 0;
+  assert(bad->GetInt(easymedia::ParamKey("a"), a) && a == 1);
+  // decimal like std::stoi, a leading 0 is not octal
+  auto num = easymedia::MediaParam::Parse("a=010\nb=0x10\n");
+  assert(num && num->IsValid());
+  assert(num->GetInt(easymedia::ParamKey("a"), a) && a == 10);
+  assert(!num->GetInt(easymedia::ParamKey("b"), a));
+
+  bench_parse(loops);
+
+  easymedia::MediaParam::EnableCache(false);
+  int64_t string_cost = bench_create(loops / 10);
+  easymedia::MediaParam::EnableCache(true);
+  int64_t param_cost = bench_create(loops / 10);
+  printf("flow create: uncached %.1f us, cached %.1f us\n",
+         string_cost * 10.0 / loops, param_cost * 10.0 / loops);
+
+  return 0;
+}
@@ -0,0 +1,131 @@
+/*
+ * Copyright (C) 2017 Hertz Wang 1989wanghang@163.com
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see http://www.gnu.org/licenses
+ *
+ * Any non-GPL usage of this software or parts of this software is strictly
+ * forbidden.
+ *
+ */
+
+#ifdef NDEBUG
+#undef NDEBUG
+#endif
+#ifndef DEBUG
+#define DEBUG
+#endif
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "filter.h"
+#include "plugin.h"
+#include "utils.h"
+
+static char optstr[] = "?p:";
+
+#define PLUGIN_FILTER "test_plugin_filter"
+// in the manifest, but not registered by the library
+#define STALE_FILTER "test_plugin_stale"
+
+static long rss_kb() {
+  FILE *f = fopen("/proc/self/status", "r");
+  if (!f)
+    return -1;
+  char line[128];
+  long kb = -1;
+  while (fgets(line, sizeof(line), f)) {
+    if (!strncmp(line, "VmRSS:", 6)) {
+      kb = atol(line + 6);
+      break;
+    }
+  }
+  fclose(f);
+  return kb;
+}
+
+static easymedia::PluginFactoryInfo plugin_info(const char *identifier) {
+  for (auto &info : easymedia::GetPluginFactories()) {
+    if (info.identifier == identifier)
+      return info;
+  }
+  fprintf(stderr, "missing manifest of %s\n", identifier);
+  abort();
+}
+
+static bool plugin_loaded() { return plugin_info(PLUGIN_FILTER).loaded; }
+
+int main(int argc, char **argv) {
+  int c;
+  std::string dir = TEST_PLUGIN_DIR;
+
+  opterr = 1;
+  while ((c = getopt(argc, argv, optstr)) != -1) {
+    switch (c) {
+    case 'p':
+      dir = optarg;
+      break;
+    case '?':
+    default:
+      printf("usage: %s [-p plugin dir]\n", argv[0]);
+      exit(0);
+    }
+  }
+
+  easymedia::SetPluginPath(dir);
+  long rss_before = rss_kb();
+  // the metadata comes from the manifest only
+  assert(!plugin_loaded());
+  std::string rules;
+  PARAM_STRING_APPEND(rules, KEY_INPUTDATATYPE, IMAGE_NV12);
+  PARAM_STRING_APPEND(rules, KEY_OUTPUTDATATYPE, IMAGE_RGB888);
+  const char *id =
+      easymedia::REFLECTOR(Filter)::FindFirstMatchIdentifier(rules.c_str());
+  assert(id && !strcmp(id, PLUGIN_FILTER));
+  assert(easymedia::REFLECTOR(Filter)::IsMatch(PLUGIN_FILTER, rules.c_str()));
+  std::string bad_rules;
+  PARAM_STRING_APPEND(bad_rules, KEY_INPUTDATATYPE, VIDEO_H264);
+  PARAM_STRING_APPEND(bad_rules, KEY_OUTPUTDATATYPE, IMAGE_RGB888);
+  assert(
+      !easymedia::REFLECTOR(Filter)::IsMatch(PLUGIN_FILTER, bad_rules.c_str()));
+  easymedia::REFLECTOR(Filter)::DumpFactories();
+  assert(!plugin_loaded());
+
+  // the first creation loads the library
+  int64_t start = easymedia::gettimeofday();
+  auto filter = easymedia::REFLECTOR(Filter)::Create<easymedia::Filter>(
+      PLUGIN_FILTER, "");
+  int64_t load_cost = easymedia::gettimeofday() - start;
+  assert(filter);
+  assert(plugin_loaded());
+  long rss_after = rss_kb();
+  // the manifest is checked against the registered factories
+  assert(!plugin_info(PLUGIN_FILTER).mismatched);
+  assert(plugin_info(STALE_FILTER).mismatched);
+  start = easymedia::gettimeofday();
+  filter = easymedia::REFLECTOR(Filter)::Create<easymedia::Filter>(
+      PLUGIN_FILTER, "");
+  int64_t create_cost = easymedia::gettimeofday() - start;
+  assert(filter);
+  assert(easymedia::REFLECTOR(Filter)::IsMatch(PLUGIN_FILTER, rules.c_str()));
+
+  printf("first create with load: %lld us, later create: %lld us\n",
+         (long long)load_cost, (long long)create_cost);
+  printf("rss before load: %ld kB, after load: %ld kB\n", rss_before,
+         rss_after);
+  return 0;
+}
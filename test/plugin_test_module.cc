@@ -0,0 +1,48 @@
+/*
+ * Copyright (C) 2017 Hertz Wang 1989wanghang@163.com
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see http://www.gnu.org/licenses
+ *
+ * Any non-GPL usage of this software or parts of this software is strictly
+ * forbidden.
+ *
+ */
+
+// A filter built as a plugin for plugin_test, see plugin.h.
+
+#include "buffer.h"
+#include "filter.h"
+
+namespace easymedia {
+
+class TestPluginFilter : public Filter {
+public:
+  TestPluginFilter(const char *param _UNUSED) {}
+  virtual ~TestPluginFilter() = default;
+  static const char *GetFilterName() { return "test_plugin_filter"; }
+  virtual int Process(std::shared_ptr<MediaBuffer> input _UNUSED,
+                      std::shared_ptr<MediaBuffer> output _UNUSED) override {
+    return 0;
+  }
+};
+
+DEFINE_COMMON_FILTER_FACTORY(TestPluginFilter)
+const char *FACTORY(TestPluginFilter)::ExpectedInputDataType() {
+  return IMAGE_NV12;
+}
+const char *FACTORY(TestPluginFilter)::OutPutDataType() {
+  return IMAGE_RGB888;
+}
+
+} // namespace easymedia
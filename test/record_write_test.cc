@@ -0,0 +1,114 @@
+/*
+ * Copyright (C) 2017 Hertz Wang 1989wanghang@163.com
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see http://www.gnu.org/licenses
+ *
+ * Any non-GPL usage of this software or parts of this software is strictly
+ * forbidden.
+ *
+ */
+
+#ifdef NDEBUG
+#undef NDEBUG
+#endif
+#ifndef DEBUG
+#define DEBUG
+#endif
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "buffer.h"
+#include "control.h"
+#include "stream.h"
+#include "utils.h"
+
+static char optstr[] = "?f:n:";
+
+static const size_t kFrameSize = 100 * 1024 + 7;
+
+int main(int argc, char **argv) {
+  int c;
+  std::string path = "/tmp/record_write_test.bin";
+  int num = 200;
+
+  opterr = 1;
+  while ((c = getopt(argc, argv, optstr)) != -1) {
+    switch (c) {
+    case 'f':
+      path = optarg;
+      break;
+    case 'n':
+      num = atoi(optarg);
+      break;
+    case '?':
+    default:
+      printf("usage: %s [-f file] [-n frame num]\n", argv[0]);
+      exit(0);
+    }
+  }
+
+  std::string param;
+  PARAM_STRING_APPEND(param, KEY_PATH, path);
+  PARAM_STRING_APPEND(param, KEY_OPEN_MODE, "w");
+  PARAM_STRING_APPEND_TO(param, KEY_CHUNK_SIZE, 1024 * 1024);
+  PARAM_STRING_APPEND_TO(param, KEY_PREALLOC_SIZE, 8 * 1024 * 1024);
+  PARAM_STRING_APPEND_TO(param, KEY_FLUSH_INTERVAL_MS, 20);
+  auto stream = easymedia::REFLECTOR(Stream)::Create<easymedia::Stream>(
+      "record_write_stream", param.c_str());
+  assert(stream);
+  for (int i = 0; i < num; i++) {
+    auto buffer = easymedia::MediaBuffer::Alloc(kFrameSize);
+    assert(buffer);
+    memset(buffer->GetPtr(), i & 0xFF, kFrameSize);
+    buffer->SetValidSize(kFrameSize);
+    if (i % 2)
+      assert(stream->Write(buffer));
+    else
+      assert(stream->Write(buffer->GetPtr(), 1, kFrameSize) == kFrameSize);
+    assert(stream->Tell() == (long)((i + 1) * kFrameSize));
+    easymedia::msleep(1);
+  }
+  easymedia::StreamWriteStats stats;
+  assert(!stream->IoCtrl(easymedia::G_STREAM_WRITE_STATS, &stats));
+  assert(stats.error == 0);
+  assert(stats.flush_times > 0);
+  printf("%llu bytes, %llu B/s, flush %llu times, avg %lld us, max %lld us, "
+         "longest write %lld us\n",
+         (unsigned long long)stats.written_bytes,
+         (unsigned long long)stats.bytes_per_second,
+         (unsigned long long)stats.flush_times, (long long)stats.avg_flush_us,
+         (long long)stats.max_flush_us, (long long)stats.max_write_us);
+  stream.reset();
+
+  // the preallocated blocks are trimmed
+  struct stat st;
+  assert(!stat(path.c_str(), &st));
+  assert(st.st_size == (off_t)(num * kFrameSize));
+  assert(st.st_blocks * 512 < st.st_size + 1024 * 1024);
+  FILE *f = fopen(path.c_str(), "r");
+  assert(f);
+  std::vector<uint8_t> frame(kFrameSize);
+  for (int i = 0; i < num; i++) {
+    assert(fread(frame.data(), 1, kFrameSize, f) == kFrameSize);
+    assert(frame[0] == (i & 0xFF) && frame[kFrameSize - 1] == frame[0]);
+  }
+  fclose(f);
+  unlink(path.c_str());
+  return 0;
+}
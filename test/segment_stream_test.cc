@@ -0,0 +1,200 @@
+/*
+ * Copyright (C) 2017 Hertz Wang 1989wanghang@163.com
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see http://www.gnu.org/licenses
+ *
+ * Any non-GPL usage of this software or parts of this software is strictly
+ * forbidden.
+ *
+ */
+
+#ifdef NDEBUG
+#undef NDEBUG
+#endif
+#ifndef DEBUG
+#define DEBUG
+#endif
+
+#include <assert.h>
+#include <dirent.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+
+#include "buffer.h"
+#include "stream.h"
+#include "utils.h"
+
+static char optstr[] = "?d:";
+
+static const size_t kFrameSize = 1000;
+static const int kGop = 5;
+
+static std::vector<std::string> list_dir(const std::string &dir) {
+  std::vector<std::string> names;
+  DIR *d = opendir(dir.c_str());
+  assert(d);
+  struct dirent *e;
+  while ((e = readdir(d)) != nullptr) {
+    if (e->d_name[0] != '.')
+      names.push_back(e->d_name);
+  }
+  closedir(d);
+  std::sort(names.begin(), names.end());
+  return names;
+}
+
+static void clean_dir(const std::string &dir) {
+  mkdir(dir.c_str(), 0755);
+  DIR *d = opendir(dir.c_str());
+  assert(d);
+  struct dirent *e;
+  while ((e = readdir(d)) != nullptr) {
+    if (strcmp(e->d_name, ".") && strcmp(e->d_name, ".."))
+      unlink((dir + "/" + e->d_name).c_str());
+  }
+  closedir(d);
+}
+
+// frame i: an extra intra before every gop, then the gop of kGop frames
+static std::shared_ptr<easymedia::MediaBuffer> new_frame(int i, bool extra) {
+  auto buffer = easymedia::MediaBuffer::Alloc(kFrameSize);
+  assert(buffer);
+  memset(buffer->GetPtr(), i & 0xFF, kFrameSize);
+  buffer->SetValidSize(kFrameSize);
+  if (extra)
+    buffer->SetUserFlag(easymedia::MediaBuffer::kExtraIntra);
+  else if (i % kGop == 0)
+    buffer->SetUserFlag(easymedia::MediaBuffer::kIntra);
+  else
+    buffer->SetUserFlag(easymedia::MediaBuffer::kPredicted);
+  buffer->SetUSTimeStamp(1000000LL + i * 40000LL);
+  return buffer;
+}
+
+int main(int argc, char **argv) {
+  int c;
+  std::string dir = "/tmp/segment_stream_test";
+
+  opterr = 1;
+  while ((c = getopt(argc, argv, optstr)) != -1) {
+    switch (c) {
+    case 'd':
+      dir = optarg;
+      break;
+    case '?':
+    default:
+      printf("usage: %s [-d tmp dir]\n", argv[0]);
+      exit(0);
+    }
+  }
+  clean_dir(dir);
+  // earlier recordings are counted by the quota, other files are kept even
+  // if they look alike
+  for (const char *name : {"seg_00003_2000.bin", "seg_00002_2000_1.bin",
+                           "other.bin", "seg_a_b.bin"}) {
+    FILE *f = fopen((dir + "/" + name).c_str(), "w");
+    assert(f && fwrite("old", 1, 3, f) == 3);
+    fclose(f);
+  }
+
+  // segments of at least 3 frames, cut at the extra intra of gops
+  const int gops = 10;
+  std::string param;
+  PARAM_STRING_APPEND(param, KEY_PATH, dir + "/seg_%n_%Y.bin");
+  PARAM_STRING_APPEND(param, KEY_OPEN_MODE, "w");
+  PARAM_STRING_APPEND_TO(param, KEY_SEGMENT_SIZE, 3 * kFrameSize);
+  PARAM_STRING_APPEND_TO(param, KEY_SEGMENT_MAX_FILES, 4);
+  auto stream = easymedia::REFLECTOR(Stream)::Create<easymedia::Stream>(
+      "segment_write_stream", param.c_str());
+  assert(stream);
+  int64_t longest = 0;
+  for (int i = 0; i < gops * kGop; i++) {
+    int64_t start = easymedia::gettimeofday();
+    if (i % kGop == 0)
+      assert(stream->Write(new_frame(i, true)));
+    assert(stream->Write(new_frame(i, false)));
+    longest = std::max(longest, easymedia::gettimeofday() - start);
+    // time for the worker to open the next segment
+    easymedia::msleep(2);
+  }
+  stream.reset();
+  printf("longest write with switches: %lld us\n", (long long)longest);
+
+  // one segment per gop, the oldest ones removed
+  auto names = list_dir(dir);
+  assert(names.size() == 6 && names[0] == "other.bin" &&
+         names[5] == "seg_a_b.bin");
+  names.erase(names.begin());
+  names.pop_back();
+  for (size_t n = 0; n < names.size(); n++) {
+    int index = gops - 4 + n;
+    char prefix[32];
+    snprintf(prefix, sizeof(prefix), "seg_%05d_", index);
+    assert(names[n].compare(0, strlen(prefix), prefix) == 0);
+    std::string path = dir + "/" + names[n];
+    struct stat st;
+    assert(!stat(path.c_str(), &st));
+    assert(st.st_size == (off_t)((kGop + 1) * kFrameSize));
+    FILE *f = fopen(path.c_str(), "r");
+    assert(f);
+    uint8_t first = 0;
+    assert(fread(&first, 1, 1, f) == 1);
+    assert(first == ((index * kGop) & 0xFF));
+    fclose(f);
+  }
+  clean_dir(dir);
+
+  // a template matching any file is refused with a quota
+  param.clear();
+  PARAM_STRING_APPEND(param, KEY_PATH, dir + "/%n.bin");
+  PARAM_STRING_APPEND(param, KEY_OPEN_MODE, "w");
+  PARAM_STRING_APPEND_TO(param, KEY_SEGMENT_MAX_FILES, 4);
+  assert(!easymedia::REFLECTOR(Stream)::Create<easymedia::Stream>(
+      "segment_write_stream", param.c_str()));
+
+  // two streams of one name in one directory, such as two runs within a
+  // second, never overwrite each other
+  param.clear();
+  PARAM_STRING_APPEND(param, KEY_PATH, dir + "/dup.bin");
+  PARAM_STRING_APPEND(param, KEY_OPEN_MODE, "w");
+  std::shared_ptr<easymedia::Stream> dups[2];
+  for (auto &dup : dups) {
+    dup = easymedia::REFLECTOR(Stream)::Create<easymedia::Stream>(
+        "segment_write_stream", param.c_str());
+    assert(dup);
+  }
+  for (int i = 0; i < kGop; i++) {
+    assert(dups[0]->Write(new_frame(1, false)));
+    assert(dups[1]->Write(new_frame(2, false)));
+    assert(dups[1]->Write(new_frame(2, false)));
+  }
+  dups[0].reset();
+  dups[1].reset();
+  names = list_dir(dir);
+  assert(names.size() == 2 && names[0] == "dup.bin" &&
+         names[1] == "dup_1.bin");
+  struct stat st[2];
+  assert(!stat((dir + "/dup.bin").c_str(), &st[0]));
+  assert(!stat((dir + "/dup_1.bin").c_str(), &st[1]));
+  assert(st[0].st_size + st[1].st_size == (off_t)(3 * kGop * kFrameSize));
+  assert(st[0].st_size != st[1].st_size);
+  clean_dir(dir);
+  rmdir(dir.c_str());
+  return 0;
+}
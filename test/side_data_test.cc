@@ -0,0 +1,109 @@
+/*
+ * Copyright (C) 2017 Hertz Wang 1989wanghang@163.com
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see http://www.gnu.org/licenses
+ *
+ * Any non-GPL usage of this software or parts of this software is strictly
+ * forbidden.
+ *
+ */
+
+#ifdef NDEBUG
+#undef NDEBUG
+#endif
+#ifndef DEBUG
+#define DEBUG
+#endif
+
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "buffer.h"
+
+using easymedia::MediaBuffer;
+using easymedia::SideData;
+
+struct Roi {
+  int x, y, w, h;
+};
+
+int main() {
+  MediaBuffer src;
+  SideData &sd = src.GetSideData();
+  assert(sd.Empty());
+
+  // inline small data
+  Roi roi = {1, 2, 3, 4};
+  assert(sd.Set(SideData::kROI, roi));
+  const Roi *r = sd.Get<Roi>(SideData::kROI);
+  assert(r && !memcmp(r, &roi, sizeof(roi)));
+  assert(!sd.Get<int>(SideData::kROI));
+
+  // large data goes to a pooled record
+  uint8_t nn[1000];
+  for (size_t i = 0; i < sizeof(nn); i++)
+    nn[i] = (uint8_t)i;
+  assert(sd.Set(SideData::kNNResult, nn, sizeof(nn)));
+  size_t size = 0;
+  const void *data = sd.Get(SideData::kNNResult, &size);
+  assert(data && size == sizeof(nn) && !memcmp(data, nn, size));
+
+  // a shared buffer, the record must point to its payload
+  auto mv = MediaBuffer::Alloc(4096);
+  assert(mv);
+  mv->SetValidSize(1500);
+  memset(mv->GetPtr(), 0x5a, mv->GetSize());
+  assert(sd.SetRecord(SideData::kMotionVector,
+                      std::shared_ptr<void>(mv, mv->GetPtr()),
+                      mv->GetValidSize()));
+  data = sd.Get(SideData::kMotionVector, &size);
+  assert(data == mv->GetPtr() && size == 1500);
+  for (size_t i = 0; i < size; i++)
+    assert(static_cast<const uint8_t *>(data)[i] == 0x5a);
+
+  // copied with the buffer, records are shared, not copied
+  MediaBuffer dst(src);
+  assert(dst.GetSideData().Get(SideData::kMotionVector) == mv->GetPtr());
+  assert(dst.GetSideData().GetRecord(SideData::kNNResult) ==
+         sd.GetRecord(SideData::kNNResult));
+  r = dst.GetSideData().Get<Roi>(SideData::kROI);
+  assert(r && r->w == 3);
+
+  // the record keeps the buffer alive
+  std::weak_ptr<MediaBuffer> weak = mv;
+  mv.reset();
+  assert(!weak.expired());
+  sd.Remove(SideData::kMotionVector);
+  assert(!sd.Has(SideData::kMotionVector) && !weak.expired());
+  dst.GetSideData().Clear();
+  assert(weak.expired());
+
+  // merge keeps the existing entries unless overwrite
+  SideData other;
+  Roi roi2 = {5, 6, 7, 8};
+  assert(other.Set(SideData::kROI, roi2));
+  int user = 42;
+  assert(other.Set(SideData::kUser, user));
+  sd.Merge(other);
+  assert(sd.Get<Roi>(SideData::kROI)->x == 1);
+  assert(*sd.Get<int>(SideData::kUser) == 42);
+  sd.Merge(other, true);
+  assert(sd.Get<Roi>(SideData::kROI)->x == 5);
+
+  printf("side data test ok\n");
+  return 0;
+}
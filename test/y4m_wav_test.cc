@@ -0,0 +1,348 @@
+/*
+ * Copyright (C) 2017 Hertz Wang 1989wanghang@163.com
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see http://www.gnu.org/licenses
+ *
+ * Any non-GPL usage of this software or parts of this software is strictly
+ * forbidden.
+ *
+ */
+
+#ifdef NDEBUG
+#undef NDEBUG
+#endif
+#ifndef DEBUG
+#define DEBUG
+#endif
+
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <mutex>
+#include <vector>
+
+#include "buffer.h"
+#include "flow.h"
+#include "key_string.h"
+#include "stream.h"
+#include "utils.h"
+
+static char optstr[] = "?f:";
+
+static const int kImageNum = 5;
+static const int kFps = 30;
+
+static std::mutex received_mtx;
+static std::vector<std::shared_ptr<easymedia::MediaBuffer>> received;
+
+class CollectFlow : public easymedia::Flow {
+public:
+  CollectFlow() {
+    easymedia::SlotMap sm;
+    sm.input_slots.push_back(0);
+    sm.thread_model = easymedia::Model::SYNC;
+    sm.mode_when_full = easymedia::InputMode::DROPFRONT;
+    sm.process = collect;
+    if (!InstallSlotMap(sm, "collect", -1))
+      SetError(-EINVAL);
+  }
+  virtual ~CollectFlow() { StopAllThread(); }
+
+private:
+  static bool collect(easymedia::Flow *f _UNUSED,
+                      easymedia::MediaBufferVector &input_vector) {
+    if (input_vector[0]) {
+      std::lock_guard<std::mutex> _lg(received_mtx);
+      received.push_back(input_vector[0]);
+    }
+    return true;
+  }
+};
+
+static std::shared_ptr<easymedia::Stream>
+open_stream(const char *name, const std::string &param) {
+  auto stream = easymedia::REFLECTOR(Stream)::Create<easymedia::Stream>(
+      name, param.c_str());
+  assert(stream);
+  return stream;
+}
+
+static void write_file(const std::string &path, const std::string &data) {
+  FILE *f = fopen(path.c_str(), "wb");
+  assert(f && fwrite(data.data(), 1, data.size(), f) == data.size());
+  fclose(f);
+}
+
+static std::string read_file(const std::string &path) {
+  std::string data;
+  FILE *f = fopen(path.c_str(), "rb");
+  assert(f);
+  char buf[4096];
+  size_t n;
+  while ((n = fread(buf, 1, sizeof(buf), f)) > 0)
+    data.append(buf, n);
+  fclose(f);
+  return data;
+}
+
+static uint32_t le32(const std::string &data, size_t offset) {
+  const uint8_t *p = (const uint8_t *)data.data() + offset;
+  return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+// padded frames, the valid pixels differ by frame
+static std::vector<std::shared_ptr<easymedia::ImageBuffer>> make_images() {
+  std::vector<std::shared_ptr<easymedia::ImageBuffer>> images;
+  ImageInfo info = {PIX_FMT_YUV420P, 64, 48, 80, 56, 0, {}};
+  for (int i = 0; i < kImageNum; i++) {
+    auto mb = easymedia::MediaBuffer::Alloc2(CalPixFmtSize(info));
+    auto image = std::make_shared<easymedia::ImageBuffer>(mb, info);
+    uint8_t *ptr = static_cast<uint8_t *>(image->GetPtr());
+    for (size_t j = 0; j < image->GetSize(); j++)
+      ptr[j] = (uint8_t)(i * 31 + j * 7 + (j >> 8));
+    images.push_back(image);
+  }
+  return images;
+}
+
+static void check_image(const std::shared_ptr<easymedia::ImageBuffer> &a,
+                        const std::shared_ptr<easymedia::MediaBuffer> &mb) {
+  assert(mb && mb->GetType() == Type::Image);
+  auto b = std::static_pointer_cast<easymedia::ImageBuffer>(mb);
+  const ImageInfo &ia = a->GetImageInfo();
+  const ImageInfo &ib = b->GetImageInfo();
+  assert(ia.pix_fmt == ib.pix_fmt && ia.width == ib.width &&
+         ia.height == ib.height);
+  ImagePlane pa[IMAGE_MAX_PLANES], pb[IMAGE_MAX_PLANES];
+  int plane_num = GetImagePlaneLayout(ia, pa);
+  assert(GetImagePlaneLayout(ib, pb) == plane_num);
+  for (int i = 0; i < plane_num; i++) {
+    int row_bytes = 0, rows = 0;
+    assert(GetPixFmtPlaneSize(ia.pix_fmt, i, ia.width, ia.height, row_bytes,
+                              rows));
+    for (int r = 0; r < rows; r++)
+      assert(!memcmp((uint8_t *)a->GetPtr() + pa[i].offset + r * pa[i].stride,
+                     (uint8_t *)b->GetPtr() + pb[i].offset + r * pb[i].stride,
+                     row_bytes));
+  }
+}
+
+static void test_y4m(const std::string &path) {
+  auto images = make_images();
+  std::string param;
+  PARAM_STRING_APPEND(param, KEY_PATH, path);
+  PARAM_STRING_APPEND_TO(param, KEY_FPS, kFps);
+  auto writer = open_stream("y4m_write_stream", param);
+  for (auto &image : images)
+    assert(writer->Write(image));
+  assert(writer->Tell() == kImageNum);
+  writer.reset();
+  std::string data = read_file(path);
+  const char header[] = "YUV4MPEG2 W64 H48 F30:1 Ip A1:1 C420jpeg\n";
+  assert(!data.compare(0, strlen(header), header));
+  assert(data.size() ==
+         strlen(header) + kImageNum * (strlen("FRAME\n") + 64 * 48 * 3 / 2));
+
+  // read into padded buffers
+  param.clear();
+  PARAM_STRING_APPEND(param, KEY_PATH, path);
+  PARAM_STRING_APPEND_TO(param, KEY_BUFFER_VIR_WIDTH, 96);
+  PARAM_STRING_APPEND_TO(param, KEY_BUFFER_VIR_HEIGHT, 50);
+  auto reader = open_stream("y4m_read_stream", param);
+  for (int i = 0; i < kImageNum; i++) {
+    auto buffer = reader->Read();
+    check_image(images[i], buffer);
+    assert(buffer->GetUSTimeStamp() == (int64_t)i * 1000000 / kFps);
+    auto image = std::static_pointer_cast<easymedia::ImageBuffer>(buffer);
+    const ImageInfo &info = image->GetImageInfo();
+    assert(info.vir_width == 96 && info.vir_height == 50);
+  }
+  assert(reader->Eof() && !reader->Read());
+
+  // frame accurate seeking
+  assert(!reader->Seek(2, SEEK_SET) && reader->Tell() == 2);
+  check_image(images[2], reader->Read());
+  assert(!reader->Seek(-1, SEEK_CUR));
+  check_image(images[2], reader->Read());
+  assert(!reader->Seek(0, SEEK_END) && reader->Tell() == kImageNum);
+  assert(reader->Eof());
+  assert(!reader->Seek(-1, SEEK_END));
+  check_image(images[kImageNum - 1], reader->Read());
+  assert(reader->Seek(kImageNum + 1, SEEK_SET) && reader->Tell() == kImageNum);
+  reader.reset();
+
+  // frame params, 4:2:2 and a truncated frame at the end
+  std::string frame(4 * 2 * 2, 0);
+  for (size_t i = 0; i < frame.size(); i++)
+    frame[i] = (char)i;
+  data = "YUV4MPEG2 C422 W4 H2 F25:1 XCOLORRANGE=FULL\n";
+  data.append("FRAME Ip XKEY=1\n").append(frame);
+  data.append("FRAME\n").append(frame.rbegin(), frame.rend());
+  data.append("FRAME\n").append(frame, 0, 5);
+  std::string hand_path = path + ".hand.y4m";
+  write_file(hand_path, data);
+  param.clear();
+  PARAM_STRING_APPEND(param, KEY_PATH, hand_path);
+  reader = open_stream("y4m_read_stream", param);
+  assert(!reader->Seek(0, SEEK_END) && reader->Tell() == 2);
+  assert(!reader->Seek(1, SEEK_SET));
+  auto buffer = reader->Read();
+  assert(buffer && buffer->GetValidSize() >= frame.size());
+  auto image = std::static_pointer_cast<easymedia::ImageBuffer>(buffer);
+  assert(image->GetImageInfo().pix_fmt == PIX_FMT_YUV422P);
+  assert(buffer->GetUSTimeStamp() == 40000);
+  std::string reversed(frame.rbegin(), frame.rend());
+  assert(!memcmp(buffer->GetPtr(), reversed.data(), frame.size()));
+  assert(reader->Eof());
+  reader.reset();
+  unlink(hand_path.c_str());
+
+  // played by flow
+  param.clear();
+  PARAM_STRING_APPEND(param, KEY_PATH, path);
+  auto source = easymedia::REFLECTOR(Flow)::Create<easymedia::Flow>(
+      "file_read_flow", param.c_str());
+  assert(source && source->GetError() == 0);
+  auto collect = std::make_shared<CollectFlow>();
+  received.clear();
+  assert(source->AddDownFlow(collect, 0, 0));
+  for (int i = 0; i < 300; i++) {
+    {
+      std::lock_guard<std::mutex> _lg(received_mtx);
+      if (received.size() == kImageNum)
+        break;
+    }
+    easymedia::msleep(10);
+  }
+  source->RemoveDownFlow(collect);
+  source.reset();
+  assert(received.size() == kImageNum);
+  for (int i = 0; i < kImageNum; i++)
+    check_image(images[i], received[i]);
+  received.clear();
+}
+
+static void test_wav(const std::string &path) {
+  SampleInfo info = {SAMPLE_FMT_S16, 2, 44100, 0};
+  const int total = 1000;
+  size_t frame_bytes = GetSampleSize(info);
+  std::string pcm(total * frame_bytes, 0);
+  for (size_t i = 0; i < pcm.size(); i++)
+    pcm[i] = (char)(i * 13 + (i >> 9));
+
+  // format from the buffers
+  std::string param;
+  PARAM_STRING_APPEND(param, KEY_PATH, path);
+  auto writer = open_stream("wav_write_stream", param);
+  for (int begin : {0, 600}) {
+    int frames = begin ? total - begin : 600;
+    SampleInfo si = info;
+    si.nb_samples = frames;
+    auto mb = easymedia::MediaBuffer::Alloc2(frames * frame_bytes);
+    memcpy(mb.GetPtr(), pcm.data() + begin * frame_bytes, frames * frame_bytes);
+    mb.SetValidSize(frames * frame_bytes);
+    assert(writer->Write(std::make_shared<easymedia::SampleBuffer>(mb, si)));
+  }
+  assert(writer->Tell() == total);
+  writer.reset();
+  std::string data = read_file(path);
+  assert(data.size() == 44 + pcm.size());
+  assert(!data.compare(0, 4, "RIFF") && !data.compare(8, 8, "WAVEfmt "));
+  assert(le32(data, 4) == 36 + pcm.size() && le32(data, 40) == pcm.size());
+  assert(!data.compare(44, pcm.size(), pcm));
+
+  param.clear();
+  PARAM_STRING_APPEND(param, KEY_PATH, path);
+  PARAM_STRING_APPEND_TO(param, KEY_FRAMES, 256);
+  auto reader = open_stream("wav_read_stream", param);
+  int64_t pos = 0;
+  while (!reader->Eof()) {
+    auto buffer = reader->Read();
+    assert(buffer && buffer->GetType() == Type::Audio);
+    auto sample = std::static_pointer_cast<easymedia::SampleBuffer>(buffer);
+    const SampleInfo &si = sample->GetSampleInfo();
+    assert(si.fmt == info.fmt && si.channels == info.channels &&
+           si.sample_rate == info.sample_rate);
+    assert(si.nb_samples == std::min<int64_t>(256, total - pos));
+    assert(buffer->GetValidSize() == si.nb_samples * frame_bytes);
+    assert(buffer->GetUSTimeStamp() == pos * 1000000 / info.sample_rate);
+    assert(!memcmp(buffer->GetPtr(), pcm.data() + pos * frame_bytes,
+                   buffer->GetValidSize()));
+    pos += si.nb_samples;
+  }
+  assert(pos == total && !reader->Read());
+
+  // sample accurate seeking
+  std::vector<char> samples(10 * frame_bytes);
+  assert(!reader->Seek(500, SEEK_SET));
+  assert(reader->Read(samples.data(), frame_bytes, 10) == 10);
+  assert(!memcmp(samples.data(), pcm.data() + 500 * frame_bytes,
+                 samples.size()));
+  assert(reader->Tell() == 510);
+  assert(!reader->Seek(-4, SEEK_END));
+  assert(reader->Read(samples.data(), frame_bytes, 10) == 4);
+  assert(reader->Eof());
+  assert(reader->Seek(1, SEEK_END));
+  reader.reset();
+
+  // a LIST chunk of odd size, 8 bits mono and the size of a streaming writer
+  data = std::string("RIFF\xff\xff\xff\xffWAVE", 12);
+  data.append("LIST\x05\x00\x00\x00" "abcde\x00", 14);
+  data.append("fmt \x10\x00\x00\x00" "\x01\x00\x01\x00" "\x40\x1f\x00\x00"
+              "\x40\x1f\x00\x00" "\x01\x00\x08\x00", 24);
+  data.append("data\xff\xff\xff\xff", 8);
+  data.append(pcm, 0, 100);
+  std::string hand_path = path + ".hand.wav";
+  write_file(hand_path, data);
+  param.clear();
+  PARAM_STRING_APPEND(param, KEY_PATH, hand_path);
+  reader = open_stream("wav_read_stream", param);
+  auto buffer = reader->Read();
+  assert(buffer && buffer->GetValidSize() == 100);
+  auto sample = std::static_pointer_cast<easymedia::SampleBuffer>(buffer);
+  const SampleInfo &si = sample->GetSampleInfo();
+  assert(si.fmt == SAMPLE_FMT_U8 && si.channels == 1 && si.sample_rate == 8000);
+  assert(!memcmp(buffer->GetPtr(), pcm.data(), 100));
+  assert(reader->Eof());
+  reader.reset();
+  unlink(hand_path.c_str());
+}
+
+int main(int argc, char **argv) {
+  int c;
+  std::string path = "/tmp/y4m_wav_test";
+
+  opterr = 1;
+  while ((c = getopt(argc, argv, optstr)) != -1) {
+    switch (c) {
+    case 'f':
+      path = optarg;
+      break;
+    case '?':
+    default:
+      printf("usage: %s [-f tmp file prefix]\n", argv[0]);
+      exit(0);
+    }
+  }
+  test_y4m(path + ".y4m");
+  test_wav(path + ".wav");
+  unlink((path + ".y4m").c_str());
+  unlink((path + ".wav").c_str());
+  printf("y4m wav test ok\n");
+  return 0;
+}
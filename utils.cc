@@ -24,9 +24,10 @@
 #include <stdarg.h>
 #include <stdio.h>
 
-#include <algorithm>
 #include <sstream>
 
+#include "media_param.h"
+
 #ifndef NDEBUG
 static void LogPrintf(const char *prefix, const char *fmt, va_list vl) {
   char line[1024];
@@ -47,19 +48,11 @@ namespace easymedia {
 
 bool parse_media_param_map(const char *param,
                            std::map<std::string, std::string> &map) {
-  if (!param)
+  // parsed once and cached
+  auto mp = MediaParam::Parse(param);
+  if (!mp)
     return false;
-
-  std::string token;
-  std::istringstream tokenStream(param);
-  while (std::getline(tokenStream, token)) {
-    std::string key, value;
-    std::istringstream subTokenStream(token);
-    if (std::getline(subTokenStream, key, '='))
-      std::getline(subTokenStream, value);
-    map[key] = value;
-  }
-
+  mp->ToMap(map);
   return true;
 }
 
@@ -97,28 +90,11 @@ int parse_media_param_match(
   return match_num;
 }
 
-bool has_intersection(const char *str, const char *expect,
-                      std::list<std::string> *expect_list) {
-  std::list<std::string> request;
-  // LOG("request: %s; expect: %s\n", str, expect);
-  if (!parse_media_param_list(str, request, ','))
-    return false;
-  if (expect_list->empty() && !parse_media_param_list(expect, *expect_list))
-    return false;
-  for (auto &req : request) {
-    if (std::find(expect_list->begin(), expect_list->end(), req) !=
-        expect_list->end()) {
-      return true;
-    }
-  }
-  return false;
-}
-
 std::string get_media_value_by_key(const char *param, const char *key) {
-  std::map<std::string, std::string> param_map;
-  if (!parse_media_param_map(param, param_map))
+  auto mp = MediaParam::Parse(param);
+  if (!mp)
     return std::string();
-  return param_map[key];
+  return mp->GetString(key);
 }
 
 bool string_start_withs(std::string const &fullString,
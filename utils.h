@@ -104,8 +104,6 @@ bool parse_media_param_list(const char *param, std::list<std::string> &list,
 int parse_media_param_match(
     const char *param, std::map<std::string, std::string> &map,
     std::list<std::pair<const std::string, std::string &>> &list);
-bool has_intersection(const char *str, const char *expect,
-                      std::list<std::string> *expect_list);
 
 std::string get_media_value_by_key(const char *param, const char *key);
 